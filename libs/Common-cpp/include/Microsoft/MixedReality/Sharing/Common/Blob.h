@@ -3,11 +3,13 @@
 
 #pragma once
 #include <Microsoft/MixedReality/Sharing/Common/RefPtr.h>
+#include <Microsoft/MixedReality/Sharing/Common/Span.h>
 
 #include <atomic>
 #include <cstdint>
 #include <limits>
 #include <string_view>
+#include <utility>
 
 namespace Microsoft::MixedReality::Sharing {
 
@@ -32,6 +34,13 @@ class Blob {
     return Create(data.data(), data.size());
   }
 
+  class UninitializedBlob;
+
+  // Allocates a blob with uninitialized content, which can be written in place
+  // and then sealed into an immutable blob (see UninitializedBlob below).
+  // Throws if the size doesn't fit into a signed int (same as Create()).
+  static UninitializedBlob CreateUninitialized(size_t size);
+
   const char* data() const noexcept { return data_; }
   size_t size() const noexcept { return static_cast<size_t>(size_); }
   int size_int() const noexcept { return size_; }
@@ -54,8 +63,12 @@ class Blob {
   }
 
  private:
-  static RefPtr<const Blob> CreateImpl(const char* data, int size) noexcept;
+  // Throws std::bad_alloc if the allocation fails.
+  static RefPtr<const Blob> CreateImpl(const char* data, int size);
+  static RefPtr<Blob> AllocateImpl(int size);
+  static size_t GetAllocationSize(int size) noexcept;
   Blob(const char* data, int size) noexcept;
+  explicit Blob(int size) noexcept : size_{size} {}
   Blob(const Blob&) = delete;
   Blob& operator=(const Blob&) = delete;
   ~Blob() noexcept = default;
@@ -80,4 +93,29 @@ class Blob {
 #endif  // _MSC_VER
 };
 
+// A blob that is not observable by anyone else yet, and can be written to.
+// Owns the blob until Seal() is called.
+class Blob::UninitializedBlob {
+ public:
+  UninitializedBlob(UninitializedBlob&&) noexcept = default;
+  UninitializedBlob& operator=(UninitializedBlob&&) noexcept = default;
+
+  // The behavior is undefined after Seal() was called.
+  char* data() const noexcept { return blob_->data_; }
+  size_t size() const noexcept { return blob_->size(); }
+  Span<char> span() const noexcept { return {data(), size()}; }
+
+  // Transfers the ownership of the blob to the returned pointer, after which
+  // the content can no longer be modified.
+  RefPtr<const Blob> Seal() && noexcept { return std::move(blob_); }
+
+ private:
+  explicit UninitializedBlob(RefPtr<Blob> blob) noexcept
+      : blob_{std::move(blob)} {}
+
+  RefPtr<Blob> blob_;
+
+  friend class Blob;
+};
+
 }  // namespace Microsoft::MixedReality::Sharing
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Microsoft::MixedReality::Sharing {
+
+// Allocates memory for small reference-counted objects with a flexible data
+// array, such as Blob and InternedBlob.
+//
+// Small allocations are grouped into size classes, and each size class is
+// served from slabs (large chunks of memory carved into blocks of the same
+// size). Each thread caches a limited number of free blocks of each size class,
+// so that in the common case both the allocation and the deallocation don't
+// touch any shared state. Blocks are moved between the thread caches and the
+// central pool of the size class in batches. Slabs are never returned to the
+// system (freed blocks are reused by future allocations of the same size
+// class).
+//
+// Larger allocations are forwarded to malloc()/free().
+//
+// The deallocation is sized: the caller must pass the same size that was
+// passed to Allocate() (which is trivially known for objects that store their
+// own size).
+class BlobAllocator {
+ public:
+  // Allocations larger than this are forwarded to malloc().
+  static constexpr size_t kMaxSmallAllocationSize = 256;
+
+  struct Stats {
+    // Cumulative numbers, including the allocations forwarded to malloc().
+    // The sizes of small allocations are rounded up to their size classes.
+    uint64_t allocations_count{0};
+    uint64_t deallocations_count{0};
+    uint64_t allocated_bytes{0};
+    uint64_t deallocated_bytes{0};
+
+    // The amount of memory reserved for slabs.
+    uint64_t slab_bytes{0};
+
+    uint64_t alive_allocations_count() const noexcept {
+      return allocations_count - deallocations_count;
+    }
+    uint64_t alive_bytes() const noexcept {
+      return allocated_bytes - deallocated_bytes;
+    }
+  };
+
+  // Returns nullptr if the allocation failed.
+  // The returned memory is aligned at least as well as by malloc() for
+  // allocations of the same size (and at least to 16 bytes for small
+  // allocations).
+  [[nodiscard]] static void* Allocate(size_t size) noexcept;
+
+  // The size must match the one that was passed to Allocate().
+  static void Free(void* ptr, size_t size) noexcept;
+
+  // Thread-safe. Collects the statistics of all threads (the numbers are not
+  // synchronized with each other, so the result is only approximately
+  // consistent if other threads are allocating concurrently).
+  static Stats GetStats() noexcept;
+};
+
+}  // namespace Microsoft::MixedReality::Sharing
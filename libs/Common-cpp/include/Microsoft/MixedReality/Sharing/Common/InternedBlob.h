@@ -58,6 +58,12 @@ class InternedBlob {
   InternedBlob& operator=(const InternedBlob&) = delete;
   ~InternedBlob() noexcept = default;
 
+  static size_t GetAllocationSize(size_t size) noexcept;
+
+  // Adds a reference unless the reference count already dropped to 0 (which
+  // means that the blob is about to be destroyed).
+  bool TryAddRef() const noexcept;
+
   // ref_count_ starts with 1 because the only way to create the object is
   // through Create(), and it returns a RefPtr.
   mutable std::atomic_uint32_t ref_count_{1};
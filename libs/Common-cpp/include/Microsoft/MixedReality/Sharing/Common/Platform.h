@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 #pragma once
+#include <cstddef>
 #include <cstdint>
 
 #if defined(__x86_64__) || defined(_M_X64)
@@ -42,8 +43,25 @@ namespace Microsoft::MixedReality::Sharing::Platform {
 
 constexpr uint32_t kPageSize = 4096;
 
+// Allocates pages_count zeroed pages.
+// Returns nullptr if the allocation is not possible.
 void* AllocateZeroedPages(size_t pages_count);
 
+// Reserves the address space for pages_count pages without allocating any
+// memory for them. The pages can't be accessed until they are committed with
+// CommitPages().
+// Returns nullptr if the reservation is not possible.
+void* ReservePages(size_t pages_count);
+
+// Allocates zeroed memory for pages_count pages starting from the address,
+// which must be page-aligned and located within a range reserved with
+// ReservePages(). Committing pages that are already committed is allowed and
+// doesn't change their content.
+// Returns false if the allocation is not possible.
+bool CommitPages(void* address, size_t pages_count);
+
+// Frees the whole range allocated with AllocateZeroedPages() or reserved with
+// ReservePages() (including all committed pages).
 void FreePages(void* address);
 
 inline void Prefetch(const void* address) noexcept {
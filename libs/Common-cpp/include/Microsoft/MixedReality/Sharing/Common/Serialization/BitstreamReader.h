@@ -4,6 +4,7 @@
 #pragma once
 #include <Microsoft/MixedReality/Sharing/Common/Platform.h>
 #include <Microsoft/MixedReality/Sharing/Common/Serialization/Serialization.h>
+#include <Microsoft/MixedReality/Sharing/Common/Span.h>
 
 #include <cassert>
 #include <cstddef>
@@ -23,6 +24,16 @@ class BitstreamReader {
   // any further non-empty reads).
   uint64_t ReadExponentialGolombCode();
 
+  // Reads values.size() exponential-Golomb codes.
+  // Produces the same results as calling ReadExponentialGolombCode() for each
+  // value, but decodes the runs of codes that are already in the read buffer
+  // without touching the state of the reader, so the refill is checked only
+  // once per loaded word.
+  // Throws std::out_of_range if there is not enough input left
+  // (the error also advances the stream to the end, preventing
+  // any further non-empty reads).
+  void ReadExponentialGolombCodes(Span<uint64_t> values);
+
   // Reads up to 32 bits from the bitstream.
   // Throws std::out_of_range if there is not enough input left
   // (the error also advances the stream to the end, preventing
@@ -45,6 +56,16 @@ class BitstreamReader {
 
   void PopulateReadBuf();
 
+  // Decodes an exponential-Golomb code if it is entirely in the provided read
+  // buffer, and removes it from the buffer. Returns false (without modifying
+  // anything) otherwise, or if the buffer would become empty.
+  static bool TryReadBufferedCode(size_t& read_buf,
+                                  bit_shift_t& read_buf_bits_count,
+                                  uint64_t& result) noexcept;
+
+  // Handles the codes that are not entirely in the read buffer.
+  uint64_t ReadExponentialGolombCodeSlow();
+
   const char* next_;
   size_t remaining_size_;
   size_t read_buf_{0};
@@ -108,8 +129,61 @@ BitstreamReader::ReadBits64(bit_shift_t bits_count) {
   return ReadBits<uint64_t>(bits_count);
 }
 
+MS_MR_SHARING_FORCEINLINE
+bool BitstreamReader::TryReadBufferedCode(size_t& read_buf,
+                                          bit_shift_t& read_buf_bits_count,
+                                          uint64_t& result) noexcept {
+  // The bits above read_buf_bits_count are always zero, so if the buffer is
+  // not zero, its lowest set bit is the separator of the next code, and its
+  // position is the number of zeros (and the number of payload bits after the
+  // separator).
+  bit_shift_t zeroes_count;
+  if (!BitScanForward(zeroes_count, read_buf))
+    return false;
+  const bit_shift_t code_bits_count = 2 * zeroes_count + 1;
+  // Excluding the case where the code ends exactly at the end of the buffer,
+  // since shifting by the size of the buffer is not allowed.
+  if (code_bits_count >= read_buf_bits_count)
+    return false;
+  const uint64_t mask = (1ull << zeroes_count) - 1;
+  const auto payload = static_cast<uint64_t>(read_buf >> (zeroes_count + 1));
+  result = (payload & mask) + mask;
+  read_buf >>= code_bits_count;
+  read_buf_bits_count -= code_bits_count;
+  return true;
+}
+
 MS_MR_SHARING_FORCEINLINE
 uint64_t BitstreamReader::ReadExponentialGolombCode() {
+  uint64_t result;
+  if (MS_MR_LIKELY(
+          TryReadBufferedCode(read_buf_, read_buf_bits_count_, result)))
+    return result;
+  return ReadExponentialGolombCodeSlow();
+}
+
+inline void BitstreamReader::ReadExponentialGolombCodes(
+    Span<uint64_t> values) {
+  uint64_t* next = values.data();
+  uint64_t* const end = next + values.size();
+  while (next != end) {
+    // Decoding from local copies of the buffer (the stores to values may alias
+    // the members, which would force the compiler to reload them after each
+    // value). They are written back before each refill.
+    size_t read_buf = read_buf_;
+    bit_shift_t read_buf_bits_count = read_buf_bits_count_;
+    while (next != end &&
+           TryReadBufferedCode(read_buf, read_buf_bits_count, *next)) {
+      ++next;
+    }
+    read_buf_ = read_buf;
+    read_buf_bits_count_ = read_buf_bits_count;
+    if (next != end)
+      *next++ = ReadExponentialGolombCodeSlow();
+  }
+}
+
+inline uint64_t BitstreamReader::ReadExponentialGolombCodeSlow() {
   // The pattern we are looking for is either:
   // * [0..63] '0' bits, then '1', then some value bits
   //   (the same number as the number of zeros, called zeroes_count below).
@@ -119,13 +193,7 @@ uint64_t BitstreamReader::ReadExponentialGolombCode() {
   bit_shift_t zeroes_count = 0;
   bit_shift_t set_bit_position;
 
-#if defined(MS_MR_SHARING_PLATFORM_AMD64)
-  while (!_BitScanForward64(&set_bit_position, read_buf_)) {
-#elif defined(MS_MR_SHARING_PLATFORM_x86)
-  while (!_BitScanForward(&set_bit_position, read_buf_)) {
-#else
-#error Unsupported platform
-#endif
+  while (!BitScanForward(set_bit_position, read_buf_)) {
     zeroes_count += read_buf_bits_count_;
     if (zeroes_count >= 64) {
       // Special case for ~0ull,
@@ -150,15 +218,13 @@ uint64_t BitstreamReader::ReadExponentialGolombCode() {
     assert(read_buf_bits_count_ > consumed_bits_count);
     read_buf_bits_count_ -= consumed_bits_count;
 
-#if defined(MS_MR_SHARING_PLATFORM_AMD64)
-    read_buf_ >>= consumed_bits_count;
-#elif defined(MS_MR_SHARING_PLATFORM_x86)
-    if (consumed_bits_count == 32) {
+    if constexpr (sizeof(read_buf_) == 8) {
+      read_buf_ >>= consumed_bits_count;
+    } else if (consumed_bits_count == 32) {
       read_buf_ = 0;
     } else {
       read_buf_ >>= consumed_bits_count;
     }
-#endif
     return ~0ull;
   }
   read_buf_bits_count_ -= set_bit_position + 1;
@@ -174,17 +240,15 @@ uint64_t BitstreamReader::ReadExponentialGolombCode() {
   const bit_shift_t consumed_bits_count =
       read_buf_bits_count_ + zeroes_count - appended_bits_count;
   read_buf_bits_count_ -= consumed_bits_count;
-#if defined(MS_MR_SHARING_PLATFORM_AMD64)
-  read_buf_ >>= consumed_bits_count;
-#elif defined(MS_MR_SHARING_PLATFORM_x86)
-  if (consumed_bits_count == 32) {
+  if constexpr (sizeof(read_buf_) == 8) {
+    read_buf_ >>= consumed_bits_count;
+  } else if (consumed_bits_count == 32) {
     read_buf_ = 0;
   } else {
     read_buf_ >>= consumed_bits_count;
   }
-#endif
   const uint64_t mask = (1ull << zeroes_count) - 1;
   return (result & mask) + mask;
-}  // namespace Microsoft::MixedReality::Sharing::Serialization
+}
 
 }  // namespace Microsoft::MixedReality::Sharing::Serialization
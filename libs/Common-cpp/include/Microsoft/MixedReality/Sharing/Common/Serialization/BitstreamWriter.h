@@ -3,6 +3,7 @@
 
 #pragma once
 #include <Microsoft/MixedReality/Sharing/Common/Serialization/Serialization.h>
+#include <Microsoft/MixedReality/Sharing/Common/Span.h>
 
 #include <cassert>
 #include <cstddef>
@@ -14,6 +15,15 @@ namespace Microsoft::MixedReality::Sharing::Serialization {
 
 class BitstreamWriter {
  public:
+  BitstreamWriter() noexcept = default;
+
+  // Writes into the provided buffer instead of the internal one (avoiding the
+  // reallocations if the buffer is large enough for the whole stream).
+  // If the buffer runs out of space, the writer switches to its own
+  // heap-allocated buffer.
+  // The buffer must outlive the writer and the view returned by Finalize().
+  explicit BitstreamWriter(Span<uint64_t> buffer) noexcept;
+
   // Outputs the provided bits into the stream.
   // Expects that the provided value fits into bits_count bits,
   // otherwise the behavior is undefined.
@@ -25,6 +35,12 @@ class BitstreamWriter {
   // in arbitrarily large codes.
   void WriteExponentialGolombCode(uint64_t value) noexcept;
 
+  // Encodes all provided values as exponential-Golomb codes (see above).
+  // Produces the same stream as calling WriteExponentialGolombCode() for each
+  // value, but the codes are packed into a local 64-bit word, and the state of
+  // the writer is only touched when the word is full.
+  void WriteExponentialGolombCodes(Span<const uint64_t> values) noexcept;
+
   // Flushes the buffer and returns the view of it.
   // The stream is extended with '0' bits to become byte-aligned.
   std::string_view Finalize() noexcept;
@@ -35,6 +51,14 @@ class BitstreamWriter {
   // Writes a single '1' bit into the stream.
   MS_MR_SHARING_FORCEINLINE void WriteOneBit() noexcept;
 
+  // Produces all bits of the exponential-Golomb code of the value, if they fit
+  // into 64 bits (true for all values below 2^32 - 1).
+  // Returns false otherwise, without modifying the arguments.
+  MS_MR_SHARING_FORCEINLINE static bool TryMakeShortCode(
+      uint64_t value,
+      uint64_t& code,
+      bit_shift_t& code_bits_count) noexcept;
+
   static constexpr size_t kInplaceElementsCount = 128;
   uint64_t inplace_buffer_[kInplaceElementsCount];
   uint64_t* dst_{inplace_buffer_};
@@ -45,6 +69,14 @@ class BitstreamWriter {
   std::unique_ptr<uint64_t[]> external_buffer_;
 };
 
+inline BitstreamWriter::BitstreamWriter(Span<uint64_t> buffer) noexcept {
+  // An empty buffer can't be grown, so the internal one is used instead.
+  if (buffer.size() != 0) {
+    dst_ = buffer.data();
+    capacity_ = buffer.size();
+  }
+}
+
 MS_MR_SHARING_FORCEINLINE
 void BitstreamWriter::WriteOneBit() noexcept {
   if (temp_bit_offset_ == 63) {
@@ -75,6 +107,22 @@ void BitstreamWriter::WriteBits(uint64_t value,
   }
 }
 
+MS_MR_SHARING_FORCEINLINE
+bool BitstreamWriter::TryMakeShortCode(uint64_t value,
+                                       uint64_t& code,
+                                       bit_shift_t& code_bits_count) noexcept {
+  // See WriteExponentialGolombCode() below for the description of the format.
+  // The index is at most 31 here, so the code fits into 63 bits.
+  const uint64_t incremented = value + 1;
+  bit_shift_t index;
+  if (!BitScanReverse(index, incremented) || index >= 32)
+    return false;
+  const uint64_t separator = 1ull << index;
+  code = ((incremented ^ separator) << (index + 1)) | separator;
+  code_bits_count = 2 * index + 1;
+  return true;
+}
+
 MS_MR_SHARING_FORCEINLINE
 void BitstreamWriter::WriteExponentialGolombCode(uint64_t value) noexcept {
   // This is a Little-Endian version of the encoding.
@@ -87,23 +135,17 @@ void BitstreamWriter::WriteExponentialGolombCode(uint64_t value) noexcept {
   // stream before the separating '1' and reverse the transform
   // (add (1ull << N) - 1) to get the original value before we offsetted it
   // by 1 and chopped off the leading '1'.
+  uint64_t code;
+  bit_shift_t code_bits_count;
   if (value == 0) {  // Fast path for the most common case
     WriteOneBit();
+  } else if (TryMakeShortCode(value, code, code_bits_count)) {
+    WriteBits(code, code_bits_count);
   } else {
     // Offsetting the value by 1. This can overflow if the value was ~0ull.
     value += 1;
     bit_shift_t index;
-
-#if defined(MS_MR_SHARING_PLATFORM_AMD64)
-    if (_BitScanReverse64(&index, value)) {
-      // Do nothing
-#elif defined(MS_MR_SHARING_PLATFORM_x86)
-    if (_BitScanReverse(&index, (value >> 32))) {
-      index += 32;
-    } else if (_BitScanReverse(&index, static_cast<uint32_t>(value))) {
-      // Do nothing
-#endif
-    } else {
+    if (!BitScanReverse(index, value)) {
       // Special encoding for ~0ull. value is 0 here due to the overflow.
       // We could encode this as a 65-bit value (exponential-Golomb coding
       // doesn't have an upper limit for the size of the value) by writing 64
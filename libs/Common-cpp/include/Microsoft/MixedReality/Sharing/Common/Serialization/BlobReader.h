@@ -3,6 +3,7 @@
 
 #pragma once
 #include <Microsoft/MixedReality/Sharing/Common/Serialization/Serialization.h>
+#include <Microsoft/MixedReality/Sharing/Common/Span.h>
 
 #include <optional>
 #include <string_view>
@@ -51,6 +52,16 @@ class BlobReader {
   // had thrown an exception.
   uint64_t ReadGolomb();
 
+  // Reads values.size() exponential-Golomb codes (as encoded by BlobWriter).
+  // Produces the same results as calling ReadGolomb() for each value, but
+  // decodes the runs of codes that are already in the bit buffer without
+  // touching the state of the reader, so the refill is checked only once per
+  // loaded word.
+  // Throws std::out_of_range if there is not enough input left.
+  // The behavior is undefined if the reader is reused after it
+  // had thrown an exception.
+  void ReadGolombN(Span<uint64_t> values);
+
   // Reads an optional exponential-Golomb code (as encoded by BlobWriter).
   // Throws std::out_of_range if there is not enough input left.
   // The behavior is undefined if the reader is reused after it
@@ -76,6 +87,16 @@ class BlobReader {
   void PopulateBitBuf();
   void PopulateBitBuf(bit_shift_t min_bits_count);
 
+  // Decodes an exponential-Golomb code if it is entirely in the provided bit
+  // buffer, and removes it from the buffer. Returns false (without modifying
+  // anything) otherwise, or if the buffer would become empty.
+  static bool TryReadBufferedGolomb(size_t& bit_buf,
+                                    bit_shift_t& bit_buf_bits_count,
+                                    uint64_t& result) noexcept;
+
+  // Handles the codes that are not entirely in the bit buffer.
+  uint64_t ReadGolombSlow();
+
   const char* unread_bytes_begin_;
   size_t unread_bytes_count_;
 
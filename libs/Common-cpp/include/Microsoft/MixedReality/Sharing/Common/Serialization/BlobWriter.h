@@ -2,10 +2,16 @@
 // Licensed under the MIT License.
 
 #pragma once
+#include <Microsoft/MixedReality/Sharing/Common/Blob.h>
+#include <Microsoft/MixedReality/Sharing/Common/RefPtr.h>
 #include <Microsoft/MixedReality/Sharing/Common/Serialization/Serialization.h>
+#include <Microsoft/MixedReality/Sharing/Common/Span.h>
 
 #include <cstddef>
+#include <memory>
 #include <optional>
+#include <string_view>
+#include <vector>
 
 namespace Microsoft::MixedReality::Sharing::Serialization {
 
@@ -27,6 +33,9 @@ namespace Microsoft::MixedReality::Sharing::Serialization {
 // also read bits from the tail, so bits1 will be returned before bits2.
 // Since it is initially unknown how large the resulting blob is going to be,
 // the blob should be finalized after all writing is done.
+// When the internal buffer runs out of space, the writer continues in a new
+// (larger) buffer without moving the already written sections, so the
+// finalized blob can consist of several segments (see FinalizeToSegments()).
 class BlobWriter {
  public:
   ~BlobWriter() {
@@ -80,18 +89,40 @@ class BlobWriter {
   // The number of bytes the blob will occupy if the writer would be finalized
   // with the current state.
   size_t finalized_size() const noexcept {
-    return bytes_section_size() + bits_section_size() + pending_bits_size();
+    return retired_sections_size_ + bytes_section_size() +
+           bits_section_size() + pending_bits_size();
   }
 
+  // Returns the list of segments that form the final blob when concatenated
+  // (in order), without composing the blob. The segments reference the
+  // internal buffers of the writer (and stay valid while it is alive), and
+  // can be passed directly to vectored I/O (such as writev() or sendmsg()),
+  // or read with FragmentedBlobReader. Empty segments are omitted.
+  // The behavior of any other methods of this object (except for
+  // finalized_size()) after FinalizeToSegments() was called is undefined.
+  Span<const std::string_view> FinalizeToSegments() noexcept;
+
   // Composes the final contiguous blob inside the internal buffers.
   // The behavior of any other methods of this object after Finalize() was
   // called is undefined.
   std::string_view Finalize() noexcept;
 
-  // TODO: add Finalize(dst) that copies the data to a preallocated buffer
-  // instead of finalizing in place.
+  // Composes the final blob in the provided buffer, which must be at least
+  // finalized_size() bytes large.
+  // The writer is not modified, so it's possible to keep writing after this
+  // call (and finalize the longer blob later).
+  void FinalizeTo(char* dst) const noexcept;
+
+  // Composes the final blob directly in a new Blob (the content is copied
+  // only once, without composing it inside the internal buffers first).
+  // Same as FinalizeTo(), the writer is not modified.
+  // Throws if the allocation fails.
+  RefPtr<const Blob> FinalizeToBlob() const;
 
  private:
+  // Retires the current buffer (keeping its sections where they are), and
+  // continues writing in a new buffer with at least min_free_bytes_after_grow
+  // free bytes.
   void Grow(size_t min_free_bytes_after_grow) noexcept;
 
   size_t bytes_section_size() const noexcept {
@@ -126,6 +157,21 @@ class BlobWriter {
 
   uint64_t* buffer_ = inplace_buffer_;
   uint64_t* buffer_end_ = inplace_buffer_ + kInplaceElementsCount;
+
+  // The sections written into the previous buffers. The bytes sections precede
+  // the current one in the final blob, and the bits sections follow the
+  // current one (in the reverse order).
+  struct RetiredBuffer {
+    std::unique_ptr<uint64_t[]> storage_;  // Empty for inplace_buffer_.
+    std::string_view bytes_section_;
+    std::string_view bits_section_;
+  };
+  std::vector<RetiredBuffer> retired_buffers_;
+  size_t retired_sections_size_{0};
+
+  // Populated by FinalizeToSegments().
+  std::string_view inplace_segments_[3];
+  std::vector<std::string_view> segments_;
 };
 
 MS_MR_SHARING_FORCEINLINE
@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <Microsoft/MixedReality/Sharing/Common/Span.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Microsoft::MixedReality::Sharing::Serialization {
+
+class BitstreamReader;
+class BitstreamWriter;
+
+// Encodes and decodes monotonic sequences of numbers in blocks of kBlockSize
+// values (an alternative to MonotonicSequenceEncoder for long sequences).
+//
+// The sequence is converted to the same deltas as the ones used by
+// MonotonicSequenceEncoder (the difference with the predicted next value).
+// Each full block of deltas is then stored with frame-of-reference bit packing:
+// all deltas are truncated to the same bit width (chosen per block to minimize
+// the size), and the high bits of the few deltas that don't fit are stored
+// afterwards as exceptions (as in PFor). The packed deltas are interleaved
+// between two 64-bit lanes, so that the block can be unpacked with SIMD
+// instructions, two values at a time, without any data-dependent branches.
+//
+// The last block of the sequence can be shorter than kBlockSize, and is stored
+// as exponential-Golomb codes (exactly like MonotonicSequenceEncoder would do),
+// so short sequences don't pay for the padding.
+class BlockMonotonicSequenceEncoder {
+ public:
+  static constexpr size_t kBlockSize = 128;
+
+  // Encodes the next block of the monotonic sequence.
+  // The values must be sorted in strictly ascending order, and be greater than
+  // any of the values previously encoded with this encoder. Only the last block
+  // of the sequence can have less than kBlockSize values.
+  void EncodeBlock(Span<const uint64_t> values,
+                   BitstreamWriter& bitstream_writer) noexcept;
+
+  // Decodes the next block of the monotonic sequence. The size of the block
+  // must be the same as the one that was encoded.
+  // Throws std::invalid_argument if the block is malformed, and
+  // std::out_of_range if there is not enough input left.
+  void DecodeBlock(Span<uint64_t> values, BitstreamReader& reader);
+
+ private:
+  // Converts the deltas to the values of the sequence (in place).
+  void AccumulateDeltas(Span<uint64_t> values);
+
+  uint64_t predicted_next_value_{0};
+  bool can_continue_{true};
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::Serialization
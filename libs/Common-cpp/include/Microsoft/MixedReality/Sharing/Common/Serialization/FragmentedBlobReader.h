@@ -0,0 +1,130 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/Serialization.h>
+#include <Microsoft/MixedReality/Sharing/Common/Span.h>
+
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace Microsoft::MixedReality::Sharing::Serialization {
+
+// Reads blobs produced by BlobWriter (see BlobReader) that are split into
+// several fragments (for example, as they were received from the network),
+// without concatenating the fragments first.
+//
+// The byte stream is read from the front of the first fragment, and the bit
+// stream is read from the back of the last one. Both streams can cross the
+// boundaries between the fragments at any position.
+// ReadBytes() returns views of the fragments whenever the requested bytes are
+// entirely within one fragment. Only the byte sections that span several
+// fragments are copied (into buffers owned by the reader).
+//
+// The results of all methods are the same as the results of BlobReader for
+// the concatenation of the fragments.
+class FragmentedBlobReader {
+ public:
+  // The fragments (and the array that references them) must stay alive while
+  // the reader is used.
+  explicit FragmentedBlobReader(Span<const std::string_view> fragments);
+
+  // Reads next bytes_count bytes (as encoded by BlobWriter).
+  // The returned string_view references the bytes of the input if they are
+  // all in the same fragment, or a copy owned by the reader otherwise (in both
+  // cases it stays valid while the reader and the fragments are alive).
+  // Throws std::out_of_range if there is not enough input left.
+  // The behavior is undefined if the reader is reused after it
+  // had thrown an exception.
+  std::string_view ReadBytes(size_t bytes_count);
+
+  // Reads a blob of bytes with the number of bytes encoded
+  // as exponential-Golomb code; see BlobWriter::WriteBytesWithSize().
+  // See ReadBytes() for the lifetime of the result.
+  // Throws std::out_of_range if there is not enough input left.
+  // The behavior is undefined if the reader is reused after it
+  // had thrown an exception.
+  std::string_view ReadBytesWithSize();
+
+  // Reads up to 32 bits from the bit stream.
+  // Throws std::out_of_range if there is not enough input left.
+  // The behavior is undefined if the reader is reused after it
+  // had thrown an exception, or if bits_count is not in [1, 32].
+  uint32_t ReadBits32(bit_shift_t bits_count);
+
+  // Reads up to 64 bits from the bit stream.
+  // Throws std::out_of_range if there is not enough input left.
+  // The behavior is undefined if the reader is reused after it
+  // had thrown an exception, or if bits_count is not in [1, 64].
+  uint64_t ReadBits64(bit_shift_t bits_count);
+
+  // Reads a single bit and returns it as a bool.
+  bool ReadBool();
+
+  // Reads an exponential-Golomb code (as encoded by BlobWriter).
+  // Throws std::out_of_range if there is not enough input left.
+  // The behavior is undefined if the reader is reused after it
+  // had thrown an exception.
+  uint64_t ReadGolomb();
+
+  // Reads an optional exponential-Golomb code (as encoded by BlobWriter).
+  // Throws std::out_of_range if there is not enough input left.
+  // The behavior is undefined if the reader is reused after it
+  // had thrown an exception.
+  std::optional<uint64_t> ReadOptionalGolomb();
+
+  // See BlobReader::ProbablyNoMoreData().
+  bool ProbablyNoMoreData() const noexcept;
+
+ private:
+  // Loads the next (up to) 8 bytes from the back of the unread input into the
+  // high bytes of bit_buf_. Throws std::out_of_range if there is less than
+  // min_bits_count bits left.
+  void PopulateBitBuf(bit_shift_t min_bits_count);
+
+  // Handles the reads that need more bits than there are in bit_buf_.
+  uint64_t ReadBitsSlow(bit_shift_t bits_count);
+
+  // Handles the codes that are not entirely in the bit buffer.
+  uint64_t ReadGolombSlow();
+
+  // Takes bytes_count bytes from the front of the input (the bytes are
+  // expected to be already accounted for).
+  std::string_view TakeFrontBytes(size_t bytes_count);
+
+  Span<const std::string_view> fragments_;
+
+  // The byte stream continues from front_offset_ in the fragment
+  // front_index_.
+  size_t front_index_{0};
+  size_t front_offset_{0};
+
+  // The bit stream continues backwards from back_size_ in the fragment
+  // back_index_.
+  size_t back_index_{0};
+  size_t back_size_{0};
+
+  // The number of bytes between the two positions above.
+  size_t unread_bytes_count_{0};
+
+  uint64_t bit_buf_{0};
+  bit_shift_t bit_buf_bits_count_{0};
+  static constexpr bit_shift_t kBitBufferBitsCount = 64;
+
+  // Copies of the byte sections that span several fragments.
+  std::vector<std::unique_ptr<char[]>> spanning_bytes_;
+};
+
+MS_MR_SHARING_FORCEINLINE
+bool FragmentedBlobReader::ProbablyNoMoreData() const noexcept {
+  return unread_bytes_count_ == 0 && bit_buf_bits_count_ < 8 && bit_buf_ == 0;
+}
+
+MS_MR_SHARING_FORCEINLINE
+bool FragmentedBlobReader::ReadBool() {
+  return ReadBits32(1) == 1;
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::Serialization
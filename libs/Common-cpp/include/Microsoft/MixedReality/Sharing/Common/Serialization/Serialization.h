@@ -5,14 +5,84 @@
 #include <Microsoft/MixedReality/Sharing/Common/Platform.h>
 
 #include <stdexcept>
+#include <type_traits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace Microsoft::MixedReality::Sharing::Serialization {
 
 class BitstreamReader;
 class BitstreamWriter;
 
-#ifdef MS_MR_SHARING_PLATFORM_x86_OR_x64
+// Matches the index type of MSVC's bit scan intrinsics.
 using bit_shift_t = unsigned long;
+
+// Portable equivalents of _BitScanForward/_BitScanReverse (and their 64-bit
+// versions) for 32-bit and 64-bit unsigned integers.
+// Return false if the value is 0 (index is not modified in this case).
+// Otherwise store the index of the lowest (BitScanForward) or the highest
+// (BitScanReverse) set bit.
+template <typename T>
+inline bool BitScanForward(bit_shift_t& index, T value) noexcept {
+  static_assert(std::is_unsigned_v<T> && (sizeof(T) == 4 || sizeof(T) == 8));
+#ifdef _MSC_VER
+  if constexpr (sizeof(T) == 4) {
+    return _BitScanForward(&index, static_cast<uint32_t>(value));
+  } else {
+#ifdef MS_MR_SHARING_PLATFORM_ANY_64_BIT
+    return _BitScanForward64(&index, static_cast<uint64_t>(value));
+#else
+    if (_BitScanForward(&index, static_cast<uint32_t>(value)))
+      return true;
+    if (!_BitScanForward(&index, static_cast<uint32_t>(value >> 32)))
+      return false;
+    index += 32;
+    return true;
+#endif
+  }
+#else
+  if (!value)
+    return false;
+  if constexpr (sizeof(T) == 4) {
+    index = static_cast<bit_shift_t>(__builtin_ctz(value));
+  } else {
+    index = static_cast<bit_shift_t>(
+        __builtin_ctzll(static_cast<unsigned long long>(value)));
+  }
+  return true;
+#endif
+}
+
+template <typename T>
+inline bool BitScanReverse(bit_shift_t& index, T value) noexcept {
+  static_assert(std::is_unsigned_v<T> && (sizeof(T) == 4 || sizeof(T) == 8));
+#ifdef _MSC_VER
+  if constexpr (sizeof(T) == 4) {
+    return _BitScanReverse(&index, static_cast<uint32_t>(value));
+  } else {
+#ifdef MS_MR_SHARING_PLATFORM_ANY_64_BIT
+    return _BitScanReverse64(&index, static_cast<uint64_t>(value));
+#else
+    if (_BitScanReverse(&index, static_cast<uint32_t>(value >> 32))) {
+      index += 32;
+      return true;
+    }
+    return _BitScanReverse(&index, static_cast<uint32_t>(value));
+#endif
+  }
+#else
+  if (!value)
+    return false;
+  if constexpr (sizeof(T) == 4) {
+    index = 31 - static_cast<bit_shift_t>(__builtin_clz(value));
+  } else {
+    index = 63 - static_cast<bit_shift_t>(__builtin_clzll(
+                     static_cast<unsigned long long>(value)));
+  }
+  return true;
 #endif
+}
 
 }  // namespace Microsoft::MixedReality::Sharing::Serialization
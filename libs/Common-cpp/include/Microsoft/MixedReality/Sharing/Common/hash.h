@@ -2,19 +2,79 @@
 // Licensed under the MIT License.
 
 #pragma once
+#include <Microsoft/MixedReality/Sharing/Common/Platform.h>
+
 #include <cstdint>
 #include <string_view>
 
 namespace Microsoft::MixedReality::Sharing {
 
+// Versions of the hashing algorithm (both are variations of wyhash).
+// Each version produces the same values on all platforms, so the values
+// produced by a specific version can be persisted or sent to other processes.
+// Different versions produce different values.
+enum class HashVersion {
+  // Uses the 32-bit-friendly multiplication (four 32-bit multiplications
+  // instead of one 64x64->128 multiplication). Has the same performance on all
+  // platforms, but is slower than kV2 on x64/ARM64.
+  kV1 = 1,
+
+  // Uses the full 128-bit product of 64-bit multiplications. Native on
+  // x64/ARM64, emulated (with the same results) on 32-bit platforms, where it's
+  // slower than kV1.
+  kV2 = 2,
+};
+
+// The version used by the overloads that don't specify it explicitly.
+// It is not changed to keep the existing hash values stable.
+constexpr HashVersion kDefaultHashVersion = HashVersion::kV1;
+
+// The fastest version for the current platform. Should only be used for the
+// values that never leave the process (such as hash tables).
+#ifdef MS_MR_SHARING_PLATFORM_ANY_64_BIT
+constexpr HashVersion kNativeHashVersion = HashVersion::kV2;
+#else
+constexpr HashVersion kNativeHashVersion = HashVersion::kV1;
+#endif
+
+// Only kV1 and kV2 are instantiated.
+template <HashVersion kVersion>
 uint64_t CalculateHash64(const char* data,
                          size_t size,
                          uint64_t seed = 0) noexcept;
 
+template <HashVersion kVersion>
 uint64_t CalculateHash64(uint64_t value_a, uint64_t value_b) noexcept;
 
+// Calculates the hashes of all keys. The results are the same as the ones
+// of CalculateHash64<kVersion>(keys[i].data(), keys[i].size(), seed), but
+// short keys (up to 16 bytes) are processed several at a time, so that the
+// multiplications of independent keys can overlap.
+template <HashVersion kVersion>
+void CalculateHash64Batch(const std::string_view* keys,
+                          size_t count,
+                          uint64_t* hashes,
+                          uint64_t seed = 0) noexcept;
+
+inline uint64_t CalculateHash64(const char* data,
+                                size_t size,
+                                uint64_t seed = 0) noexcept {
+  return CalculateHash64<kDefaultHashVersion>(data, size, seed);
+}
+
+inline uint64_t CalculateHash64(uint64_t value_a, uint64_t value_b) noexcept {
+  return CalculateHash64<kDefaultHashVersion>(value_a, value_b);
+}
+
 inline uint64_t CalculateHash64(std::string_view sv) noexcept {
   return CalculateHash64(sv.data(), sv.size());
 }
 
+inline void CalculateHash64Batch(const std::string_view* keys,
+                                 size_t count,
+                                 uint64_t* hashes,
+                                 uint64_t seed = 0) noexcept {
+  CalculateHash64Batch<kDefaultHashVersion>(keys, count, hashes, seed);
+}
+
 }  // namespace Microsoft::MixedReality::Sharing
@@ -4,11 +4,13 @@
 #include "src/pch.h"
 
 #include <Microsoft/MixedReality/Sharing/Common/Blob.h>
+#include <Microsoft/MixedReality/Sharing/Common/BlobAllocator.h>
 #include <Microsoft/MixedReality/Sharing/Common/Platform.h>
 
 #include <algorithm>
 #include <cstddef>
 #include <memory>
+#include <new>
 
 namespace Microsoft::MixedReality::Sharing {
 
@@ -19,24 +21,41 @@ Blob::Blob(const char* data, int size) noexcept : size_{size} {
   }
 }
 
+MS_MR_SHARING_FORCEINLINE
+size_t Blob::GetAllocationSize(int size) noexcept {
+  return std::max(sizeof(Blob),
+                  offsetof(Blob, data_) + static_cast<size_t>(size));
+}
+
 void Blob::RemoveRef() const noexcept {
   if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
     void* const raw_ptr = const_cast<Blob*>(this);
+    const size_t alloc_size = GetAllocationSize(size_);
     this->~Blob();
-    free(raw_ptr);
+    BlobAllocator::Free(raw_ptr, alloc_size);
   }
 }
 
 MS_MR_SHARING_FORCEINLINE
-RefPtr<const Blob> Blob::CreateImpl(const char* data, int size) noexcept {
+RefPtr<const Blob> Blob::CreateImpl(const char* data, int size) {
   assert(size >= 0);
-  const size_t alloc_size =
-      std::max(sizeof(Blob), offsetof(Blob, data_) + static_cast<size_t>(size));
-  void* raw_ptr = malloc(alloc_size);
+  void* raw_ptr = BlobAllocator::Allocate(GetAllocationSize(size));
+  if (!raw_ptr)
+    throw std::bad_alloc{};
   Blob* key_ptr = new (raw_ptr) Blob{data, size};
   return RefPtr<Blob>{key_ptr, DontAddRef{}};  // ref_count_ starts at 1.
 }
 
+RefPtr<Blob> Blob::AllocateImpl(int size) {
+  assert(size >= 0);
+  void* raw_ptr = BlobAllocator::Allocate(GetAllocationSize(size));
+  if (!raw_ptr)
+    throw std::bad_alloc{};
+  // The content stays uninitialized.
+  Blob* key_ptr = new (raw_ptr) Blob{size};
+  return RefPtr<Blob>{key_ptr, DontAddRef{}};  // ref_count_ starts at 1.
+}
+
 RefPtr<const Blob> Blob::Create(const char* data, size_t size) {
   if (size > std::numeric_limits<int>::max())
     throw std::invalid_argument(
@@ -50,6 +69,13 @@ RefPtr<const Blob> Blob::Create(const char* data, int size) {
   return CreateImpl(data, size);
 }
 
+Blob::UninitializedBlob Blob::CreateUninitialized(size_t size) {
+  if (size > std::numeric_limits<int>::max())
+    throw std::invalid_argument(
+        "Can't create a blob larger than 2147483647 bytes");
+  return UninitializedBlob{AllocateImpl(static_cast<int>(size))};
+}
+
 RefPtr<const Blob> Blob::GetFromSharedViewDataPtr(
     const char* valid_data_ptr) noexcept {
   assert(valid_data_ptr);
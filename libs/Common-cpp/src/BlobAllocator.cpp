@@ -0,0 +1,354 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include <Microsoft/MixedReality/Sharing/Common/BlobAllocator.h>
+
+#include <Microsoft/MixedReality/Sharing/Common/Platform.h>
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+
+namespace Microsoft::MixedReality::Sharing {
+namespace {
+
+constexpr size_t kSizeClassGranularity = 16;
+
+// Most blobs are small, so the classes are denser at the lower end.
+constexpr std::array<uint32_t, 8> kSizeClasses{16, 32,  48,  64,
+                                               96, 128, 192, 256};
+constexpr size_t kSizeClassesCount = kSizeClasses.size();
+static_assert(kSizeClasses.back() == BlobAllocator::kMaxSmallAllocationSize);
+
+// Maps (size + kSizeClassGranularity - 1) / kSizeClassGranularity to the index
+// of the smallest size class that can fit the size.
+constexpr auto kSizeClassIds = [] {
+  std::array<uint8_t,
+             BlobAllocator::kMaxSmallAllocationSize / kSizeClassGranularity + 1>
+      result{};
+  uint8_t class_id = 0;
+  for (size_t i = 0; i < result.size(); ++i) {
+    if (i * kSizeClassGranularity > kSizeClasses[class_id])
+      ++class_id;
+    result[i] = class_id;
+  }
+  return result;
+}();
+
+MS_MR_SHARING_FORCEINLINE size_t GetSizeClassId(size_t size) noexcept {
+  assert(size <= BlobAllocator::kMaxSmallAllocationSize);
+  return kSizeClassIds[(size + kSizeClassGranularity - 1) /
+                       kSizeClassGranularity];
+}
+
+constexpr size_t kSlabSize = 64 * 1024;
+
+// The number of blocks moved between a thread cache and the central pool at
+// once. A thread cache keeps at most 2 batches of each size class.
+constexpr uint32_t kBatchSize = 32;
+
+struct FreeBlock {
+  FreeBlock* next_;
+};
+
+// Intrusive singly-linked list of free blocks.
+struct FreeList {
+  FreeBlock* head_{nullptr};
+  uint32_t size_{0};
+
+  void Push(void* ptr) noexcept {
+    auto block = static_cast<FreeBlock*>(ptr);
+    block->next_ = head_;
+    head_ = block;
+    ++size_;
+  }
+
+  void* Pop() noexcept {
+    assert(head_);
+    FreeBlock* block = head_;
+    head_ = block->next_;
+    --size_;
+    return block;
+  }
+
+  // Moves up to max_count blocks to the other list.
+  void MoveTo(FreeList& other, uint32_t max_count) noexcept {
+    for (uint32_t i = 0; i < max_count && head_; ++i)
+      other.Push(Pop());
+  }
+};
+
+// Shared by all threads. Owns the slabs, and stores the blocks that don't fit
+// into thread caches.
+class CentralPool {
+ public:
+  // Moves up to kBatchSize blocks of the size class into the list, allocating
+  // a new slab if necessary. Returns false if the allocation failed.
+  bool Refill(size_t class_id, FreeList& list) noexcept {
+    SizeClassPool& pool = pools_[class_id];
+    auto lock = std::lock_guard(pool.mutex_);
+    if (!pool.free_blocks_.head_) {
+      auto slab = static_cast<std::byte*>(malloc(kSlabSize));
+      if (!slab)
+        return false;
+      slab_bytes_.fetch_add(kSlabSize, std::memory_order_relaxed);
+      const size_t block_size = kSizeClasses[class_id];
+      for (size_t offset = kSlabSize - kSlabSize % block_size; offset != 0;)
+        pool.free_blocks_.Push(slab + (offset -= block_size));
+    }
+    pool.free_blocks_.MoveTo(list, kBatchSize);
+    return true;
+  }
+
+  void Release(size_t class_id, FreeList& list, uint32_t count) noexcept {
+    SizeClassPool& pool = pools_[class_id];
+    auto lock = std::lock_guard(pool.mutex_);
+    list.MoveTo(pool.free_blocks_, count);
+  }
+
+  uint64_t slab_bytes() const noexcept {
+    return slab_bytes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct alignas(64) SizeClassPool {
+    std::mutex mutex_;
+    FreeList free_blocks_;
+  };
+  SizeClassPool pools_[kSizeClassesCount];
+  std::atomic<uint64_t> slab_bytes_{0};
+};
+
+class ThreadCache;
+
+// Keeps track of all thread caches for GetStats().
+class Registry {
+ public:
+  void Register(ThreadCache& cache) noexcept;
+  void Unregister(ThreadCache& cache) noexcept;
+  BlobAllocator::Stats GetStats() noexcept;
+
+  // For allocations and deallocations performed after the thread cache of the
+  // calling thread was destroyed (this is rare, so it's done under the lock).
+  void OnAllocatedWithoutCache(uint64_t size) noexcept;
+  void OnDeallocatedWithoutCache(uint64_t size) noexcept;
+
+ private:
+  std::mutex mutex_;
+  ThreadCache* head_{nullptr};
+  // The statistics of the threads that already exited (or destroyed their
+  // caches).
+  BlobAllocator::Stats retired_stats_;
+};
+
+// Both objects are intentionally leaked, since blobs can be released during
+// (or after) the destruction of static objects.
+CentralPool& GetCentralPool() noexcept {
+  static CentralPool* pool = new CentralPool;
+  return *pool;
+}
+
+Registry& GetRegistry() noexcept {
+  static Registry* registry = new Registry;
+  return *registry;
+}
+
+class ThreadCache {
+ public:
+  ThreadCache() noexcept { GetRegistry().Register(*this); }
+
+  ~ThreadCache() noexcept {
+    for (size_t class_id = 0; class_id < kSizeClassesCount; ++class_id) {
+      FreeList& list = free_lists_[class_id];
+      GetCentralPool().Release(class_id, list, list.size_);
+    }
+    GetRegistry().Unregister(*this);
+  }
+
+  void* Allocate(size_t size) noexcept {
+    const size_t class_id = GetSizeClassId(size);
+    FreeList& list = free_lists_[class_id];
+    if (!list.head_ && !GetCentralPool().Refill(class_id, list))
+      return nullptr;
+    OnAllocated(kSizeClasses[class_id]);
+    return list.Pop();
+  }
+
+  void Free(void* ptr, size_t size) noexcept {
+    const size_t class_id = GetSizeClassId(size);
+    FreeList& list = free_lists_[class_id];
+    list.Push(ptr);
+    if (list.size_ > 2 * kBatchSize)
+      GetCentralPool().Release(class_id, list, kBatchSize);
+    OnDeallocated(kSizeClasses[class_id]);
+  }
+
+  void OnAllocated(uint64_t size) noexcept {
+    Increment(allocations_count_, 1);
+    Increment(allocated_bytes_, size);
+  }
+
+  void OnDeallocated(uint64_t size) noexcept {
+    Increment(deallocations_count_, 1);
+    Increment(deallocated_bytes_, size);
+  }
+
+  void AddStatsTo(BlobAllocator::Stats& stats) const noexcept {
+    stats.allocations_count +=
+        allocations_count_.load(std::memory_order_relaxed);
+    stats.deallocations_count +=
+        deallocations_count_.load(std::memory_order_relaxed);
+    stats.allocated_bytes += allocated_bytes_.load(std::memory_order_relaxed);
+    stats.deallocated_bytes +=
+        deallocated_bytes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // The counters are only modified by the owning thread, so there is no need
+  // for atomic read-modify-write operations. They are atomic only because
+  // GetStats() can read them from other threads.
+  static void Increment(std::atomic<uint64_t>& counter,
+                        uint64_t value) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  FreeList free_lists_[kSizeClassesCount];
+  std::atomic<uint64_t> allocations_count_{0};
+  std::atomic<uint64_t> deallocations_count_{0};
+  std::atomic<uint64_t> allocated_bytes_{0};
+  std::atomic<uint64_t> deallocated_bytes_{0};
+
+  // Guarded by the mutex of the registry.
+  ThreadCache* next_{nullptr};
+  ThreadCache* prev_{nullptr};
+
+  friend class Registry;
+};
+
+void Registry::Register(ThreadCache& cache) noexcept {
+  auto lock = std::lock_guard(mutex_);
+  cache.next_ = head_;
+  if (head_)
+    head_->prev_ = &cache;
+  head_ = &cache;
+}
+
+void Registry::Unregister(ThreadCache& cache) noexcept {
+  auto lock = std::lock_guard(mutex_);
+  cache.AddStatsTo(retired_stats_);
+  if (cache.prev_)
+    cache.prev_->next_ = cache.next_;
+  else
+    head_ = cache.next_;
+  if (cache.next_)
+    cache.next_->prev_ = cache.prev_;
+}
+
+void Registry::OnAllocatedWithoutCache(uint64_t size) noexcept {
+  auto lock = std::lock_guard(mutex_);
+  ++retired_stats_.allocations_count;
+  retired_stats_.allocated_bytes += size;
+}
+
+void Registry::OnDeallocatedWithoutCache(uint64_t size) noexcept {
+  auto lock = std::lock_guard(mutex_);
+  ++retired_stats_.deallocations_count;
+  retired_stats_.deallocated_bytes += size;
+}
+
+BlobAllocator::Stats Registry::GetStats() noexcept {
+  auto lock = std::lock_guard(mutex_);
+  BlobAllocator::Stats result = retired_stats_;
+  for (ThreadCache* cache = head_; cache; cache = cache->next_)
+    cache->AddStatsTo(result);
+  return result;
+}
+
+// Both are trivially destructible, so they stay valid during the destruction
+// of other thread-local objects (which may release blobs after the cache is
+// gone). Checking the pointer first avoids the initialization guard of the
+// holder below on the fast path.
+thread_local ThreadCache* thread_cache = nullptr;
+thread_local bool is_thread_cache_destroyed = false;
+
+struct ThreadCacheHolder {
+  ThreadCacheHolder() noexcept { thread_cache = &cache; }
+  ~ThreadCacheHolder() noexcept {
+    thread_cache = nullptr;
+    is_thread_cache_destroyed = true;
+  }
+  ThreadCache cache;
+};
+
+ThreadCache* CreateThreadCache() noexcept {
+  if (is_thread_cache_destroyed)
+    return nullptr;
+  thread_local ThreadCacheHolder holder;
+  return &holder.cache;
+}
+
+// Returns nullptr if the thread cache of this thread was already destroyed.
+MS_MR_SHARING_FORCEINLINE ThreadCache* GetThreadCache() noexcept {
+  return thread_cache ? thread_cache : CreateThreadCache();
+}
+
+}  // namespace
+
+void* BlobAllocator::Allocate(size_t size) noexcept {
+  ThreadCache* cache = GetThreadCache();
+  if (size <= kMaxSmallAllocationSize) {
+    if (cache)
+      return cache->Allocate(size);
+    // Very late allocations (during the thread shutdown) are rare, so they
+    // are simply served by the central pool one block at a time.
+    FreeList list;
+    const size_t class_id = GetSizeClassId(size);
+    if (!GetCentralPool().Refill(class_id, list))
+      return nullptr;
+    void* result = list.Pop();
+    GetCentralPool().Release(class_id, list, list.size_);
+    GetRegistry().OnAllocatedWithoutCache(kSizeClasses[class_id]);
+    return result;
+  }
+  void* result = malloc(size);
+  if (result) {
+    if (cache)
+      cache->OnAllocated(size);
+    else
+      GetRegistry().OnAllocatedWithoutCache(size);
+  }
+  return result;
+}
+
+void BlobAllocator::Free(void* ptr, size_t size) noexcept {
+  ThreadCache* cache = GetThreadCache();
+  if (size <= kMaxSmallAllocationSize) {
+    if (cache) {
+      cache->Free(ptr, size);
+    } else {
+      FreeList list;
+      list.Push(ptr);
+      const size_t class_id = GetSizeClassId(size);
+      GetCentralPool().Release(class_id, list, 1);
+      GetRegistry().OnDeallocatedWithoutCache(kSizeClasses[class_id]);
+    }
+    return;
+  }
+  free(ptr);
+  if (cache)
+    cache->OnDeallocated(size);
+  else
+    GetRegistry().OnDeallocatedWithoutCache(size);
+}
+
+BlobAllocator::Stats BlobAllocator::GetStats() noexcept {
+  Stats result = GetRegistry().GetStats();
+  result.slab_bytes = GetCentralPool().slab_bytes();
+  return result;
+}
+
+}  // namespace Microsoft::MixedReality::Sharing
@@ -5,6 +5,7 @@
 
 #include <Microsoft/MixedReality/Sharing/Common/InternedBlob.h>
 
+#include <Microsoft/MixedReality/Sharing/Common/BlobAllocator.h>
 #include <Microsoft/MixedReality/Sharing/Common/Platform.h>
 #include <Microsoft/MixedReality/Sharing/Common/hash.h>
 
@@ -13,34 +14,252 @@
 #include <cstring>
 #include <memory>
 #include <mutex>
-#include <unordered_set>
+#include <new>
+#include <thread>
 
 namespace Microsoft::MixedReality::Sharing {
 namespace {
-// FIXME: this is a temporary slow implementation of the interning mechanism.
-struct BlobShard {
-  struct BlobPtrHash {
-    MS_MR_SHARING_FORCEINLINE
-    size_t operator()(const InternedBlob* blob) const noexcept {
-      return static_cast<size_t>(blob->hash());
+
+// The interning table is split into shards (selected by the top bits of the
+// hash), each of which is an open-addressing hash table with linear probing.
+//
+// Lookups are lock-free: they are announced by incrementing one of the two
+// lookup counters of the shard, which allows the writers to wait for all
+// lookups that could have observed a slot before it was modified.
+// All modifications (insertions, removals and rehashing) are performed under
+// the mutex of the shard. Removed slots are marked with tombstones, which are
+// cleaned up on removal when possible, or by rehashing.
+//
+// Once the reference count of a blob drops to 0, lookups can't add
+// references to it. Only the threads that hold the mutex can resurrect such
+// blobs (see RemoveRef() for details).
+class alignas(64) BlobShard {
+ public:
+  // Finds the blob with the provided content and returns it if try_acquire
+  // (which is called while the blob is guaranteed to stay alive) returns true.
+  // Returns nullptr otherwise.
+  template <typename TTryAcquire>
+  const InternedBlob* TryFind(uint64_t hash,
+                              const char* data,
+                              size_t size,
+                              TTryAcquire&& try_acquire) noexcept {
+    LookupScope scope{*this};
+    const Table* table = table_.load(std::memory_order_seq_cst);
+    if (!table)
+      return nullptr;
+    for (size_t i = static_cast<size_t>(hash);; ++i) {
+      const Slot& slot = table->slots_[i & table->mask_];
+      const InternedBlob* blob = slot.blob_.load(std::memory_order_seq_cst);
+      if (!blob)
+        return nullptr;
+      if (slot.hash_.load(std::memory_order_relaxed) == hash &&
+          blob != Tombstone() && IsEqual(*blob, hash, data, size)) {
+        return try_acquire(*blob) ? blob : nullptr;
+      }
+    }
+  }
+
+  // Same as above, but resurrects the blob if its reference count is 0 (which
+  // is only allowed under the lock).
+  const InternedBlob* FindAndAddRefUnderLock(uint64_t hash,
+                                             const char* data,
+                                             size_t size) noexcept {
+    Slot* slot = FindSlotUnderLock(hash, [&](const InternedBlob& blob) {
+      return IsEqual(blob, hash, data, size);
+    });
+    if (!slot)
+      return nullptr;
+    const InternedBlob* blob = slot->blob_.load(std::memory_order_relaxed);
+    blob->AddRef();
+    return blob;
+  }
+
+  // The blob must be missing. Can throw if the table has to be grown, and the
+  // allocation fails.
+  void InsertUnderLock(const InternedBlob& blob) {
+    Table* table = table_.load(std::memory_order_relaxed);
+    if (!table || (used_slots_count_ + 1) * 4 > (table->mask_ + 1) * 3)
+      table = RehashUnderLock(alive_blobs_count_ + 1);
+    for (size_t i = static_cast<size_t>(blob.hash());; ++i) {
+      Slot& slot = table->slots_[i & table->mask_];
+      const InternedBlob* existing = slot.blob_.load(std::memory_order_relaxed);
+      if (!existing || existing == Tombstone()) {
+        if (!existing)
+          ++used_slots_count_;
+        slot.hash_.store(blob.hash(), std::memory_order_relaxed);
+        slot.blob_.store(&blob, std::memory_order_seq_cst);
+        ++alive_blobs_count_;
+        return;
+      }
+    }
+  }
+
+  // Returns false if the blob is not in the table.
+  // Once this returns true, the blob is unreachable by new lookups, but
+  // the caller must call WaitForLookupsUnderLock() before destroying it.
+  bool RemoveUnderLock(const InternedBlob& blob) noexcept {
+    Slot* slot = FindSlotUnderLock(
+        blob.hash(), [&](const InternedBlob& other) { return &blob == &other; });
+    if (!slot)
+      return false;
+    --alive_blobs_count_;
+    Table& table = *table_.load(std::memory_order_relaxed);
+    size_t i = static_cast<size_t>(slot - table.slots_.get());
+    if (table.slots_[(i + 1) & table.mask_].blob_.load(
+            std::memory_order_relaxed)) {
+      slot->blob_.store(Tombstone(), std::memory_order_seq_cst);
+    } else {
+      // No probe sequence continues past an empty slot, so this slot and the
+      // tombstones right before it are not needed by any lookup.
+      do {
+        table.slots_[i].blob_.store(nullptr, std::memory_order_seq_cst);
+        --used_slots_count_;
+        i = (i - 1) & table.mask_;
+      } while (table.slots_[i].blob_.load(std::memory_order_relaxed) ==
+               Tombstone());
+    }
+    // The remaining tombstones are dropped by rehashing once they occupy a
+    // quarter of the table (otherwise a shard that is never inserted into
+    // would keep them forever).
+    if ((used_slots_count_ - alive_blobs_count_) * 4 > table.mask_ + 1) {
+      try {
+        RehashUnderLock(alive_blobs_count_);
+      } catch (const std::bad_alloc&) {
+        // The tombstones will be dropped by the next successful rehash.
+      }
     }
+    return true;
+  }
+
+  // Waits until all lookups that could have observed the state of the table
+  // before the last modification are finished.
+  // The lookups don't block, so the wait is short. New lookups don't delay it
+  // since they are counted separately.
+  void WaitForLookupsUnderLock() noexcept {
+    const uint32_t old_epoch = epoch_.load(std::memory_order_relaxed);
+    epoch_.store(old_epoch ^ 1, std::memory_order_seq_cst);
+    while (lookups_counts_[old_epoch].load(std::memory_order_seq_cst) != 0)
+      std::this_thread::yield();
+  }
+
+  std::mutex& mutex() noexcept { return mutex_; }
+
+  ~BlobShard() noexcept { delete table_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> hash_{0};
+    std::atomic<const InternedBlob*> blob_{nullptr};
+  };
+
+  struct Table {
+    explicit Table(size_t capacity)
+        : mask_{capacity - 1}, slots_{new Slot[capacity]} {}
+    const size_t mask_;
+    const std::unique_ptr<Slot[]> slots_;
   };
 
-  struct BlobPtrEqual {
-    MS_MR_SHARING_FORCEINLINE
-    size_t operator()(const InternedBlob* a, const InternedBlob* b) const
-        noexcept {
-      return (a == b) ||
-             ((a->size() == b->size()) && (a->hash() == b->hash()) &&
-              (0 == memcmp(a->data(), b->data(), a->size())));
+  class LookupScope {
+   public:
+    explicit LookupScope(BlobShard& shard) noexcept {
+      // The writer could switch the epoch after we've read it, but before we
+      // incremented the counter, and then stop waiting for this counter
+      // without noticing us. Re-reading the epoch after the increment ensures
+      // that any writer that switches it later will wait for the counter.
+      uint32_t epoch = shard.epoch_.load(std::memory_order_seq_cst);
+      for (;;) {
+        counter_ = &shard.lookups_counts_[epoch];
+        counter_->fetch_add(1, std::memory_order_seq_cst);
+        const uint32_t current_epoch =
+            shard.epoch_.load(std::memory_order_seq_cst);
+        if (current_epoch == epoch)
+          break;
+        counter_->fetch_sub(1, std::memory_order_release);
+        epoch = current_epoch;
+      }
     }
+    ~LookupScope() noexcept {
+      counter_->fetch_sub(1, std::memory_order_release);
+    }
+
+   private:
+    std::atomic_uint32_t* counter_;
   };
 
-  std::unordered_set<const InternedBlob*, BlobPtrHash, BlobPtrEqual> blobs_;
+  static const InternedBlob* Tombstone() noexcept {
+    static const uint64_t tombstone_storage = 0;
+    return reinterpret_cast<const InternedBlob*>(&tombstone_storage);
+  }
+
+  static bool IsEqual(const InternedBlob& blob,
+                      uint64_t hash,
+                      const char* data,
+                      size_t size) noexcept {
+    return blob.hash() == hash && blob.size() == size &&
+           0 == memcmp(blob.data(), data, size);
+  }
+
+  template <typename TPredicate>
+  Slot* FindSlotUnderLock(uint64_t hash, TPredicate&& predicate) noexcept {
+    Table* table = table_.load(std::memory_order_relaxed);
+    if (!table)
+      return nullptr;
+    for (size_t i = static_cast<size_t>(hash);; ++i) {
+      Slot& slot = table->slots_[i & table->mask_];
+      const InternedBlob* blob = slot.blob_.load(std::memory_order_relaxed);
+      if (!blob)
+        return nullptr;
+      if (blob != Tombstone() &&
+          slot.hash_.load(std::memory_order_relaxed) == hash &&
+          predicate(*blob)) {
+        return &slot;
+      }
+    }
+  }
+
+  Table* RehashUnderLock(size_t min_alive_blobs_count) {
+    size_t capacity = kMinCapacity;
+    while (capacity < min_alive_blobs_count * 2)
+      capacity *= 2;
+    auto new_table = std::make_unique<Table>(capacity);
+    std::unique_ptr<Table> old_table{table_.load(std::memory_order_relaxed)};
+    if (old_table) {
+      for (size_t i = 0; i <= old_table->mask_; ++i) {
+        const Slot& old_slot = old_table->slots_[i];
+        const InternedBlob* blob =
+            old_slot.blob_.load(std::memory_order_relaxed);
+        if (!blob || blob == Tombstone())
+          continue;
+        for (size_t j = static_cast<size_t>(blob->hash());; ++j) {
+          Slot& slot = new_table->slots_[j & new_table->mask_];
+          if (!slot.blob_.load(std::memory_order_relaxed)) {
+            slot.hash_.store(blob->hash(), std::memory_order_relaxed);
+            slot.blob_.store(blob, std::memory_order_relaxed);
+            break;
+          }
+        }
+      }
+    }
+    used_slots_count_ = alive_blobs_count_;
+    table_.store(new_table.get(), std::memory_order_seq_cst);
+    if (old_table)
+      WaitForLookupsUnderLock();
+    return new_table.release();
+  }
+
+  static constexpr size_t kMinCapacity = 16;
+
+  std::atomic<Table*> table_{nullptr};
+  std::atomic_uint32_t epoch_{0};
+  std::atomic_uint32_t lookups_counts_[2]{};
+
+  // Guarded by mutex_.
+  size_t alive_blobs_count_{0};
+  size_t used_slots_count_{0};  // Including tombstones.
   std::mutex mutex_;
 };
 
-BlobShard& GetBlobShard(uint64_t hash) {
+BlobShard& GetBlobShard(uint64_t hash) noexcept {
   static constexpr size_t kShardsCountLog = 6;
   static BlobShard shards[1u << kShardsCountLog];
   return shards[hash >> (64 - kShardsCountLog)];
@@ -54,6 +273,20 @@ inline InternedBlob::InternedBlob(uint64_t hash,
   memcpy(data_, data, size);
 }
 
+size_t InternedBlob::GetAllocationSize(size_t size) noexcept {
+  return std::max(sizeof(InternedBlob), offsetof(InternedBlob, data_) + size);
+}
+
+bool InternedBlob::TryAddRef() const noexcept {
+  uint32_t ref_count = ref_count_.load(std::memory_order_relaxed);
+  do {
+    if (ref_count == 0)
+      return false;
+  } while (!ref_count_.compare_exchange_weak(ref_count, ref_count + 1,
+                                             std::memory_order_relaxed));
+  return true;
+}
+
 void InternedBlob::RemoveRef() const noexcept {
   // We should read the hash before doing the atomic operation, because some
   // other thread may destroy this object ahead of us, see the details below.
@@ -61,31 +294,34 @@ void InternedBlob::RemoveRef() const noexcept {
   if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
     BlobShard& shard = GetBlobShard(hash);
     {
-      auto lock = std::lock_guard(shard.mutex_);
-      auto it = shard.blobs_.find(this);
+      auto lock = std::lock_guard(shard.mutex());
 
       // Threads that are performing the interning are allowed to resurrect the
-      // blobs with no references. What can happen is:
+      // blobs with no references (but only under the lock).
+      // What can happen is:
       // * This thread drops the ref_count_ to 0
       // * Some other thread resurrects the blob
-      // * Then it removes the last reference, cleans up the map and destroys
+      // * Then it removes the last reference, cleans up the table and destroys
       //   the blob.
-      // As a result, we won't find the blob in the map, and this would be
+      // As a result, we won't find the blob in the table, and this would be
       // invalid. We don't need to perform any actions in this case.
       //
       // Once the ref_count_ drops to 0, it can only increase under this
-      // lock. Since we are holding this lock, we can be sure that this
-      // object is still alive, has no alive references, won't get any new
-      // references, and therefore should be deleted.
-      if (it == shard.blobs_.end() ||
-          ref_count_.load(std::memory_order_relaxed) != 0)
+      // lock (lock-free lookups never add references to such blobs). Since we
+      // are holding this lock, we can be sure that this object is still alive,
+      // has no alive references, won't get any new references, and therefore
+      // should be deleted.
+      if (ref_count_.load(std::memory_order_relaxed) != 0 ||
+          !shard.RemoveUnderLock(*this))
         return;
-      // Erasing should be performed under the lock, but destroying the blob can
-      // be done outside.
-      shard.blobs_.erase(it);
+      // Lock-free lookups that started before the removal may still be
+      // reading the blob.
+      shard.WaitForLookupsUnderLock();
     }
+    void* const raw_ptr = const_cast<InternedBlob*>(this);
+    const size_t alloc_size = GetAllocationSize(size());
     this->~InternedBlob();
-    free(const_cast<InternedBlob*>(this));
+    BlobAllocator::Free(raw_ptr, alloc_size);
   }
 }
 
@@ -96,37 +332,40 @@ RefPtr<const InternedBlob> InternedBlob::Create(const char* data, size_t size) {
         "bytes.");
   }
   const uint64_t hash = CalculateHash64(data, size);
+  BlobShard& shard = GetBlobShard(hash);
 
-  // FIXME: this is a temporary slow implementation of the interning mechanism.
-  // We shouldn't pessimistically allocate anything, and for already
-  // existing blobs the interning can be made lock-free.
+  // Fast path: the blob already exists and is alive. If it's being destroyed,
+  // we'll have to retry under the lock.
+  if (auto existing = shard.TryFind(
+          hash, data, size,
+          [](const InternedBlob& blob) { return blob.TryAddRef(); })) {
+    return {const_cast<InternedBlob*>(existing), DontAddRef{}};
+  }
 
-  const size_t alloc_size =
-      std::max(sizeof(InternedBlob), offsetof(InternedBlob, data_) + size);
-  void* raw_ptr = malloc(alloc_size);
-  InternedBlob* candidate =
-      new (raw_ptr) InternedBlob{hash, data, static_cast<int>(size)};
-  const InternedBlob* existing = nullptr;
-  BlobShard& shard = GetBlobShard(hash);
+  void* raw_ptr = BlobAllocator::Allocate(GetAllocationSize(size));
+  if (!raw_ptr)
+    throw std::bad_alloc{};
+  std::unique_ptr<InternedBlob, void (*)(InternedBlob*)> candidate{
+      new (raw_ptr) InternedBlob{hash, data, static_cast<int>(size)},
+      [](InternedBlob* blob) {
+        const size_t alloc_size = GetAllocationSize(blob->size());
+        blob->~InternedBlob();
+        BlobAllocator::Free(blob, alloc_size);
+      }};
   {
-    auto lock = std::lock_guard(shard.mutex_);
-    auto&& [it, was_inserted] = shard.blobs_.emplace(candidate);
-    if (was_inserted) {
-      // ref_count_ of the candidate starts with 1
-      return {candidate, DontAddRef{}};
-    }
-    existing = *it;
-    // We don't care if the refcount was 0 (because the last reference just
-    // expired). RemoveRef that did that will perform the cleanup under the
-    // lock, and will check the refcount there again. So there should be no
-    // race with the cleanup code as long as we add the reference under the
-    // same lock.
-    existing->AddRef();
+    auto lock = std::lock_guard(shard.mutex());
+    // Someone could have inserted the blob while we were allocating the
+    // candidate. We don't care if the refcount of the existing blob is 0
+    // (because the last reference just expired). RemoveRef that did that will
+    // perform the cleanup under the lock, and will check the refcount there
+    // again. So there should be no race with the cleanup code as long as we
+    // add the reference under the same lock.
+    if (auto existing = shard.FindAndAddRefUnderLock(hash, data, size))
+      return {const_cast<InternedBlob*>(existing), DontAddRef{}};
+    shard.InsertUnderLock(*candidate);
   }
-  candidate->~InternedBlob();
-  free(candidate);
-  // The reference was already added under the lock above.
-  return {const_cast<InternedBlob*>(existing), DontAddRef{}};
+  // ref_count_ of the candidate starts with 1
+  return {candidate.release(), DontAddRef{}};
 }
 
 bool InternedBlob::OrderedLess(const InternedBlob& other) const noexcept {
@@ -5,18 +5,113 @@
 
 #include <Microsoft/MixedReality/Sharing/Common/Platform.h>
 
-// TODO: implement for non-Windows platforms
+#ifdef _WIN32
 #include <Microsoft/MixedReality/Sharing/Common/windows.h>
+#else
+#include <sys/mman.h>
+
+#include <map>
+#include <mutex>
+#include <new>
+#endif
 
 namespace Microsoft::MixedReality::Sharing::Platform {
 
+#ifdef _WIN32
+
 void* AllocateZeroedPages(size_t pages_count) {
   return VirtualAlloc(NULL, pages_count * kPageSize, MEM_COMMIT,
                       PAGE_READWRITE);
 }
 
+void* ReservePages(size_t pages_count) {
+  return VirtualAlloc(NULL, pages_count * kPageSize, MEM_RESERVE,
+                      PAGE_NOACCESS);
+}
+
+bool CommitPages(void* address, size_t pages_count) {
+  return VirtualAlloc(address, pages_count * kPageSize, MEM_COMMIT,
+                      PAGE_READWRITE) != NULL;
+}
+
 void FreePages(void* address) {
   VirtualFree(address, 0, MEM_RELEASE);
 }
 
+#else  // #ifdef _WIN32
+
+namespace {
+
+// Unlike VirtualFree(), munmap() requires the size of the range, so the sizes
+// of all mapped ranges are remembered here. The ranges are large and
+// allocated rarely, so the lock is not contended.
+class MappedRanges {
+ public:
+  // Throws std::bad_alloc.
+  void Add(void* address, size_t size) {
+    auto lock = std::lock_guard(mutex_);
+    sizes_.emplace(address, size);
+  }
+
+  size_t Remove(void* address) noexcept {
+    auto lock = std::lock_guard(mutex_);
+    auto it = sizes_.find(address);
+    assert(it != sizes_.end());
+    const size_t size = it->second;
+    sizes_.erase(it);
+    return size;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<void*, size_t> sizes_;
+};
+
+// Intentionally leaked, since pages can be freed during the destruction of
+// static objects.
+MappedRanges& GetMappedRanges() noexcept {
+  static MappedRanges* ranges = new MappedRanges;
+  return *ranges;
+}
+
+void* Map(size_t pages_count, int protection, int extra_flags) noexcept {
+  const size_t size = pages_count * kPageSize;
+  void* address = mmap(nullptr, size, protection,
+                       MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+  if (address == MAP_FAILED)
+    return nullptr;
+  try {
+    GetMappedRanges().Add(address, size);
+  } catch (const std::bad_alloc&) {
+    // The range couldn't be freed later.
+    munmap(address, size);
+    return nullptr;
+  }
+  return address;
+}
+
+}  // namespace
+
+void* AllocateZeroedPages(size_t pages_count) {
+  return Map(pages_count, PROT_READ | PROT_WRITE, 0);
+}
+
+void* ReservePages(size_t pages_count) {
+  // The reserved pages are not accounted for until they are committed.
+  return Map(pages_count, PROT_NONE, MAP_NORESERVE);
+}
+
+bool CommitPages(void* address, size_t pages_count) {
+  // Anonymous pages are zeroed by the kernel when they are touched for the
+  // first time, so making them accessible is enough.
+  return mprotect(address, pages_count * kPageSize, PROT_READ | PROT_WRITE) ==
+         0;
+}
+
+void FreePages(void* address) {
+  munmap(address, GetMappedRanges().Remove(address));
+}
+
+#endif  // #ifdef _WIN32
+
 }  // namespace Microsoft::MixedReality::Sharing::Platform
@@ -9,11 +9,232 @@
 
 #include <Microsoft/MixedReality/Sharing/Common/RandomDevice.h>
 
+#include <array>
+#include <atomic>
 #include <cstdlib>
-#include <mutex>
 #include <random>
+#include <utility>
+
+#if defined(MS_MR_SHARING_PLATFORM_x86_OR_x64)
+#include <emmintrin.h>
+#elif defined(MS_MR_SHARING_PLATFORM_ARM64)
+#ifdef _MSC_VER
+#include <arm64_neon.h>
+#else
+#include <arm_neon.h>
+#endif
+#endif
 
 namespace Microsoft::MixedReality::Sharing {
+namespace {
+
+using Polynomial = std::array<uint64_t, 4>;
+
+// The characteristic polynomial of the state transition of xoshiro256 is
+// P(x) = x^256 + kCharacteristicPolynomial (obtained with the Berlekamp-Massey
+// algorithm from the sequence of the lowest bits of the state).
+constexpr Polynomial kCharacteristicPolynomial{
+    0x9d116f2bb0f0f001, 0x0280002bcefd1a5e, 0x04b4edcf26259f85,
+    0x0003c03c3f3ecb19};
+
+// The jump constants are obtained from the reference implementation.
+// x^(2^128) mod P(x)
+constexpr Polynomial kJumpPolynomial{0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                     0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+// x^(2^192) mod P(x)
+constexpr Polynomial kLongJumpPolynomial{
+    0x76e15d3efefdcbbf, 0xc5004e441c522fb3, 0x77710069854ee241,
+    0x39109bb02acbe635};
+
+Polynomial MultiplyModulo(const Polynomial& a, const Polynomial& b) noexcept {
+  Polynomial result{};
+  Polynomial shifted = a;  // a * x^i mod P(x)
+  for (size_t i = 0; i < 256; ++i) {
+    if ((b[i / 64] >> (i % 64)) & 1) {
+      for (size_t j = 0; j < 4; ++j)
+        result[j] ^= shifted[j];
+    }
+    const uint64_t overflow = shifted[3] >> 63;
+    for (size_t j = 3; j != 0; --j)
+      shifted[j] = (shifted[j] << 1) | (shifted[j - 1] >> 63);
+    shifted[0] <<= 1;
+    if (overflow) {
+      for (size_t j = 0; j < 4; ++j)
+        shifted[j] ^= kCharacteristicPolynomial[j];
+    }
+  }
+  return result;
+}
+
+// The i-th polynomial is x^(2^(128 + i)) mod P(x), which advances the state by
+// 2^i jumps.
+const std::array<Polynomial, 64>& GetJumpPolynomials() noexcept {
+  static const std::array<Polynomial, 64> polynomials = [] {
+    std::array<Polynomial, 64> result;
+    result[0] = kJumpPolynomial;
+    for (size_t i = 1; i < result.size(); ++i)
+      result[i] = MultiplyModulo(result[i - 1], result[i - 1]);
+    // 2^64 jumps is one long jump.
+    assert(MultiplyModulo(result.back(), result.back()) ==
+           kLongJumpPolynomial);
+    return result;
+  }();
+  return polynomials;
+}
+
+// Fill() steps the lanes with the widest vectors available.
+#if defined(MS_MR_SHARING_PLATFORM_x86_OR_x64)
+struct Vector {
+  static constexpr size_t kSize = 2;
+  static Vector Load(const uint64_t* src) noexcept {
+    return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))};
+  }
+  void Store(uint64_t* dst) const noexcept {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), value_);
+  }
+  template <int kShift>
+  Vector ShiftLeft() const noexcept {
+    return {_mm_slli_epi64(value_, kShift)};
+  }
+  template <int kShift>
+  Vector ShiftRight() const noexcept {
+    return {_mm_srli_epi64(value_, kShift)};
+  }
+  Vector operator+(Vector other) const noexcept {
+    return {_mm_add_epi64(value_, other.value_)};
+  }
+  Vector operator^(Vector other) const noexcept {
+    return {_mm_xor_si128(value_, other.value_)};
+  }
+  Vector operator|(Vector other) const noexcept {
+    return {_mm_or_si128(value_, other.value_)};
+  }
+  __m128i value_;
+};
+#elif defined(MS_MR_SHARING_PLATFORM_ARM64)
+struct Vector {
+  static constexpr size_t kSize = 2;
+  static Vector Load(const uint64_t* src) noexcept { return {vld1q_u64(src)}; }
+  void Store(uint64_t* dst) const noexcept { vst1q_u64(dst, value_); }
+  template <int kShift>
+  Vector ShiftLeft() const noexcept {
+    return {vshlq_n_u64(value_, kShift)};
+  }
+  template <int kShift>
+  Vector ShiftRight() const noexcept {
+    return {vshrq_n_u64(value_, kShift)};
+  }
+  Vector operator+(Vector other) const noexcept {
+    return {vaddq_u64(value_, other.value_)};
+  }
+  Vector operator^(Vector other) const noexcept {
+    return {veorq_u64(value_, other.value_)};
+  }
+  Vector operator|(Vector other) const noexcept {
+    return {vorrq_u64(value_, other.value_)};
+  }
+  uint64x2_t value_;
+};
+#else
+struct Vector {
+  static constexpr size_t kSize = 1;
+  static Vector Load(const uint64_t* src) noexcept { return {*src}; }
+  void Store(uint64_t* dst) const noexcept { *dst = value_; }
+  template <int kShift>
+  Vector ShiftLeft() const noexcept {
+    return {value_ << kShift};
+  }
+  template <int kShift>
+  Vector ShiftRight() const noexcept {
+    return {value_ >> kShift};
+  }
+  Vector operator+(Vector other) const noexcept {
+    return {value_ + other.value_};
+  }
+  Vector operator^(Vector other) const noexcept {
+    return {value_ ^ other.value_};
+  }
+  Vector operator|(Vector other) const noexcept {
+    return {value_ | other.value_};
+  }
+  uint64_t value_;
+};
+#endif
+
+template <int kShift>
+MS_MR_SHARING_FORCEINLINE Vector RotateLeft(Vector x) noexcept {
+  return x.ShiftLeft<kShift>() | x.ShiftRight<64 - kShift>();
+}
+
+constexpr size_t kLanesCount = RandomDevice::kLanesCount;
+constexpr size_t kVectorsCount = kLanesCount / Vector::kSize;
+static_assert(kVectorsCount * Vector::kSize == kLanesCount);
+
+// The states of Vector::kSize lanes.
+struct VectorState {
+  Vector s0_;
+  Vector s1_;
+  Vector s2_;
+  Vector s3_;
+};
+
+// Same as RandomDevice::operator(), for all lanes of the state at once.
+MS_MR_SHARING_FORCEINLINE Vector Next(VectorState& state) noexcept {
+  const Vector result = RotateLeft<23>(state.s0_ + state.s3_) + state.s0_;
+  const Vector t = state.s1_.ShiftLeft<17>();
+  state.s2_ = state.s2_ ^ state.s0_;
+  state.s3_ = state.s3_ ^ state.s1_;
+  state.s1_ = state.s1_ ^ state.s2_;
+  state.s0_ = state.s0_ ^ state.s3_;
+  state.s2_ = state.s2_ ^ t;
+  state.s3_ = RotateLeft<45>(state.s3_);
+  return result;
+}
+
+MS_MR_SHARING_FORCEINLINE VectorState
+LoadVectorState(const uint64_t (&lane_states)[4][kLanesCount],
+                size_t offset) noexcept {
+  return {Vector::Load(lane_states[0] + offset),
+          Vector::Load(lane_states[1] + offset),
+          Vector::Load(lane_states[2] + offset),
+          Vector::Load(lane_states[3] + offset)};
+}
+
+MS_MR_SHARING_FORCEINLINE void StoreVectorState(
+    const VectorState& state,
+    uint64_t (&lane_states)[4][kLanesCount],
+    size_t offset) noexcept {
+  state.s0_.Store(lane_states[0] + offset);
+  state.s1_.Store(lane_states[1] + offset);
+  state.s2_.Store(lane_states[2] + offset);
+  state.s3_.Store(lane_states[3] + offset);
+}
+
+// Fills groups of kLanesCount values while there is enough space, and returns
+// the pointer past the last filled value.
+// The vectors are enumerated with a pack expansion (instead of a loop), so that
+// their states can be kept in registers.
+template <size_t... kIndices>
+uint64_t* FillFromLanes(uint64_t (&lane_states)[4][kLanesCount],
+                        uint64_t* dst,
+                        uint64_t* end,
+                        std::index_sequence<kIndices...>) noexcept {
+  VectorState states[]{
+      LoadVectorState(lane_states, kIndices * Vector::kSize)...};
+  for (; end - dst >= static_cast<ptrdiff_t>(kLanesCount);
+       dst += kLanesCount) {
+    (Next(states[kIndices]).Store(dst + kIndices * Vector::kSize), ...);
+  }
+  (StoreVectorState(states[kIndices], lane_states, kIndices * Vector::kSize),
+   ...);
+  return dst;
+}
+
+// Shorter spans are filled by operator(), since creating the lanes takes about
+// as much time as generating a thousand values.
+constexpr size_t kMinLanesFillSize = 64;
+
+}  // namespace
 
 RandomDevice::RandomDevice() noexcept {
   // Assuming here that random_device is good enough for generating the global
@@ -38,16 +259,33 @@ RandomDevice::RandomDevice() noexcept {
 }
 
 RandomDevice::RandomDevice(InitializeFromGlobalState) noexcept {
-  // Each thread-local instance advances the global state by 2^128 stages,
-  // and takes a copy of it.
-  // The global state is not used for any purpose other than this.
-
-  static RandomDevice global_state;
-  static std::mutex global_state_mutex;
-  auto lock = std::lock_guard{global_state_mutex};
-  global_state.Jump();
+  // Each thread reserves blocks of kInstancesPerBlock consecutive instance
+  // indices with a single atomic increment. The first instance of a block
+  // copies the global state advanced by (block index * kInstancesPerBlock)
+  // * 2^128 stages, and the following ones are each advanced by 2^128 more
+  // stages, so all instances are independent, and the expensive jump is only
+  // performed once per block. The global state is not used for any purpose
+  // other than this.
+  static constexpr uint64_t kInstancesPerBlock = 64;
+  static const RandomDevice global_state;
+  static std::atomic<uint64_t> blocks_count{0};
+  thread_local uint64_t block_state[4];
+  thread_local uint64_t instances_left_in_block = 0;
+  if (instances_left_in_block == 0) {
+    const uint64_t block_index =
+        blocks_count.fetch_add(1, std::memory_order_relaxed) + 1;
+    for (size_t i = 0; i < 4; ++i)
+      state_[i] = global_state.state_[i];
+    Jump(block_index * kInstancesPerBlock);
+    instances_left_in_block = kInstancesPerBlock;
+  } else {
+    for (size_t i = 0; i < 4; ++i)
+      state_[i] = block_state[i];
+    Jump();
+  }
+  --instances_left_in_block;
   for (size_t i = 0; i < 4; ++i)
-    state_[i] = global_state.state_[i];
+    block_state[i] = state_[i];
 }
 
 RandomDevice::RandomDevice(uint64_t s0,
@@ -61,15 +299,31 @@ RandomDevice::RandomDevice(uint64_t s0,
 }
 
 void RandomDevice::Jump() noexcept {
-  // The jump constants are obtained from the reference implementation.
-  static constexpr uint64_t kJumpConstants[] = {
-      0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa,
-      0x39abdc4529b1661c};
+  ApplyJumpPolynomial(kJumpPolynomial);
+}
+
+void RandomDevice::Jump(uint64_t jumps_count) noexcept {
+  // Jumps commute, so the jumps by 2^i * 2^128 stages can be applied in any
+  // order.
+  const std::array<Polynomial, 64>& polynomials = GetJumpPolynomials();
+  for (size_t i = 0; jumps_count != 0; ++i, jumps_count >>= 1) {
+    if (jumps_count & 1)
+      ApplyJumpPolynomial(polynomials[i]);
+  }
+}
+
+void RandomDevice::LongJump() noexcept {
+  ApplyJumpPolynomial(kLongJumpPolynomial);
+}
+
+void RandomDevice::ApplyJumpPolynomial(const Polynomial& polynomial) noexcept {
+  // The state after N stages is a linear combination of the states after
+  // 0..255 stages, with the coefficients of x^N mod P(x).
   uint64_t s0 = 0;
   uint64_t s1 = 0;
   uint64_t s2 = 0;
   uint64_t s3 = 0;
-  for (auto& constant : kJumpConstants) {
+  for (auto& constant : polynomial) {
     for (int b = 0; b < 64; b++) {
       if (constant & (1ull << b)) {
         s0 ^= state_[0];
@@ -86,4 +340,34 @@ void RandomDevice::Jump() noexcept {
   state_[3] = s3;
 }
 
+void RandomDevice::Fill(Span<uint64_t> values) noexcept {
+  uint64_t* dst = values.data();
+  uint64_t* const end = dst + values.size();
+  if (values.size() >= kMinLanesFillSize) {
+    if (!has_lanes_)
+      InitializeLanes();
+    dst = FillFromLanes(lane_states_, dst, end,
+                        std::make_index_sequence<kVectorsCount>{});
+  }
+  // Generating the rest from a local copy of the state (the stores to dst could
+  // alias the state otherwise, forcing it to be reloaded after each value).
+  RandomDevice local{state_[0], state_[1], state_[2], state_[3]};
+  for (; dst != end; ++dst)
+    *dst = local();
+  for (size_t i = 0; i < 4; ++i)
+    state_[i] = local.state_[i];
+}
+
+void RandomDevice::InitializeLanes() noexcept {
+  RandomDevice lane{state_[0], state_[1], state_[2], state_[3]};
+  lane.LongJump();
+  for (size_t i = 0; i < kLanesCount; ++i) {
+    if (i != 0)
+      lane.Jump();
+    for (size_t j = 0; j < 4; ++j)
+      lane_states_[j][i] = lane.state_[j];
+  }
+  has_lanes_ = true;
+}
+
 }  // namespace Microsoft::MixedReality::Sharing
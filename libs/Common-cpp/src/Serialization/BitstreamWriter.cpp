@@ -16,6 +16,40 @@ void BitstreamWriter::Grow(size_t new_capacity) noexcept {
   external_buffer_ = std::move(new_buffer_);
 }
 
+void BitstreamWriter::WriteExponentialGolombCodes(
+    Span<const uint64_t> values) noexcept {
+  // The codes are accumulated in local copies of temp_ and temp_bit_offset_
+  // (otherwise the stores into dst_, which may alias them, would force the
+  // compiler to reload them after each flush).
+  uint64_t temp = temp_;
+  bit_shift_t temp_bit_offset = temp_bit_offset_;
+  for (const uint64_t value : values) {
+    uint64_t code;
+    bit_shift_t code_bits_count;
+    if (MS_MR_UNLIKELY(!TryMakeShortCode(value, code, code_bits_count))) {
+      temp_ = temp;
+      temp_bit_offset_ = temp_bit_offset;
+      WriteExponentialGolombCode(value);
+      temp = temp_;
+      temp_bit_offset = temp_bit_offset_;
+      continue;
+    }
+    temp |= code << temp_bit_offset;
+    temp_bit_offset += code_bits_count;
+    if (temp_bit_offset > 63) {
+      if (offset_ == capacity_)
+        Grow(capacity_ * 2);
+      dst_[offset_++] = temp;
+      temp_bit_offset &= 63;
+      // code_bits_count is at most 63, so the shift is always valid (and
+      // produces 0 if the code ended exactly at the end of the flushed word).
+      temp = code >> (code_bits_count - temp_bit_offset);
+    }
+  }
+  temp_ = temp;
+  temp_bit_offset_ = temp_bit_offset;
+}
+
 std::string_view BitstreamWriter::Finalize() noexcept {
   size_t size_bytes = offset_ * 8;
   if (temp_bit_offset_) {
@@ -184,20 +184,68 @@ uint64_t BlobReader::ReadBits64(bit_shift_t bits_count) {
   return ReadBits<uint64_t>(bits_count);
 }
 
+MS_MR_SHARING_FORCEINLINE
+bool BlobReader::TryReadBufferedGolomb(size_t& bit_buf,
+                                       bit_shift_t& bit_buf_bits_count,
+                                       uint64_t& result) noexcept {
+  // The unread bits are stored in the high bits of the buffer, and the rest of
+  // the buffer is always zero. Therefore if the buffer is not zero, its highest
+  // set bit is the separator of the next code, and the number of leading zeros
+  // is the length of the code's payload. The whole code (the zeros, the
+  // separator and the payload) is the value + 1, written with
+  // 2 * zeroes_count + 1 bits.
+  bit_shift_t set_bit_position;
+  if (!BitScanReverse(set_bit_position, bit_buf))
+    return false;
+  const bit_shift_t code_bits_count =
+      2 * (kBitBufferBitsCount - 1 - set_bit_position) + 1;
+  // Excluding the case where the code ends exactly at the end of the buffer,
+  // since shifting by the size of the buffer is not allowed.
+  if (code_bits_count >= bit_buf_bits_count)
+    return false;
+  result = static_cast<uint64_t>(
+               bit_buf >> (kBitBufferBitsCount - code_bits_count)) -
+           1;
+  bit_buf <<= code_bits_count;
+  bit_buf_bits_count -= code_bits_count;
+  return true;
+}
+
 uint64_t BlobReader::ReadGolomb() {
+  uint64_t result;
+  if (MS_MR_LIKELY(
+          TryReadBufferedGolomb(bit_buf_, bit_buf_bits_count_, result)))
+    return result;
+  return ReadGolombSlow();
+}
+
+void BlobReader::ReadGolombN(Span<uint64_t> values) {
+  uint64_t* next = values.data();
+  uint64_t* const end = next + values.size();
+  while (next != end) {
+    // Decoding from local copies of the buffer (the stores to values may alias
+    // the members, which would force the compiler to reload them after each
+    // value). They are written back before each refill.
+    size_t bit_buf = bit_buf_;
+    bit_shift_t bit_buf_bits_count = bit_buf_bits_count_;
+    while (next != end &&
+           TryReadBufferedGolomb(bit_buf, bit_buf_bits_count, *next)) {
+      ++next;
+    }
+    bit_buf_ = bit_buf;
+    bit_buf_bits_count_ = bit_buf_bits_count;
+    if (next != end)
+      *next++ = ReadGolombSlow();
+  }
+}
+
+uint64_t BlobReader::ReadGolombSlow() {
   // Counting the number of zero bits to determine the length of the code.
   // 64 zeros is a special case for ~0ull (see BlobWriter for details).
   bit_shift_t zeroes_count = 0;
   bit_shift_t set_bit_position;
 
-#if defined(MS_MR_SHARING_PLATFORM_AMD64)
-  while (!_BitScanReverse64(&set_bit_position, bit_buf_))
-#elif defined(MS_MR_SHARING_PLATFORM_x86)
-  while (!_BitScanReverse(&set_bit_position, bit_buf_))
-#else
-#error Unsupported platform
-#endif
-  {
+  while (!BitScanReverse(set_bit_position, bit_buf_)) {
     zeroes_count += bit_buf_bits_count_;
     if (zeroes_count >= 64) {
       // Special case for ~0ull (see BlobWriter for details).
@@ -16,39 +16,36 @@ void BlobWriter::Grow(size_t min_free_bytes_after_grow) noexcept {
   // |         |                                          |                 |
   // buffer_   bytes_scection_end_      bits_section_begin_        buffer_end
   //
-  // The new buffer will have the same layout, but the free section in the
-  // middle (free_bytes_count_) will be larger.
+  // Both sections stay in the current buffer (which is retired, so that they
+  // are never copied before the finalization), and the new buffer will have
+  // the same layout with empty sections.
 
   const size_t bytes_size = bytes_section_size();
   const size_t bits_size = bits_section_size();
   const size_t buffer_size = reinterpret_cast<std::byte*>(buffer_end_) -
                              reinterpret_cast<std::byte*>(buffer_);
 
+  RetiredBuffer& retired_buffer = retired_buffers_.emplace_back();
+  if (buffer_ != inplace_buffer_)
+    retired_buffer.storage_.reset(buffer_);
+  retired_buffer.bytes_section_ = {reinterpret_cast<const char*>(buffer_),
+                                   bytes_size};
+  retired_buffer.bits_section_ = {
+      reinterpret_cast<const char*>(bits_section_begin_), bits_size};
+  retired_sections_size_ += bytes_size + bits_size;
+
   // 15 comes from 8 (to always have free space for the current bit buffer) and
   // 7 (to make the division round up).
-  const size_t min_new_elements_count =
-      (bytes_size + bits_size + min_free_bytes_after_grow + 15) / 8;
+  const size_t min_new_elements_count = (min_free_bytes_after_grow + 15) / 8;
   const size_t new_elements_count =
       std::max(min_new_elements_count, buffer_size / 4);
-  const size_t new_buffer_size = new_elements_count * 8;
-  auto new_buffer = std::make_unique<uint64_t[]>(new_elements_count);
-  std::byte* new_buffer_begin = reinterpret_cast<std::byte*>(new_buffer.get());
-  std::byte* new_buffer_end = new_buffer_begin + new_buffer_size;
-
-  // Copying the bytes section (head)
-  memcpy(new_buffer_begin, buffer_, bytes_size);
-  bytes_scection_end_ = new_buffer_begin + bytes_size;
-
-  // Copying the bits section (tail)
-  std::byte* new_bits_section_begin = new_buffer_end - bits_size;
-  memcpy(new_bits_section_begin, bits_section_begin_, bits_size);
-  bits_section_begin_ = reinterpret_cast<uint64_t*>(new_bits_section_begin);
-  // Reserving 8 bytes for the current bit buffer.
-  free_bytes_count_ = new_buffer_size - bytes_size - bits_size - 8;
-  if (buffer_ != inplace_buffer_)
-    delete[] buffer_;
-  buffer_ = new_buffer.release();
+  // Not initializing the new buffer, since all of it will be overwritten.
+  buffer_ = new uint64_t[new_elements_count];
   buffer_end_ = buffer_ + new_elements_count;
+  bytes_scection_end_ = reinterpret_cast<std::byte*>(buffer_);
+  bits_section_begin_ = buffer_end_;
+  // Reserving 8 bytes for the current bit buffer.
+  free_bytes_count_ = new_elements_count * 8 - 8;
 }
 
 void BlobWriter::WriteGolomb(uint64_t value) noexcept {
@@ -73,23 +70,19 @@ void BlobWriter::WriteGolomb(uint64_t value) noexcept {
   // Offsetting the value by 1. This can overflow if the value was ~0ull.
   value += 1;
   bit_shift_t index;
-#if defined(MS_MR_SHARING_PLATFORM_AMD64)
-  if (_BitScanReverse64(&index, value)) {
-    // Do nothing
-#elif defined(MS_MR_SHARING_PLATFORM_x86)
-  if (_BitScanReverse(&index, (value >> 32))) {
-    index += 32;
-  } else if (_BitScanReverse(&index, static_cast<uint32_t>(value))) {
-    // Do nothing
-#endif
-  } else {
+  if (!BitScanReverse(index, value)) {
     // Special encoding for ~0ull. value is 0 here due to the overflow.
     // All other values will encode themselves with less than 64 leading zeros.
     WriteBits(0, 64);
     return;
   }
-  WriteBits(0, index);
-  WriteBits(value, index + 1);
+  if (index < 32) {
+    // The zeros and the value fit into a single write.
+    WriteBits(value, 2 * index + 1);
+  } else {
+    WriteBits(0, index);
+    WriteBits(value, index + 1);
+  }
 }
 
 void BlobWriter::WriteBytesWithSize(const std::byte* data,
@@ -116,7 +109,45 @@ void BlobWriter::WritePresentOptionalGolomb(uint64_t present_value) noexcept {
   }
 }
 
+Span<const std::string_view> BlobWriter::FinalizeToSegments() noexcept {
+  // There are at most 3 segments if the writer never switched to a new
+  // buffer, so the list is only allocated for large blobs.
+  std::string_view* segments = inplace_segments_;
+  if (!retired_buffers_.empty()) {
+    segments_.resize(2 * retired_buffers_.size() + 3);
+    segments = segments_.data();
+  }
+  size_t segments_count = 0;
+  const auto append = [&](std::string_view segment) {
+    if (segment.size() != 0)
+      segments[segments_count++] = segment;
+  };
+  for (const RetiredBuffer& retired_buffer : retired_buffers_)
+    append(retired_buffer.bytes_section_);
+  append({reinterpret_cast<const char*>(buffer_), bytes_section_size()});
+  const size_t pending_size = pending_bits_size();
+  append({reinterpret_cast<const char*>(&bit_buffer_) + 8 - pending_size,
+          pending_size});
+  append({reinterpret_cast<const char*>(bits_section_begin_),
+          bits_section_size()});
+  for (auto it = retired_buffers_.rbegin(); it != retired_buffers_.rend();
+       ++it) {
+    append(it->bits_section_);
+  }
+  return {segments, segments_count};
+}
+
 std::string_view BlobWriter::Finalize() noexcept {
+  if (!retired_buffers_.empty()) {
+    // The blob consists of several segments, which are copied into a new
+    // buffer (each byte is copied only once).
+    const size_t result_size = finalized_size();
+    std::unique_ptr<uint64_t[]> result{new uint64_t[(result_size + 7) / 8]};
+    FinalizeTo(reinterpret_cast<char*>(result.get()));
+    const char* data = reinterpret_cast<const char*>(result.get());
+    retired_buffers_.push_back({std::move(result), {}, {}});
+    return {data, result_size};
+  }
   const size_t bits_size = bits_section_size();
   const size_t bytes_size = bytes_section_size();
   const size_t pending_size = pending_bits_size();
@@ -137,4 +168,36 @@ std::string_view BlobWriter::Finalize() noexcept {
   return {reinterpret_cast<const char*>(buffer_), result_size};
 }
 
+void BlobWriter::FinalizeTo(char* dst) const noexcept {
+  for (const RetiredBuffer& retired_buffer : retired_buffers_) {
+    const std::string_view section = retired_buffer.bytes_section_;
+    memcpy(dst, section.data(), section.size());
+    dst += section.size();
+  }
+  const size_t bytes_size = bytes_section_size();
+  const size_t pending_size = pending_bits_size();
+  memcpy(dst, buffer_, bytes_size);
+  dst += bytes_size;
+  if (pending_size) {
+    const std::byte* src =
+        reinterpret_cast<const std::byte*>(&bit_buffer_) + 8 - pending_size;
+    memcpy(dst, src, pending_size);
+    dst += pending_size;
+  }
+  const size_t bits_size = bits_section_size();
+  memcpy(dst, bits_section_begin_, bits_size);
+  dst += bits_size;
+  for (auto it = retired_buffers_.rbegin(); it != retired_buffers_.rend();
+       ++it) {
+    memcpy(dst, it->bits_section_.data(), it->bits_section_.size());
+    dst += it->bits_section_.size();
+  }
+}
+
+RefPtr<const Blob> BlobWriter::FinalizeToBlob() const {
+  auto blob = Blob::CreateUninitialized(finalized_size());
+  FinalizeTo(blob.data());
+  return std::move(blob).Seal();
+}
+
 }  // namespace Microsoft::MixedReality::Sharing::Serialization
@@ -0,0 +1,319 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlockMonotonicSequenceEncoder.h>
+
+#include <Microsoft/MixedReality/Sharing/Common/Platform.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamWriter.h>
+
+#if defined(MS_MR_SHARING_PLATFORM_x86_OR_x64)
+#include <emmintrin.h>
+#elif defined(MS_MR_SHARING_PLATFORM_ARM64)
+#ifdef _MSC_VER
+#include <arm64_neon.h>
+#else
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace Microsoft::MixedReality::Sharing::Serialization {
+namespace {
+
+constexpr size_t kBlockSize = BlockMonotonicSequenceEncoder::kBlockSize;
+
+// The bit width of the packed deltas is stored with this many bits (0 to 64).
+constexpr bit_shift_t kBitsCountBitsCount = 7;
+
+// The position of an exception within the block.
+constexpr bit_shift_t kPositionBitsCount = 7;
+static_assert(kBlockSize == 1 << kPositionBitsCount);
+
+// Two 64-bit lanes of the packed block (the even and the odd deltas).
+#if defined(MS_MR_SHARING_PLATFORM_x86_OR_x64)
+using Lanes = __m128i;
+
+MS_MR_SHARING_FORCEINLINE Lanes Broadcast(uint64_t value) noexcept {
+  return _mm_set1_epi64x(static_cast<long long>(value));
+}
+MS_MR_SHARING_FORCEINLINE Lanes Load(const uint64_t* src) noexcept {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+}
+MS_MR_SHARING_FORCEINLINE void Store(uint64_t* dst, Lanes lanes) noexcept {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), lanes);
+}
+MS_MR_SHARING_FORCEINLINE Lanes ShiftLeft(Lanes lanes,
+                                          bit_shift_t shift) noexcept {
+  return _mm_sll_epi64(lanes, _mm_cvtsi32_si128(static_cast<int>(shift)));
+}
+MS_MR_SHARING_FORCEINLINE Lanes ShiftRight(Lanes lanes,
+                                           bit_shift_t shift) noexcept {
+  return _mm_srl_epi64(lanes, _mm_cvtsi32_si128(static_cast<int>(shift)));
+}
+MS_MR_SHARING_FORCEINLINE Lanes Or(Lanes a, Lanes b) noexcept {
+  return _mm_or_si128(a, b);
+}
+MS_MR_SHARING_FORCEINLINE Lanes And(Lanes a, Lanes b) noexcept {
+  return _mm_and_si128(a, b);
+}
+#elif defined(MS_MR_SHARING_PLATFORM_ARM64)
+using Lanes = uint64x2_t;
+
+MS_MR_SHARING_FORCEINLINE Lanes Broadcast(uint64_t value) noexcept {
+  return vdupq_n_u64(value);
+}
+MS_MR_SHARING_FORCEINLINE Lanes Load(const uint64_t* src) noexcept {
+  return vld1q_u64(src);
+}
+MS_MR_SHARING_FORCEINLINE void Store(uint64_t* dst, Lanes lanes) noexcept {
+  vst1q_u64(dst, lanes);
+}
+MS_MR_SHARING_FORCEINLINE Lanes ShiftLeft(Lanes lanes,
+                                          bit_shift_t shift) noexcept {
+  return vshlq_u64(lanes, vdupq_n_s64(static_cast<int64_t>(shift)));
+}
+MS_MR_SHARING_FORCEINLINE Lanes ShiftRight(Lanes lanes,
+                                           bit_shift_t shift) noexcept {
+  // NEON only has variable shifts to the left (negative ones shift right).
+  return vshlq_u64(lanes, vdupq_n_s64(-static_cast<int64_t>(shift)));
+}
+MS_MR_SHARING_FORCEINLINE Lanes Or(Lanes a, Lanes b) noexcept {
+  return vorrq_u64(a, b);
+}
+MS_MR_SHARING_FORCEINLINE Lanes And(Lanes a, Lanes b) noexcept {
+  return vandq_u64(a, b);
+}
+#else
+struct Lanes {
+  uint64_t even_;
+  uint64_t odd_;
+};
+
+MS_MR_SHARING_FORCEINLINE Lanes Broadcast(uint64_t value) noexcept {
+  return {value, value};
+}
+MS_MR_SHARING_FORCEINLINE Lanes Load(const uint64_t* src) noexcept {
+  return {src[0], src[1]};
+}
+MS_MR_SHARING_FORCEINLINE void Store(uint64_t* dst, Lanes lanes) noexcept {
+  dst[0] = lanes.even_;
+  dst[1] = lanes.odd_;
+}
+MS_MR_SHARING_FORCEINLINE Lanes ShiftLeft(Lanes lanes,
+                                          bit_shift_t shift) noexcept {
+  return {lanes.even_ << shift, lanes.odd_ << shift};
+}
+MS_MR_SHARING_FORCEINLINE Lanes ShiftRight(Lanes lanes,
+                                           bit_shift_t shift) noexcept {
+  return {lanes.even_ >> shift, lanes.odd_ >> shift};
+}
+MS_MR_SHARING_FORCEINLINE Lanes Or(Lanes a, Lanes b) noexcept {
+  return {a.even_ | b.even_, a.odd_ | b.odd_};
+}
+MS_MR_SHARING_FORCEINLINE Lanes And(Lanes a, Lanes b) noexcept {
+  return {a.even_ & b.even_, a.odd_ & b.odd_};
+}
+#endif
+
+constexpr uint64_t MakeMask(bit_shift_t bits_count) noexcept {
+  return bits_count == 64 ? ~0ull : (1ull << bits_count) - 1;
+}
+
+inline bit_shift_t GetBitWidth(uint64_t value) noexcept {
+  bit_shift_t index = 0;
+  return BitScanReverse(index, value) ? index + 1 : 0;
+}
+
+// Chooses the bit width of the packed deltas that minimizes the size of the
+// block. Each delta that doesn't fit becomes an exception, which costs the
+// position and the exponential-Golomb code of the high bits (2 * N - 1 bits
+// for N high bits).
+bit_shift_t ChooseBitsCount(const uint64_t* deltas) noexcept {
+  size_t width_counts[65]{};
+  for (size_t i = 0; i < kBlockSize; ++i)
+    ++width_counts[GetBitWidth(deltas[i])];
+
+  bit_shift_t best_bits_count = 64;
+  uint64_t best_cost = kBlockSize * 64;
+  uint64_t exceptions_count = 0;
+  uint64_t high_bits_count = 0;
+  for (bit_shift_t bits_count = 64; bits_count-- != 0;) {
+    // Decreasing the width by one adds one high bit to each exception (and
+    // turns the deltas that were exactly one bit wider into exceptions).
+    exceptions_count += width_counts[bits_count + 1];
+    high_bits_count += exceptions_count;
+    const uint64_t cost = kBlockSize * bits_count +
+                          exceptions_count * (kPositionBitsCount - 1) +
+                          2 * high_bits_count;
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_bits_count = bits_count;
+    }
+  }
+  return best_bits_count;
+}
+
+// Packs the low bits_count bits of each delta. The even deltas are packed into
+// the even words, and the odd deltas into the odd ones, so that each pair of
+// words can be unpacked with the same shifts. 2 * bits_count words are
+// written.
+void PackBlock(const uint64_t* deltas,
+               bit_shift_t bits_count,
+               uint64_t* packed) noexcept {
+  assert(bits_count != 0 && bits_count <= 64);
+  const uint64_t mask = MakeMask(bits_count);
+  for (size_t lane = 0; lane < 2; ++lane) {
+    uint64_t* dst = packed + lane;
+    uint64_t word = 0;
+    bit_shift_t offset = 0;
+    for (size_t i = lane; i < kBlockSize; i += 2) {
+      const uint64_t value = deltas[i] & mask;
+      word |= value << offset;
+      offset += bits_count;
+      if (offset >= 64) {
+        *dst = word;
+        dst += 2;
+        offset -= 64;
+        word = offset == 0 ? 0 : value >> (bits_count - offset);
+      }
+    }
+  }
+}
+
+// The reverse of PackBlock(). The sequence of shifts depends only on
+// bits_count, so the branches are perfectly predictable.
+void UnpackBlock(const uint64_t* packed,
+                 bit_shift_t bits_count,
+                 uint64_t* deltas) noexcept {
+  assert(bits_count != 0 && bits_count <= 64);
+  const Lanes mask = Broadcast(MakeMask(bits_count));
+  Lanes current = Load(packed);
+  bit_shift_t offset = 0;
+  for (size_t i = 0; i < kBlockSize; i += 2) {
+    Lanes value = ShiftRight(current, offset);
+    offset += bits_count;
+    // The last pair of deltas always ends at the end of the last pair of words.
+    if (offset >= 64 && i + 2 != kBlockSize) {
+      offset -= 64;
+      packed += 2;
+      current = Load(packed);
+      if (offset != 0)
+        value = Or(value, ShiftLeft(current, bits_count - offset));
+    }
+    Store(deltas + i, And(value, mask));
+  }
+}
+
+}  // namespace
+
+void BlockMonotonicSequenceEncoder::EncodeBlock(
+    Span<const uint64_t> values,
+    BitstreamWriter& bitstream_writer) noexcept {
+  assert(values.size() <= kBlockSize);
+  uint64_t deltas[kBlockSize];
+  for (size_t i = 0; i < values.size(); ++i) {
+    const uint64_t value = values.data()[i];
+    assert(can_continue_ && value >= predicted_next_value_);
+    deltas[i] = value - predicted_next_value_;
+    if (value == ~0ull) {
+      can_continue_ = false;
+    } else {
+      predicted_next_value_ = value + 1;
+    }
+  }
+  if (values.size() != kBlockSize) {
+    bitstream_writer.WriteExponentialGolombCodes({deltas, values.size()});
+    return;
+  }
+  const bit_shift_t bits_count = ChooseBitsCount(deltas);
+  bitstream_writer.WriteBits(bits_count, kBitsCountBitsCount);
+  if (bits_count != 0) {
+    uint64_t packed[2 * 64];
+    PackBlock(deltas, bits_count, packed);
+    for (size_t i = 0; i < 2 * size_t{bits_count}; ++i)
+      bitstream_writer.WriteBits(packed[i], 64);
+  }
+  if (bits_count == 64)
+    return;
+  uint64_t exceptions_count = 0;
+  for (size_t i = 0; i < kBlockSize; ++i)
+    exceptions_count += (deltas[i] >> bits_count) != 0;
+  bitstream_writer.WriteExponentialGolombCode(exceptions_count);
+  for (size_t i = 0; exceptions_count != 0; ++i) {
+    const uint64_t high_bits = deltas[i] >> bits_count;
+    if (high_bits != 0) {
+      bitstream_writer.WriteBits(i, kPositionBitsCount);
+      bitstream_writer.WriteExponentialGolombCode(high_bits - 1);
+      --exceptions_count;
+    }
+  }
+}
+
+void BlockMonotonicSequenceEncoder::DecodeBlock(Span<uint64_t> values,
+                                                BitstreamReader& reader) {
+  assert(values.size() <= kBlockSize);
+  if (values.size() != kBlockSize) {
+    reader.ReadExponentialGolombCodes(values);
+    AccumulateDeltas(values);
+    return;
+  }
+  uint64_t* deltas = values.data();
+  const bit_shift_t bits_count = reader.ReadBits32(kBitsCountBitsCount);
+  if (bits_count > 64) {
+    throw std::invalid_argument{
+        "Can't decode a block of the monotonic sequence: invalid bit width"};
+  }
+  if (bits_count == 0) {
+    std::fill_n(deltas, kBlockSize, 0);
+  } else {
+    uint64_t packed[2 * 64];
+    for (size_t i = 0; i < 2 * size_t{bits_count}; ++i)
+      packed[i] = reader.ReadBits64(64);
+    UnpackBlock(packed, bits_count, deltas);
+  }
+  if (bits_count != 64) {
+    const uint64_t exceptions_count = reader.ReadExponentialGolombCode();
+    if (exceptions_count > kBlockSize) {
+      throw std::invalid_argument{
+          "Can't decode a block of the monotonic sequence: too many "
+          "exceptions"};
+    }
+    const uint64_t max_high_bits = ~0ull >> bits_count;
+    for (uint64_t i = 0; i < exceptions_count; ++i) {
+      const uint32_t position = reader.ReadBits32(kPositionBitsCount);
+      const uint64_t high_bits_minus_one = reader.ReadExponentialGolombCode();
+      if (high_bits_minus_one >= max_high_bits) {
+        throw std::invalid_argument{
+            "Can't decode a block of the monotonic sequence: exception "
+            "overflows the maximum encodable value"};
+      }
+      deltas[position] |= (high_bits_minus_one + 1) << bits_count;
+    }
+  }
+  AccumulateDeltas(values);
+}
+
+void BlockMonotonicSequenceEncoder::AccumulateDeltas(Span<uint64_t> values) {
+  for (uint64_t& value : values) {
+    if (!can_continue_) {
+      throw std::invalid_argument{
+          "Can't decode the next value of the monotonic sequence because the "
+          "largest encodable value is already reached"};
+    }
+    if (value > ~0ull - predicted_next_value_) {
+      throw std::invalid_argument{
+          "Can't decode the next value of the monotonic sequence: value "
+          "overflows the maximum encodable value"};
+    }
+    value += predicted_next_value_;
+    if (value == ~0ull) {
+      can_continue_ = false;
+    } else {
+      predicted_next_value_ = value + 1;
+    }
+  }
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::Serialization
@@ -0,0 +1,217 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/FragmentedBlobReader.h>
+
+namespace Microsoft::MixedReality::Sharing::Serialization {
+
+FragmentedBlobReader::FragmentedBlobReader(
+    Span<const std::string_view> fragments)
+    : fragments_{fragments} {
+  for (const std::string_view& fragment : fragments)
+    unread_bytes_count_ += fragment.size();
+  if (fragments.size() != 0) {
+    back_index_ = fragments.size() - 1;
+    back_size_ = fragments.back().size();
+  }
+}
+
+MS_MR_SHARING_FORCEINLINE
+void FragmentedBlobReader::PopulateBitBuf(bit_shift_t min_bits_count) {
+  assert(min_bits_count > 0 && min_bits_count <= kBitBufferBitsCount);
+  if (unread_bytes_count_ * 8 < min_bits_count)
+    throw std::out_of_range("Not enough bytes in the blob");
+
+  // Same layout as in BlobReader: the last unread byte of the input ends up in
+  // the highest byte of the buffer. Usually all the bytes are in the same
+  // fragment, and the loop below performs a single copy.
+  const size_t bytes_count =
+      std::min<size_t>(unread_bytes_count_, sizeof(bit_buf_));
+  unread_bytes_count_ -= bytes_count;
+  bit_buf_ = 0;
+  char* dst = reinterpret_cast<char*>(&bit_buf_) + sizeof(bit_buf_);
+  for (size_t bytes_left = bytes_count; bytes_left != 0;) {
+    if (back_size_ == 0) {
+      assert(back_index_ != 0);
+      back_size_ = fragments_.data()[--back_index_].size();
+      continue;
+    }
+    const size_t chunk_size = std::min(bytes_left, back_size_);
+    back_size_ -= chunk_size;
+    bytes_left -= chunk_size;
+    dst -= chunk_size;
+    memcpy(dst, fragments_.data()[back_index_].data() + back_size_,
+           chunk_size);
+  }
+  bit_buf_bits_count_ = static_cast<bit_shift_t>(bytes_count) * 8;
+}
+
+std::string_view FragmentedBlobReader::TakeFrontBytes(size_t bytes_count) {
+  if (bytes_count == 0)
+    return {};
+  const std::string_view* fragments = fragments_.data();
+  while (front_offset_ == fragments[front_index_].size()) {
+    ++front_index_;
+    front_offset_ = 0;
+  }
+  const std::string_view& fragment = fragments[front_index_];
+  if (fragment.size() - front_offset_ >= bytes_count) {
+    // Fast path: the bytes are entirely within one fragment.
+    const char* begin = fragment.data() + front_offset_;
+    front_offset_ += bytes_count;
+    return {begin, bytes_count};
+  }
+  spanning_bytes_.emplace_back(new char[bytes_count]);
+  char* const result = spanning_bytes_.back().get();
+  for (size_t offset = 0; offset != bytes_count;) {
+    if (front_offset_ == fragments[front_index_].size()) {
+      ++front_index_;
+      front_offset_ = 0;
+      continue;
+    }
+    const std::string_view& current = fragments[front_index_];
+    const size_t chunk_size =
+        std::min(bytes_count - offset, current.size() - front_offset_);
+    memcpy(result + offset, current.data() + front_offset_, chunk_size);
+    front_offset_ += chunk_size;
+    offset += chunk_size;
+  }
+  return {result, bytes_count};
+}
+
+std::string_view FragmentedBlobReader::ReadBytes(size_t bytes_count) {
+  if (bytes_count <= unread_bytes_count_) {
+    unread_bytes_count_ -= bytes_count;
+  } else if (bytes_count <= unread_bytes_count_ + bit_buf_bits_count_ / 8) {
+    // Some of the bytes were optimistically loaded into the bit buffer (see
+    // BlobReader::ReadBytes() for the details). They are still in the
+    // fragments, so only their bits have to be cleared from the buffer.
+    const auto removed_bits_count =
+        static_cast<bit_shift_t>(bytes_count - unread_bytes_count_) * 8;
+    unread_bytes_count_ = 0;
+    bit_buf_bits_count_ -= removed_bits_count;
+    if (bit_buf_bits_count_ == 0)
+      bit_buf_ = 0;
+    else
+      bit_buf_ &= ~(~0ull >> bit_buf_bits_count_);
+  } else {
+    throw std::out_of_range("Not enough bytes in the blob");
+  }
+  return TakeFrontBytes(bytes_count);
+}
+
+std::string_view FragmentedBlobReader::ReadBytesWithSize() {
+  uint64_t size = ReadGolomb();
+  if constexpr (sizeof(size_t) < sizeof(uint64_t)) {
+    if (size > std::numeric_limits<size_t>::max()) {
+      throw std::out_of_range("Not enough bytes in the blob");
+    }
+  }
+  return ReadBytes(static_cast<size_t>(size));
+}
+
+uint32_t FragmentedBlobReader::ReadBits32(bit_shift_t bits_count) {
+  assert(bits_count <= 32);
+  return static_cast<uint32_t>(ReadBits64(bits_count));
+}
+
+uint64_t FragmentedBlobReader::ReadBits64(bit_shift_t bits_count) {
+  assert(bits_count > 0 && bits_count <= 64);
+  if (MS_MR_LIKELY(bits_count < bit_buf_bits_count_)) {
+    const uint64_t result = bit_buf_ >> (kBitBufferBitsCount - bits_count);
+    bit_buf_ <<= bits_count;
+    bit_buf_bits_count_ -= bits_count;
+    return result;
+  }
+  return ReadBitsSlow(bits_count);
+}
+
+uint64_t FragmentedBlobReader::ReadBitsSlow(bit_shift_t bits_count) {
+  assert(bits_count >= bit_buf_bits_count_);
+  if (bits_count == bit_buf_bits_count_) {
+    const uint64_t result = bit_buf_ >> (kBitBufferBitsCount - bits_count);
+    bit_buf_ = 0;
+    bit_buf_bits_count_ = 0;
+    return result;
+  }
+  bit_shift_t shift = kBitBufferBitsCount - bits_count;
+  uint64_t result = 0;
+  if (bit_buf_bits_count_) {
+    result = bit_buf_ >> shift;
+    bits_count -= bit_buf_bits_count_;
+    shift += bit_buf_bits_count_;
+    PopulateBitBuf(bits_count);
+  } else {
+    PopulateBitBuf(bits_count);
+    if (bits_count == kBitBufferBitsCount) {
+      result = bit_buf_;
+      bit_buf_ = 0;
+      bit_buf_bits_count_ = 0;
+      return result;
+    }
+  }
+  result |= bit_buf_ >> shift;
+  bit_buf_bits_count_ -= bits_count;
+  bit_buf_ <<= bits_count;
+  return result;
+}
+
+uint64_t FragmentedBlobReader::ReadGolomb() {
+  // See BlobReader::TryReadBufferedGolomb() for the details.
+  bit_shift_t set_bit_position;
+  if (MS_MR_LIKELY(BitScanReverse(set_bit_position, bit_buf_))) {
+    const bit_shift_t code_bits_count =
+        2 * (kBitBufferBitsCount - 1 - set_bit_position) + 1;
+    if (MS_MR_LIKELY(code_bits_count < bit_buf_bits_count_)) {
+      const uint64_t result =
+          (bit_buf_ >> (kBitBufferBitsCount - code_bits_count)) - 1;
+      bit_buf_ <<= code_bits_count;
+      bit_buf_bits_count_ -= code_bits_count;
+      return result;
+    }
+  }
+  return ReadGolombSlow();
+}
+
+uint64_t FragmentedBlobReader::ReadGolombSlow() {
+  // Same as BlobReader::ReadGolombSlow().
+  bit_shift_t zeroes_count = 0;
+  bit_shift_t set_bit_position;
+
+  while (!BitScanReverse(set_bit_position, bit_buf_)) {
+    zeroes_count += bit_buf_bits_count_;
+    if (zeroes_count >= 64) {
+      // Special case for ~0ull (see BlobWriter for details).
+      bit_buf_bits_count_ = zeroes_count - 64;
+      return ~0ull;
+    }
+    PopulateBitBuf(1);
+  }
+  static constexpr bit_shift_t kLastBitPosition = kBitBufferBitsCount - 1;
+  const bit_shift_t new_zeros_count = kLastBitPosition - set_bit_position;
+  zeroes_count += new_zeros_count;
+  if (zeroes_count >= 64) {
+    // Special case for ~0ull (see BlobWriter for details).
+    const bit_shift_t consumed_zeros_count =
+        new_zeros_count - zeroes_count + 64;
+    bit_buf_bits_count_ -= consumed_zeros_count;
+    bit_buf_ <<= consumed_zeros_count;
+    return ~0ull;
+  }
+  bit_buf_bits_count_ -= new_zeros_count;
+  bit_buf_ <<= new_zeros_count;
+  return ReadBits64(zeroes_count + 1) - 1;
+}
+
+std::optional<uint64_t> FragmentedBlobReader::ReadOptionalGolomb() {
+  uint64_t code = ReadGolomb();
+  if (code == 0)
+    return {};
+  if (code == ~0ull)
+    return ~ReadBits64(1);  // Special encoding for ~0ull and ~1ull.
+  return code - 1;
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::Serialization
@@ -9,15 +9,13 @@
 #include <Microsoft/MixedReality/Sharing/Common/Platform.h>
 #include <Microsoft/MixedReality/Sharing/Common/hash.h>
 
-#if defined(_MSC_VER) && defined(_M_X64)
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
 #include <intrin.h>
-#pragma intrinsic(_umul128)
 #endif
 
-// Using the 32-bit-friendly variation to make the performance consistent
-// on all platforms.
-// It's slower than the default one on x64/ARM64, but much faster on x86.
-#define WYHASH32
+#if defined(_MSC_VER) && defined(_M_X64)
+#pragma intrinsic(_umul128)
+#endif
 
 namespace Microsoft::MixedReality::Sharing {
 namespace {
@@ -32,21 +30,72 @@ MS_MR_SHARING_FORCEINLINE uint64_t _wyrotr(uint64_t v, unsigned k) {
   return (v >> k) | (v << (64 - k));
 }
 
-MS_MR_SHARING_FORCEINLINE uint64_t _wymum(uint64_t A, uint64_t B) {
-#ifdef WYHASH32
+MS_MR_SHARING_FORCEINLINE uint64_t _wyr8(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+MS_MR_SHARING_FORCEINLINE uint64_t _wyr4(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+MS_MR_SHARING_FORCEINLINE uint64_t _wyr3(const uint8_t* p, unsigned k) {
+  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+template <HashVersion kVersion>
+struct Wyhash {
+  MS_MR_SHARING_FORCEINLINE static uint64_t _wymum(uint64_t A,
+                                                   uint64_t B) noexcept;
+
+  static uint64_t Hash(const char* data, size_t size, uint64_t seed) noexcept;
+
+  // Keys of up to 16 bytes are hashed as
+  // _wymum(_wymum(a ^ seed ^ _wyp0, b ^ seed ^ _wyp1), m),
+  // where a, b and m depend only on the key.
+  static constexpr size_t kMaxShortKeySize = 16;
+
+  MS_MR_SHARING_FORCEINLINE static void PrepareShortKey(const uint8_t* p,
+                                                        size_t len,
+                                                        uint64_t& a,
+                                                        uint64_t& b,
+                                                        uint64_t& m) noexcept;
+
+  static void HashBatch(const std::string_view* keys,
+                        size_t count,
+                        uint64_t* hashes,
+                        uint64_t seed) noexcept;
+};
+
+// Using the 32-bit-friendly variation (WYHASH32 in the reference
+// implementation).
+template <>
+MS_MR_SHARING_FORCEINLINE uint64_t
+Wyhash<HashVersion::kV1>::_wymum(uint64_t A, uint64_t B) noexcept {
   uint64_t hh = (A >> 32) * (B >> 32);
   uint64_t hl = (A >> 32) * (unsigned)B;
   uint64_t lh = (unsigned)A * (B >> 32);
   uint64_t ll = (uint64_t)(unsigned)A * (unsigned)B;
   return _wyrotr(hl, 32) ^ _wyrotr(lh, 32) ^ hh ^ ll;
-#else
+}
+
+// Xors the high and low halves of the full 128-bit product. All branches
+// produce the same results.
+template <>
+MS_MR_SHARING_FORCEINLINE uint64_t
+Wyhash<HashVersion::kV2>::_wymum(uint64_t A, uint64_t B) noexcept {
 #ifdef __SIZEOF_INT128__
   __uint128_t r = A;
   r *= B;
-  return (r >> 64) ^ r;
+  return static_cast<uint64_t>(r >> 64) ^ static_cast<uint64_t>(r);
 #elif defined(_MSC_VER) && defined(_M_X64)
   A = _umul128(A, B, &B);
   return A ^ B;
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+  return __umulh(A, B) ^ (A * B);
 #else
   uint64_t ha = A >> 32;
   uint64_t hb = B >> 32;
@@ -63,30 +112,12 @@ MS_MR_SHARING_FORCEINLINE uint64_t _wymum(uint64_t A, uint64_t B) {
   uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
   return hi ^ lo;
 #endif
-#endif
-}
-
-MS_MR_SHARING_FORCEINLINE uint64_t _wyr8(const uint8_t* p) {
-  uint64_t v;
-  memcpy(&v, p, 8);
-  return v;
-}
-
-MS_MR_SHARING_FORCEINLINE uint64_t _wyr4(const uint8_t* p) {
-  uint32_t v;
-  memcpy(&v, p, 4);
-  return v;
-}
-
-MS_MR_SHARING_FORCEINLINE uint64_t _wyr3(const uint8_t* p, unsigned k) {
-  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
 }
 
-}  // namespace
-
-uint64_t CalculateHash64(const char* data,
-                         size_t size,
-                         uint64_t seed) noexcept {
+template <HashVersion kVersion>
+uint64_t Wyhash<kVersion>::Hash(const char* data,
+                                size_t size,
+                                uint64_t seed) noexcept {
   // This is a deviation from the current reference implementation of wyhash
   // (it would always return 0).
   if (MS_MR_UNLIKELY(!size))
@@ -167,8 +198,110 @@ uint64_t CalculateHash64(const char* data,
   return _wymum(seed ^ see1, len ^ _wyp4);
 }
 
+template <HashVersion kVersion>
+MS_MR_SHARING_FORCEINLINE void Wyhash<kVersion>::PrepareShortKey(
+    const uint8_t* p,
+    size_t len,
+    uint64_t& a,
+    uint64_t& b,
+    uint64_t& m) noexcept {
+  assert(len <= kMaxShortKeySize);
+  // Matches the first branches of Hash() above.
+  if (len > 8) {
+    a = _wyr8(p);
+    b = _wyr8(p + len - 8);
+  } else if (len >= 4) {
+    a = _wyr4(p);
+    b = _wyr4(p + len - 4);
+  } else {
+    a = len ? _wyr3(p, static_cast<unsigned>(len)) : 0;
+    b = 0;
+  }
+  m = len ? len ^ _wyp4 : _wyp2;
+}
+
+template <HashVersion kVersion>
+void Wyhash<kVersion>::HashBatch(const std::string_view* keys,
+                                 size_t count,
+                                 uint64_t* hashes,
+                                 uint64_t seed) noexcept {
+  // Groups of short keys are hashed together, performing each step of the
+  // calculation for all keys of the group at once. The multiplications of
+  // different keys are independent, so they can be pipelined instead of
+  // waiting for each other (a single short key is a chain of two dependent
+  // multiplications, and its hash is mostly latency-bound).
+  constexpr size_t kGroupSize = 4;
+  const uint64_t seed0 = seed ^ _wyp0;
+  const uint64_t seed1 = seed ^ _wyp1;
+  size_t i = 0;
+  for (; i + kGroupSize <= count; i += kGroupSize) {
+    const std::string_view* group = keys + i;
+    bool all_short = true;
+    for (size_t j = 0; j < kGroupSize; ++j)
+      all_short &= group[j].size() <= kMaxShortKeySize;
+    if (MS_MR_UNLIKELY(!all_short)) {
+      for (size_t j = 0; j < kGroupSize; ++j)
+        hashes[i + j] = Hash(group[j].data(), group[j].size(), seed);
+      continue;
+    }
+    uint64_t a[kGroupSize];
+    uint64_t b[kGroupSize];
+    uint64_t m[kGroupSize];
+    for (size_t j = 0; j < kGroupSize; ++j) {
+      PrepareShortKey(reinterpret_cast<const uint8_t*>(group[j].data()),
+                      group[j].size(), a[j], b[j], m[j]);
+    }
+    for (size_t j = 0; j < kGroupSize; ++j)
+      a[j] = _wymum(a[j] ^ seed0, b[j] ^ seed1);
+    for (size_t j = 0; j < kGroupSize; ++j)
+      hashes[i + j] = _wymum(a[j], m[j]);
+  }
+  for (; i < count; ++i)
+    hashes[i] = Hash(keys[i].data(), keys[i].size(), seed);
+}
+
+}  // namespace
+
+template <HashVersion kVersion>
+uint64_t CalculateHash64(const char* data,
+                         size_t size,
+                         uint64_t seed) noexcept {
+  return Wyhash<kVersion>::Hash(data, size, seed);
+}
+
+template <HashVersion kVersion>
 uint64_t CalculateHash64(uint64_t value_a, uint64_t value_b) noexcept {
-  return _wymum(_wymum(value_a ^ _wyp0, value_b ^ _wyp1), _wyp2);
+  using H = Wyhash<kVersion>;
+  return H::_wymum(H::_wymum(value_a ^ _wyp0, value_b ^ _wyp1), _wyp2);
+}
+
+template <HashVersion kVersion>
+void CalculateHash64Batch(const std::string_view* keys,
+                          size_t count,
+                          uint64_t* hashes,
+                          uint64_t seed) noexcept {
+  Wyhash<kVersion>::HashBatch(keys, count, hashes, seed);
 }
 
+template uint64_t CalculateHash64<HashVersion::kV1>(const char* data,
+                                                    size_t size,
+                                                    uint64_t seed) noexcept;
+template uint64_t CalculateHash64<HashVersion::kV2>(const char* data,
+                                                    size_t size,
+                                                    uint64_t seed) noexcept;
+template uint64_t CalculateHash64<HashVersion::kV1>(uint64_t value_a,
+                                                    uint64_t value_b) noexcept;
+template uint64_t CalculateHash64<HashVersion::kV2>(uint64_t value_a,
+                                                    uint64_t value_b) noexcept;
+template void CalculateHash64Batch<HashVersion::kV1>(
+    const std::string_view* keys,
+    size_t count,
+    uint64_t* hashes,
+    uint64_t seed) noexcept;
+template void CalculateHash64Batch<HashVersion::kV2>(
+    const std::string_view* keys,
+    size_t count,
+    uint64_t* hashes,
+    uint64_t seed) noexcept;
+
 }  // namespace Microsoft::MixedReality::Sharing
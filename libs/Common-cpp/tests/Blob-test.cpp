@@ -5,6 +5,7 @@
 
 #include <Microsoft/MixedReality/Sharing/Common/Blob.h>
 
+#include <cstring>
 #include <string_view>
 
 using namespace Microsoft::MixedReality::Sharing;
@@ -26,3 +27,22 @@ TEST(Blob, GetFromSharedViewDataPtr) {
 
   ASSERT_EQ(blob.get(), blob.get());
 }
+
+TEST(Blob, CreateUninitialized) {
+  auto uninitialized = Blob::CreateUninitialized(5);
+  ASSERT_EQ(uninitialized.size(), 5);
+  Span<char> span = uninitialized.span();
+  ASSERT_EQ(span.data(), uninitialized.data());
+  ASSERT_EQ(span.size(), 5);
+  memcpy(span.data(), "hello", 5);
+
+  RefPtr<const Blob> blob = std::move(uninitialized).Seal();
+  ASSERT_EQ(blob->view(), "hello"sv);
+  ASSERT_EQ(blob->ref_count_for_testing(), 1);
+
+  auto empty = Blob::CreateUninitialized(0);
+  ASSERT_EQ(std::move(empty).Seal()->view(), ""sv);
+
+  ASSERT_THROW(Blob::CreateUninitialized(Blob::kMaxSize + 1),
+               std::invalid_argument);
+}
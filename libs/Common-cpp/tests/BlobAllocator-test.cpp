@@ -0,0 +1,82 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include <Microsoft/MixedReality/Sharing/Common/Blob.h>
+#include <Microsoft/MixedReality/Sharing/Common/BlobAllocator.h>
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::MixedReality::Sharing;
+using namespace std::literals;
+
+TEST(BlobAllocator, reuses_freed_blocks) {
+  void* a = BlobAllocator::Allocate(40);
+  ASSERT_NE(a, nullptr);
+  memset(a, 0xAB, 40);
+  BlobAllocator::Free(a, 40);
+  // The most recently freed block of the same size class is reused first.
+  void* b = BlobAllocator::Allocate(33);
+  EXPECT_EQ(a, b);
+  BlobAllocator::Free(b, 33);
+}
+
+TEST(BlobAllocator, alignment) {
+  std::vector<std::pair<void*, size_t>> allocations;
+  for (size_t size = 1; size <= 1000; size += 7) {
+    void* ptr = BlobAllocator::Allocate(size);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t), 0);
+    memset(ptr, 0xCD, size);
+    allocations.emplace_back(ptr, size);
+  }
+  for (auto [ptr, size] : allocations)
+    BlobAllocator::Free(ptr, size);
+}
+
+TEST(BlobAllocator, stats) {
+  const BlobAllocator::Stats before = BlobAllocator::GetStats();
+  {
+    auto small = Blob::Create("small blob"sv);
+    auto large = Blob::Create(std::string(1000, 'x'));
+    const BlobAllocator::Stats stats = BlobAllocator::GetStats();
+    EXPECT_EQ(stats.allocations_count - before.allocations_count, 2);
+    EXPECT_EQ(stats.deallocations_count - before.deallocations_count, 0);
+    // The small blob is rounded up to its size class.
+    EXPECT_GE(stats.allocated_bytes - before.allocated_bytes, 1000 + 10);
+    EXPECT_GT(stats.slab_bytes, 0);
+  }
+  const BlobAllocator::Stats after = BlobAllocator::GetStats();
+  EXPECT_EQ(after.allocations_count - before.allocations_count, 2);
+  EXPECT_EQ(after.deallocations_count - before.deallocations_count, 2);
+  EXPECT_EQ(after.alive_bytes(), before.alive_bytes());
+}
+
+TEST(BlobAllocator, release_on_other_threads) {
+  // Blobs are frequently created on one thread and released on another.
+  // The stats of the exited threads should be preserved.
+  constexpr size_t kBlobsCount = 10000;
+  const BlobAllocator::Stats before = BlobAllocator::GetStats();
+  std::vector<RefPtr<const Blob>> blobs;
+  std::thread producer{[&] {
+    for (size_t i = 0; i < kBlobsCount; ++i)
+      blobs.push_back(Blob::Create(std::to_string(i)));
+  }};
+  producer.join();
+  std::thread consumer{[&] {
+    for (size_t i = 0; i < kBlobsCount; ++i) {
+      ASSERT_EQ(blobs[i]->view(), std::to_string(i));
+      blobs[i] = nullptr;
+    }
+  }};
+  consumer.join();
+  const BlobAllocator::Stats after = BlobAllocator::GetStats();
+  EXPECT_EQ(after.allocations_count - before.allocations_count, kBlobsCount);
+  EXPECT_EQ(after.deallocations_count - before.deallocations_count,
+            kBlobsCount);
+  EXPECT_EQ(after.alive_bytes(), before.alive_bytes());
+}
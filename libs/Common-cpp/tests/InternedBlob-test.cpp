@@ -5,7 +5,14 @@
 
 #include <Microsoft/MixedReality/Sharing/Common/InternedBlob.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 using namespace Microsoft::MixedReality::Sharing;
 using namespace std::literals;
@@ -54,3 +61,103 @@ TEST(InternedBlob, ordering) {
   ASSERT_TRUE(blob_aaa->OrderedLess("aab"));
   ASSERT_FALSE(blob_aaa->OrderedGreater("aab"));
 }
+
+TEST(InternedBlob, many_blobs) {
+  // Enough blobs to grow the tables of all shards several times.
+  constexpr size_t kBlobsCount = 20000;
+  std::vector<RefPtr<const InternedBlob>> blobs;
+  blobs.reserve(kBlobsCount);
+  for (size_t i = 0; i < kBlobsCount; ++i)
+    blobs.push_back(InternedBlob::Create(std::to_string(i)));
+
+  for (size_t i = 0; i < kBlobsCount; ++i) {
+    auto blob = InternedBlob::Create(std::to_string(i));
+    ASSERT_EQ(blob.get(), blobs[i].get());
+    ASSERT_EQ(blob->ref_count_for_testing(), 2);
+  }
+  // Releasing every other blob, and checking that the remaining ones are still
+  // found after the removed ones are replaced with tombstones.
+  for (size_t i = 0; i < kBlobsCount; i += 2)
+    blobs[i] = nullptr;
+  for (size_t i = 1; i < kBlobsCount; i += 2) {
+    auto blob = InternedBlob::Create(std::to_string(i));
+    ASSERT_EQ(blob.get(), blobs[i].get());
+  }
+  for (size_t i = 0; i < kBlobsCount; i += 2) {
+    blobs[i] = InternedBlob::Create(std::to_string(i));
+    ASSERT_EQ(blobs[i]->ref_count_for_testing(), 1);
+  }
+}
+
+TEST(InternedBlob, concurrent_interning) {
+  constexpr size_t kContentsCount = 64;
+  constexpr size_t kIterationsCount = 20000;
+  const size_t threads_count =
+      std::max<size_t>(4, std::thread::hardware_concurrency());
+
+  // Each thread keeps its own references to some of the blobs alive, and
+  // repeatedly interns and releases all of them. While the thread holds a
+  // reference, interning the same content must return the same object.
+  std::vector<std::thread> threads;
+  std::atomic<size_t> failures_count{0};
+  for (size_t thread_id = 0; thread_id < threads_count; ++thread_id) {
+    threads.emplace_back([&, thread_id] {
+      std::vector<RefPtr<const InternedBlob>> held(kContentsCount);
+      for (size_t i = 0; i < kIterationsCount; ++i) {
+        const size_t content_id = (i * 7 + thread_id) % kContentsCount;
+        const std::string content = "content " + std::to_string(content_id);
+        auto blob = InternedBlob::Create(content);
+        if (blob->view() != content ||
+            (held[content_id] && held[content_id] != blob)) {
+          ++failures_count;
+        }
+        if ((i + thread_id) % 3 == 0) {
+          held[content_id] = std::move(blob);
+        } else if ((i + thread_id) % 5 == 0) {
+          held[content_id] = nullptr;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  EXPECT_EQ(failures_count, 0);
+}
+
+// Benchmark (disabled by default, run with --gtest_also_run_disabled_tests).
+// Multiple threads are interning and releasing blobs from a shared set of
+// contents, with about half of the blobs kept alive by the main thread (so
+// that some of the interning calls find existing blobs).
+TEST(InternedBlob, DISABLED_concurrent_interning_benchmark) {
+  constexpr size_t kContentsCount = 4096;
+  constexpr size_t kIterationsCount = 1'000'000;
+  std::vector<std::string> contents;
+  std::vector<RefPtr<const InternedBlob>> held;
+  for (size_t i = 0; i < kContentsCount; ++i) {
+    contents.push_back("benchmark content " + std::to_string(i));
+    if (i % 2)
+      held.push_back(InternedBlob::Create(contents.back()));
+  }
+  const unsigned max_threads_count =
+      std::max(4u, std::thread::hardware_concurrency());
+  for (unsigned threads_count = 1; threads_count <= max_threads_count;
+       threads_count *= 2) {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned thread_id = 0; thread_id < threads_count; ++thread_id) {
+      threads.emplace_back([&, thread_id] {
+        for (size_t i = 0; i < kIterationsCount / threads_count; ++i) {
+          auto blob = InternedBlob::Create(
+              contents[(i * 13 + thread_id * 101) % kContentsCount]);
+        }
+      });
+    }
+    for (auto& thread : threads)
+      thread.join();
+    std::cout << threads_count << " thread(s): "
+              << std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count()
+              << "us for " << kIterationsCount << " interning calls\n";
+  }
+}
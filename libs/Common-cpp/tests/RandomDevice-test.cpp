@@ -5,6 +5,12 @@
 
 #include <Microsoft/MixedReality/Sharing/Common/RandomDevice.h>
 
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
 using namespace Microsoft::MixedReality::Sharing;
 
 namespace {
@@ -92,4 +98,127 @@ TEST(RandomDevice, jump_works) {
   EXPECT_EQ(jump_next(), 0x78406efb089be6eaull);
 }
 
+TEST(RandomDevice, long_jump_works) {
+  RandomDevice rd{0x3cfe4d1177ecc6a5ull, 0xd5e7fe74b35a5d2cull,
+                  0xb55681d95d037ef7ull, 0xfcc3a9b769225ea5ull};
+
+  auto long_jump_next = [&] {
+    rd.LongJumpForTestingPurposesOnly();
+    return rd();
+  };
+
+  // The expected constants are obtained from the reference implementation.
+  EXPECT_EQ(long_jump_next(), 0x56c68797eb4810a1ull);
+  EXPECT_EQ(long_jump_next(), 0xf94058edd59d28c5ull);
+  EXPECT_EQ(long_jump_next(), 0x660558c9c62382d9ull);
+  EXPECT_EQ(long_jump_next(), 0xa63de9e2694467c3ull);
+  EXPECT_EQ(long_jump_next(), 0xeb94a5531da854f3ull);
+  EXPECT_EQ(long_jump_next(), 0x903687e188b99ceeull);
+  EXPECT_EQ(long_jump_next(), 0x80ac1a0f80dc7b13ull);
+  EXPECT_EQ(long_jump_next(), 0x25eb80feb797e4ccull);
+}
+
+TEST(RandomDevice, multiple_jumps_work) {
+  for (uint64_t jumps_count : {0, 1, 2, 3, 7, 64, 1000}) {
+    RandomDevice expected{0x3cfe4d1177ecc6a5ull, 0xd5e7fe74b35a5d2cull,
+                          0xb55681d95d037ef7ull, 0xfcc3a9b769225ea5ull};
+    for (uint64_t i = 0; i < jumps_count; ++i)
+      expected.JumpForTestingPurposesOnly();
+    RandomDevice rd{0x3cfe4d1177ecc6a5ull, 0xd5e7fe74b35a5d2cull,
+                    0xb55681d95d037ef7ull, 0xfcc3a9b769225ea5ull};
+    rd.JumpForTestingPurposesOnly(jumps_count);
+    for (int i = 0; i < 4; ++i)
+      EXPECT_EQ(rd(), expected()) << "jumps_count=" << jumps_count;
+  }
+}
+
+TEST(RandomDevice, fill_interleaves_lanes) {
+  constexpr uint64_t kState[]{0x3cfe4d1177ecc6a5ull, 0xd5e7fe74b35a5d2cull,
+                              0xb55681d95d037ef7ull, 0xfcc3a9b769225ea5ull};
+  constexpr size_t kLanesCount = RandomDevice::kLanesCount;
+  for (size_t size : {0, 1, 63, 64, 67, 1000}) {
+    RandomDevice rd{kState[0], kState[1], kState[2], kState[3]};
+    std::vector<uint64_t> values(size);
+    // Filling twice to check that the lanes continue where they stopped.
+    for (int pass = 0; pass < 2; ++pass) {
+      rd.Fill({values.data(), values.size()});
+      // Short spans are filled by operator(), and long ones by the lanes
+      // (except for the remainder that doesn't fill all lanes).
+      const size_t lanes_values_count =
+          size < 64 ? 0 : size / kLanesCount * kLanesCount;
+      RandomDevice expected{kState[0], kState[1], kState[2], kState[3]};
+      for (size_t i = 0; i < pass * (size - lanes_values_count); ++i)
+        expected();
+      for (size_t i = lanes_values_count; i < size; ++i)
+        ASSERT_EQ(values[i], expected()) << "size=" << size << ", i=" << i;
+
+      for (size_t lane = 0; lane < kLanesCount; ++lane) {
+        RandomDevice expected_lane{kState[0], kState[1], kState[2], kState[3]};
+        expected_lane.LongJumpForTestingPurposesOnly();
+        expected_lane.JumpForTestingPurposesOnly(lane);
+        for (size_t i = 0; i < pass * lanes_values_count; i += kLanesCount)
+          expected_lane();
+        for (size_t i = lane; i < lanes_values_count; i += kLanesCount) {
+          ASSERT_EQ(values[i], expected_lane())
+              << "size=" << size << ", i=" << i;
+        }
+      }
+    }
+  }
+}
+
+TEST(RandomDevice, thread_instances_are_different) {
+  constexpr size_t kThreadsCount = 8;
+  uint64_t values[kThreadsCount];
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kThreadsCount; ++i) {
+    threads.emplace_back(
+        [&values, i] { values[i] = RandomDevice::thread_instance()(); });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  std::sort(std::begin(values), std::end(values));
+  EXPECT_EQ(std::adjacent_find(std::begin(values), std::end(values)),
+            std::end(values));
+}
+
+TEST(RandomDevice, DISABLED_fill_benchmark) {
+  constexpr size_t kTotalBytes = 1 << 30;
+  uint64_t checksum = 0;
+  RandomDevice& rd = RandomDevice::thread_instance();
+  for (size_t size : {16, 64, 1024, 64 * 1024}) {
+    std::vector<uint64_t> values(size);
+    const size_t iterations_count = kTotalBytes / (size * sizeof(uint64_t));
+    const auto report = [&](const char* name, auto&& fill) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < iterations_count; ++i) {
+        fill();
+        checksum += values[i % size];
+      }
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      std::cout << name << ", " << size
+                << " values: " << kTotalBytes / seconds / (1 << 20)
+                << " MiB/s\n";
+    };
+    report("operator()", [&] {
+      for (uint64_t& value : values)
+        value = rd();
+    });
+    report("Fill", [&] { rd.Fill({values.data(), values.size()}); });
+  }
+
+  constexpr size_t kInstancesCount = 10000;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kInstancesCount; ++i)
+    checksum += RandomDevice{RandomDevice::InitializeFromGlobalState{}}();
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  std::cout << "Initialization from the global state: "
+            << seconds * 1e9 / kInstancesCount << " ns\n";
+  std::cout << "Checksum: " << checksum << '\n';
+}
+
 }  // namespace
@@ -3,8 +3,18 @@
 
 #include "pch.h"
 
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamWriter.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlockMonotonicSequenceEncoder.h>
 #include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobReader.h>
 #include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobWriter.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/FragmentedBlobReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/MonotonicSequenceEncoder.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
 
 namespace Microsoft::MixedReality::Sharing::Serialization {
 using namespace std::literals;
@@ -149,6 +159,208 @@ TEST(Serialization, blob_write_read_golomb_codes_long_sequence) {
   ASSERT_TRUE(reader.ProbablyNoMoreData());
 }
 
+TEST(Serialization, blob_read_golomb_n) {
+  static constexpr size_t kRerunsCount = 10;
+  for (size_t i = 0; i < kRerunsCount; ++i) {
+    for (size_t sequence_length = 0; sequence_length < 300;
+         sequence_length += 13) {
+      for (bit_shift_t offset = 1; offset <= 64; offset += 9) {
+        auto values = GenerateRandomValues(sequence_length);
+        BlobWriter writer;
+        writer.WriteBits(0, offset);
+        for (const auto& x : values)
+          writer.WriteGolomb(x.value);
+        writer.WriteGolomb(42);
+        BlobReader reader{writer.Finalize()};
+        ASSERT_EQ(reader.ReadBits64(offset), 0);
+        std::vector<uint64_t> read_values(sequence_length);
+        reader.ReadGolombN({read_values.data(), read_values.size()});
+        for (size_t j = 0; j < sequence_length; ++j)
+          ASSERT_EQ(values[j].value, read_values[j]);
+        // The reader should be in a consistent state after the bulk read.
+        ASSERT_EQ(reader.ReadGolomb(), 42);
+        ASSERT_TRUE(reader.ProbablyNoMoreData());
+      }
+    }
+  }
+}
+
+TEST(Serialization, bitstream_write_read_golomb_codes) {
+  static constexpr size_t kRerunsCount = 10;
+  for (size_t i = 0; i < kRerunsCount; ++i) {
+    for (size_t sequence_length = 0; sequence_length < 300;
+         sequence_length += 13) {
+      for (bit_shift_t offset = 1; offset <= 64; offset += 9) {
+        auto values = GenerateRandomValues(sequence_length);
+        BitstreamWriter writer;
+        writer.WriteBits(0, offset);
+        for (const auto& x : values)
+          writer.WriteExponentialGolombCode(x.value);
+        writer.WriteExponentialGolombCode(42);
+        for (const auto& x : values)
+          writer.WriteExponentialGolombCode(x.value);
+        const std::string_view stream = writer.Finalize();
+
+        BitstreamReader reader{stream};
+        ASSERT_EQ(reader.ReadBits64(offset), 0);
+        for (const auto& expected : values)
+          ASSERT_EQ(expected.value, reader.ReadExponentialGolombCode());
+        ASSERT_EQ(reader.ReadExponentialGolombCode(), 42);
+        std::vector<uint64_t> read_values(sequence_length);
+        reader.ReadExponentialGolombCodes(
+            {read_values.data(), read_values.size()});
+        for (size_t j = 0; j < sequence_length; ++j)
+          ASSERT_EQ(values[j].value, read_values[j]);
+        ASSERT_EQ(reader.untouched_bytes_count(), 0);
+      }
+    }
+  }
+}
+
+TEST(Serialization, bitstream_write_golomb_codes_in_bulk) {
+  static constexpr size_t kRerunsCount = 10;
+  for (size_t i = 0; i < kRerunsCount; ++i) {
+    for (size_t sequence_length = 0; sequence_length < 300;
+         sequence_length += 13) {
+      for (bit_shift_t offset = 1; offset <= 64; offset += 9) {
+        auto values = GenerateRandomValues(sequence_length);
+        std::vector<uint64_t> raw_values;
+        for (const auto& x : values)
+          raw_values.push_back(x.value);
+
+        BitstreamWriter reference_writer;
+        reference_writer.WriteBits(0, offset);
+        for (uint64_t value : raw_values)
+          reference_writer.WriteExponentialGolombCode(value);
+        reference_writer.WriteBits(1, 1);
+
+        BitstreamWriter writer;
+        writer.WriteBits(0, offset);
+        writer.WriteExponentialGolombCodes(
+            {raw_values.data(), raw_values.size()});
+        writer.WriteBits(1, 1);
+        ASSERT_EQ(writer.Finalize(), reference_writer.Finalize());
+      }
+    }
+  }
+}
+
+TEST(Serialization, bitstream_writer_external_buffer) {
+  std::vector<uint64_t> values(1000);
+  for (size_t i = 0; i < values.size(); ++i)
+    values[i] = i * i;
+
+  BitstreamWriter reference_writer;
+  reference_writer.WriteExponentialGolombCodes({values.data(), values.size()});
+  const std::string_view reference = reference_writer.Finalize();
+
+  // Large enough for the whole stream.
+  std::vector<uint64_t> large_buffer(reference.size() / 8 + 1);
+  BitstreamWriter large_buffer_writer{
+      {large_buffer.data(), large_buffer.size()}};
+  large_buffer_writer.WriteExponentialGolombCodes(
+      {values.data(), values.size()});
+  const std::string_view large_buffer_result = large_buffer_writer.Finalize();
+  ASSERT_EQ(large_buffer_result, reference);
+  ASSERT_EQ(large_buffer_result.data(),
+            reinterpret_cast<const char*>(large_buffer.data()));
+
+  // The writer should switch to its own buffer.
+  uint64_t small_buffer[3];
+  BitstreamWriter small_buffer_writer{{small_buffer, 3}};
+  for (uint64_t value : values)
+    small_buffer_writer.WriteExponentialGolombCode(value);
+  ASSERT_EQ(small_buffer_writer.Finalize(), reference);
+
+  BitstreamWriter empty_buffer_writer{{}};
+  empty_buffer_writer.WriteExponentialGolombCodes(
+      {values.data(), values.size()});
+  ASSERT_EQ(empty_buffer_writer.Finalize(), reference);
+}
+
+TEST(Serialization, read_golomb_n_out_of_range) {
+  BlobWriter blob_writer;
+  BitstreamWriter bitstream_writer;
+  for (uint64_t value = 0; value < 10; ++value) {
+    blob_writer.WriteGolomb(value);
+    bitstream_writer.WriteExponentialGolombCode(value);
+  }
+  uint64_t read_values[11];
+  BlobReader blob_reader{blob_writer.Finalize()};
+  ASSERT_THROW(blob_reader.ReadGolombN({read_values, 11}), std::out_of_range);
+  BitstreamReader bitstream_reader{bitstream_writer.Finalize()};
+  ASSERT_THROW(bitstream_reader.ReadExponentialGolombCodes({read_values, 11}),
+               std::out_of_range);
+}
+
+TEST(Serialization, blob_finalize_to_blob) {
+  // Mixing bytes and bits, so that the bits section is not aligned.
+  static constexpr size_t kRerunsCount = 10;
+  for (size_t i = 0; i < kRerunsCount; ++i) {
+    for (size_t sequence_length = 0; sequence_length < 200;
+         sequence_length += 7) {
+      auto values = GenerateRandomValues(sequence_length);
+      BlobWriter writer;
+      BlobWriter reference_writer;
+      for (const auto& x : values) {
+        const std::string_view bytes{reinterpret_cast<const char*>(&x.value),
+                                     x.width_bits / 8u};
+        writer.WriteBytes(bytes);
+        writer.WriteBits(x.value, x.width_bits);
+        reference_writer.WriteBytes(bytes);
+        reference_writer.WriteBits(x.value, x.width_bits);
+        // The writer is not modified, so it can keep writing.
+        if (&x == &values[values.size() / 2]) {
+          ASSERT_EQ(writer.FinalizeToBlob()->size(), writer.finalized_size());
+        }
+      }
+      RefPtr<const Blob> blob = writer.FinalizeToBlob();
+      ASSERT_EQ(blob->view(), reference_writer.Finalize());
+    }
+  }
+}
+
+TEST(Serialization, blob_finalize_to_segments) {
+  // Large enough to make the writer switch to new buffers several times.
+  static constexpr size_t kRerunsCount = 5;
+  for (size_t i = 0; i < kRerunsCount; ++i) {
+    for (size_t sequence_length : {0, 1, 10, 100, 1000, 10000}) {
+      auto values = GenerateRandomValues(sequence_length);
+      BlobWriter writer;
+      BlobWriter reference_writer;
+      for (const auto& x : values) {
+        const std::string_view bytes{reinterpret_cast<const char*>(&x.value),
+                                     x.width_bits / 8u};
+        writer.WriteBytesWithSize(bytes);
+        writer.WriteBits(x.value, x.width_bits);
+        reference_writer.WriteBytesWithSize(bytes);
+        reference_writer.WriteBits(x.value, x.width_bits);
+      }
+      const size_t finalized_size = writer.finalized_size();
+      const Span<const std::string_view> segments =
+          writer.FinalizeToSegments();
+      std::string concatenated;
+      for (const std::string_view& segment : segments) {
+        ASSERT_NE(segment.size(), 0);
+        concatenated += segment;
+      }
+      const std::string_view reference = reference_writer.Finalize();
+      ASSERT_EQ(concatenated, reference);
+      ASSERT_EQ(finalized_size, reference.size());
+
+      // The segments can be read without concatenating them.
+      FragmentedBlobReader reader{segments};
+      for (const auto& x : values) {
+        ASSERT_EQ(reader.ReadBytesWithSize(),
+                  std::string_view(reinterpret_cast<const char*>(&x.value),
+                                   x.width_bits / 8u));
+        ASSERT_EQ(reader.ReadBits64(x.width_bits), x.value);
+      }
+      ASSERT_TRUE(reader.ProbablyNoMoreData());
+    }
+  }
+}
+
 TEST(Serialization, blob_read_from_empty) {
   for (bit_shift_t width = 1; width <= 32; ++width) {
     BlobReader reader{{}};
@@ -200,4 +412,445 @@ TEST(Serialization, blob_read_golomb_out_of_range) {
   ASSERT_THROW(reader.ReadGolomb(), std::out_of_range);
 }
 
+namespace {
+// Splits the input into fragments of fragment_size bytes (with an empty
+// fragment after each of them, to make sure that they are skipped correctly).
+std::vector<std::string_view> SplitIntoFragments(std::string_view input,
+                                                 size_t fragment_size) {
+  std::vector<std::string_view> fragments;
+  for (size_t offset = 0; offset < input.size(); offset += fragment_size) {
+    fragments.push_back(input.substr(offset, fragment_size));
+    fragments.push_back(input.substr(offset, 0));
+  }
+  return fragments;
+}
+}  // namespace
+
+TEST(Serialization, fragmented_blob_reader) {
+  static constexpr size_t kRerunsCount = 10;
+  for (size_t i = 0; i < kRerunsCount; ++i) {
+    for (size_t sequence_length = 0; sequence_length < 100;
+         sequence_length += 11) {
+      auto values = GenerateRandomValues(sequence_length);
+      BlobWriter writer;
+      for (const auto& x : values) {
+        writer.WriteBytesWithSize(reinterpret_cast<const char*>(&x.value),
+                                  x.width_bits / 8u);
+        writer.WriteBits(x.value, x.width_bits);
+        writer.WriteGolomb(x.value);
+        writer.WriteOptionalGolomb(x.value);
+      }
+      const std::string_view blob = writer.Finalize();
+
+      for (size_t fragment_size : {1, 3, 7, 8, 13, 64, 1000}) {
+        const auto fragments = SplitIntoFragments(blob, fragment_size);
+        FragmentedBlobReader reader{{fragments.data(), fragments.size()}};
+        size_t bytes_offset = 0;
+        for (const auto& expected : values) {
+          const std::string_view bytes = reader.ReadBytesWithSize();
+          ASSERT_EQ(bytes, std::string_view(reinterpret_cast<const char*>(
+                                                &expected.value),
+                                            expected.width_bits / 8u));
+          // The bytes that are entirely within one fragment are not copied
+          // (the sizes are in the bit stream).
+          bytes_offset += bytes.size();
+          const size_t begin = bytes_offset - bytes.size();
+          if (bytes.size() != 0 &&
+              begin / fragment_size == (bytes_offset - 1) / fragment_size) {
+            ASSERT_EQ(bytes.data(), blob.data() + begin);
+          }
+          ASSERT_EQ(reader.ReadBits64(expected.width_bits), expected.value);
+          ASSERT_EQ(reader.ReadGolomb(), expected.value);
+          ASSERT_EQ(reader.ReadOptionalGolomb(), expected.value);
+        }
+        ASSERT_TRUE(reader.ProbablyNoMoreData());
+      }
+    }
+  }
+}
+
+TEST(Serialization, fragmented_blob_reader_bytes_overlap_bits) {
+  // The bit stream is read first, so the bytes at the end of the byte stream
+  // are loaded into the bit buffer before they are read as bytes.
+  BlobWriter writer;
+  writer.WriteBytes("0123456789abcdef"sv);
+  writer.WriteBits(5, 3);
+  const std::string_view blob = writer.Finalize();
+  for (size_t fragment_size = 1; fragment_size <= blob.size();
+       ++fragment_size) {
+    const auto fragments = SplitIntoFragments(blob, fragment_size);
+    FragmentedBlobReader reader{{fragments.data(), fragments.size()}};
+    ASSERT_EQ(reader.ReadBits32(3), 5);
+    ASSERT_EQ(reader.ReadBytes(10), "0123456789"sv);
+    ASSERT_EQ(reader.ReadBytes(6), "abcdef"sv);
+    ASSERT_TRUE(reader.ProbablyNoMoreData());
+    ASSERT_THROW(reader.ReadBytes(1), std::out_of_range);
+  }
+}
+
+TEST(Serialization, fragmented_blob_reader_out_of_range) {
+  FragmentedBlobReader empty_reader{{}};
+  ASSERT_THROW(empty_reader.ReadBits64(1), std::out_of_range);
+  ASSERT_THROW(empty_reader.ReadGolomb(), std::out_of_range);
+
+  BlobWriter writer;
+  writer.WriteGolomb(6);
+  writer.WriteGolomb(2);
+  const std::string_view blob = writer.Finalize();
+  const std::string_view fragments[]{{}, blob, {}};
+  FragmentedBlobReader reader{{fragments, 3}};
+  ASSERT_EQ(reader.ReadGolomb(), 6);
+  ASSERT_EQ(reader.ReadGolomb(), 2);
+  ASSERT_THROW(reader.ReadGolomb(), std::out_of_range);
+}
+
+namespace {
+// Distributions of sorted subkeys that are typical for transactions.
+enum class SubkeysDistribution {
+  // Consecutive indices (for example, elements of an array).
+  Consecutive,
+  // Runs of consecutive indices separated by gaps of various sizes.
+  Clustered,
+  // Sparse identifiers from a 32-bit range.
+  Sparse,
+  // Uniformly distributed 64-bit values (for example, hashes).
+  Uniform,
+};
+
+constexpr SubkeysDistribution kSubkeysDistributions[]{
+    SubkeysDistribution::Consecutive, SubkeysDistribution::Clustered,
+    SubkeysDistribution::Sparse, SubkeysDistribution::Uniform};
+
+const char* GetName(SubkeysDistribution distribution) noexcept {
+  switch (distribution) {
+    case SubkeysDistribution::Consecutive:
+      return "consecutive";
+    case SubkeysDistribution::Clustered:
+      return "clustered";
+    case SubkeysDistribution::Sparse:
+      return "sparse";
+    default:
+      return "uniform";
+  }
+}
+
+std::vector<uint64_t> GenerateSubkeys(SubkeysDistribution distribution,
+                                      size_t count,
+                                      std::mt19937_64& rng) {
+  std::vector<uint64_t> result;
+  result.reserve(count);
+  uint64_t next = rng() % 1000;
+  while (result.size() < count) {
+    switch (distribution) {
+      case SubkeysDistribution::Consecutive:
+        result.push_back(next++);
+        break;
+      case SubkeysDistribution::Clustered: {
+        for (uint64_t run = 1 + rng() % 32; run && result.size() < count;
+             --run) {
+          result.push_back(next++);
+        }
+        // Mostly small gaps, with an occasional large one.
+        next += rng() % 8 == 0 ? rng() % 100000 : rng() % 16;
+        break;
+      }
+      case SubkeysDistribution::Sparse:
+        next += 1 + rng() % (2 * (1ull << 32) / count);
+        result.push_back(next);
+        break;
+      default:
+        result.push_back(rng());
+        break;
+    }
+  }
+  if (distribution == SubkeysDistribution::Uniform) {
+    std::sort(begin(result), end(result));
+    result.erase(std::unique(begin(result), end(result)), end(result));
+  }
+  return result;
+}
+
+void EncodeInBlocks(const std::vector<uint64_t>& values,
+                    BitstreamWriter& writer) {
+  BlockMonotonicSequenceEncoder encoder;
+  constexpr size_t kBlockSize = BlockMonotonicSequenceEncoder::kBlockSize;
+  for (size_t i = 0; i < values.size(); i += kBlockSize) {
+    encoder.EncodeBlock(
+        {values.data() + i, std::min(kBlockSize, values.size() - i)}, writer);
+  }
+}
+
+std::vector<uint64_t> DecodeInBlocks(size_t count, BitstreamReader& reader) {
+  BlockMonotonicSequenceEncoder encoder;
+  constexpr size_t kBlockSize = BlockMonotonicSequenceEncoder::kBlockSize;
+  std::vector<uint64_t> result(count);
+  for (size_t i = 0; i < count; i += kBlockSize)
+    encoder.DecodeBlock({result.data() + i, std::min(kBlockSize, count - i)},
+                        reader);
+  return result;
+}
+}  // namespace
+
+TEST(Serialization, block_monotonic_sequence_round_trip) {
+  std::mt19937_64 rng{42};
+  for (SubkeysDistribution distribution : kSubkeysDistributions) {
+    for (size_t count : {0, 1, 5, 127, 128, 129, 256, 300, 1000}) {
+      for (bit_shift_t offset : {0, 1, 37, 64}) {
+        const std::vector<uint64_t> values =
+            GenerateSubkeys(distribution, count, rng);
+        BitstreamWriter writer;
+        writer.WriteBits(0, offset);
+        EncodeInBlocks(values, writer);
+        writer.WriteExponentialGolombCode(42);
+        const std::string_view stream = writer.Finalize();
+
+        BitstreamReader reader{stream};
+        ASSERT_EQ(reader.ReadBits64(offset), 0);
+        ASSERT_EQ(DecodeInBlocks(values.size(), reader), values)
+            << GetName(distribution) << ", count=" << count;
+        ASSERT_EQ(reader.ReadExponentialGolombCode(), 42);
+        ASSERT_EQ(reader.untouched_bytes_count(), 0);
+      }
+    }
+  }
+}
+
+TEST(Serialization, block_monotonic_sequence_widths_and_exceptions) {
+  std::mt19937_64 rng{42};
+  constexpr size_t kBlockSize = BlockMonotonicSequenceEncoder::kBlockSize;
+  // The deltas are at most 56 bits wide, so that their sum stays in range.
+  for (bit_shift_t width = 0; width <= 56; ++width) {
+    for (size_t exceptions_count : {0, 1, 10, 100}) {
+      // Deltas of the requested width, with a few wider ones.
+      std::vector<uint64_t> deltas(kBlockSize);
+      for (uint64_t& delta : deltas)
+        delta = width == 0 ? 0 : rng() >> (64 - width);
+      for (size_t i = 0; i < exceptions_count; ++i)
+        deltas[rng() % kBlockSize] = rng() >> (8 + rng() % 56);
+      std::vector<uint64_t> values(kBlockSize);
+      uint64_t next = 0;
+      for (size_t i = 0; i < kBlockSize; ++i) {
+        values[i] = next + deltas[i];
+        next = values[i] + 1;
+      }
+      BitstreamWriter writer;
+      EncodeInBlocks(values, writer);
+      BitstreamReader reader{writer.Finalize()};
+      ASSERT_EQ(DecodeInBlocks(values.size(), reader), values)
+          << "width=" << width << ", exceptions_count=" << exceptions_count;
+    }
+  }
+}
+
+TEST(Serialization, block_monotonic_sequence_largest_value) {
+  for (size_t count : {1, 100, 128, 129}) {
+    std::vector<uint64_t> values(count);
+    for (size_t i = 0; i < count; ++i)
+      values[i] = ~0ull - (count - 1 - i) * 1000;
+    BitstreamWriter writer;
+    EncodeInBlocks(values, writer);
+    writer.WriteExponentialGolombCode(0);
+    const std::string_view stream = writer.Finalize();
+    {
+      BitstreamReader reader{stream};
+      ASSERT_EQ(DecodeInBlocks(values.size(), reader), values);
+    }
+    // Nothing can follow ~0ull.
+    BitstreamReader reader{stream};
+    ASSERT_THROW(DecodeInBlocks(values.size() + 1, reader),
+                 std::invalid_argument);
+  }
+}
+
+TEST(Serialization, block_monotonic_sequence_is_compact) {
+  std::mt19937_64 rng{42};
+  for (SubkeysDistribution distribution : kSubkeysDistributions) {
+    const std::vector<uint64_t> values =
+        GenerateSubkeys(distribution, 10000, rng);
+    BitstreamWriter golomb_writer;
+    MonotonicSequenceEncoder encoder;
+    for (uint64_t value : values)
+      encoder.EncodeNext(value, golomb_writer);
+    BitstreamWriter block_writer;
+    EncodeInBlocks(values, block_writer);
+    // The block encoding is never significantly larger, since the worst case
+    // (all deltas are exceptions) is avoided by choosing a wider bit width.
+    EXPECT_LE(block_writer.Finalize().size(),
+              golomb_writer.Finalize().size() * 105 / 100)
+        << GetName(distribution);
+  }
+}
+
+TEST(Serialization, DISABLED_golomb_encode_benchmark) {
+  constexpr size_t kValuesCount = 1 << 20;
+  constexpr size_t kRepeatsCount = 20;
+  std::mt19937_64 rng{42};
+  for (bit_shift_t max_width : {1, 4, 8, 16, 32}) {
+    // Widths are uniformly distributed in [0, max_width].
+    std::vector<uint64_t> values(kValuesCount);
+    for (uint64_t& value : values) {
+      const auto width = static_cast<bit_shift_t>(rng() % (max_width + 1));
+      value = width ? rng() >> (64 - width) : 0;
+    }
+    // The buffer is large enough for any of the tested streams.
+    std::vector<uint64_t> buffer(kValuesCount);
+    size_t stream_size = 0;
+    const auto report = [&](const char* name, auto&& encode) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < kRepeatsCount; ++i)
+        stream_size += encode();
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      std::cout << name << ", widths up to " << max_width << ": "
+                << seconds * 1e9 / (kValuesCount * kRepeatsCount)
+                << " ns/value\n";
+    };
+    report("BlobWriter::WriteGolomb", [&] {
+      BlobWriter writer;
+      for (uint64_t value : values)
+        writer.WriteGolomb(value);
+      return writer.Finalize().size();
+    });
+    report("BitstreamWriter::WriteExponentialGolombCode", [&] {
+      BitstreamWriter writer;
+      for (uint64_t value : values)
+        writer.WriteExponentialGolombCode(value);
+      return writer.Finalize().size();
+    });
+    report("BitstreamWriter::WriteExponentialGolombCodes", [&] {
+      BitstreamWriter writer;
+      writer.WriteExponentialGolombCodes({values.data(), values.size()});
+      return writer.Finalize().size();
+    });
+    report("BitstreamWriter::WriteExponentialGolombCodes, external buffer",
+           [&] {
+             BitstreamWriter writer{{buffer.data(), buffer.size()}};
+             writer.WriteExponentialGolombCodes(
+                 {values.data(), values.size()});
+             return writer.Finalize().size();
+           });
+    std::cout << "Total size: " << stream_size << '\n';
+  }
+}
+
+TEST(Serialization, DISABLED_golomb_decode_benchmark) {
+  constexpr size_t kValuesCount = 1 << 20;
+  constexpr size_t kRepeatsCount = 20;
+  std::mt19937_64 rng{42};
+  for (bit_shift_t max_width : {1, 4, 8, 16, 32}) {
+    // Widths are uniformly distributed in [0, max_width].
+    std::vector<uint64_t> values(kValuesCount);
+    for (uint64_t& value : values) {
+      const auto width = static_cast<bit_shift_t>(rng() % (max_width + 1));
+      value = width ? rng() >> (64 - width) : 0;
+    }
+    BlobWriter blob_writer;
+    BitstreamWriter bitstream_writer;
+    for (uint64_t value : values) {
+      blob_writer.WriteGolomb(value);
+      bitstream_writer.WriteExponentialGolombCode(value);
+    }
+    const std::string_view blob = blob_writer.Finalize();
+    const std::string_view bitstream = bitstream_writer.Finalize();
+    std::vector<uint64_t> decoded(kValuesCount);
+
+    const auto report = [&](const char* name, auto&& decode) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < kRepeatsCount; ++i)
+        decode();
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      ASSERT_EQ(decoded, values);
+      std::cout << name << ", widths up to " << max_width << ": "
+                << seconds * 1e9 / (kValuesCount * kRepeatsCount)
+                << " ns/value\n";
+    };
+    report("BlobReader::ReadGolomb", [&] {
+      BlobReader reader{blob};
+      for (uint64_t& value : decoded)
+        value = reader.ReadGolomb();
+    });
+    report("BlobReader::ReadGolombN", [&] {
+      BlobReader reader{blob};
+      reader.ReadGolombN({decoded.data(), decoded.size()});
+    });
+    report("BitstreamReader::ReadExponentialGolombCode", [&] {
+      BitstreamReader reader{bitstream};
+      for (uint64_t& value : decoded)
+        value = reader.ReadExponentialGolombCode();
+    });
+    report("BitstreamReader::ReadExponentialGolombCodes", [&] {
+      BitstreamReader reader{bitstream};
+      reader.ReadExponentialGolombCodes({decoded.data(), decoded.size()});
+    });
+  }
+}
+
+TEST(Serialization, DISABLED_monotonic_sequence_benchmark) {
+  constexpr size_t kValuesCount = 1 << 16;
+  constexpr size_t kRepeatsCount = 200;
+  constexpr size_t kBlockSize = BlockMonotonicSequenceEncoder::kBlockSize;
+  std::mt19937_64 rng{42};
+  for (SubkeysDistribution distribution : kSubkeysDistributions) {
+    const std::vector<uint64_t> values =
+        GenerateSubkeys(distribution, kValuesCount, rng);
+    std::vector<uint64_t> decoded(values.size());
+    uint64_t checksum = 0;
+    const auto report = [&](const char* name, auto&& func) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < kRepeatsCount; ++i)
+        checksum += func();
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      std::cout << name << ", " << GetName(distribution) << ": "
+                << seconds * 1e9 / (values.size() * kRepeatsCount)
+                << " ns/value\n";
+    };
+    std::string golomb_stream;
+    std::string block_stream;
+    report("MonotonicSequenceEncoder::EncodeNext", [&] {
+      BitstreamWriter writer;
+      MonotonicSequenceEncoder encoder;
+      for (uint64_t value : values)
+        encoder.EncodeNext(value, writer);
+      golomb_stream = writer.Finalize();
+      return golomb_stream.size();
+    });
+    report("BlockMonotonicSequenceEncoder::EncodeBlock", [&] {
+      BitstreamWriter writer;
+      EncodeInBlocks(values, writer);
+      block_stream = writer.Finalize();
+      return block_stream.size();
+    });
+    report("MonotonicSequenceEncoder::DecodeNext", [&] {
+      BitstreamReader reader{golomb_stream};
+      MonotonicSequenceEncoder encoder;
+      for (uint64_t& value : decoded)
+        value = encoder.DecodeNext(reader);
+      return decoded.back();
+    });
+    ASSERT_EQ(decoded, values);
+    report("BlockMonotonicSequenceEncoder::DecodeBlock", [&] {
+      BitstreamReader reader{block_stream};
+      BlockMonotonicSequenceEncoder encoder;
+      for (size_t i = 0; i < decoded.size(); i += kBlockSize) {
+        encoder.DecodeBlock(
+            {decoded.data() + i, std::min(kBlockSize, decoded.size() - i)},
+            reader);
+      }
+      return decoded.back();
+    });
+    ASSERT_EQ(decoded, values);
+    std::cout << "Bits per value, " << GetName(distribution)
+              << ": MonotonicSequenceEncoder "
+              << 8.0 * golomb_stream.size() / values.size()
+              << ", BlockMonotonicSequenceEncoder "
+              << 8.0 * block_stream.size() / values.size() << '\n';
+    std::cout << "Checksum: " << checksum << '\n';
+  }
+}
+
 }  // namespace Microsoft::MixedReality::Sharing::Serialization
@@ -0,0 +1,165 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include <Microsoft/MixedReality/Sharing/Common/hash.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace Microsoft::MixedReality::Sharing;
+
+namespace {
+
+constexpr std::string_view kText =
+    "The quick brown fox jumps over the lazy dog. "
+    "The quick brown fox jumps over the lazy dog. "
+    "The quick brown fox jumps over the lazy dog. "
+    "The quick brown fox jumps over the lazy dog. "
+    "The quick brown fox jumps over the lazy dog. "
+    "The quick brown fox jumps over the lazy dog. "
+    "The quick brown fox jumps over the lazy dog. ";
+
+struct ExpectedHashes {
+  size_t size;
+  uint64_t v1;
+  uint64_t v2;
+};
+
+// The values must never change, since the hashes can be persisted.
+// kV1 values were produced by the original implementation (which was always
+// using WYHASH32), and kV2 values by the same implementation without WYHASH32.
+constexpr ExpectedHashes kExpectedHashes[]{
+    {0, 0xc6a7de6ef4482ecaull, 0xa5506ff52926ac13ull},
+    {1, 0x620c50cbd5d33b12ull, 0xd6f138a6040ca6c2ull},
+    {3, 0x183b24183e3e3100ull, 0xe3d4fb4e74e1de69ull},
+    {4, 0x080f99c6988557d0ull, 0x6ebca340751ed783ull},
+    {7, 0x2730422d00101c13ull, 0x622b69a1294beef1ull},
+    {8, 0xfbb6ab8f6add33e5ull, 0xb4dfd81b5a28d80full},
+    {9, 0x5b2acc3ec380c93bull, 0xd4b7835f82b7168bull},
+    {16, 0x17ab0403a159c5bcull, 0x9a938cb34ef38699ull},
+    {17, 0x12f495ae0c0baafaull, 0x5c89835e2a812b23ull},
+    {24, 0x0835dcb23ea37d15ull, 0x4967f95b72bf09e0ull},
+    {25, 0x661c47c4d454ca13ull, 0xce3723a4314a957aull},
+    {32, 0xc39555c9d73938e2ull, 0x06dda11d5b959d87ull},
+    {33, 0x5803da202d519b7full, 0x924d9b9bab63cf83ull},
+    {64, 0x1cf9c59dcd675f64ull, 0x9f3b85c9779a471aull},
+    {255, 0x596cda8c5d04d998ull, 0x34f0713b1460f486ull},
+    {256, 0x5bf3f127d2ba8acbull, 0xa2cd32c5ca98bca0ull},
+    {300, 0xcb71ad711b625fd4ull, 0xd26eced94fda44a4ull},
+};
+
+TEST(Hash, values_are_stable) {
+  for (const ExpectedHashes& expected : kExpectedHashes) {
+    EXPECT_EQ(CalculateHash64(kText.data(), expected.size), expected.v1);
+    EXPECT_EQ(CalculateHash64<HashVersion::kV1>(kText.data(), expected.size),
+              expected.v1);
+    EXPECT_EQ(CalculateHash64<HashVersion::kV2>(kText.data(), expected.size),
+              expected.v2);
+  }
+  EXPECT_EQ(CalculateHash64(kText.data(), 20, 12345), 0x7537e14158eea8aaull);
+  EXPECT_EQ(CalculateHash64<HashVersion::kV2>(kText.data(), 20, 12345),
+            0x8f5bf7ad9288972bull);
+
+  EXPECT_EQ(CalculateHash64(1, 42), 0xcf5ed6964fb7b804ull);
+  EXPECT_EQ(CalculateHash64<HashVersion::kV1>(1, 42), 0xcf5ed6964fb7b804ull);
+  EXPECT_EQ(CalculateHash64<HashVersion::kV2>(1, 42), 0xf616b70d0fb46a43ull);
+}
+
+template <HashVersion kVersion>
+void CheckBatch(uint64_t seed) {
+  // Mixing the sizes to make sure that short keys that are accumulated
+  // in the batch are not confused with the long ones hashed immediately.
+  std::vector<std::string_view> keys;
+  for (size_t size = 0; size <= 40; ++size) {
+    for (size_t offset = 0; offset < 3; ++offset)
+      keys.push_back(kText.substr(offset, size));
+    keys.push_back(kText.substr(0, size * 7));
+  }
+  for (size_t count = 0; count <= keys.size(); ++count) {
+    std::vector<uint64_t> hashes(count);
+    CalculateHash64Batch<kVersion>(keys.data(), count, hashes.data(), seed);
+    for (size_t i = 0; i < count; ++i) {
+      ASSERT_EQ(hashes[i], CalculateHash64<kVersion>(keys[i].data(),
+                                                     keys[i].size(), seed))
+          << "i=" << i << ", count=" << count;
+    }
+  }
+}
+
+TEST(Hash, batch_matches_individual_hashes) {
+  CheckBatch<HashVersion::kV1>(0);
+  CheckBatch<HashVersion::kV1>(0x12345678abcdefull);
+  CheckBatch<HashVersion::kV2>(0);
+  CheckBatch<HashVersion::kV2>(0x12345678abcdefull);
+
+  std::vector<std::string_view> keys{"a", "bcd", "efghijklmno"};
+  uint64_t hashes[3];
+  CalculateHash64Batch(keys.data(), keys.size(), hashes);
+  for (size_t i = 0; i < 3; ++i)
+    EXPECT_EQ(hashes[i], CalculateHash64(keys[i]));
+}
+
+TEST(Hash, DISABLED_throughput_benchmark) {
+  constexpr size_t kTotalBytes = 256 * 1024 * 1024;
+  constexpr size_t kKeysCount = 1024;
+  std::string data(64 * 1024, '\0');
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<char>(i * 2654435761u >> 13);
+
+  uint64_t checksum = 0;
+  const auto report = [&](const char* name, size_t size, auto&& func) {
+    const size_t iterations_count =
+        std::max<size_t>(1, kTotalBytes / (std::max<size_t>(size, 8) *
+                                           kKeysCount));
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations_count; ++i)
+      checksum += func();
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    const double keys_count =
+        static_cast<double>(iterations_count * kKeysCount);
+    std::cout << name << ", " << size
+              << " bytes: " << seconds * 1e9 / keys_count << " ns/key, "
+              << keys_count * size / seconds / (1 << 20) << " MiB/s\n";
+  };
+
+  for (size_t size : {0, 3, 8, 16, 24, 32, 64, 256, 1024, 4096}) {
+    std::vector<std::string_view> keys;
+    for (size_t i = 0; i < kKeysCount; ++i)
+      keys.emplace_back(data.data() + (i * 61) % (data.size() - size), size);
+    std::vector<uint64_t> hashes(kKeysCount);
+
+    report("kV1", size, [&] {
+      for (size_t i = 0; i < kKeysCount; ++i) {
+        hashes[i] = CalculateHash64<HashVersion::kV1>(keys[i].data(),
+                                                    keys[i].size());
+      }
+      return hashes[size % kKeysCount];
+    });
+    report("kV2", size, [&] {
+      for (size_t i = 0; i < kKeysCount; ++i) {
+        hashes[i] = CalculateHash64<HashVersion::kV2>(keys[i].data(),
+                                                    keys[i].size());
+      }
+      return hashes[size % kKeysCount];
+    });
+    report("kV1 batch", size, [&] {
+      CalculateHash64Batch<HashVersion::kV1>(keys.data(), kKeysCount,
+                                             hashes.data());
+      return hashes[size % kKeysCount];
+    });
+    report("kV2 batch", size, [&] {
+      CalculateHash64Batch<HashVersion::kV2>(keys.data(), kKeysCount,
+                                             hashes.data());
+      return hashes[size % kKeysCount];
+    });
+  }
+  std::cout << "Checksum: " << checksum << '\n';
+}
+
+}  // namespace
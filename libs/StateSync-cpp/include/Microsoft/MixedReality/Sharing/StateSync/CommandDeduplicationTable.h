@@ -0,0 +1,105 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <Microsoft/MixedReality/Sharing/StateSync/CommandId.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace Microsoft::MixedReality::Sharing::Serialization {
+class BlobReader;
+class BlobWriter;
+}  // namespace Microsoft::MixedReality::Sharing::Serialization
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+// Detects the commands that were committed more than once (the connections
+// resend the commands that could have been lost, for example when the leader
+// of the RSM changes, so the same command can be appended to the log twice).
+//
+// The commands of each connection have consecutive ids (see
+// CommandId::operator++()), so the table is keyed by data_[1] (the random
+// part of the id that identifies the sender), and only tracks the highest
+// counter (data_[0]) of the applied commands of each sender, and which of the
+// previous kWindowSize counters were applied. The commands that are older
+// than that are considered to be duplicates.
+//
+// The table tracks at most capacity senders, and forgets the sender that
+// applied a command least recently when a new one is added. The eviction only
+// depends on the order of the calls to TryRecord(), so the participants that
+// observe the same log make the same decisions.
+//
+// The senders are stored in one array (the slot of the evicted sender is
+// reused by the new one), linked into the recency list by their indices, and
+// found through an open-addressing index of the same array.
+//
+// Not thread-safe.
+class CommandDeduplicationTable {
+ public:
+  static constexpr size_t kDefaultCapacity = 4096;
+  static constexpr size_t kMaxCapacity = size_t{1} << 30;
+  static constexpr uint64_t kWindowSize = 64;
+
+  // The capacity is clamped to [1, kMaxCapacity].
+  explicit CommandDeduplicationTable(
+      size_t capacity = kDefaultCapacity) noexcept;
+
+  // Returns false if the command was already recorded (and thus shouldn't be
+  // applied again). Otherwise records it and returns true.
+  bool TryRecord(const CommandId& command_id);
+
+  // Returns true if TryRecord() would return false for this command.
+  bool Contains(const CommandId& command_id) const noexcept;
+
+  size_t senders_count() const noexcept { return senders_.size(); }
+
+  // Writes the tracked senders in the order of recency, so that the table
+  // restored by Deserialize() evicts the same senders as this one.
+  void Serialize(Serialization::BlobWriter& writer) const noexcept;
+
+  // Replaces the content of the table with the serialized one (keeping only
+  // the most recent senders if there are more than the capacity).
+  // Throws std::out_of_range if the input is malformed.
+  void Deserialize(Serialization::BlobReader& reader);
+
+ private:
+  static constexpr uint32_t kInvalidIndex = ~uint32_t{0};
+
+  struct Sender {
+    uint64_t sender_id_;
+    uint64_t highest_counter_;
+    // Bit i is set if the command with the counter highest_counter_ - i was
+    // recorded.
+    uint64_t recorded_mask_;
+    // The neighbors in the recency list (indices in senders_).
+    uint32_t less_recent_;
+    uint32_t more_recent_;
+  };
+
+  // Returns the position of the sender in index_, or the position of the
+  // empty element where it should be inserted.
+  size_t FindIndexPosition(uint64_t sender_id) const noexcept;
+
+  // Returns the sender (which becomes the most recent one), adding it (with
+  // no recorded commands) if it's not tracked yet.
+  Sender& GetOrAddSender(uint64_t sender_id);
+
+  void Unlink(uint32_t sender_index) noexcept;
+  void LinkAsMostRecent(uint32_t sender_index) noexcept;
+
+  // Removes the element from index_, and moves the following elements of the
+  // same cluster so that they can still be found.
+  void EraseFromIndex(size_t position) noexcept;
+
+  size_t capacity_;
+  std::vector<Sender> senders_;
+  // The indices in senders_ (kInvalidIndex for the empty elements), placed
+  // with linear probing. The size is a power of two that is at least twice
+  // the capacity (allocated on the first insertion).
+  std::vector<uint32_t> index_;
+  uint32_t least_recent_{kInvalidIndex};
+  uint32_t most_recent_{kInvalidIndex};
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -39,12 +39,26 @@ class RSMConnection : public VirtualRefCountedBase {
   // Connects to a remote RAFT replicated state machine.
   // The servers decide what the current state is (if the leader is sure the
   // machine didn't exist, a new machine is created).
-  //
-  // This is a placeholder interface.
+  // The commands are sent to the current leader (the connection finds it
+  // automatically, and switches to the new one if the leader fails).
   static RefPtr<RSMConnection> ConnectToRaftRSM(
       std::string name,
       RefPtr<NetworkManager> network_manager,
       std::vector<std::string> servers);
+
+  // Creates one of the servers of a RAFT replicated state machine.
+  // servers contains the connection strings of all servers of the machine
+  // (in the same order for each server), and own_server_index is the index
+  // of this server in it.
+  // The server is also a connection to the machine (the commands sent to it
+  // are forwarded to the leader, and all committed entries are delivered to
+  // its listener).
+  // Throws std::invalid_argument if own_server_index is out of range.
+  static RefPtr<RSMConnection> CreateRaftRSMServer(
+      std::string name,
+      RefPtr<NetworkManager> network_manager,
+      std::vector<std::string> servers,
+      size_t own_server_index);
 };
 
 }  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -6,6 +6,7 @@
 
 #include <Microsoft/MixedReality/Sharing/Common/VirtualRefCountedBase.h>
 
+#include <string>
 #include <string_view>
 
 namespace Microsoft::MixedReality::Sharing::StateSync {
@@ -22,10 +23,30 @@ class RSMListener : public VirtualRefCountedBase {
                                 CommandId command_id,
                                 std::string_view entry) noexcept = 0;
 
-  // Placeholder interface.
-  // There should be a handshake mechanism that allows the listener to catch up
-  // without re-sending the entire state.
-  virtual void OnLogFastForward(std::string_view state_blob) noexcept = 0;
+  // Invoked instead of OnEntryCommitted() for the entries that were discarded
+  // from the log before the listener received them. The state produced by
+  // these entries (the result of TrySerializeState() on another participant)
+  // is delivered as consecutive chunks, where offset is the position of the
+  // chunk in the serialized state of state_size bytes. A chunk with offset 0
+  // starts a new transfer (the incomplete previous transfer, if any, should be
+  // discarded), and the transfer is complete once the chunk that ends at
+  // state_size is received. The following OnEntryCommitted() continues from
+  // the first entry after that state (if it's invoked before the transfer is
+  // complete, the transfer was abandoned).
+  // The listener is expected to restore its state incrementally, so the
+  // serialized state is never stored in one contiguous buffer.
+  virtual void OnLogFastForwardChunk(uint64_t offset,
+                                     uint64_t state_size,
+                                     std::string_view chunk) noexcept = 0;
+
+  // Serializes the state produced by all entries committed so far into the
+  // provided string (in the format expected by OnLogFastForwardChunk()).
+  // Invoked periodically by the state machines that discard old entries from
+  // their logs. Returns false if the listener can't serialize its state (in
+  // which case the log is kept).
+  virtual bool TrySerializeState(std::string&) noexcept {
+    return false;
+  }
 };
 
 }  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -3,27 +3,186 @@
 
 #pragma once
 
+#include <Microsoft/MixedReality/Sharing/StateSync/CommandDeduplicationTable.h>
 #include <Microsoft/MixedReality/Sharing/StateSync/RSMConnection.h>
 
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/SpeculativeOverlay.h>
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/Storage.h>
+
 #include <Microsoft/MixedReality/Sharing/Common/Guid.h>
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
 namespace Microsoft::MixedReality::Sharing::StateSync {
 
+class RSMListener;
+
+// A VersionedStorage::Storage that is kept in sync with a replicated state
+// machine. Each committed entry of the state machine is a serialized
+// transaction (see VersionedStorage::TransactionBuilder::Serialize()), and the
+// entries are applied to the storage in the order of the log.
+//
+// The committed entries go through two stages:
+// * Decoding (see VersionedStorage::Storage::DecodeTransaction()), which
+//   happens on decoding_threads_count worker threads, in parallel for
+//   different entries.
+// * Applying, which happens in the order of the log on the thread that calls
+//   ProcessSingleUpdate().
+// Therefore the decoding of the next entries overlaps with applying the
+// current one. Each applied entry produces a new snapshot, which can be
+// observed from any thread with GetSnapshot().
+// The entries with the ids of the commands that were already committed (see
+// CommandDeduplicationTable) are skipped, so the retried transactions are
+// applied at most once. The malformed transactions are skipped as well (all
+// participants decode the same entries, so they skip the same ones).
+// When the state machine discards old entries from its log, the participants
+// that didn't receive them restore the serialized state of the storage
+// instead (see VersionedStorage::Storage::SerializeState()), one chunk at a
+// time. The state includes the deduplication table, so the retries of the
+// commands committed in the discarded entries are still skipped.
+//
+// The transactions sent by this participant are also applied speculatively
+// on top of the latest snapshot until they are committed (see
+// GetSpeculativeState()), so the participant can observe its own writes
+// without waiting for the round trip.
 class ReplicatedState : public VirtualRefCountedBase {
  public:
   ~ReplicatedState() noexcept override;
 
+  // If decoding_threads_count is 0, the entries are decoded on the thread
+  // that calls ProcessSingleUpdate(), right before they are applied.
+  // Throws std::system_error if the decoding threads can't be started.
   static RefPtr<ReplicatedState> Create(
       Guid guid,
-      RefPtr<RSMConnection> connection) noexcept;
+      RefPtr<RSMConnection> connection,
+      std::shared_ptr<VersionedStorage::Behavior> behavior,
+      size_t decoding_threads_count = 1);
 
   const Guid& guid() const noexcept { return guid_; }
 
+  // Sends the serialized transaction to the replicated state machine. It will
+  // be applied by all participants once it's committed (see
+  // RSMConnection::SendCommand()). Until then, it's applied to the speculative
+  // state.
+  CommandId SendTransaction(std::string_view serialized_transaction);
+
+  // Processes the updates of the connection, and applies all committed entries
+  // that were decoded. If there is nothing else to do, waits for the oldest
+  // pending entry to be decoded.
+  // Returns false if there was nothing to do.
+  // Should be called from one thread at a time.
+  bool ProcessSingleUpdate();
+
+  // Returns the latest applied state. Can be called from any thread.
+  VersionedStorage::Snapshot GetSnapshot() const noexcept {
+    return storage_.GetSnapshot();
+  }
+
+  // Returns the latest applied state with the transactions that were sent by
+  // this participant, but not yet applied, applied on top of it. If the
+  // transactions are committed in a different order, or interleaved with the
+  // transactions of other participants, their effects may change (or be
+  // rolled back if their prerequisites are no longer satisfied).
+  // Can be called from any thread. The returned overlay is a copy of the
+  // current one, which is only made once per change of the speculative state.
+  // Throws std::bad_alloc if the copy can't be allocated.
+  std::shared_ptr<const VersionedStorage::SpeculativeOverlay>
+  GetSpeculativeState() const;
+
+  // True if the storage failed to decode or apply an entry due to
+  // insufficient resources (see VersionedStorage::Storage::TransactionResult),
+  // or failed to restore the state received from another participant.
+  // The state can't make progress after that, and the remaining entries are
+  // discarded.
+  bool has_failed() const noexcept { return has_failed_; }
+
  private:
+  class Listener;
+
+  struct PendingEntry {
+    CommandId command_id_;
+    std::string serialized_transaction_;
+    // Empty if the transaction is malformed, or if it couldn't be decoded due
+    // to insufficient resources.
+    std::optional<VersionedStorage::Storage::DecodedTransaction> decoded_;
+    bool is_malformed_{false};
+    bool is_decoded_{false};
+  };
+
+  ReplicatedState(Guid guid,
+                  RefPtr<RSMConnection> connection,
+                  std::shared_ptr<VersionedStorage::Behavior> behavior,
+                  size_t decoding_threads_count);
+
+  struct LocalTransaction {
+    CommandId command_id_;
+    std::string serialized_transaction_;
+  };
+
+  void PushEntry(CommandId command_id, std::string_view entry);
+  void DecodeEntries() noexcept;
+  void Decode(PendingEntry& entry) noexcept;
+
+  // Returns true if any entries were applied.
+  bool ApplyDecodedEntries(bool wait_for_decoding);
+
+  // Waits for all pending entries to be decoded, and applies them.
+  void ApplyAllEntries();
+
+  // Replaces the state of the storage and the deduplication table with the
+  // state received from another participant (see
+  // RSMListener::OnLogFastForwardChunk()).
+  void RestoreState(
+      CommandDeduplicationTable&& deduplication_table,
+      VersionedStorage::Storage::StateRestorer& restorer) noexcept;
+
+  // Removes the applied local transactions, and applies the remaining ones on
+  // top of the latest snapshot.
+  void RebaseSpeculativeState(const std::vector<CommandId>& applied_commands);
+
   const Guid guid_;
   RefPtr<RSMConnection> connection_;
+  RefPtr<RSMListener> listener_;
+  VersionedStorage::Storage storage_;
+  bool has_failed_{false};
+  // Only accessed by the applying thread.
+  CommandDeduplicationTable deduplication_table_;
+
+  // The entries are appended by the applying thread, decoded by the worker
+  // threads, and removed by the applying thread once they are applied.
+  // std::deque doesn't move the elements when they are added or removed at
+  // the ends, so the entries can be accessed without holding the lock.
+  std::mutex pending_entries_mutex_;
+  std::condition_variable entries_to_decode_cv_;
+  std::condition_variable decoded_entries_cv_;
+  std::deque<PendingEntry> pending_entries_;
+  // The index of the first entry in pending_entries_ that wasn't taken by a
+  // worker thread.
+  size_t next_entry_to_decode_{0};
+  bool is_stopping_{false};
+
+  std::vector<std::thread> decoding_threads_;
 
-  ReplicatedState(Guid guid, RefPtr<RSMConnection> connection);
+  // Held while sending the transactions, so the local transactions are
+  // recorded before they can be committed.
+  mutable std::mutex speculative_state_mutex_;
+  std::deque<LocalTransaction> local_transactions_;
+  // The new local transactions are applied to this overlay in place, so
+  // sending a transaction doesn't copy the changes of the previous ones.
+  std::unique_ptr<VersionedStorage::SpeculativeOverlay> speculative_state_;
+  // The copy of speculative_state_ returned by GetSpeculativeState(). Never
+  // modified after being published, so it can be observed without holding
+  // the lock. Reset when speculative_state_ changes.
+  mutable std::shared_ptr<const VersionedStorage::SpeculativeOverlay>
+      published_speculative_state_;
 };
 
 }  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -0,0 +1,173 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include <Microsoft/MixedReality/Sharing/StateSync/CommandDeduplicationTable.h>
+
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobWriter.h>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+namespace {
+
+// The ids are usually random, but are mixed anyway so that the sequential ones
+// don't form long clusters in the index.
+size_t HomePosition(uint64_t sender_id, size_t mask) noexcept {
+  return static_cast<size_t>((sender_id * 0x9E3779B97F4A7C15) >> 32) & mask;
+}
+
+}  // namespace
+
+CommandDeduplicationTable::CommandDeduplicationTable(size_t capacity) noexcept
+    : capacity_{std::clamp<size_t>(capacity, 1, kMaxCapacity)} {}
+
+bool CommandDeduplicationTable::TryRecord(const CommandId& command_id) {
+  const uint64_t counter = command_id.data_[0];
+  Sender& sender = GetOrAddSender(command_id.data_[1]);
+  if (counter > sender.highest_counter_) {
+    const uint64_t shift = counter - sender.highest_counter_;
+    sender.recorded_mask_ =
+        (shift < kWindowSize ? sender.recorded_mask_ << shift : 0) | 1;
+    sender.highest_counter_ = counter;
+    return true;
+  }
+  const uint64_t age = sender.highest_counter_ - counter;
+  if (age >= kWindowSize)
+    return false;
+  const uint64_t bit = uint64_t{1} << age;
+  if (sender.recorded_mask_ & bit)
+    return false;
+  sender.recorded_mask_ |= bit;
+  return true;
+}
+
+bool CommandDeduplicationTable::Contains(const CommandId& command_id) const
+    noexcept {
+  if (index_.empty())
+    return false;
+  const uint32_t sender_index =
+      index_[FindIndexPosition(command_id.data_[1])];
+  if (sender_index == kInvalidIndex)
+    return false;
+  const Sender& sender = senders_[sender_index];
+  const uint64_t counter = command_id.data_[0];
+  if (counter > sender.highest_counter_)
+    return false;
+  const uint64_t age = sender.highest_counter_ - counter;
+  return age >= kWindowSize || ((sender.recorded_mask_ >> age) & 1) != 0;
+}
+
+void CommandDeduplicationTable::Serialize(
+    Serialization::BlobWriter& writer) const noexcept {
+  writer.WriteGolomb(senders_.size());
+  for (uint32_t i = least_recent_; i != kInvalidIndex;
+       i = senders_[i].more_recent_) {
+    const Sender& sender = senders_[i];
+    writer.WriteBits(sender.sender_id_, 64);
+    writer.WriteBits(sender.highest_counter_, 64);
+    writer.WriteBits(sender.recorded_mask_, 64);
+  }
+}
+
+void CommandDeduplicationTable::Deserialize(
+    Serialization::BlobReader& reader) {
+  senders_.clear();
+  std::fill(index_.begin(), index_.end(), kInvalidIndex);
+  least_recent_ = kInvalidIndex;
+  most_recent_ = kInvalidIndex;
+  const uint64_t senders_count = reader.ReadGolomb();
+  for (uint64_t i = 0; i < senders_count; ++i) {
+    const uint64_t sender_id = reader.ReadBits64(64);
+    const uint64_t highest_counter = reader.ReadBits64(64);
+    const uint64_t recorded_mask = reader.ReadBits64(64);
+    Sender& sender = GetOrAddSender(sender_id);
+    sender.highest_counter_ = highest_counter;
+    sender.recorded_mask_ = recorded_mask;
+  }
+}
+
+size_t CommandDeduplicationTable::FindIndexPosition(uint64_t sender_id) const
+    noexcept {
+  const size_t mask = index_.size() - 1;
+  size_t position = HomePosition(sender_id, mask);
+  while (index_[position] != kInvalidIndex &&
+         senders_[index_[position]].sender_id_ != sender_id) {
+    position = (position + 1) & mask;
+  }
+  return position;
+}
+
+CommandDeduplicationTable::Sender& CommandDeduplicationTable::GetOrAddSender(
+    uint64_t sender_id) {
+  if (index_.empty()) {
+    size_t index_size = 2;
+    while (index_size < capacity_ * 2)
+      index_size *= 2;
+    index_.assign(index_size, kInvalidIndex);
+  }
+  size_t position = FindIndexPosition(sender_id);
+  uint32_t sender_index = index_[position];
+  if (sender_index != kInvalidIndex) {
+    Unlink(sender_index);
+    LinkAsMostRecent(sender_index);
+    return senders_[sender_index];
+  }
+  if (senders_.size() < capacity_) {
+    sender_index = static_cast<uint32_t>(senders_.size());
+    senders_.emplace_back();
+  } else {
+    // Reusing the slot of the least recent sender.
+    sender_index = least_recent_;
+    Unlink(sender_index);
+    EraseFromIndex(FindIndexPosition(senders_[sender_index].sender_id_));
+    position = FindIndexPosition(sender_id);
+  }
+  index_[position] = sender_index;
+  senders_[sender_index] =
+      Sender{sender_id, 0, 0, kInvalidIndex, kInvalidIndex};
+  LinkAsMostRecent(sender_index);
+  return senders_[sender_index];
+}
+
+void CommandDeduplicationTable::Unlink(uint32_t sender_index) noexcept {
+  Sender& sender = senders_[sender_index];
+  if (sender.less_recent_ != kInvalidIndex)
+    senders_[sender.less_recent_].more_recent_ = sender.more_recent_;
+  else
+    least_recent_ = sender.more_recent_;
+  if (sender.more_recent_ != kInvalidIndex)
+    senders_[sender.more_recent_].less_recent_ = sender.less_recent_;
+  else
+    most_recent_ = sender.less_recent_;
+}
+
+void CommandDeduplicationTable::LinkAsMostRecent(
+    uint32_t sender_index) noexcept {
+  Sender& sender = senders_[sender_index];
+  sender.less_recent_ = most_recent_;
+  sender.more_recent_ = kInvalidIndex;
+  if (most_recent_ != kInvalidIndex)
+    senders_[most_recent_].more_recent_ = sender_index;
+  else
+    least_recent_ = sender_index;
+  most_recent_ = sender_index;
+}
+
+void CommandDeduplicationTable::EraseFromIndex(size_t position) noexcept {
+  const size_t mask = index_.size() - 1;
+  size_t hole = position;
+  for (size_t next = (hole + 1) & mask; index_[next] != kInvalidIndex;
+       next = (next + 1) & mask) {
+    const size_t home = HomePosition(senders_[index_[next]].sender_id_, mask);
+    // The element can fill the hole if its probing sequence starts at or
+    // before the hole.
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      index_[hole] = index_[next];
+      hole = next;
+    }
+  }
+  index_[hole] = kInvalidIndex;
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -0,0 +1,92 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include "src/RSMCommon.h"
+
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMListener.h>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+CommandId CommandQueue::Push(std::string_view command) {
+  auto lock = std::lock_guard{mutex_};
+  const CommandId command_id = next_command_id_;
+  ++next_command_id_;
+  commands_.push_back({command_id, std::string{command}});
+  return command_id;
+}
+
+std::vector<RSMCommand> CommandQueue::TakeAll() {
+  std::vector<RSMCommand> result;
+  auto lock = std::lock_guard{mutex_};
+  result.swap(commands_);
+  return result;
+}
+
+void WriteMessageHeader(Serialization::BlobWriter& writer,
+                        const InternedBlob& name,
+                        uint64_t message_type) noexcept {
+  writer.WriteBytesWithSize(name.view());
+  writer.WriteGolomb(message_type);
+}
+
+bool ReadMessageHeader(Serialization::BlobReader& reader,
+                       const InternedBlob& name,
+                       uint64_t& message_type) {
+  if (reader.ReadBytesWithSize() != name.view())
+    return false;
+  message_type = reader.ReadGolomb();
+  return true;
+}
+
+void WriteCommandId(Serialization::BlobWriter& writer,
+                    const CommandId& command_id) noexcept {
+  writer.WriteBits(command_id.data_[0], 64);
+  writer.WriteBits(command_id.data_[1], 64);
+}
+
+CommandId ReadCommandId(Serialization::BlobReader& reader) {
+  CommandId result;
+  result.data_[0] = reader.ReadBits64(64);
+  result.data_[1] = reader.ReadBits64(64);
+  return result;
+}
+
+uint64_t WriteSnapshotChunk(Serialization::BlobWriter& writer,
+                            std::string_view state,
+                            uint64_t offset,
+                            size_t chunk_size) noexcept {
+  const std::string_view data = state.substr(offset, chunk_size);
+  writer.WriteGolomb(state.size());
+  writer.WriteGolomb(offset);
+  writer.WriteBytesWithSize(data);
+  return offset + data.size();
+}
+
+SnapshotChunk ReadSnapshotChunk(Serialization::BlobReader& reader) {
+  SnapshotChunk chunk;
+  chunk.state_size_ = reader.ReadGolomb();
+  chunk.offset_ = reader.ReadGolomb();
+  chunk.data_ = reader.ReadBytesWithSize();
+  // Only the chunk of an empty state can be empty.
+  if (chunk.offset_ > chunk.state_size_ ||
+      chunk.state_size_ - chunk.offset_ < chunk.data_.size() ||
+      (chunk.data_.empty() && chunk.state_size_ != 0)) {
+    throw std::out_of_range{"Malformed snapshot chunk"};
+  }
+  return chunk;
+}
+
+void FastForward(RSMListener& listener,
+                 std::string_view state,
+                 size_t chunk_size) noexcept {
+  uint64_t offset = 0;
+  do {
+    const std::string_view data = state.substr(offset, chunk_size);
+    listener.OnLogFastForwardChunk(offset, state.size(), data);
+    offset += data.size();
+  } while (offset != state.size());
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
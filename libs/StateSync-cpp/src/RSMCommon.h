@@ -0,0 +1,98 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <Microsoft/MixedReality/Sharing/StateSync/CommandId.h>
+
+#include <Microsoft/MixedReality/Sharing/Common/InternedBlob.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobWriter.h>
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Helpers shared by the implementations of RSMConnection.
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+class RSMListener;
+
+struct RSMCommand {
+  CommandId id_;
+  std::string data_;
+};
+
+// Commands sent with RSMConnection::SendCommand() that were not processed by
+// the connection yet. Can be used from any thread.
+class CommandQueue {
+ public:
+  // Assigns the next id to the command and queues it.
+  CommandId Push(std::string_view command);
+
+  // Returns all queued commands (in order) and clears the queue.
+  std::vector<RSMCommand> TakeAll();
+
+ private:
+  std::mutex mutex_;
+  std::vector<RSMCommand> commands_;
+  // Commands of each connection have consecutive ids.
+  CommandId next_command_id_{CommandId::GenerateRandom()};
+};
+
+// Each message starts with the name of the state machine it belongs to, and
+// the type of the message (interpreted by the implementation).
+void WriteMessageHeader(Serialization::BlobWriter& writer,
+                        const InternedBlob& name,
+                        uint64_t message_type) noexcept;
+
+// Returns false if the message belongs to a different state machine.
+// Throws std::out_of_range if the message is malformed.
+bool ReadMessageHeader(Serialization::BlobReader& reader,
+                       const InternedBlob& name,
+                       uint64_t& message_type);
+
+void WriteCommandId(Serialization::BlobWriter& writer,
+                    const CommandId& command_id) noexcept;
+
+// Throws std::out_of_range if the message is malformed.
+CommandId ReadCommandId(Serialization::BlobReader& reader);
+
+// A chunk of the serialized state of a listener (see
+// RSMListener::TrySerializeState()), encoded as state_size, offset, data.
+struct SnapshotChunk {
+  uint64_t state_size_;
+  uint64_t offset_;
+  std::string_view data_;
+
+  bool is_last() const noexcept {
+    return offset_ + data_.size() == state_size_;
+  }
+};
+
+// The part of the serialized state received by a client, which allows the
+// client to recognize the chunks of the same transfer (and to resume it).
+struct SnapshotProgress {
+  uint64_t commands_count_;
+  uint64_t state_size_;
+  uint64_t received_size_;
+};
+
+// Writes the chunk of the state that starts at the offset (up to chunk_size
+// bytes), and returns the offset of the next chunk.
+uint64_t WriteSnapshotChunk(Serialization::BlobWriter& writer,
+                            std::string_view state,
+                            uint64_t offset,
+                            size_t chunk_size) noexcept;
+
+// Throws std::out_of_range if the chunk is malformed.
+SnapshotChunk ReadSnapshotChunk(Serialization::BlobReader& reader);
+
+// Passes the state to the listener in chunks of chunk_size bytes, as if it
+// was received from the network.
+void FastForward(RSMListener& listener,
+                 std::string_view state,
+                 size_t chunk_size) noexcept;
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -0,0 +1,1001 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include "src/RaftRSM.h"
+
+#include <Microsoft/MixedReality/Sharing/StateSync/NetworkConnection.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/NetworkListener.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/NetworkManager.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMListener.h>
+
+#include <Microsoft/MixedReality/Sharing/Common/RandomDevice.h>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+namespace {
+
+// Each message has the common header (see WriteMessageHeader()), followed by:
+//
+// Between the servers:
+//   RequestVote:        term, last_log_index, last_log_term
+//   Vote:               term, granted
+//   AppendEntries:      term, request_id, prev_log_index, prev_log_term,
+//                       leader_commit, count,
+//                       (term, has_command, [command_id, command]) * count
+//   AppendEntriesReply: term, request_id, success, index (the last matching
+//                       index on success, otherwise the next index to try)
+//   InstallSnapshot:    term, request_id, last_index, last_term,
+//                       commands_count, chunk
+//
+// From the clients (and the servers forwarding their own commands):
+//   Subscribe:          next_entry_id, has_partial_snapshot,
+//                       [commands_count, state_size, received_size]
+//   Commands:           count, (command_id, command) * count
+//
+// To the clients:
+//   Entries:            first_entry_id, count, (command_id, entry) * count
+//   Snapshot:           commands_count, chunk
+//   Redirect:           optional leader_index
+//
+// The serialized state is split into chunks (see WriteSnapshotChunk()):
+//   chunk:              state_size, offset, data
+enum MessageType : uint64_t {
+  kRequestVote = 0,
+  kVote = 1,
+  kAppendEntries = 2,
+  kAppendEntriesReply = 3,
+  kInstallSnapshot = 4,
+  kSubscribe = 5,
+  kCommands = 6,
+  kEntries = 7,
+  kSnapshot = 8,
+  kRedirect = 9,
+};
+
+template <typename TIterator>
+void SendCommands(NetworkConnection& connection,
+                  const InternedBlob& name,
+                  TIterator begin,
+                  TIterator end) {
+  Serialization::BlobWriter writer;
+  WriteMessageHeader(writer, name, kCommands);
+  writer.WriteGolomb(static_cast<uint64_t>(std::distance(begin, end)));
+  for (; begin != end; ++begin) {
+    WriteCommandId(writer, begin->id_);
+    writer.WriteBytesWithSize(begin->data_);
+  }
+  connection.SendMessage(writer.Finalize());
+}
+
+// Removes the command from the list of commands that are waiting for the
+// commit. The commands are committed in the order they were sent, so it's
+// normally the first one. The rest of the list is only searched after a
+// leader change (when a command can be dropped and committed after the
+// following ones, or committed twice).
+void RemoveCommand(std::deque<RSMCommand>& commands, const CommandId& id) {
+  if (commands.front().id_ == id) {
+    commands.pop_front();
+    return;
+  }
+  auto it = std::find_if(commands.begin() + 1, commands.end(),
+                         [&](const RSMCommand& c) { return c.id_ == id; });
+  if (it != commands.end())
+    commands.erase(it);
+}
+
+RaftClock::duration GetRandomElectionTimeout() noexcept {
+  using std::chrono::duration_cast;
+  std::uniform_int_distribution<RaftClock::rep> distribution{
+      duration_cast<RaftClock::duration>(RaftRSMServer::kMinElectionTimeout)
+          .count(),
+      duration_cast<RaftClock::duration>(RaftRSMServer::kMaxElectionTimeout)
+          .count()};
+  return RaftClock::duration{distribution(RandomDevice::thread_instance())};
+}
+
+}  // namespace
+
+class RaftRSMServer::MessageHandler : public NetworkListener {
+ public:
+  MessageHandler(RaftRSMServer& server, RaftClock::time_point now) noexcept
+      : server_{server}, now_{now} {}
+
+  void OnMessage(const InternedBlob& sender_connection_string,
+                 std::string_view data) override {
+    try {
+      Serialization::BlobReader reader{data};
+      uint64_t type;
+      if (!ReadMessageHeader(reader, *server_.name_, type))
+        return;
+      if (type == kSubscribe) {
+        OnSubscribe(sender_connection_string, reader);
+      } else if (type == kCommands) {
+        OnCommands(sender_connection_string, reader);
+      } else if (auto peer_index =
+                     server_.FindPeer(sender_connection_string)) {
+        switch (type) {
+          case kRequestVote:
+            OnRequestVote(*peer_index, reader);
+            break;
+          case kVote:
+            OnVote(*peer_index, reader);
+            break;
+          case kAppendEntries:
+            OnAppendEntries(*peer_index, reader);
+            break;
+          case kAppendEntriesReply:
+            OnAppendEntriesReply(*peer_index, reader);
+            break;
+          case kInstallSnapshot:
+            OnInstallSnapshot(*peer_index, reader);
+            break;
+          default:
+            break;
+        }
+      }
+    } catch (const std::out_of_range&) {
+      // The message is malformed. Each handler reads the whole message before
+      // changing the state.
+    }
+  }
+
+ private:
+  // Returns false if the message is from an older term (and should be
+  // ignored). Steps down if the message is from a newer term.
+  bool CheckTerm(uint64_t term) {
+    if (term < server_.current_term_)
+      return false;
+    if (term > server_.current_term_)
+      server_.BecomeFollower(term);
+    return true;
+  }
+
+  void OnSubscribe(const InternedBlob& sender,
+                   Serialization::BlobReader& reader) {
+    const uint64_t next_entry_id = reader.ReadGolomb();
+    std::optional<SnapshotProgress> partial_snapshot;
+    if (reader.ReadBool()) {
+      SnapshotProgress& progress = partial_snapshot.emplace();
+      progress.commands_count_ = reader.ReadGolomb();
+      progress.state_size_ = reader.ReadGolomb();
+      progress.received_size_ = reader.ReadGolomb();
+    }
+    server_.Subscribe(sender, next_entry_id, partial_snapshot, now_);
+  }
+
+  void OnCommands(const InternedBlob& sender,
+                  Serialization::BlobReader& reader) {
+    std::vector<RSMCommand> commands;
+    // The count is not trusted, so the vector is not reserved in advance.
+    for (uint64_t count = reader.ReadGolomb(); count; --count) {
+      const CommandId command_id = ReadCommandId(reader);
+      commands.push_back({command_id, std::string{reader.ReadBytesWithSize()}});
+    }
+    if (server_.role_ != Role::Leader) {
+      server_.SendRedirect(*server_.network_manager_->GetConnection(sender));
+      return;
+    }
+    for (RSMCommand& command : commands)
+      server_.AppendEntry(server_.current_term_, true, std::move(command));
+  }
+
+  void OnRequestVote(size_t peer_index, Serialization::BlobReader& reader) {
+    const uint64_t term = reader.ReadGolomb();
+    const uint64_t last_log_index = reader.ReadGolomb();
+    const uint64_t last_log_term = reader.ReadGolomb();
+    if (term > server_.current_term_)
+      server_.BecomeFollower(term);
+
+    const uint64_t own_last_index = server_.last_index();
+    const uint64_t own_last_term = server_.TermAt(own_last_index);
+    const bool is_log_up_to_date =
+        last_log_term > own_last_term ||
+        (last_log_term == own_last_term && last_log_index >= own_last_index);
+    const bool granted =
+        term == server_.current_term_ && is_log_up_to_date &&
+        (!server_.voted_for_ || *server_.voted_for_ == peer_index);
+    if (granted) {
+      server_.voted_for_ = peer_index;
+      server_.ResetElectionDeadline(now_);
+    }
+    Serialization::BlobWriter writer;
+    WriteMessageHeader(writer, *server_.name_, kVote);
+    writer.WriteGolomb(server_.current_term_);
+    writer.WriteBool(granted);
+    server_.peers_[peer_index].connection_->SendMessage(writer.Finalize());
+  }
+
+  void OnVote(size_t peer_index, Serialization::BlobReader& reader) {
+    const uint64_t term = reader.ReadGolomb();
+    const bool granted = reader.ReadBool();
+    if (!CheckTerm(term) || server_.role_ != Role::Candidate || !granted)
+      return;
+    server_.votes_[peer_index] = true;
+    const auto votes_count =
+        std::count(server_.votes_.begin(), server_.votes_.end(), true);
+    if (static_cast<size_t>(votes_count) * 2 > server_.peers_.size())
+      server_.BecomeLeader(now_);
+  }
+
+  void OnAppendEntries(size_t peer_index, Serialization::BlobReader& reader) {
+    const uint64_t term = reader.ReadGolomb();
+    request_id_ = reader.ReadGolomb();
+    const uint64_t prev_log_index = reader.ReadGolomb();
+    const uint64_t prev_log_term = reader.ReadGolomb();
+    const uint64_t leader_commit = reader.ReadGolomb();
+    std::vector<Entry> entries;
+    for (uint64_t count = reader.ReadGolomb(); count; --count) {
+      Entry& entry = entries.emplace_back();
+      entry.term_ = reader.ReadGolomb();
+      entry.has_command_ = reader.ReadBool();
+      if (entry.has_command_) {
+        entry.command_.id_ = ReadCommandId(reader);
+        entry.command_.data_ = reader.ReadBytesWithSize();
+      }
+    }
+
+    if (!CheckTerm(term)) {
+      Reply(peer_index, false, server_.last_index() + 1);
+      return;
+    }
+    if (server_.role_ != Role::Follower)
+      server_.BecomeFollower(term);
+    server_.SetLeader(peer_index);
+    server_.ResetElectionDeadline(now_);
+
+    const uint64_t last_index = server_.last_index();
+    if (prev_log_index > last_index) {
+      Reply(peer_index, false, last_index + 1);
+      return;
+    }
+    const uint64_t snapshot_index = server_.snapshot_.last_index_;
+    if (prev_log_index >= snapshot_index &&
+        server_.TermAt(prev_log_index) != prev_log_term) {
+      // Skipping all entries of the conflicting term at once (the committed
+      // entries always match).
+      const uint64_t conflicting_term = server_.TermAt(prev_log_index);
+      const uint64_t min_index =
+          std::max(snapshot_index, server_.commit_index_) + 1;
+      uint64_t hint = prev_log_index;
+      while (hint > min_index && server_.TermAt(hint - 1) == conflicting_term)
+        --hint;
+      Reply(peer_index, false, hint);
+      return;
+    }
+
+    uint64_t index = prev_log_index;
+    for (Entry& entry : entries) {
+      ++index;
+      // The entries up to the snapshot are committed, and thus match.
+      if (index <= snapshot_index)
+        continue;
+      if (index <= server_.last_index()) {
+        if (server_.TermAt(index) == entry.term_)
+          continue;
+        assert(index > server_.commit_index_);
+        server_.log_.resize(index - snapshot_index - 1);
+      }
+      server_.AppendEntry(entry.term_, entry.has_command_,
+                          std::move(entry.command_));
+    }
+    if (leader_commit > server_.commit_index_) {
+      server_.commit_index_ =
+          std::max(server_.commit_index_, std::min(leader_commit, index));
+    }
+    Reply(peer_index, true, index);
+  }
+
+  void OnAppendEntriesReply(size_t peer_index,
+                            Serialization::BlobReader& reader) {
+    const uint64_t term = reader.ReadGolomb();
+    const uint64_t request_id = reader.ReadGolomb();
+    const bool success = reader.ReadBool();
+    const uint64_t index = reader.ReadGolomb();
+    if (!CheckTerm(term) || server_.role_ != Role::Leader ||
+        term != server_.current_term_) {
+      return;
+    }
+    Peer& peer = server_.peers_[peer_index];
+    if (success) {
+      peer.match_index_ = std::max(peer.match_index_, index);
+      peer.next_index_ = std::max(peer.next_index_, peer.match_index_ + 1);
+    } else if (request_id >= peer.first_valid_request_id_) {
+      // The requests that were pipelined after the rejected one will be
+      // rejected as well, so their replies are ignored.
+      // The suggested index can't be after the end of the log.
+      peer.next_index_ = std::min(std::max(index, peer.match_index_ + 1),
+                                  server_.last_index() + 1);
+      peer.snapshot_offset_ = 0;
+      peer.first_valid_request_id_ = peer.next_request_id_;
+    }
+  }
+
+  void OnInstallSnapshot(size_t peer_index, Serialization::BlobReader& reader) {
+    const uint64_t term = reader.ReadGolomb();
+    request_id_ = reader.ReadGolomb();
+    const uint64_t last_index = reader.ReadGolomb();
+    const uint64_t last_term = reader.ReadGolomb();
+    const uint64_t commands_count = reader.ReadGolomb();
+    const SnapshotChunk chunk = ReadSnapshotChunk(reader);
+    if (!CheckTerm(term)) {
+      Reply(peer_index, false, server_.last_index() + 1);
+      return;
+    }
+    if (server_.role_ != Role::Follower)
+      server_.BecomeFollower(term);
+    server_.SetLeader(peer_index);
+    server_.ResetElectionDeadline(now_);
+
+    Snapshot& incoming_snapshot = server_.incoming_snapshot_;
+    if (chunk.offset_ == 0) {
+      incoming_snapshot = {last_index, last_term, commands_count, {}};
+    } else if (incoming_snapshot.last_index_ != last_index ||
+               incoming_snapshot.last_term_ != last_term ||
+               incoming_snapshot.state_.size() != chunk.offset_) {
+      // The previous chunks belong to another snapshot (or weren't received).
+      // The leader will restart the transfer.
+      Reply(peer_index, false, server_.last_index() + 1);
+      return;
+    }
+    incoming_snapshot.state_.append(chunk.data_);
+    // Only the last chunk is acknowledged.
+    if (!chunk.is_last())
+      return;
+    Snapshot snapshot = std::exchange(incoming_snapshot, {});
+
+    const uint64_t index = snapshot.last_index_;
+    if (index > server_.commit_index_) {
+      // Keeping the entries after the snapshot if the log matches it.
+      if (index < server_.last_index() &&
+          server_.TermAt(index) == snapshot.last_term_) {
+        server_.log_.erase(
+            server_.log_.begin(),
+            server_.log_.begin() + (index - server_.snapshot_.last_index_));
+      } else {
+        server_.log_.clear();
+      }
+      server_.snapshot_ = std::move(snapshot);
+      server_.next_snapshot_index_ = index + kSnapshotInterval;
+      server_.commit_index_ = index;
+      server_.delivered_index_ = index;
+      server_.is_snapshot_pending_ = true;
+    }
+    Reply(peer_index, true, index);
+  }
+
+  void Reply(size_t peer_index, bool success, uint64_t index) {
+    Serialization::BlobWriter writer;
+    WriteMessageHeader(writer, *server_.name_, kAppendEntriesReply);
+    writer.WriteGolomb(server_.current_term_);
+    writer.WriteGolomb(request_id_);
+    writer.WriteBool(success);
+    writer.WriteGolomb(index);
+    server_.peers_[peer_index].connection_->SendMessage(writer.Finalize());
+  }
+
+  RaftRSMServer& server_;
+  const RaftClock::time_point now_;
+  // The id of the request that is being processed.
+  uint64_t request_id_{0};
+};
+
+RaftRSMServer::RaftRSMServer(std::string name,
+                             RefPtr<NetworkManager> network_manager,
+                             std::vector<std::string> servers,
+                             size_t own_server_index)
+    : name_{InternedBlob::Create(name)},
+      network_manager_{std::move(network_manager)},
+      own_index_{own_server_index} {
+  if (own_server_index >= servers.size())
+    throw std::invalid_argument("own_server_index is out of range");
+  peers_.resize(servers.size());
+  for (size_t i = 0; i < servers.size(); ++i) {
+    Peer& peer = peers_[i];
+    peer.connection_string_ = InternedBlob::Create(servers[i]);
+    if (i != own_index_) {
+      peer.connection_ =
+          network_manager_->GetConnection(*peer.connection_string_);
+    }
+  }
+  votes_.resize(servers.size());
+  ResetElectionDeadline(RaftClock::now());
+}
+
+CommandId RaftRSMServer::SendCommand(std::string_view command) {
+  return commands_.Push(command);
+}
+
+bool RaftRSMServer::ProcessSingleUpdate(RSMListener& listener) {
+  const auto now = RaftClock::now();
+  bool has_updates = false;
+  std::vector<RSMCommand> commands = commands_.TakeAll();
+  if (!commands.empty()) {
+    has_updates = true;
+    if (role_ == Role::Leader) {
+      for (const RSMCommand& command : commands)
+        AppendEntry(current_term_, true, command);
+    } else if (leader_index_) {
+      SendCommands(*peers_[*leader_index_].connection_, *name_,
+                   commands.begin(), commands.end());
+    }
+    // Kept until committed, since the leader can lose them.
+    std::move(commands.begin(), commands.end(),
+              std::back_inserter(pending_commands_));
+  }
+
+  MessageHandler handler{*this, now};
+  for (size_t i = 0; i < kMaxMessagesPerUpdate; ++i) {
+    if (!network_manager_->PollMessage(handler))
+      break;
+    has_updates = true;
+  }
+
+  if (role_ == Role::Leader) {
+    Replicate(now);
+    // The entries were sent to the followers before the leader's own copy is
+    // accounted for.
+    peers_[own_index_].match_index_ = last_index();
+    AdvanceCommitIndex();
+  } else if (now >= election_deadline_) {
+    StartElection(now);
+    has_updates = true;
+  }
+
+  if (is_snapshot_pending_) {
+    is_snapshot_pending_ = false;
+    FastForward(listener, snapshot_.state_, kSnapshotChunkSize);
+    has_updates = true;
+  }
+  if (delivered_index_ < commit_index_) {
+    DeliverCommittedEntries(listener);
+    has_updates = true;
+  }
+  if (role_ == Role::Leader)
+    SendToSubscribers(now);
+  TryCompactLog(listener);
+  return has_updates;
+}
+
+uint64_t RaftRSMServer::TermAt(uint64_t index) const noexcept {
+  if (index == snapshot_.last_index_)
+    return snapshot_.last_term_;
+  return EntryAt(index).term_;
+}
+
+uint64_t RaftRSMServer::CommandsCountAt(uint64_t index) const noexcept {
+  if (index == snapshot_.last_index_)
+    return snapshot_.commands_count_;
+  return EntryAt(index).commands_count_;
+}
+
+auto RaftRSMServer::EntryAt(uint64_t index) const noexcept -> const Entry& {
+  assert(index > snapshot_.last_index_ && index <= last_index());
+  return log_[index - snapshot_.last_index_ - 1];
+}
+
+void RaftRSMServer::AppendEntry(uint64_t term,
+                                bool has_command,
+                                RSMCommand command) {
+  const uint64_t commands_count =
+      CommandsCountAt(last_index()) + (has_command ? 1 : 0);
+  log_.push_back({term, commands_count, has_command, std::move(command)});
+}
+
+uint64_t RaftRSMServer::FindEntryIndex(uint64_t commands_count) const
+    noexcept {
+  auto it = std::upper_bound(log_.begin(), log_.end(), commands_count,
+                             [](uint64_t count, const Entry& entry) {
+                               return count < entry.commands_count_;
+                             });
+  return snapshot_.last_index_ + 1 + (it - log_.begin());
+}
+
+std::optional<size_t> RaftRSMServer::FindPeer(
+    const InternedBlob& connection_string) const noexcept {
+  for (size_t i = 0; i < peers_.size(); ++i) {
+    if (i != own_index_ &&
+        peers_[i].connection_string_.get() == &connection_string) {
+      return i;
+    }
+  }
+  return {};
+}
+
+void RaftRSMServer::ResetElectionDeadline(RaftClock::time_point now) {
+  election_deadline_ = now + GetRandomElectionTimeout();
+}
+
+void RaftRSMServer::BecomeFollower(uint64_t term) {
+  if (term > current_term_) {
+    current_term_ = term;
+    voted_for_.reset();
+    leader_index_.reset();
+  }
+  if (role_ == Role::Leader) {
+    // The clients will find the new leader.
+    for (Subscriber& subscriber : subscribers_)
+      SendRedirect(*subscriber.connection_);
+    subscribers_.clear();
+  }
+  role_ = Role::Follower;
+}
+
+void RaftRSMServer::SetLeader(size_t leader_index) {
+  if (leader_index_ == leader_index)
+    return;
+  leader_index_ = leader_index;
+  if (!pending_commands_.empty()) {
+    // The previous leader could have lost the commands.
+    SendCommands(*peers_[leader_index].connection_, *name_,
+                 pending_commands_.begin(), pending_commands_.end());
+  }
+}
+
+void RaftRSMServer::StartElection(RaftClock::time_point now) {
+  ++current_term_;
+  role_ = Role::Candidate;
+  voted_for_ = own_index_;
+  leader_index_.reset();
+  std::fill(votes_.begin(), votes_.end(), false);
+  votes_[own_index_] = true;
+  ResetElectionDeadline(now);
+  if (peers_.size() == 1) {
+    BecomeLeader(now);
+    return;
+  }
+  Serialization::BlobWriter writer;
+  WriteMessageHeader(writer, *name_, kRequestVote);
+  writer.WriteGolomb(current_term_);
+  writer.WriteGolomb(last_index());
+  writer.WriteGolomb(TermAt(last_index()));
+  const std::string_view message = writer.Finalize();
+  for (Peer& peer : peers_) {
+    if (peer.connection_)
+      peer.connection_->SendMessage(message);
+  }
+}
+
+void RaftRSMServer::BecomeLeader(RaftClock::time_point now) {
+  role_ = Role::Leader;
+  leader_index_ = own_index_;
+  for (Peer& peer : peers_) {
+    peer.next_index_ = last_index() + 1;
+    peer.match_index_ = 0;
+    peer.sent_commit_index_ = 0;
+    peer.snapshot_offset_ = 0;
+    peer.first_valid_request_id_ = peer.next_request_id_;
+    peer.last_sent_time_ = {};
+  }
+  // The entries from the previous terms can only be committed together with
+  // an entry from the current term.
+  AppendEntry(current_term_, false, {});
+  for (const RSMCommand& command : pending_commands_)
+    AppendEntry(current_term_, true, command);
+  Replicate(now);
+}
+
+void RaftRSMServer::Replicate(RaftClock::time_point now) {
+  for (Peer& peer : peers_) {
+    if (!peer.connection_)
+      continue;
+    if (peer.next_index_ <= snapshot_.last_index_) {
+      SendSnapshot(peer, now);
+      continue;
+    }
+    const bool can_send_entries =
+        peer.next_index_ <= last_index() &&
+        peer.next_index_ - peer.match_index_ <= kMaxInFlightEntries;
+    if (can_send_entries || peer.sent_commit_index_ < commit_index_ ||
+        now - peer.last_sent_time_ >= kHeartbeatInterval) {
+      SendAppendEntries(peer, now);
+    }
+  }
+}
+
+void RaftRSMServer::SendAppendEntries(Peer& peer, RaftClock::time_point now) {
+  const uint64_t prev_log_index = peer.next_index_ - 1;
+  const uint64_t max_end_index =
+      std::min(last_index(), peer.match_index_ + kMaxInFlightEntries);
+  uint64_t end_index = prev_log_index;
+  size_t bytes_count = 0;
+  while (end_index < max_end_index && bytes_count <= kMaxEntriesBytesPerMessage)
+    bytes_count += EntryAt(++end_index).command_.data_.size();
+
+  Serialization::BlobWriter writer;
+  WriteMessageHeader(writer, *name_, kAppendEntries);
+  writer.WriteGolomb(current_term_);
+  writer.WriteGolomb(peer.next_request_id_++);
+  writer.WriteGolomb(prev_log_index);
+  writer.WriteGolomb(TermAt(prev_log_index));
+  writer.WriteGolomb(commit_index_);
+  writer.WriteGolomb(end_index - prev_log_index);
+  for (uint64_t index = prev_log_index + 1; index <= end_index; ++index) {
+    const Entry& entry = EntryAt(index);
+    writer.WriteGolomb(entry.term_);
+    writer.WriteBool(entry.has_command_);
+    if (entry.has_command_) {
+      WriteCommandId(writer, entry.command_.id_);
+      writer.WriteBytesWithSize(entry.command_.data_);
+    }
+  }
+  peer.connection_->SendMessage(writer.Finalize());
+  // Not waiting for the reply before sending the next entries.
+  peer.next_index_ = end_index + 1;
+  peer.sent_commit_index_ = commit_index_;
+  peer.last_sent_time_ = now;
+}
+
+void RaftRSMServer::SendSnapshot(Peer& peer, RaftClock::time_point now) {
+  // The chunks are not acknowledged (except for the last one), so the
+  // transfer continues on the next updates.
+  for (size_t i = 0; i < kMaxSnapshotChunksPerUpdate; ++i) {
+    Serialization::BlobWriter writer;
+    WriteMessageHeader(writer, *name_, kInstallSnapshot);
+    writer.WriteGolomb(current_term_);
+    writer.WriteGolomb(peer.next_request_id_++);
+    writer.WriteGolomb(snapshot_.last_index_);
+    writer.WriteGolomb(snapshot_.last_term_);
+    writer.WriteGolomb(snapshot_.commands_count_);
+    peer.snapshot_offset_ =
+        WriteSnapshotChunk(writer, snapshot_.state_, peer.snapshot_offset_,
+                           kSnapshotChunkSize);
+    peer.connection_->SendMessage(writer.Finalize());
+    if (peer.snapshot_offset_ == snapshot_.state_.size()) {
+      // The following entries are pipelined after the snapshot.
+      peer.next_index_ = snapshot_.last_index_ + 1;
+      peer.snapshot_offset_ = 0;
+      break;
+    }
+  }
+  peer.sent_commit_index_ = commit_index_;
+  peer.last_sent_time_ = now;
+}
+
+void RaftRSMServer::SendSnapshot(Subscriber& subscriber,
+                                 RaftClock::time_point now) {
+  uint64_t offset = *subscriber.snapshot_offset_;
+  for (size_t i = 0; i < kMaxSnapshotChunksPerUpdate; ++i) {
+    Serialization::BlobWriter writer;
+    WriteMessageHeader(writer, *name_, kSnapshot);
+    writer.WriteGolomb(snapshot_.commands_count_);
+    offset = WriteSnapshotChunk(writer, snapshot_.state_, offset,
+                                kSnapshotChunkSize);
+    subscriber.connection_->SendMessage(writer.Finalize());
+    if (offset == snapshot_.state_.size()) {
+      subscriber.snapshot_offset_.reset();
+      break;
+    }
+    subscriber.snapshot_offset_ = offset;
+  }
+  subscriber.last_sent_time_ = now;
+}
+
+void RaftRSMServer::AdvanceCommitIndex() {
+  // The highest index that is stored by the majority of the servers.
+  std::vector<uint64_t> match_indices;
+  match_indices.reserve(peers_.size());
+  for (const Peer& peer : peers_)
+    match_indices.push_back(peer.match_index_);
+  auto median = match_indices.begin() + match_indices.size() / 2;
+  std::nth_element(match_indices.begin(), median, match_indices.end(),
+                   std::greater<uint64_t>{});
+  const uint64_t index = *median;
+  // Only the entries from the current term are committed by counting the
+  // replicas (the previous ones are committed together with them).
+  if (index > commit_index_ && TermAt(index) == current_term_)
+    commit_index_ = index;
+}
+
+void RaftRSMServer::DeliverCommittedEntries(RSMListener& listener) {
+  for (uint64_t index = delivered_index_ + 1; index <= commit_index_;
+       ++index) {
+    const Entry& entry = EntryAt(index);
+    if (entry.has_command_) {
+      listener.OnEntryCommitted(entry.commands_count_ - 1, entry.command_.id_,
+                                entry.command_.data_);
+      if (!pending_commands_.empty())
+        RemoveCommand(pending_commands_, entry.command_.id_);
+    }
+  }
+  delivered_index_ = commit_index_;
+}
+
+void RaftRSMServer::TryCompactLog(RSMListener& listener) {
+  if (delivered_index_ < next_snapshot_index_ || is_snapshot_pending_)
+    return;
+  next_snapshot_index_ = delivered_index_ + kSnapshotInterval;
+  std::string state;
+  if (!listener.TrySerializeState(state))
+    return;
+  Snapshot snapshot;
+  snapshot.last_index_ = delivered_index_;
+  snapshot.last_term_ = TermAt(delivered_index_);
+  snapshot.commands_count_ = CommandsCountAt(delivered_index_);
+  snapshot.state_ = std::move(state);
+  log_.erase(log_.begin(),
+             log_.begin() + (delivered_index_ - snapshot_.last_index_));
+  snapshot_ = std::move(snapshot);
+  // The interrupted transfers of the previous snapshot start over with the
+  // new one.
+  for (Peer& peer : peers_)
+    peer.snapshot_offset_ = 0;
+  for (Subscriber& subscriber : subscribers_) {
+    if (subscriber.next_index_ <= snapshot_.last_index_) {
+      subscriber.snapshot_offset_ = 0;
+      subscriber.next_index_ = snapshot_.last_index_ + 1;
+    }
+  }
+}
+
+void RaftRSMServer::Subscribe(
+    const InternedBlob& connection_string,
+    uint64_t next_entry_id,
+    const std::optional<SnapshotProgress>& partial_snapshot,
+    RaftClock::time_point now) {
+  auto connection = network_manager_->GetConnection(connection_string);
+  if (role_ != Role::Leader) {
+    SendRedirect(*connection);
+    return;
+  }
+  auto it = std::find_if(subscribers_.begin(), subscribers_.end(),
+                         [&](const Subscriber& subscriber) {
+                           return subscriber.connection_string_.get() ==
+                                  &connection_string;
+                         });
+  if (it == subscribers_.end()) {
+    subscribers_.push_back(
+        {&connection_string, std::move(connection), 0, std::nullopt, now});
+    it = subscribers_.end() - 1;
+  }
+  if (next_entry_id < snapshot_.commands_count_) {
+    // Resuming the interrupted transfer if the client was receiving the same
+    // state (the listeners are expected to serialize the same state the same
+    // way).
+    const bool can_resume =
+        partial_snapshot &&
+        partial_snapshot->commands_count_ == snapshot_.commands_count_ &&
+        partial_snapshot->state_size_ == snapshot_.state_.size() &&
+        partial_snapshot->received_size_ < snapshot_.state_.size();
+    it->snapshot_offset_ = can_resume ? partial_snapshot->received_size_ : 0;
+    it->next_index_ = snapshot_.last_index_ + 1;
+  } else {
+    it->snapshot_offset_.reset();
+    it->next_index_ = FindEntryIndex(next_entry_id);
+  }
+  it->last_sent_time_ = now;
+}
+
+void RaftRSMServer::SendToSubscribers(RaftClock::time_point now) {
+  // The subscribers usually need the same entries, so the last message is
+  // reused.
+  uint64_t message_begin_index = 0;
+  uint64_t message_end_index = 0;
+  std::string message;
+  for (Subscriber& subscriber : subscribers_) {
+    if (subscriber.snapshot_offset_) {
+      SendSnapshot(subscriber, now);
+      // The entries are sent after the last chunk.
+      if (subscriber.snapshot_offset_)
+        continue;
+    }
+    while (subscriber.next_index_ <= commit_index_ ||
+           now - subscriber.last_sent_time_ >= kHeartbeatInterval) {
+      if (subscriber.next_index_ != message_begin_index) {
+        message_begin_index = subscriber.next_index_;
+        message_end_index = message_begin_index;
+        std::vector<const Entry*> entries;
+        size_t bytes_count = 0;
+        while (message_end_index <= commit_index_ &&
+               bytes_count <= kMaxEntriesBytesPerMessage) {
+          const Entry& entry = EntryAt(message_end_index++);
+          if (entry.has_command_) {
+            entries.push_back(&entry);
+            bytes_count += entry.command_.data_.size();
+          }
+        }
+        // Heartbeats have no entries.
+        Serialization::BlobWriter writer;
+        WriteMessageHeader(writer, *name_, kEntries);
+        writer.WriteGolomb(CommandsCountAt(message_begin_index - 1));
+        writer.WriteGolomb(entries.size());
+        for (const Entry* entry : entries) {
+          WriteCommandId(writer, entry->command_.id_);
+          writer.WriteBytesWithSize(entry->command_.data_);
+        }
+        message = writer.Finalize();
+      }
+      subscriber.connection_->SendMessage(message);
+      subscriber.next_index_ = message_end_index;
+      subscriber.last_sent_time_ = now;
+    }
+  }
+}
+
+void RaftRSMServer::SendRedirect(NetworkConnection& connection) {
+  Serialization::BlobWriter writer;
+  WriteMessageHeader(writer, *name_, kRedirect);
+  writer.WriteOptionalGolomb(leader_index_);
+  connection.SendMessage(writer.Finalize());
+}
+
+class RaftRSMClient::MessageHandler : public NetworkListener {
+ public:
+  MessageHandler(RaftRSMClient& client,
+                 RSMListener& listener,
+                 RaftClock::time_point now) noexcept
+      : client_{client}, listener_{listener}, now_{now} {}
+
+  void OnMessage(const InternedBlob& sender_connection_string,
+                 std::string_view data) override {
+    if (&sender_connection_string !=
+        client_.servers_[client_.server_index_].get()) {
+      return;
+    }
+    try {
+      Serialization::BlobReader reader{data};
+      uint64_t type;
+      if (!ReadMessageHeader(reader, *client_.name_, type))
+        return;
+      client_.last_heard_time_ = now_;
+      switch (type) {
+        case kEntries:
+          OnEntries(reader);
+          break;
+        case kSnapshot:
+          OnSnapshot(reader);
+          break;
+        case kRedirect:
+          OnRedirect(reader);
+          break;
+        default:
+          break;
+      }
+    } catch (const std::out_of_range&) {
+      // The rest of the message is malformed. The entries that were already
+      // delivered are kept.
+    }
+  }
+
+ private:
+  void OnEntries(Serialization::BlobReader& reader) {
+    uint64_t id = reader.ReadGolomb();
+    if (id > client_.next_entry_id_) {
+      // Some entries were missed. Subscribing again.
+      client_.SwitchToServer(client_.server_index_, now_);
+      return;
+    }
+    for (uint64_t count = reader.ReadGolomb(); count; --count, ++id) {
+      const CommandId command_id = ReadCommandId(reader);
+      const std::string_view entry = reader.ReadBytesWithSize();
+      if (id == client_.next_entry_id_) {
+        // The incomplete snapshot is no longer needed.
+        client_.partial_snapshot_.reset();
+        listener_.OnEntryCommitted(id, command_id, entry);
+        ++client_.next_entry_id_;
+        if (!client_.in_flight_commands_.empty())
+          RemoveCommand(client_.in_flight_commands_, command_id);
+      }
+    }
+  }
+
+  void OnSnapshot(Serialization::BlobReader& reader) {
+    const uint64_t commands_count = reader.ReadGolomb();
+    const SnapshotChunk chunk = ReadSnapshotChunk(reader);
+    if (commands_count <= client_.next_entry_id_)
+      return;
+    auto& partial_snapshot = client_.partial_snapshot_;
+    if (chunk.offset_ == 0) {
+      partial_snapshot = {commands_count, chunk.state_size_, 0};
+    } else if (!partial_snapshot ||
+               partial_snapshot->commands_count_ != commands_count ||
+               partial_snapshot->state_size_ != chunk.state_size_ ||
+               partial_snapshot->received_size_ != chunk.offset_) {
+      // A chunk of another transfer.
+      return;
+    }
+    listener_.OnLogFastForwardChunk(chunk.offset_, chunk.state_size_,
+                                    chunk.data_);
+    partial_snapshot->received_size_ += chunk.data_.size();
+    if (chunk.is_last()) {
+      partial_snapshot.reset();
+      client_.next_entry_id_ = commands_count;
+    }
+  }
+
+  void OnRedirect(Serialization::BlobReader& reader) {
+    const std::optional<uint64_t> leader_index = reader.ReadOptionalGolomb();
+    if (leader_index && *leader_index < client_.servers_.size() &&
+        *leader_index != client_.server_index_) {
+      client_.SwitchToServer(static_cast<size_t>(*leader_index), now_);
+    } else {
+      // The server doesn't know the leader (yet).
+      client_.retry_time_ = now_ + kRetryInterval;
+    }
+  }
+
+  RaftRSMClient& client_;
+  RSMListener& listener_;
+  const RaftClock::time_point now_;
+};
+
+RaftRSMClient::RaftRSMClient(std::string name,
+                             RefPtr<NetworkManager> network_manager,
+                             std::vector<std::string> servers)
+    : name_{InternedBlob::Create(name)},
+      network_manager_{std::move(network_manager)} {
+  if (servers.empty())
+    throw std::invalid_argument("The list of servers is empty");
+  for (const std::string& server : servers) {
+    servers_.push_back(InternedBlob::Create(server));
+    connections_.push_back(network_manager_->GetConnection(*servers_.back()));
+  }
+  // Spreading the initial requests between the servers.
+  SwitchToServer(RandomDevice::thread_instance()() % servers_.size(),
+                 RaftClock::now());
+}
+
+CommandId RaftRSMClient::SendCommand(std::string_view command) {
+  return commands_.Push(command);
+}
+
+bool RaftRSMClient::ProcessSingleUpdate(RSMListener& listener) {
+  const auto now = RaftClock::now();
+  std::vector<RSMCommand> commands = commands_.TakeAll();
+  if (!commands.empty()) {
+    // If the server is not the leader, the commands will be resent to the
+    // leader.
+    SendCommands(*connections_[server_index_], *name_, commands.begin(),
+                 commands.end());
+    std::move(commands.begin(), commands.end(),
+              std::back_inserter(in_flight_commands_));
+  }
+  MessageHandler handler{*this, listener, now};
+  const bool has_message = network_manager_->PollMessage(handler);
+  if ((retry_time_ && now >= *retry_time_) ||
+      now - last_heard_time_ >= kServerTimeout) {
+    SwitchToServer((server_index_ + 1) % servers_.size(), now);
+  }
+  return has_message;
+}
+
+void RaftRSMClient::SwitchToServer(size_t index, RaftClock::time_point now) {
+  server_index_ = index;
+  retry_time_.reset();
+  last_heard_time_ = now;
+  NetworkConnection& connection = *connections_[index];
+  Serialization::BlobWriter writer;
+  WriteMessageHeader(writer, *name_, kSubscribe);
+  writer.WriteGolomb(next_entry_id_);
+  writer.WriteBool(partial_snapshot_.has_value());
+  if (partial_snapshot_) {
+    writer.WriteGolomb(partial_snapshot_->commands_count_);
+    writer.WriteGolomb(partial_snapshot_->state_size_);
+    writer.WriteGolomb(partial_snapshot_->received_size_);
+  }
+  connection.SendMessage(writer.Finalize());
+  if (!in_flight_commands_.empty()) {
+    SendCommands(connection, *name_, in_flight_commands_.begin(),
+                 in_flight_commands_.end());
+  }
+}
+
+RefPtr<RSMConnection> RSMConnection::ConnectToRaftRSM(
+    std::string name,
+    RefPtr<NetworkManager> network_manager,
+    std::vector<std::string> servers) {
+  return new RaftRSMClient{std::move(name), std::move(network_manager),
+                           std::move(servers)};
+}
+
+RefPtr<RSMConnection> RSMConnection::CreateRaftRSMServer(
+    std::string name,
+    RefPtr<NetworkManager> network_manager,
+    std::vector<std::string> servers,
+    size_t own_server_index) {
+  return new RaftRSMServer{std::move(name), std::move(network_manager),
+                           std::move(servers), own_server_index};
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
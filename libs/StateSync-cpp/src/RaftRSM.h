@@ -0,0 +1,264 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMConnection.h>
+
+#include "src/RSMCommon.h"
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+class NetworkConnection;
+
+using RaftClock = std::chrono::steady_clock;
+
+// One of the servers of a Raft cluster (see "In Search of an Understandable
+// Consensus Algorithm" by Diego Ongaro and John Ousterhout).
+//
+// The log, the current term and the vote are only kept in memory. A restarted
+// server would forget its vote and its acknowledged entries, which breaks the
+// safety guarantees of Raft, so the servers are expected to run for the whole
+// lifetime of the cluster (the list of servers can't be changed either).
+//
+// Replication:
+// * The leader sends all new entries to each follower in one AppendEntries
+//   message (split into several if the entries are large), and doesn't wait
+//   for the acknowledgment before sending the next ones (up to
+//   kMaxInFlightEntries unacknowledged entries per follower). If a follower
+//   rejects the entries, the leader continues from the index suggested by
+//   the follower.
+// * The leader counts its own copy of the log towards the majority only after
+//   the new entries are sent to the followers, so persisting the log can
+//   happen in parallel with the replication.
+// * Each new leader appends an entry without a command, so that the entries
+//   from the previous terms can be committed. Such entries are not delivered
+//   to the listeners (the sequential ids only count the commands).
+// * Every kSnapshotInterval entries, the server attempts to serialize the
+//   state of its listener (see RSMListener::TrySerializeState()), and
+//   discards the entries covered by it. The followers and the clients that
+//   need the discarded entries receive the serialized state instead (see
+//   RSMListener::OnLogFastForwardChunk()).
+// * The serialized state is sent in chunks of kSnapshotChunkSize bytes, up to
+//   kMaxSnapshotChunksPerUpdate chunks per update for each recipient, so the
+//   other messages are not stuck behind it. The clients pass each chunk to the
+//   listener as soon as it arrives, and resume the interrupted transfers from
+//   the received offset.
+//
+// Clients (see RaftRSMClient) subscribe to the leader, which streams the
+// committed entries to them. The servers that are not the leader redirect the
+// clients to the leader.
+//
+// SendCommand() can be called from any thread. ProcessSingleUpdate() is
+// expected to be called regularly (it also drives the timers), from one
+// thread at a time.
+class RaftRSMServer : public RSMConnection {
+ public:
+  RaftRSMServer(std::string name,
+                RefPtr<NetworkManager> network_manager,
+                std::vector<std::string> servers,
+                size_t own_server_index);
+
+  CommandId SendCommand(std::string_view command) override;
+
+  bool ProcessSingleUpdate(RSMListener& listener) override;
+
+  bool is_leader() const noexcept { return role_ == Role::Leader; }
+
+  static constexpr auto kHeartbeatInterval = std::chrono::milliseconds{50};
+  static constexpr auto kMinElectionTimeout = std::chrono::milliseconds{150};
+  static constexpr auto kMaxElectionTimeout = std::chrono::milliseconds{300};
+
+  static constexpr uint64_t kMaxInFlightEntries = 8192;
+  static constexpr uint64_t kSnapshotInterval = 4096;
+
+  // The maximum number of incoming messages processed by one call to
+  // ProcessSingleUpdate().
+  static constexpr size_t kMaxMessagesPerUpdate = 64;
+
+  // The maximum total size of the entries sent in one message (unless it's a
+  // single entry).
+  static constexpr size_t kMaxEntriesBytesPerMessage = 64 * 1024;
+
+  static constexpr size_t kSnapshotChunkSize = 64 * 1024;
+  static constexpr size_t kMaxSnapshotChunksPerUpdate = 16;
+
+ private:
+  class MessageHandler;
+
+  enum class Role { Follower, Candidate, Leader };
+
+  struct Entry {
+    uint64_t term_;
+    // The number of commands in the log up to and including this entry.
+    uint64_t commands_count_;
+    bool has_command_;
+    RSMCommand command_;
+  };
+
+  struct Peer {
+    RefPtr<const InternedBlob> connection_string_;
+    // nullptr for this server.
+    std::shared_ptr<NetworkConnection> connection_;
+
+    // Only used by the leader.
+    uint64_t next_index_{1};
+    uint64_t match_index_{0};
+    uint64_t sent_commit_index_{0};
+    // The offset of the next chunk of snapshot_ to send (while next_index_
+    // is not after snapshot_.last_index_).
+    uint64_t snapshot_offset_{0};
+    // Each AppendEntries and InstallSnapshot request has an id, and the
+    // rejections of the requests sent before the last rejection are ignored.
+    uint64_t next_request_id_{0};
+    uint64_t first_valid_request_id_{0};
+    RaftClock::time_point last_sent_time_;
+  };
+
+  struct Subscriber {
+    RefPtr<const InternedBlob> connection_string_;
+    std::shared_ptr<NetworkConnection> connection_;
+    // The index of the next committed entry to send.
+    uint64_t next_index_{0};
+    // Set while the snapshot is being sent to the subscriber (the entries are
+    // sent after it). The offset of the next chunk to send.
+    std::optional<uint64_t> snapshot_offset_;
+    RaftClock::time_point last_sent_time_;
+  };
+
+  struct Snapshot {
+    uint64_t last_index_{0};
+    uint64_t last_term_{0};
+    uint64_t commands_count_{0};
+    std::string state_;
+  };
+
+  // The log is indexed from 1. The entries up to snapshot_.last_index_ are
+  // discarded.
+  uint64_t last_index() const noexcept {
+    return snapshot_.last_index_ + log_.size();
+  }
+
+  // The index must be in [snapshot_.last_index_, last_index()].
+  uint64_t TermAt(uint64_t index) const noexcept;
+  uint64_t CommandsCountAt(uint64_t index) const noexcept;
+
+  // The index must be in (snapshot_.last_index_, last_index()].
+  const Entry& EntryAt(uint64_t index) const noexcept;
+
+  void AppendEntry(uint64_t term, bool has_command, RSMCommand command);
+
+  // Returns the index of the first entry after the first commands_count
+  // commands.
+  uint64_t FindEntryIndex(uint64_t commands_count) const noexcept;
+
+  std::optional<size_t> FindPeer(const InternedBlob& connection_string) const
+      noexcept;
+
+  void ResetElectionDeadline(RaftClock::time_point now);
+  void BecomeFollower(uint64_t term);
+  void SetLeader(size_t leader_index);
+  void StartElection(RaftClock::time_point now);
+  void BecomeLeader(RaftClock::time_point now);
+
+  // Sends the new entries (or heartbeats) to all followers.
+  void Replicate(RaftClock::time_point now);
+  void SendAppendEntries(Peer& peer, RaftClock::time_point now);
+  void SendSnapshot(Peer& peer, RaftClock::time_point now);
+  void SendSnapshot(Subscriber& subscriber, RaftClock::time_point now);
+  void AdvanceCommitIndex();
+
+  void DeliverCommittedEntries(RSMListener& listener);
+  void TryCompactLog(RSMListener& listener);
+
+  void Subscribe(const InternedBlob& connection_string,
+                 uint64_t next_entry_id,
+                 const std::optional<SnapshotProgress>& partial_snapshot,
+                 RaftClock::time_point now);
+  void SendToSubscribers(RaftClock::time_point now);
+
+  // Tells the sender of a request who the leader is.
+  void SendRedirect(NetworkConnection& connection);
+
+  const RefPtr<const InternedBlob> name_;
+  const RefPtr<NetworkManager> network_manager_;
+  const size_t own_index_;
+  std::vector<Peer> peers_;
+
+  CommandQueue commands_;
+  // Commands sent with SendCommand() that weren't committed yet. They are
+  // sent again to each new leader.
+  std::deque<RSMCommand> pending_commands_;
+
+  Role role_{Role::Follower};
+  uint64_t current_term_{0};
+  std::optional<size_t> voted_for_;
+  std::optional<size_t> leader_index_;
+  std::vector<bool> votes_;
+  RaftClock::time_point election_deadline_;
+
+  std::deque<Entry> log_;
+  Snapshot snapshot_;
+  // The snapshot that is being received from the leader.
+  Snapshot incoming_snapshot_;
+  uint64_t next_snapshot_index_{kSnapshotInterval};
+  uint64_t commit_index_{0};
+  uint64_t delivered_index_{0};
+  // The snapshot was installed, but wasn't delivered to the listener yet.
+  bool is_snapshot_pending_{false};
+
+  std::vector<Subscriber> subscribers_;
+};
+
+// A client of a Raft cluster (see RaftRSMServer).
+// Keeps the commands that were not observed in the committed entries, and
+// resends them when it switches to another server (so they can be appended
+// more than once if the leader fails).
+class RaftRSMClient : public RSMConnection {
+ public:
+  RaftRSMClient(std::string name,
+                RefPtr<NetworkManager> network_manager,
+                std::vector<std::string> servers);
+
+  CommandId SendCommand(std::string_view command) override;
+
+  bool ProcessSingleUpdate(RSMListener& listener) override;
+
+  // The client switches to the next server if it doesn't hear from the
+  // current one for this long (the leader sends heartbeats to the clients).
+  static constexpr auto kServerTimeout = std::chrono::milliseconds{500};
+
+  // The delay before trying the next server if the current one doesn't know
+  // who the leader is.
+  static constexpr auto kRetryInterval = std::chrono::milliseconds{50};
+
+ private:
+  class MessageHandler;
+
+  void SwitchToServer(size_t index, RaftClock::time_point now);
+
+  const RefPtr<const InternedBlob> name_;
+  const RefPtr<NetworkManager> network_manager_;
+  std::vector<RefPtr<const InternedBlob>> servers_;
+  std::vector<std::shared_ptr<NetworkConnection>> connections_;
+
+  CommandQueue commands_;
+  std::deque<RSMCommand> in_flight_commands_;
+
+  size_t server_index_{0};
+  uint64_t next_entry_id_{0};
+  // The snapshot that is being received (the chunks are passed to the
+  // listener as they arrive).
+  std::optional<SnapshotProgress> partial_snapshot_;
+  RaftClock::time_point last_heard_time_;
+  std::optional<RaftClock::time_point> retry_time_;
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -5,17 +5,339 @@
 
 #include <Microsoft/MixedReality/Sharing/StateSync/ReplicatedState.h>
 
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMListener.h>
+
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobWriter.h>
+
 namespace Microsoft::MixedReality::Sharing::StateSync {
+namespace {
+
+// The serialized state starts with the serialized deduplication table,
+// preceded by its size (kTableSizeBytes bytes, little-endian), followed by the
+// serialized state of the storage.
+constexpr size_t kTableSizeBytes = 4;
+
+size_t ReadTableSize(std::string_view data) noexcept {
+  assert(data.size() >= kTableSizeBytes);
+  size_t size = 0;
+  for (size_t i = 0; i < kTableSizeBytes; ++i)
+    size |= size_t{static_cast<uint8_t>(data[i])} << (i * 8);
+  return size;
+}
+
+}  // namespace
+
+class ReplicatedState::Listener : public RSMListener {
+ public:
+  explicit Listener(ReplicatedState& state) noexcept : state_{state} {}
+
+  void OnEntryCommitted(uint64_t,
+                        CommandId command_id,
+                        std::string_view entry) noexcept override {
+    // The incomplete transfer of the state was abandoned.
+    restorer_.reset();
+    // The retries of the commands that were already committed are skipped
+    // without decoding them.
+    if (state_.deduplication_table_.TryRecord(command_id))
+      state_.PushEntry(command_id, entry);
+  }
+
+  void OnLogFastForwardChunk(uint64_t offset,
+                             uint64_t state_size,
+                             std::string_view chunk) noexcept override {
+    if (offset == 0) {
+      restorer_.emplace(state_.storage_.behavior());
+      restored_table_.reset();
+      table_state_.clear();
+      restored_size_ = 0;
+    } else if (!restorer_ || offset != restored_size_) {
+      // Not a continuation of the current transfer, which can't be completed
+      // without the missing chunks.
+      restorer_.reset();
+      return;
+    }
+    restored_size_ += chunk.size();
+    if (!Append(chunk)) {
+      restorer_.reset();
+      state_.has_failed_ = true;
+      return;
+    }
+    if (restored_size_ == state_size) {
+      if (restored_table_)
+        state_.RestoreState(std::move(*restored_table_), *restorer_);
+      else
+        state_.has_failed_ = true;
+      restorer_.reset();
+    }
+  }
 
-ReplicatedState::ReplicatedState(Guid guid, RefPtr<RSMConnection> connection)
-    : guid_{guid}, connection_{std::move(connection)} {}
+  bool TrySerializeState(std::string& state_blob) noexcept override {
+    try {
+      // The state must include all entries delivered so far.
+      state_.ApplyAllEntries();
+      if (state_.has_failed_)
+        return false;
+      Serialization::BlobWriter writer;
+      state_.deduplication_table_.Serialize(writer);
+      const std::string_view table_state = writer.Finalize();
+      for (size_t i = 0; i < kTableSizeBytes; ++i)
+        state_blob.push_back(static_cast<char>(table_state.size() >> (i * 8)));
+      state_blob.append(table_state);
+      state_.storage_.SerializeState(state_blob);
+      return true;
+    } catch (const std::bad_alloc&) {
+      return false;
+    }
+  }
 
-ReplicatedState::~ReplicatedState() noexcept = default;
+ private:
+  // Passes the chunk to the restored deduplication table until it's complete,
+  // and the rest to restorer_. Returns false if the state is malformed, or if
+  // there is not enough memory to restore it.
+  bool Append(std::string_view chunk) noexcept {
+    try {
+      while (!restored_table_ && !chunk.empty()) {
+        const size_t table_state_size =
+            table_state_.size() < kTableSizeBytes
+                ? kTableSizeBytes
+                : kTableSizeBytes + ReadTableSize(table_state_);
+        const size_t taken =
+            std::min(table_state_size - table_state_.size(), chunk.size());
+        table_state_.append(chunk.substr(0, taken));
+        chunk.remove_prefix(taken);
+        if (table_state_.size() > kTableSizeBytes &&
+            table_state_.size() ==
+                kTableSizeBytes + ReadTableSize(table_state_)) {
+          Serialization::BlobReader reader{
+              std::string_view{table_state_}.substr(kTableSizeBytes)};
+          restored_table_.emplace();
+          restored_table_->Deserialize(reader);
+          table_state_ = {};
+        }
+      }
+    } catch (const std::exception&) {
+      return false;
+    }
+    return chunk.empty() || restorer_->Append(chunk);
+  }
+
+  ReplicatedState& state_;
+  // The state that is being received (see OnLogFastForwardChunk()).
+  std::optional<VersionedStorage::Storage::StateRestorer> restorer_;
+  std::optional<CommandDeduplicationTable> restored_table_;
+  // The part of the serialized deduplication table received so far.
+  std::string table_state_;
+  uint64_t restored_size_{0};
+};
+
+ReplicatedState::ReplicatedState(
+    Guid guid,
+    RefPtr<RSMConnection> connection,
+    std::shared_ptr<VersionedStorage::Behavior> behavior,
+    size_t decoding_threads_count)
+    : guid_{guid},
+      connection_{std::move(connection)},
+      listener_{new Listener{*this}},
+      storage_{std::move(behavior)},
+      speculative_state_{std::make_unique<VersionedStorage::SpeculativeOverlay>(
+          storage_.GetSnapshot(),
+          storage_.behavior())} {
+  try {
+    decoding_threads_.reserve(decoding_threads_count);
+    for (size_t i = 0; i < decoding_threads_count; ++i)
+      decoding_threads_.emplace_back([this] { DecodeEntries(); });
+  } catch (...) {
+    {
+      auto lock = std::lock_guard{pending_entries_mutex_};
+      is_stopping_ = true;
+    }
+    entries_to_decode_cv_.notify_all();
+    for (std::thread& thread : decoding_threads_)
+      thread.join();
+    throw;
+  }
+}
+
+ReplicatedState::~ReplicatedState() noexcept {
+  {
+    auto lock = std::lock_guard{pending_entries_mutex_};
+    is_stopping_ = true;
+  }
+  entries_to_decode_cv_.notify_all();
+  for (std::thread& thread : decoding_threads_)
+    thread.join();
+}
 
 RefPtr<ReplicatedState> ReplicatedState::Create(
     Guid guid,
-    RefPtr<RSMConnection> connection) noexcept {
-  return new ReplicatedState{guid, std::move(connection)};
+    RefPtr<RSMConnection> connection,
+    std::shared_ptr<VersionedStorage::Behavior> behavior,
+    size_t decoding_threads_count) {
+  return new ReplicatedState{guid, std::move(connection), std::move(behavior),
+                             decoding_threads_count};
+}
+
+CommandId ReplicatedState::SendTransaction(
+    std::string_view serialized_transaction) {
+  auto lock = std::lock_guard{speculative_state_mutex_};
+  const CommandId command_id = connection_->SendCommand(serialized_transaction);
+  local_transactions_.push_back(
+      {command_id, std::string{serialized_transaction}});
+  speculative_state_->ApplyTransaction(serialized_transaction);
+  published_speculative_state_.reset();
+  return command_id;
+}
+
+std::shared_ptr<const VersionedStorage::SpeculativeOverlay>
+ReplicatedState::GetSpeculativeState() const {
+  auto lock = std::lock_guard{speculative_state_mutex_};
+  if (!published_speculative_state_) {
+    published_speculative_state_ =
+        std::make_shared<const VersionedStorage::SpeculativeOverlay>(
+            *speculative_state_);
+  }
+  return published_speculative_state_;
+}
+
+bool ReplicatedState::ProcessSingleUpdate() {
+  const bool has_updates = connection_->ProcessSingleUpdate(*listener_);
+  const bool applied_entries = ApplyDecodedEntries(!has_updates);
+  return has_updates || applied_entries;
+}
+
+void ReplicatedState::PushEntry(CommandId command_id, std::string_view entry) {
+  {
+    auto lock = std::lock_guard{pending_entries_mutex_};
+    pending_entries_.push_back(
+        {command_id, std::string{entry}, std::nullopt, false, false});
+  }
+  if (!decoding_threads_.empty())
+    entries_to_decode_cv_.notify_one();
+}
+
+void ReplicatedState::DecodeEntries() noexcept {
+  auto lock = std::unique_lock{pending_entries_mutex_};
+  for (;;) {
+    entries_to_decode_cv_.wait(lock, [this] {
+      return is_stopping_ || next_entry_to_decode_ != pending_entries_.size();
+    });
+    if (is_stopping_)
+      return;
+    PendingEntry& entry = pending_entries_[next_entry_to_decode_++];
+    lock.unlock();
+    Decode(entry);
+    lock.lock();
+    entry.is_decoded_ = true;
+    // The applying thread only waits for the oldest entry.
+    if (&entry == &pending_entries_.front())
+      decoded_entries_cv_.notify_one();
+  }
+}
+
+void ReplicatedState::Decode(PendingEntry& entry) noexcept {
+  try {
+    entry.decoded_ = storage_.DecodeTransaction(entry.serialized_transaction_);
+    entry.is_malformed_ = !entry.decoded_;
+  } catch (const std::bad_alloc&) {
+    // Handled as a failure to apply the transaction (see
+    // ApplyDecodedEntries()), since other participants could decode it.
+  }
+}
+
+bool ReplicatedState::ApplyDecodedEntries(bool wait_for_decoding) {
+  std::vector<CommandId> applied_commands;
+  auto lock = std::unique_lock{pending_entries_mutex_};
+  while (!pending_entries_.empty()) {
+    PendingEntry& entry = pending_entries_.front();
+    if (decoding_threads_.empty()) {
+      // The entries are never accessed by other threads.
+      lock.unlock();
+      Decode(entry);
+    } else {
+      if (!entry.is_decoded_) {
+        if (!applied_commands.empty() || !wait_for_decoding)
+          break;
+        decoded_entries_cv_.wait(lock, [&] { return entry.is_decoded_; });
+      }
+      lock.unlock();
+    }
+    // The workers keep decoding the next entries while this one is applied.
+    if (!has_failed_ && !entry.is_malformed_) {
+      has_failed_ =
+          !entry.decoded_ ||
+          storage_.ApplyTransaction(std::move(*entry.decoded_)) ==
+              VersionedStorage::Storage::TransactionResult::
+                  FailedDueToInsufficientResources;
+    }
+    applied_commands.push_back(entry.command_id_);
+    lock.lock();
+    pending_entries_.pop_front();
+    if (next_entry_to_decode_)
+      --next_entry_to_decode_;
+  }
+  lock.unlock();
+  if (applied_commands.empty())
+    return false;
+  RebaseSpeculativeState(applied_commands);
+  return true;
+}
+
+void ReplicatedState::ApplyAllEntries() {
+  // Each call waits for the decoding of the first pending entry.
+  while (ApplyDecodedEntries(true)) {
+  }
+}
+
+void ReplicatedState::RestoreState(
+    CommandDeduplicationTable&& deduplication_table,
+    VersionedStorage::Storage::StateRestorer& restorer) noexcept {
+  try {
+    // The entries that were delivered before the state are covered by it.
+    ApplyAllEntries();
+    if (!storage_.RestoreState(restorer)) {
+      has_failed_ = true;
+      return;
+    }
+    deduplication_table_ = std::move(deduplication_table);
+    // The local transactions that were committed in the skipped entries are
+    // no longer speculative.
+    std::vector<CommandId> committed_commands;
+    {
+      auto lock = std::lock_guard{speculative_state_mutex_};
+      for (const LocalTransaction& transaction : local_transactions_) {
+        if (deduplication_table_.Contains(transaction.command_id_))
+          committed_commands.push_back(transaction.command_id_);
+      }
+    }
+    RebaseSpeculativeState(committed_commands);
+  } catch (const std::bad_alloc&) {
+    has_failed_ = true;
+  }
+}
+
+void ReplicatedState::RebaseSpeculativeState(
+    const std::vector<CommandId>& applied_commands) {
+  auto lock = std::lock_guard{speculative_state_mutex_};
+  // The local transactions are usually committed in the order they were sent,
+  // so the search is expected to stop at the front.
+  for (const CommandId& command_id : applied_commands) {
+    auto it = std::find_if(local_transactions_.begin(),
+                           local_transactions_.end(),
+                           [&](const LocalTransaction& transaction) {
+                             return transaction.command_id_ == command_id;
+                           });
+    if (it != local_transactions_.end())
+      local_transactions_.erase(it);
+  }
+  // The transactions that were rejected, or committed in a different order,
+  // are rolled back by applying the remaining ones again.
+  auto new_state = std::make_unique<VersionedStorage::SpeculativeOverlay>(
+      storage_.GetSnapshot(), storage_.behavior());
+  for (const LocalTransaction& transaction : local_transactions_)
+    new_state->ApplyTransaction(transaction.serialized_transaction_);
+  speculative_state_ = std::move(new_state);
+  published_speculative_state_.reset();
 }
 
 }  // namespace Microsoft::MixedReality::Sharing::StateSync
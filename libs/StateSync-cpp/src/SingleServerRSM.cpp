@@ -0,0 +1,334 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include "src/SingleServerRSM.h"
+
+#include <Microsoft/MixedReality/Sharing/StateSync/NetworkConnection.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/NetworkListener.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/NetworkManager.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMListener.h>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+namespace {
+
+// Each message has the common header (see WriteMessageHeader()), followed by:
+//   Subscribe: next_entry_id
+//   Commands:  count, (command_id, command) * count
+//   Entries:   first_entry_id, count, (command_id, entry) * count
+//   Snapshot:  commands_count, chunk (see WriteSnapshotChunk())
+//   Rejected:  (empty)
+enum MessageType : uint64_t {
+  kSubscribe = 0,
+  kCommands = 1,
+  kEntries = 2,
+  kSnapshot = 3,
+  kRejected = 4,
+};
+
+}  // namespace
+
+SingleServerRSMBase::SingleServerRSMBase(
+    std::string name,
+    RefPtr<NetworkManager> network_manager)
+    : name_{InternedBlob::Create(name)},
+      network_manager_{std::move(network_manager)} {}
+
+CommandId SingleServerRSMBase::SendCommand(std::string_view command) {
+  return commands_.Push(command);
+}
+
+class SingleServerRSM::MessageHandler : public NetworkListener {
+ public:
+  MessageHandler(SingleServerRSM& rsm, RSMListener& listener) noexcept
+      : rsm_{rsm}, listener_{listener} {}
+
+  void OnMessage(const InternedBlob& sender_connection_string,
+                 std::string_view data) override {
+    const size_t log_size = rsm_.log_.size();
+    try {
+      Serialization::BlobReader reader{data};
+      uint64_t type;
+      if (!ReadMessageHeader(reader, *rsm_.name_, type))
+        return;
+      switch (type) {
+        case kSubscribe:
+          rsm_.Subscribe(sender_connection_string, reader.ReadGolomb(),
+                         listener_);
+          break;
+        case kCommands:
+          // The count is not trusted, so the log is not reserved in advance.
+          for (uint64_t count = reader.ReadGolomb(); count; --count) {
+            const CommandId command_id = ReadCommandId(reader);
+            rsm_.log_.push_back(
+                {command_id, std::string{reader.ReadBytesWithSize()}});
+          }
+          break;
+        default:
+          break;
+      }
+    } catch (const std::out_of_range&) {
+      // The message is malformed. Dropping all commands from it.
+      rsm_.log_.resize(log_size);
+    }
+  }
+
+ private:
+  SingleServerRSM& rsm_;
+  RSMListener& listener_;
+};
+
+SingleServerRSM::SingleServerRSM(std::string name,
+                                 RefPtr<NetworkManager> network_manager)
+    : SingleServerRSMBase{std::move(name), std::move(network_manager)} {}
+
+bool SingleServerRSM::ProcessSingleUpdate(RSMListener& listener) {
+  bool has_updates = false;
+  for (RSMCommand& command : commands_.TakeAll())
+    log_.push_back(std::move(command));
+
+  MessageHandler handler{*this, listener};
+  for (size_t i = 0; i < kMaxMessagesPerUpdate; ++i) {
+    if (!network_manager_->PollMessage(handler))
+      break;
+    has_updates = true;
+  }
+
+  const uint64_t begin_id = committed_entries_count_;
+  const uint64_t end_id = snapshot_.commands_count_ + log_.size();
+  if (begin_id == end_id)
+    return has_updates;
+
+  // Everything that was received so far is committed as one batch.
+  SendEntries(begin_id, end_id, {subscribers_.data(), subscribers_.size()});
+  committed_entries_count_ = end_id;
+  for (uint64_t id = begin_id; id != end_id; ++id) {
+    const RSMCommand& entry = EntryAt(id);
+    listener.OnEntryCommitted(id, entry.id_, entry.data_);
+  }
+  if (committed_entries_count_ >= next_snapshot_id_) {
+    next_snapshot_id_ = committed_entries_count_ + kSnapshotInterval;
+    TryCompactLog(listener);
+  }
+  return true;
+}
+
+bool SingleServerRSM::TryCompactLog(RSMListener& listener) {
+  std::string state;
+  if (!listener.TrySerializeState(state))
+    return false;
+  log_.erase(log_.begin(), log_.begin() + (committed_entries_count_ -
+                                           snapshot_.commands_count_));
+  snapshot_.commands_count_ = committed_entries_count_;
+  snapshot_.state_ = std::move(state);
+  return true;
+}
+
+void SingleServerRSM::Subscribe(const InternedBlob& connection_string,
+                                uint64_t next_entry_id,
+                                RSMListener& listener) {
+  auto connection = network_manager_->GetConnection(connection_string);
+  const bool is_ahead = next_entry_id > committed_entries_count_;
+  if (is_ahead && !TryCompactLog(listener)) {
+    // The client has seen entries that this server doesn't have, and can't
+    // be fast-forwarded without the serialized state.
+    Serialization::BlobWriter writer;
+    WriteMessageHeader(writer, *name_, kRejected);
+    connection->SendMessage(writer.Finalize());
+    return;
+  }
+  auto it = std::find_if(subscribers_.begin(), subscribers_.end(),
+                         [&](const Subscriber& subscriber) {
+                           return subscriber.connection_string_.get() ==
+                                  &connection_string;
+                         });
+  if (it == subscribers_.end()) {
+    subscribers_.push_back({&connection_string, std::move(connection)});
+    it = subscribers_.end() - 1;
+  }
+  // The snapshot replaces the state of the listener of the client that is
+  // ahead (it was just taken, so no entries follow it).
+  if (is_ahead || next_entry_id < snapshot_.commands_count_) {
+    SendSnapshot(*it->connection_);
+    next_entry_id = snapshot_.commands_count_;
+  }
+  // The entries that are not committed yet will be sent to all subscribers
+  // together.
+  SendEntries(next_entry_id, committed_entries_count_, {&*it, 1});
+}
+
+void SingleServerRSM::SendSnapshot(NetworkConnection& connection) {
+  uint64_t offset = 0;
+  do {
+    Serialization::BlobWriter writer;
+    WriteMessageHeader(writer, *name_, kSnapshot);
+    writer.WriteGolomb(snapshot_.commands_count_);
+    offset = WriteSnapshotChunk(writer, snapshot_.state_, offset,
+                                kSnapshotChunkSize);
+    connection.SendMessage(writer.Finalize());
+  } while (offset != snapshot_.state_.size());
+}
+
+void SingleServerRSM::SendEntries(uint64_t begin_id,
+                                  uint64_t end_id,
+                                  Span<const Subscriber> subscribers) {
+  if (subscribers.size() == 0)
+    return;
+  while (begin_id != end_id) {
+    // Splitting large batches into several messages.
+    uint64_t chunk_end_id = begin_id + 1;
+    size_t chunk_bytes_count = EntryAt(begin_id).data_.size();
+    while (chunk_end_id != end_id) {
+      chunk_bytes_count += EntryAt(chunk_end_id).data_.size();
+      if (chunk_bytes_count > kMaxEntriesBytesPerMessage)
+        break;
+      ++chunk_end_id;
+    }
+    Serialization::BlobWriter writer;
+    WriteMessageHeader(writer, *name_, kEntries);
+    writer.WriteGolomb(begin_id);
+    writer.WriteGolomb(chunk_end_id - begin_id);
+    for (uint64_t id = begin_id; id != chunk_end_id; ++id) {
+      const RSMCommand& entry = EntryAt(id);
+      WriteCommandId(writer, entry.id_);
+      writer.WriteBytesWithSize(entry.data_);
+    }
+    const std::string_view message = writer.Finalize();
+    for (const Subscriber& subscriber : subscribers)
+      subscriber.connection_->SendMessage(message);
+    begin_id = chunk_end_id;
+  }
+}
+
+class SingleServerRSMClient::MessageHandler : public NetworkListener {
+ public:
+  MessageHandler(SingleServerRSMClient& rsm, RSMListener& listener) noexcept
+      : rsm_{rsm}, listener_{listener} {}
+
+  void OnMessage(const InternedBlob& sender_connection_string,
+                 std::string_view data) override {
+    if (&sender_connection_string != rsm_.server_connection_string_.get())
+      return;
+    try {
+      Serialization::BlobReader reader{data};
+      uint64_t type;
+      if (!ReadMessageHeader(reader, *rsm_.name_, type))
+        return;
+      switch (type) {
+        case kEntries:
+          OnEntries(reader);
+          break;
+        case kSnapshot:
+          OnSnapshot(reader);
+          break;
+        case kRejected:
+          rsm_.is_rejected_ = true;
+          break;
+        default:
+          break;
+      }
+    } catch (const std::out_of_range&) {
+      // The rest of the message is malformed. The entries that were already
+      // delivered are kept.
+    }
+  }
+
+ private:
+  void OnEntries(Serialization::BlobReader& reader) {
+    uint64_t id = reader.ReadGolomb();
+    if (id > rsm_.next_entry_id_ || rsm_.partial_snapshot_) {
+      // Some entries (or chunks) were missed (should never happen with
+      // reliable delivery).
+      return;
+    }
+    for (uint64_t count = reader.ReadGolomb(); count; --count, ++id) {
+      const CommandId command_id = ReadCommandId(reader);
+      const std::string_view entry = reader.ReadBytesWithSize();
+      // Skipping the entries that were already delivered.
+      if (id == rsm_.next_entry_id_) {
+        listener_.OnEntryCommitted(id, command_id, entry);
+        ++rsm_.next_entry_id_;
+      }
+    }
+  }
+
+  // The server only sends the snapshot in response to the subscription, so it
+  // is applied even if the client has seen more entries (the server's state
+  // replaces the state of the listener).
+  void OnSnapshot(Serialization::BlobReader& reader) {
+    const uint64_t commands_count = reader.ReadGolomb();
+    const SnapshotChunk chunk = ReadSnapshotChunk(reader);
+    auto& partial_snapshot = rsm_.partial_snapshot_;
+    if (chunk.offset_ == 0) {
+      partial_snapshot = {commands_count, chunk.state_size_, 0};
+    } else if (!partial_snapshot ||
+               partial_snapshot->commands_count_ != commands_count ||
+               partial_snapshot->state_size_ != chunk.state_size_ ||
+               partial_snapshot->received_size_ != chunk.offset_) {
+      // Not a continuation of the current transfer.
+      return;
+    }
+    listener_.OnLogFastForwardChunk(chunk.offset_, chunk.state_size_,
+                                    chunk.data_);
+    partial_snapshot->received_size_ += chunk.data_.size();
+    if (chunk.is_last()) {
+      partial_snapshot.reset();
+      rsm_.next_entry_id_ = commands_count;
+    }
+  }
+
+  SingleServerRSMClient& rsm_;
+  RSMListener& listener_;
+};
+
+SingleServerRSMClient::SingleServerRSMClient(
+    std::string name,
+    RefPtr<NetworkManager> network_manager,
+    std::string server_connection_string)
+    : SingleServerRSMBase{std::move(name), std::move(network_manager)},
+      server_connection_string_{
+          InternedBlob::Create(server_connection_string)},
+      server_connection_{
+          network_manager_->GetConnection(*server_connection_string_)} {
+  Serialization::BlobWriter writer;
+  WriteMessageHeader(writer, *name_, kSubscribe);
+  writer.WriteGolomb(next_entry_id_);
+  server_connection_->SendMessage(writer.Finalize());
+}
+
+bool SingleServerRSMClient::ProcessSingleUpdate(RSMListener& listener) {
+  std::vector<RSMCommand> commands = commands_.TakeAll();
+  // The commands of a rejected client would be committed without the client
+  // observing them, so they are dropped.
+  if (!commands.empty() && !is_rejected_) {
+    // All pending commands are sent in one message.
+    Serialization::BlobWriter writer;
+    WriteMessageHeader(writer, *name_, kCommands);
+    writer.WriteGolomb(commands.size());
+    for (const RSMCommand& command : commands) {
+      WriteCommandId(writer, command.id_);
+      writer.WriteBytesWithSize(command.data_);
+    }
+    server_connection_->SendMessage(writer.Finalize());
+  }
+  MessageHandler handler{*this, listener};
+  return network_manager_->PollMessage(handler);
+}
+
+RefPtr<RSMConnection> RSMConnection::CreateSingleServerRSM(
+    std::string name,
+    RefPtr<NetworkManager> network_manager) {
+  return new SingleServerRSM{std::move(name), std::move(network_manager)};
+}
+
+RefPtr<RSMConnection> RSMConnection::ConnectToSingleServerRSM(
+    std::string name,
+    RefPtr<NetworkManager> network_manager,
+    std::string server_connection_string) {
+  return new SingleServerRSMClient{std::move(name), std::move(network_manager),
+                                   std::move(server_connection_string)};
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
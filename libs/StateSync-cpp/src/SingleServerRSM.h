@@ -0,0 +1,156 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMConnection.h>
+
+#include "src/RSMCommon.h"
+
+#include <Microsoft/MixedReality/Sharing/Common/InternedBlob.h>
+#include <Microsoft/MixedReality/Sharing/Common/Span.h>
+
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+class NetworkConnection;
+
+// A replicated state machine where a single server owns the log, and all
+// other participants connect to it directly.
+//
+// Commands sent with SendCommand() are queued, and are sent to the server (or
+// appended to the log, if this is the server) by the next call to
+// ProcessSingleUpdate(), so any number of commands can be in flight without
+// waiting for the previous ones to be committed.
+// The server commits all commands it received since the previous update as a
+// single batch of consecutive entries, and sends the whole batch to each
+// client in one message. Each call to ProcessSingleUpdate() delivers a whole
+// batch to the listener.
+//
+// Every kSnapshotInterval entries, the server attempts to serialize the state
+// of its listener (see RSMListener::TrySerializeState()), and discards the
+// entries covered by it. The clients that subscribe later receive the
+// serialized state (in chunks of kSnapshotChunkSize bytes) followed by the
+// entries after it.
+//
+// SendCommand() can be called from any thread. ProcessSingleUpdate() is
+// expected to be called from one thread at a time.
+//
+// The messages are expected to be delivered reliably and in order by the
+// NetworkManager. The messages that belong to other state machines (or are
+// malformed) are ignored.
+class SingleServerRSMBase : public RSMConnection {
+ public:
+  CommandId SendCommand(std::string_view command) override;
+
+ protected:
+  SingleServerRSMBase(std::string name,
+                      RefPtr<NetworkManager> network_manager);
+
+  const RefPtr<const InternedBlob> name_;
+  const RefPtr<NetworkManager> network_manager_;
+  CommandQueue commands_;
+};
+
+// The server side. Keeps the log after the last snapshot, so that new clients
+// can catch up.
+class SingleServerRSM : public SingleServerRSMBase {
+ public:
+  SingleServerRSM(std::string name, RefPtr<NetworkManager> network_manager);
+
+  bool ProcessSingleUpdate(RSMListener& listener) override;
+
+  static constexpr uint64_t kSnapshotInterval = 4096;
+  static constexpr size_t kSnapshotChunkSize = 64 * 1024;
+
+ private:
+  class MessageHandler;
+
+  // The maximum number of incoming messages processed by one call to
+  // ProcessSingleUpdate() (the commands from all of them are committed as one
+  // batch).
+  static constexpr size_t kMaxMessagesPerUpdate = 64;
+
+  // The maximum total size of the entries sent in one message (unless it's a
+  // single entry).
+  static constexpr size_t kMaxEntriesBytesPerMessage = 64 * 1024;
+
+  struct Subscriber {
+    RefPtr<const InternedBlob> connection_string_;
+    std::shared_ptr<NetworkConnection> connection_;
+  };
+
+  struct Snapshot {
+    uint64_t commands_count_{0};
+    std::string state_;
+  };
+
+  // The id must be in [snapshot_.commands_count_, log end).
+  const RSMCommand& EntryAt(uint64_t id) const noexcept {
+    return log_[id - snapshot_.commands_count_];
+  }
+
+  // Serializes the state of the listener (which must have received all
+  // committed entries) and discards the entries covered by it. Returns false
+  // if the listener can't serialize its state.
+  bool TryCompactLog(RSMListener& listener);
+
+  // Sends all committed entries starting from next_entry_id (or the snapshot
+  // and the entries after it, if some of them were discarded) to the sender
+  // of the message, and starts sending it all new entries.
+  // If the sender has seen more entries than were committed (for example, it
+  // was subscribed to another instance of the server), it is fast-forwarded
+  // to the current state, or rejected if the state can't be serialized.
+  void Subscribe(const InternedBlob& connection_string,
+                 uint64_t next_entry_id,
+                 RSMListener& listener);
+
+  void SendSnapshot(NetworkConnection& connection);
+
+  // Encodes the entries once and sends them to all subscribers.
+  void SendEntries(uint64_t begin_id,
+                   uint64_t end_id,
+                   Span<const Subscriber> subscribers);
+
+  // The entries after the snapshot (including the ones that are not
+  // committed yet).
+  std::deque<RSMCommand> log_;
+  Snapshot snapshot_;
+  uint64_t next_snapshot_id_{kSnapshotInterval};
+
+  // The entries before this one were sent to all subscribers and delivered
+  // to the local listener.
+  uint64_t committed_entries_count_{0};
+
+  std::vector<Subscriber> subscribers_;
+};
+
+// The client side. Receives the entries committed by the server.
+class SingleServerRSMClient : public SingleServerRSMBase {
+ public:
+  SingleServerRSMClient(std::string name,
+                        RefPtr<NetworkManager> network_manager,
+                        std::string server_connection_string);
+
+  bool ProcessSingleUpdate(RSMListener& listener) override;
+
+ private:
+  class MessageHandler;
+
+  const RefPtr<const InternedBlob> server_connection_string_;
+  const std::shared_ptr<NetworkConnection> server_connection_;
+
+  uint64_t next_entry_id_{0};
+  // The snapshot that is being received (the chunks are passed to the
+  // listener as they arrive).
+  std::optional<SnapshotProgress> partial_snapshot_;
+  // The server rejected the subscription, so no entries will be delivered.
+  bool is_rejected_{false};
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
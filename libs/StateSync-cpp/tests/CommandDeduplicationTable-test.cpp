@@ -0,0 +1,132 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include <Microsoft/MixedReality/Sharing/StateSync/CommandDeduplicationTable.h>
+
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobWriter.h>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+TEST(CommandDeduplicationTable, retries_are_detected) {
+  CommandDeduplicationTable table;
+  CommandId id = CommandId::GenerateRandom();
+  const CommandId first_id = id;
+  std::vector<CommandId> ids;
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(table.TryRecord(id));
+    ids.push_back(id);
+    ++id;
+  }
+  for (const CommandId& retried_id : ids)
+    EXPECT_FALSE(table.TryRecord(retried_id));
+  EXPECT_EQ(table.senders_count(), 1);
+
+  // Commands of another sender are independent.
+  CommandId other_id = first_id;
+  ++other_id.data_[1];
+  EXPECT_TRUE(table.TryRecord(other_id));
+  EXPECT_FALSE(table.TryRecord(other_id));
+  EXPECT_EQ(table.senders_count(), 2);
+}
+
+TEST(CommandDeduplicationTable, reordered_commands_are_recorded) {
+  CommandDeduplicationTable table;
+  const CommandId first_id{{1000, 42}};
+  auto make_id = [&](uint64_t offset) {
+    return CommandId{{first_id.data_[0] + offset, first_id.data_[1]}};
+  };
+  // The command 5 is committed before the commands 1 to 4 (for example, if
+  // it was sent to a new leader before the older ones were resent).
+  EXPECT_TRUE(table.TryRecord(make_id(0)));
+  EXPECT_TRUE(table.TryRecord(make_id(5)));
+  for (uint64_t i = 1; i < 5; ++i)
+    EXPECT_TRUE(table.TryRecord(make_id(i)));
+  for (uint64_t i = 0; i <= 5; ++i)
+    EXPECT_FALSE(table.TryRecord(make_id(i)));
+
+  // The commands that are too old to be tracked are considered duplicates.
+  EXPECT_TRUE(table.TryRecord(make_id(5 + 100)));
+  EXPECT_FALSE(table.TryRecord(make_id(6)));
+  EXPECT_TRUE(
+      table.TryRecord(make_id(5 + 100 - CommandDeduplicationTable::kWindowSize +
+                              1)));
+}
+
+TEST(CommandDeduplicationTable, least_recent_senders_are_evicted) {
+  CommandDeduplicationTable table{3};
+  EXPECT_TRUE(table.TryRecord({{1, 1}}));
+  EXPECT_TRUE(table.TryRecord({{1, 2}}));
+  EXPECT_TRUE(table.TryRecord({{1, 3}}));
+
+  // The sender 1 becomes the most recent one, so the sender 2 is evicted.
+  EXPECT_TRUE(table.TryRecord({{2, 1}}));
+  EXPECT_TRUE(table.TryRecord({{1, 4}}));
+  EXPECT_EQ(table.senders_count(), 3);
+
+  EXPECT_FALSE(table.TryRecord({{1, 1}}));
+  EXPECT_FALSE(table.TryRecord({{1, 3}}));
+  EXPECT_FALSE(table.TryRecord({{1, 4}}));
+  // The retry of the evicted sender can't be detected.
+  EXPECT_TRUE(table.TryRecord({{1, 2}}));
+}
+
+TEST(CommandDeduplicationTable, evicted_senders_are_forgotten) {
+  constexpr uint64_t kCapacity = 100;
+  CommandDeduplicationTable table{kCapacity};
+  // The senders with sequential ids, which share the clusters of the index.
+  for (uint64_t sender_id = 0; sender_id < 10 * kCapacity; ++sender_id) {
+    EXPECT_TRUE(table.TryRecord({{7, sender_id}}));
+    EXPECT_TRUE(table.Contains({{7, sender_id}}));
+  }
+  EXPECT_EQ(table.senders_count(), kCapacity);
+  for (uint64_t sender_id = 0; sender_id < 10 * kCapacity; ++sender_id) {
+    EXPECT_EQ(table.Contains({{7, sender_id}}),
+              sender_id >= 9 * kCapacity);
+  }
+}
+
+TEST(CommandDeduplicationTable, serialized_table_makes_same_decisions) {
+  CommandDeduplicationTable table{3};
+  EXPECT_TRUE(table.TryRecord({{10, 1}}));
+  EXPECT_TRUE(table.TryRecord({{10, 2}}));
+  EXPECT_TRUE(table.TryRecord({{12, 1}}));
+  EXPECT_TRUE(table.TryRecord({{10, 3}}));
+
+  Serialization::BlobWriter writer;
+  table.Serialize(writer);
+  const std::string serialized_table{writer.Finalize()};
+
+  CommandDeduplicationTable restored_table{3};
+  EXPECT_TRUE(restored_table.TryRecord({{1, 4}}));
+  Serialization::BlobReader reader{serialized_table};
+  restored_table.Deserialize(reader);
+  EXPECT_EQ(restored_table.senders_count(), 3);
+  EXPECT_FALSE(restored_table.Contains({{1, 4}}));
+
+  // The sender 2 is the least recent one in both tables.
+  for (auto* checked_table : {&table, &restored_table}) {
+    EXPECT_FALSE(checked_table->TryRecord({{10, 1}}));
+    EXPECT_TRUE(checked_table->TryRecord({{11, 1}}));
+    EXPECT_FALSE(checked_table->TryRecord({{12, 1}}));
+    EXPECT_TRUE(checked_table->TryRecord({{10, 4}}));
+    EXPECT_FALSE(checked_table->Contains({{10, 2}}));
+    EXPECT_TRUE(checked_table->Contains({{10, 3}}));
+  }
+
+  // A smaller table keeps the most recent senders.
+  CommandDeduplicationTable small_table{1};
+  Serialization::BlobReader small_reader{serialized_table};
+  small_table.Deserialize(small_reader);
+  EXPECT_EQ(small_table.senders_count(), 1);
+  EXPECT_TRUE(small_table.Contains({{10, 3}}));
+  EXPECT_FALSE(small_table.Contains({{10, 1}}));
+
+  Serialization::BlobReader truncated_reader{
+      std::string_view{serialized_table}.substr(0, 8)};
+  EXPECT_THROW(restored_table.Deserialize(truncated_reader), std::out_of_range);
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -0,0 +1,735 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMConnection.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMListener.h>
+
+#include "TestNetworkManager.h"
+#include "src/RaftRSM.h"
+#include "src/SingleServerRSM.h"
+
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobWriter.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+namespace {
+
+struct Entry {
+  uint64_t sequential_entry_id_;
+  CommandId command_id_;
+  std::string data_;
+};
+
+bool operator==(const Entry& a, const Entry& b) noexcept {
+  return a.sequential_entry_id_ == b.sequential_entry_id_ &&
+         a.command_id_ == b.command_id_ && a.data_ == b.data_;
+}
+
+// The state is the list of all committed entries.
+class TestListener : public RSMListener {
+ public:
+  explicit TestListener(bool supports_snapshots = false) noexcept
+      : supports_snapshots_{supports_snapshots} {}
+
+  void OnEntryCommitted(uint64_t sequential_entry_id,
+                        CommandId command_id,
+                        std::string_view entry) noexcept override {
+    entries_.push_back({sequential_entry_id, command_id, std::string{entry}});
+  }
+
+  // Assembles the chunks, and replaces the entries with the ones from the
+  // state once it's complete.
+  void OnLogFastForwardChunk(uint64_t offset,
+                             uint64_t state_size,
+                             std::string_view chunk) noexcept override {
+    if (!supports_snapshots_) {
+      ADD_FAILURE() << "Unexpected fast-forward";
+      return;
+    }
+    ++fast_forward_chunks_count_;
+    max_fast_forward_chunk_size_ =
+        std::max(max_fast_forward_chunk_size_, chunk.size());
+    if (offset == 0) {
+      ++fast_forward_transfers_count_;
+      fast_forward_state_.clear();
+    } else if (offset != fast_forward_state_.size()) {
+      ADD_FAILURE() << "The chunk at " << offset << " doesn't continue the "
+                    << fast_forward_state_.size() << " received bytes";
+      return;
+    }
+    fast_forward_state_.append(chunk);
+    if (fast_forward_state_.size() != state_size)
+      return;
+    ++fast_forwards_count_;
+    entries_.clear();
+    Serialization::BlobReader reader{fast_forward_state_};
+    for (uint64_t count = reader.ReadGolomb(); count; --count) {
+      Entry& entry = entries_.emplace_back();
+      entry.sequential_entry_id_ = reader.ReadGolomb();
+      entry.command_id_.data_[0] = reader.ReadBits64(64);
+      entry.command_id_.data_[1] = reader.ReadBits64(64);
+      entry.data_ = reader.ReadBytesWithSize();
+    }
+    fast_forward_state_.clear();
+  }
+
+  bool TrySerializeState(std::string& state_blob) noexcept override {
+    if (!supports_snapshots_)
+      return false;
+    Serialization::BlobWriter writer;
+    writer.WriteGolomb(entries_.size());
+    for (const Entry& entry : entries_) {
+      writer.WriteGolomb(entry.sequential_entry_id_);
+      writer.WriteBits(entry.command_id_.data_[0], 64);
+      writer.WriteBits(entry.command_id_.data_[1], 64);
+      writer.WriteBytesWithSize(entry.data_);
+    }
+    state_blob = writer.Finalize();
+    return true;
+  }
+
+  bool Contains(CommandId command_id) const noexcept {
+    return std::any_of(entries_.begin(), entries_.end(),
+                       [&](const Entry& entry) {
+                         return entry.command_id_ == command_id;
+                       });
+  }
+
+  const bool supports_snapshots_;
+  std::vector<Entry> entries_;
+  size_t fast_forwards_count_{0};
+  size_t fast_forward_transfers_count_{0};
+  size_t fast_forward_chunks_count_{0};
+  size_t max_fast_forward_chunk_size_{0};
+  std::string fast_forward_state_;
+};
+
+}  // namespace
+
+class RSMConnection_Test : public ::testing::Test {
+ protected:
+  RefPtr<NetworkManager> CreateNetworkManager(std::string connection_string) {
+    return new TestNetworkManager{network_, std::move(connection_string)};
+  }
+
+  // Processes the updates of all connections until none of them has any.
+  static void ProcessAllUpdates(
+      std::initializer_list<std::pair<RSMConnection*, TestListener*>>
+          connections) {
+    for (bool has_updates = true; has_updates;) {
+      has_updates = false;
+      for (auto [connection, listener] : connections) {
+        while (connection->ProcessSingleUpdate(*listener))
+          has_updates = true;
+      }
+    }
+  }
+
+  // Processes the updates of all connections until the predicate is
+  // satisfied (the Raft connections have timers, so they always have
+  // something to do). Returns false on timeout.
+  template <typename TPredicate>
+  static bool ProcessUpdatesUntil(
+      const std::vector<std::pair<RSMConnection*, TestListener*>>& connections,
+      TPredicate&& predicate) {
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds{30};
+    while (!predicate()) {
+      if (std::chrono::steady_clock::now() > deadline)
+        return false;
+      for (auto [connection, listener] : connections)
+        connection->ProcessSingleUpdate(*listener);
+    }
+    return true;
+  }
+
+  std::vector<RefPtr<RSMConnection>> CreateRaftServers(size_t count) {
+    std::vector<std::string> server_names;
+    for (size_t i = 0; i < count; ++i)
+      server_names.push_back("server_" + std::to_string(i));
+    std::vector<RefPtr<RSMConnection>> servers;
+    for (size_t i = 0; i < count; ++i) {
+      servers.push_back(RSMConnection::CreateRaftRSMServer(
+          "test_rsm", CreateNetworkManager(server_names[i]), server_names, i));
+    }
+    return servers;
+  }
+
+  RefPtr<RSMConnection> ConnectToRaftServers(std::string connection_string,
+                                             size_t servers_count) {
+    std::vector<std::string> server_names;
+    for (size_t i = 0; i < servers_count; ++i)
+      server_names.push_back("server_" + std::to_string(i));
+    return RSMConnection::ConnectToRaftRSM(
+        "test_rsm", CreateNetworkManager(std::move(connection_string)),
+        std::move(server_names));
+  }
+
+  static size_t FindRaftLeader(
+      const std::vector<RefPtr<RSMConnection>>& servers) {
+    for (size_t i = 0; i < servers.size(); ++i) {
+      if (static_cast<RaftRSMServer&>(*servers[i]).is_leader())
+        return i;
+    }
+    return servers.size();
+  }
+
+  std::shared_ptr<TestNetwork> network_{std::make_shared<TestNetwork>()};
+};
+
+TEST_F(RSMConnection_Test, single_server_rsm) {
+  auto server = RSMConnection::CreateSingleServerRSM(
+      "test_rsm", CreateNetworkManager("server"));
+  auto client_a = RSMConnection::ConnectToSingleServerRSM(
+      "test_rsm", CreateNetworkManager("client_a"), "server");
+  auto client_b = RSMConnection::ConnectToSingleServerRSM(
+      "test_rsm", CreateNetworkManager("client_b"), "server");
+  TestListener server_listener;
+  TestListener listener_a;
+  TestListener listener_b;
+
+  // Many commands are in flight at the same time.
+  std::vector<std::pair<CommandId, std::string>> sent_commands;
+  for (int i = 0; i < 10; ++i) {
+    for (auto connection : {server.get(), client_a.get(), client_b.get()}) {
+      std::string command = "command_" + std::to_string(sent_commands.size());
+      const CommandId command_id = connection->SendCommand(command);
+      sent_commands.emplace_back(command_id, std::move(command));
+    }
+  }
+  ProcessAllUpdates({{server.get(), &server_listener},
+                     {client_a.get(), &listener_a},
+                     {client_b.get(), &listener_b}});
+
+  // All participants observe the same log.
+  ASSERT_EQ(server_listener.entries_.size(), sent_commands.size());
+  EXPECT_EQ(listener_a.entries_, server_listener.entries_);
+  EXPECT_EQ(listener_b.entries_, server_listener.entries_);
+  for (size_t i = 0; i < sent_commands.size(); ++i) {
+    const Entry& entry = server_listener.entries_[i];
+    EXPECT_EQ(entry.sequential_entry_id_, i);
+    auto it = std::find_if(sent_commands.begin(), sent_commands.end(),
+                           [&](const auto& command) {
+                             return command.first == entry.command_id_;
+                           });
+    ASSERT_NE(it, sent_commands.end());
+    EXPECT_EQ(it->second, entry.data_);
+  }
+
+  // The client that connects later receives the entire log.
+  auto client_c = RSMConnection::ConnectToSingleServerRSM(
+      "test_rsm", CreateNetworkManager("client_c"), "server");
+  TestListener listener_c;
+  client_c->SendCommand("late_command");
+  ProcessAllUpdates({{server.get(), &server_listener},
+                     {client_a.get(), &listener_a},
+                     {client_b.get(), &listener_b},
+                     {client_c.get(), &listener_c}});
+  ASSERT_EQ(server_listener.entries_.size(), sent_commands.size() + 1);
+  EXPECT_EQ(server_listener.entries_.back().data_, "late_command");
+  EXPECT_EQ(listener_a.entries_, server_listener.entries_);
+  EXPECT_EQ(listener_b.entries_, server_listener.entries_);
+  EXPECT_EQ(listener_c.entries_, server_listener.entries_);
+}
+
+TEST_F(RSMConnection_Test, single_server_rsm_ignores_other_machines) {
+  auto network_manager = CreateNetworkManager("server");
+  auto server = RSMConnection::CreateSingleServerRSM("rsm_a", network_manager);
+  auto client = RSMConnection::ConnectToSingleServerRSM(
+      "rsm_b", CreateNetworkManager("client"), "server");
+  TestListener server_listener;
+  TestListener client_listener;
+  client->SendCommand("command");
+  ProcessAllUpdates(
+      {{server.get(), &server_listener}, {client.get(), &client_listener}});
+  EXPECT_TRUE(server_listener.entries_.empty());
+  EXPECT_TRUE(client_listener.entries_.empty());
+}
+
+TEST_F(RSMConnection_Test, single_server_rsm_snapshot) {
+  auto server = RSMConnection::CreateSingleServerRSM(
+      "test_rsm", CreateNetworkManager("server"));
+  auto client_a = RSMConnection::ConnectToSingleServerRSM(
+      "test_rsm", CreateNetworkManager("client_a"), "server");
+  TestListener server_listener{true};
+  TestListener listener_a{true};
+  constexpr size_t kCommandsCount = SingleServerRSM::kSnapshotInterval * 2;
+  for (size_t i = 0; i < kCommandsCount; ++i) {
+    server->SendCommand(std::to_string(i));
+    if (i % 256 == 0)
+      server->ProcessSingleUpdate(server_listener);
+  }
+  ProcessAllUpdates(
+      {{server.get(), &server_listener}, {client_a.get(), &listener_a}});
+  ASSERT_EQ(server_listener.entries_.size(), kCommandsCount);
+  EXPECT_EQ(listener_a.entries_, server_listener.entries_);
+  EXPECT_EQ(listener_a.fast_forwards_count_, 0u);
+
+  // The client that connects later receives the serialized state instead of
+  // the discarded entries, followed by the rest of the log.
+  auto client_b = RSMConnection::ConnectToSingleServerRSM(
+      "test_rsm", CreateNetworkManager("client_b"), "server");
+  TestListener listener_b{true};
+  client_b->SendCommand("late_command");
+  ProcessAllUpdates({{server.get(), &server_listener},
+                     {client_a.get(), &listener_a},
+                     {client_b.get(), &listener_b}});
+  ASSERT_EQ(server_listener.entries_.size(), kCommandsCount + 1);
+  EXPECT_EQ(listener_a.entries_, server_listener.entries_);
+  EXPECT_EQ(listener_b.entries_, server_listener.entries_);
+  EXPECT_EQ(listener_b.fast_forwards_count_, 1u);
+  EXPECT_GT(listener_b.fast_forward_chunks_count_, 1u);
+  EXPECT_LE(listener_b.max_fast_forward_chunk_size_,
+            SingleServerRSM::kSnapshotChunkSize);
+}
+
+TEST_F(RSMConnection_Test, single_server_rsm_client_ahead_of_server) {
+  auto server = RSMConnection::CreateSingleServerRSM(
+      "test_rsm", CreateNetworkManager("server"));
+  auto network_manager = CreateNetworkManager("client");
+  auto client = RSMConnection::ConnectToSingleServerRSM(
+      "test_rsm", network_manager, "server");
+  TestListener server_listener{true};
+  TestListener client_listener{true};
+  server->SendCommand("command");
+  ProcessAllUpdates(
+      {{server.get(), &server_listener}, {client.get(), &client_listener}});
+  ASSERT_EQ(client_listener.entries_.size(), 1u);
+
+  // A subscription that claims more entries than the server has committed
+  // (as if the client saw another instance of the server) is fast-forwarded
+  // to the state of the server.
+  client_listener.entries_.push_back({1, {}, "unknown"});
+  Serialization::BlobWriter writer;
+  writer.WriteBytesWithSize("test_rsm");
+  writer.WriteGolomb(0);  // Subscribe
+  writer.WriteGolomb(10);
+  network_manager->GetConnection(*InternedBlob::Create("server"))
+      ->SendMessage(writer.Finalize());
+  ProcessAllUpdates(
+      {{server.get(), &server_listener}, {client.get(), &client_listener}});
+  EXPECT_EQ(client_listener.fast_forwards_count_, 1u);
+  EXPECT_EQ(client_listener.entries_, server_listener.entries_);
+
+  // The client continues from the state of the server.
+  client->SendCommand("next_command");
+  ProcessAllUpdates(
+      {{client.get(), &client_listener}, {server.get(), &server_listener}});
+  ASSERT_EQ(server_listener.entries_.size(), 2u);
+  EXPECT_EQ(client_listener.entries_, server_listener.entries_);
+}
+
+TEST_F(RSMConnection_Test, DISABLED_single_server_rsm_benchmark) {
+  constexpr size_t kClientsCount = 4;
+  constexpr size_t kCommandsPerClient = 200'000;
+  // The number of commands each client keeps in flight.
+  constexpr size_t kPipelineDepth = 256;
+  using Clock = std::chrono::steady_clock;
+
+  auto server = RSMConnection::CreateSingleServerRSM(
+      "benchmark", CreateNetworkManager("server"));
+  std::vector<RefPtr<RSMConnection>> clients;
+  for (size_t i = 0; i < kClientsCount; ++i) {
+    clients.push_back(RSMConnection::ConnectToSingleServerRSM(
+        "benchmark", CreateNetworkManager("client_" + std::to_string(i)),
+        "server"));
+  }
+
+  // Each client observes the commit of its own commands in the order they
+  // were sent, so the latencies are measured with a queue of send times.
+  class LatencyListener : public RSMListener {
+   public:
+    void OnEntryCommitted(uint64_t,
+                          CommandId command_id,
+                          std::string_view) noexcept override {
+      ++committed_entries_count_;
+      if (!in_flight_.empty() && in_flight_.front().first == command_id) {
+        latencies_.push_back(Clock::now() - in_flight_.front().second);
+        in_flight_.pop_front();
+      }
+    }
+
+    void OnLogFastForwardChunk(uint64_t,
+                               uint64_t,
+                               std::string_view) noexcept override {}
+
+    std::deque<std::pair<CommandId, Clock::time_point>> in_flight_;
+    std::vector<Clock::duration> latencies_;
+    uint64_t committed_entries_count_{0};
+  };
+
+  constexpr uint64_t kTotalCommandsCount = kClientsCount * kCommandsPerClient;
+  std::atomic_bool stop_server{false};
+  const std::string command(64, 'x');
+  const auto start = Clock::now();
+  std::thread server_thread{[&] {
+    LatencyListener listener;
+    while (!stop_server.load(std::memory_order_relaxed)) {
+      if (!server->ProcessSingleUpdate(listener))
+        std::this_thread::yield();
+    }
+  }};
+  std::vector<LatencyListener> listeners(kClientsCount);
+  std::vector<std::thread> client_threads;
+  for (size_t i = 0; i < kClientsCount; ++i) {
+    client_threads.emplace_back([&, i] {
+      RSMConnection& client = *clients[i];
+      LatencyListener& listener = listeners[i];
+      size_t sent_count = 0;
+      while (listener.committed_entries_count_ != kTotalCommandsCount) {
+        while (sent_count != kCommandsPerClient &&
+               listener.in_flight_.size() < kPipelineDepth) {
+          const auto now = Clock::now();
+          listener.in_flight_.emplace_back(client.SendCommand(command), now);
+          ++sent_count;
+        }
+        if (!client.ProcessSingleUpdate(listener))
+          std::this_thread::yield();
+      }
+    });
+  }
+  for (auto& thread : client_threads)
+    thread.join();
+  const auto duration = Clock::now() - start;
+  stop_server = true;
+  server_thread.join();
+
+  std::vector<Clock::duration> latencies;
+  for (auto& listener : listeners) {
+    EXPECT_TRUE(listener.in_flight_.empty());
+    latencies.insert(latencies.end(), listener.latencies_.begin(),
+                     listener.latencies_.end());
+  }
+  ASSERT_EQ(latencies.size(), kTotalCommandsCount);
+  std::sort(latencies.begin(), latencies.end());
+  auto to_us = [](Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  };
+  std::cout << kTotalCommandsCount << " commands from " << kClientsCount
+            << " clients (" << kPipelineDepth << " in flight per client) took "
+            << to_us(duration) << "us ("
+            << kTotalCommandsCount * 1'000'000 / std::max<int64_t>(
+                                                     to_us(duration), 1)
+            << " commands/s)\nLatency: p50 "
+            << to_us(latencies[latencies.size() / 2]) << "us, p99 "
+            << to_us(latencies[latencies.size() * 99 / 100]) << "us, max "
+            << to_us(latencies.back()) << "us\n";
+}
+
+TEST_F(RSMConnection_Test, raft_rsm) {
+  auto servers = CreateRaftServers(3);
+  auto client_a = ConnectToRaftServers("client_a", servers.size());
+  auto client_b = ConnectToRaftServers("client_b", servers.size());
+  std::deque<TestListener> listeners(servers.size() + 2);
+  std::vector<std::pair<RSMConnection*, TestListener*>> connections;
+  for (size_t i = 0; i < servers.size(); ++i)
+    connections.emplace_back(servers[i].get(), &listeners[i]);
+  connections.emplace_back(client_a.get(), &listeners[servers.size()]);
+  connections.emplace_back(client_b.get(), &listeners[servers.size() + 1]);
+
+  // The commands are sent before the leader is elected.
+  std::vector<std::pair<CommandId, std::string>> sent_commands;
+  for (int i = 0; i < 100; ++i) {
+    for (auto [connection, listener] : connections) {
+      std::string command = "command_" + std::to_string(sent_commands.size());
+      const CommandId command_id = connection->SendCommand(command);
+      sent_commands.emplace_back(command_id, std::move(command));
+    }
+  }
+  auto all_committed = [&] {
+    for (const TestListener& listener : listeners) {
+      if (listener.entries_.size() < sent_commands.size() ||
+          listener.entries_ != listeners[0].entries_) {
+        return false;
+      }
+    }
+    return true;
+  };
+  ASSERT_TRUE(ProcessUpdatesUntil(connections, all_committed));
+
+  // Without failures, each command is committed exactly once.
+  const auto& entries = listeners[0].entries_;
+  ASSERT_EQ(entries.size(), sent_commands.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const Entry& entry = entries[i];
+    EXPECT_EQ(entry.sequential_entry_id_, i);
+    auto it = std::find_if(sent_commands.begin(), sent_commands.end(),
+                           [&](const auto& command) {
+                             return command.first == entry.command_id_;
+                           });
+    ASSERT_NE(it, sent_commands.end());
+    EXPECT_EQ(it->second, entry.data_);
+  }
+}
+
+TEST_F(RSMConnection_Test, raft_rsm_leader_failure) {
+  auto servers = CreateRaftServers(3);
+  auto client = ConnectToRaftServers("client", servers.size());
+  std::deque<TestListener> listeners(servers.size() + 1);
+  std::vector<std::pair<RSMConnection*, TestListener*>> connections;
+  for (size_t i = 0; i < servers.size(); ++i)
+    connections.emplace_back(servers[i].get(), &listeners[i]);
+  connections.emplace_back(client.get(), &listeners.back());
+
+  const CommandId first_id = client->SendCommand("first");
+  ASSERT_TRUE(ProcessUpdatesUntil(connections, [&] {
+    return std::all_of(listeners.begin(), listeners.end(),
+                       [&](const TestListener& listener) {
+                         return listener.Contains(first_id);
+                       });
+  }));
+
+  // The leader stops responding. Its messages are still in flight.
+  const size_t leader_index = FindRaftLeader(servers);
+  ASSERT_LT(leader_index, servers.size());
+  connections.erase(connections.begin() + leader_index);
+  listeners[leader_index].entries_.clear();
+
+  std::vector<CommandId> sent_ids;
+  for (int i = 0; i < 10; ++i) {
+    for (auto [connection, listener] : connections)
+      sent_ids.push_back(connection->SendCommand("command"));
+  }
+  ASSERT_TRUE(ProcessUpdatesUntil(connections, [&] {
+    for (auto [connection, listener] : connections) {
+      for (const CommandId& id : sent_ids) {
+        if (!listener->Contains(id))
+          return false;
+      }
+      if (listener->entries_ != connections[0].second->entries_)
+        return false;
+    }
+    return true;
+  }));
+  // The old leader doesn't know that it was replaced.
+  servers.erase(servers.begin() + leader_index);
+  EXPECT_LT(FindRaftLeader(servers), servers.size());
+}
+
+TEST_F(RSMConnection_Test, raft_rsm_snapshot) {
+  auto servers = CreateRaftServers(3);
+  std::deque<TestListener> listeners;
+  for (size_t i = 0; i < servers.size() + 1; ++i)
+    listeners.emplace_back(true);
+  std::vector<std::pair<RSMConnection*, TestListener*>> connections;
+  for (size_t i = 0; i < servers.size(); ++i)
+    connections.emplace_back(servers[i].get(), &listeners[i]);
+
+  const CommandId first_id = servers[0]->SendCommand("first");
+  ASSERT_TRUE(ProcessUpdatesUntil(connections, [&] {
+    return listeners[0].Contains(first_id) &&
+           listeners[1].Contains(first_id) && listeners[2].Contains(first_id);
+  }));
+
+  // One of the followers falls behind by more than the leader keeps in the
+  // log.
+  const size_t leader_index = FindRaftLeader(servers);
+  ASSERT_LT(leader_index, servers.size());
+  const size_t paused_index = (leader_index + 1) % servers.size();
+  auto paused_connection = connections[paused_index];
+  connections.erase(connections.begin() + paused_index);
+  constexpr size_t kCommandsCount = RaftRSMServer::kMaxInFlightEntries +
+                                    RaftRSMServer::kSnapshotInterval * 2;
+  CommandId last_id;
+  for (size_t i = 0; i < kCommandsCount; ++i) {
+    last_id = servers[leader_index]->SendCommand(std::to_string(i));
+    if (i % 256 == 0) {
+      for (auto [connection, listener] : connections)
+        connection->ProcessSingleUpdate(*listener);
+    }
+  }
+  ASSERT_TRUE(ProcessUpdatesUntil(connections, [&] {
+    return listeners[leader_index].Contains(last_id);
+  }));
+
+  // The follower and a new client receive the serialized state instead of
+  // the discarded entries.
+  auto client = ConnectToRaftServers("client", servers.size());
+  connections.push_back(paused_connection);
+  connections.emplace_back(client.get(), &listeners.back());
+  ASSERT_TRUE(ProcessUpdatesUntil(connections, [&] {
+    return std::all_of(listeners.begin(), listeners.end(),
+                       [&](const TestListener& listener) {
+                         return listener.entries_ ==
+                                listeners[leader_index].entries_;
+                       });
+  }));
+  EXPECT_EQ(listeners[paused_index].fast_forwards_count_, 1u);
+  EXPECT_EQ(listeners.back().fast_forwards_count_, 1u);
+  // The state is larger than one chunk.
+  for (const TestListener* listener :
+       {&listeners[paused_index], &listeners.back()}) {
+    EXPECT_GT(listener->fast_forward_chunks_count_, 1u);
+    EXPECT_LE(listener->max_fast_forward_chunk_size_,
+              RaftRSMServer::kSnapshotChunkSize);
+  }
+  EXPECT_EQ(listeners[leader_index].entries_.size(), kCommandsCount + 1);
+}
+
+TEST_F(RSMConnection_Test, raft_rsm_resumes_interrupted_snapshot_transfer) {
+  auto servers = CreateRaftServers(1);
+  std::deque<TestListener> listeners;
+  listeners.emplace_back(true);
+  listeners.emplace_back(true);
+  std::vector<std::pair<RSMConnection*, TestListener*>> connections{
+      {servers[0].get(), &listeners[0]}};
+  CommandId last_id;
+  for (size_t i = 0; i < RaftRSMServer::kSnapshotInterval * 2; ++i)
+    last_id = servers[0]->SendCommand(std::to_string(i));
+  ASSERT_TRUE(ProcessUpdatesUntil(
+      connections, [&] { return listeners[0].Contains(last_id); }));
+
+  // The client receives the first chunk of the state, and the rest of the
+  // chunks are lost.
+  RefPtr<TestNetworkManager> client_network_manager =
+      new TestNetworkManager{network_, "client"};
+  auto client = RSMConnection::ConnectToRaftRSM(
+      "test_rsm", client_network_manager, {"server_0"});
+  connections.emplace_back(client.get(), &listeners[1]);
+  ASSERT_TRUE(ProcessUpdatesUntil(connections, [&] {
+    return listeners[1].fast_forward_chunks_count_ != 0;
+  }));
+  client_network_manager->DiscardReceivedMessages();
+  ASSERT_EQ(listeners[1].fast_forward_chunks_count_, 1u);
+  ASSERT_EQ(listeners[1].fast_forwards_count_, 0u);
+
+  // The client notices the gap once the server sends the next entries, and
+  // subscribes again with the received part of the state, so the transfer
+  // continues from the second chunk.
+  ASSERT_TRUE(ProcessUpdatesUntil(connections, [&] {
+    return listeners[1].entries_ == listeners[0].entries_;
+  }));
+  EXPECT_EQ(listeners[1].fast_forward_transfers_count_, 1u);
+  EXPECT_EQ(listeners[1].fast_forwards_count_, 1u);
+  EXPECT_GT(listeners[1].fast_forward_chunks_count_, 1u);
+}
+
+TEST_F(RSMConnection_Test, DISABLED_raft_rsm_benchmark) {
+  constexpr size_t kClientsCount = 4;
+  constexpr size_t kCommandsPerClient = 50'000;
+  // The number of commands each client keeps in flight.
+  constexpr size_t kPipelineDepth = 256;
+  constexpr uint64_t kTotalCommandsCount = kClientsCount * kCommandsPerClient;
+  using Clock = std::chrono::steady_clock;
+
+  class LatencyListener : public RSMListener {
+   public:
+    void OnEntryCommitted(uint64_t,
+                          CommandId command_id,
+                          std::string_view) noexcept override {
+      ++committed_entries_count_;
+      if (!in_flight_.empty() && in_flight_.front().first == command_id) {
+        latencies_.push_back(Clock::now() - in_flight_.front().second);
+        in_flight_.pop_front();
+      }
+    }
+
+    void OnLogFastForwardChunk(uint64_t,
+                               uint64_t,
+                               std::string_view) noexcept override {}
+
+    std::deque<std::pair<CommandId, Clock::time_point>> in_flight_;
+    std::vector<Clock::duration> latencies_;
+    uint64_t committed_entries_count_{0};
+  };
+
+  for (size_t servers_count : {3, 5}) {
+    network_ = std::make_shared<TestNetwork>();
+    auto servers = CreateRaftServers(servers_count);
+    std::vector<RefPtr<RSMConnection>> clients;
+    for (size_t i = 0; i < kClientsCount; ++i) {
+      clients.push_back(ConnectToRaftServers("client_" + std::to_string(i),
+                                             servers_count));
+    }
+
+    // Waiting for the leader to be elected (and for all clients to find it).
+    {
+      std::deque<TestListener> listeners(servers_count + kClientsCount);
+      std::vector<std::pair<RSMConnection*, TestListener*>> connections;
+      for (size_t i = 0; i < servers_count; ++i)
+        connections.emplace_back(servers[i].get(), &listeners[i]);
+      for (size_t i = 0; i < kClientsCount; ++i) {
+        connections.emplace_back(clients[i].get(),
+                                 &listeners[servers_count + i]);
+      }
+      for (auto& client : clients)
+        client->SendCommand("warmup");
+      ASSERT_TRUE(ProcessUpdatesUntil(connections, [&] {
+        return std::all_of(listeners.begin(), listeners.end(),
+                           [&](const TestListener& listener) {
+                             return listener.entries_.size() == kClientsCount;
+                           });
+      }));
+    }
+
+    std::atomic_bool stop_servers{false};
+    const std::string command(64, 'x');
+    const auto start = Clock::now();
+    std::vector<std::thread> server_threads;
+    for (auto& server : servers) {
+      server_threads.emplace_back([&] {
+        LatencyListener listener;
+        while (!stop_servers.load(std::memory_order_relaxed)) {
+          if (!server->ProcessSingleUpdate(listener))
+            std::this_thread::yield();
+        }
+      });
+    }
+    std::vector<LatencyListener> listeners(kClientsCount);
+    std::vector<std::thread> client_threads;
+    for (size_t i = 0; i < kClientsCount; ++i) {
+      client_threads.emplace_back([&, i] {
+        RSMConnection& client = *clients[i];
+        LatencyListener& listener = listeners[i];
+        size_t sent_count = 0;
+        while (sent_count != kCommandsPerClient ||
+               !listener.in_flight_.empty()) {
+          while (sent_count != kCommandsPerClient &&
+                 listener.in_flight_.size() < kPipelineDepth) {
+            const auto now = Clock::now();
+            listener.in_flight_.emplace_back(client.SendCommand(command), now);
+            ++sent_count;
+          }
+          if (!client.ProcessSingleUpdate(listener))
+            std::this_thread::yield();
+        }
+      });
+    }
+    for (auto& thread : client_threads)
+      thread.join();
+    const auto duration = Clock::now() - start;
+    stop_servers = true;
+    for (auto& thread : server_threads)
+      thread.join();
+
+    std::vector<Clock::duration> latencies;
+    for (auto& listener : listeners) {
+      latencies.insert(latencies.end(), listener.latencies_.begin(),
+                       listener.latencies_.end());
+    }
+    ASSERT_EQ(latencies.size(), kTotalCommandsCount);
+    std::sort(latencies.begin(), latencies.end());
+    auto to_us = [](Clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    };
+    std::cout << servers_count << " servers: " << kTotalCommandsCount
+              << " commands from " << kClientsCount << " clients ("
+              << kPipelineDepth << " in flight per client) took "
+              << to_us(duration) << "us ("
+              << kTotalCommandsCount * 1'000'000 /
+                     std::max<int64_t>(to_us(duration), 1)
+              << " commands/s)\nLatency: p50 "
+              << to_us(latencies[latencies.size() / 2]) << "us, p99 "
+              << to_us(latencies[latencies.size() * 99 / 100]) << "us, max "
+              << to_us(latencies.back()) << "us\n";
+  }
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
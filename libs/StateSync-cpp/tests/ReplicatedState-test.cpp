@@ -0,0 +1,311 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMConnection.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/RSMListener.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/ReplicatedState.h>
+
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/KeyDescriptorWithHandle.h>
+
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamWriter.h>
+
+#include "../../VersionedStorage-cpp/tests/TestBehavior.h"
+#include "TestNetworkManager.h"
+#include "src/SingleServerRSM.h"
+
+#include <chrono>
+#include <deque>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+using VersionedStorage::KeyDescriptorWithHandle;
+using VersionedStorage::TestBehavior;
+using VersionedStorage::TransactionBuilder;
+
+class ReplicatedState_Test : public ::testing::Test {
+ protected:
+  ~ReplicatedState_Test() override {
+    behavior_->CheckLeakingHandles();
+    EXPECT_EQ(behavior_.use_count(), 1);
+  }
+
+  KeyDescriptorWithHandle MakeKeyDescriptor(uint64_t id) const noexcept {
+    return {*behavior_, behavior_->MakeKey(id), true};
+  }
+
+  std::string SerializeTransaction(TransactionBuilder& transaction) {
+    Serialization::BitstreamWriter bitstream_writer;
+    std::vector<std::byte> byte_stream;
+    transaction.Serialize(bitstream_writer, byte_stream);
+    std::string result{bitstream_writer.Finalize()};
+    result.append(reinterpret_cast<const char*>(byte_stream.data()),
+                  byte_stream.size());
+    return result;
+  }
+
+  // Each transaction requires the payload written by the previous one, so
+  // the transactions only have an effect if they are applied in order.
+  std::string MakeChainedTransaction(uint64_t index) {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    if (index != 0) {
+      transaction->RequireExactPayload(MakeKeyDescriptor(0), 0,
+                                       behavior_->MakePayload(index - 1));
+    }
+    transaction->Put(MakeKeyDescriptor(0), 0, behavior_->MakePayload(index));
+    transaction->Put(MakeKeyDescriptor(1 + index % 8), index,
+                     behavior_->MakePayload(index));
+    return SerializeTransaction(*transaction);
+  }
+
+  RefPtr<NetworkManager> CreateNetworkManager(std::string connection_string) {
+    return new TestNetworkManager{network_, std::move(connection_string)};
+  }
+
+  std::shared_ptr<TestBehavior> behavior_{std::make_shared<TestBehavior>()};
+  std::shared_ptr<TestNetwork> network_{std::make_shared<TestNetwork>()};
+};
+
+TEST_F(ReplicatedState_Test, applies_committed_transactions_in_order) {
+  constexpr uint64_t kTransactionsCount = 200;
+  {
+    const Guid guid{{1, 2}};
+    // The server decodes the entries on worker threads, and the client
+    // decodes them right before applying.
+    auto server = ReplicatedState::Create(
+        guid,
+        RSMConnection::CreateSingleServerRSM("state",
+                                             CreateNetworkManager("server")),
+        behavior_, 2);
+    auto client = ReplicatedState::Create(
+        guid,
+        RSMConnection::ConnectToSingleServerRSM(
+            "state", CreateNetworkManager("client"), "server"),
+        behavior_, 0);
+
+    for (uint64_t i = 0; i < kTransactionsCount; ++i)
+      client->SendTransaction(MakeChainedTransaction(i));
+
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds{30};
+    while (server->GetSnapshot().version() != kTransactionsCount ||
+           client->GetSnapshot().version() != kTransactionsCount) {
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+      server->ProcessSingleUpdate();
+      client->ProcessSingleUpdate();
+    }
+
+    for (auto* state : {server.get(), client.get()}) {
+      EXPECT_FALSE(state->has_failed());
+      auto snapshot = state->GetSnapshot();
+      EXPECT_EQ(snapshot.keys_count(), 9);
+      EXPECT_EQ(snapshot.subkeys_count(), kTransactionsCount + 1);
+      EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(0), 0).payload(),
+                VersionedStorage::PayloadHandle{kTransactionsCount - 1});
+    }
+  }
+}
+
+namespace {
+
+// Delivers the scripted entries, as if they were committed by another
+// participant.
+class ScriptedRSMConnection : public RSMConnection {
+ public:
+  CommandId SendCommand(std::string_view) override {
+    ADD_FAILURE() << "Unexpected command";
+    return {};
+  }
+
+  bool ProcessSingleUpdate(RSMListener& listener) override {
+    if (entries_.empty())
+      return false;
+    listener.OnEntryCommitted(next_entry_id_++, entries_.front().first,
+                              entries_.front().second);
+    entries_.pop_front();
+    return true;
+  }
+
+  std::deque<std::pair<CommandId, std::string>> entries_;
+  uint64_t next_entry_id_{0};
+};
+
+}  // namespace
+
+TEST_F(ReplicatedState_Test, retried_commands_are_applied_once) {
+  RefPtr<ScriptedRSMConnection> connection = new ScriptedRSMConnection;
+  auto state = ReplicatedState::Create(Guid{{5, 6}}, connection, behavior_, 1);
+
+  // Each transaction is committed twice (the second time after the
+  // following transactions), as it could happen if the sender resent the
+  // transactions after losing the connection to the leader.
+  CommandId command_id = CommandId::GenerateRandom();
+  std::vector<std::pair<CommandId, std::string>> transactions;
+  for (uint64_t i = 0; i < 10; ++i) {
+    transactions.emplace_back(command_id, MakeChainedTransaction(i));
+    ++command_id;
+  }
+  for (size_t i = 0; i < transactions.size(); ++i) {
+    connection->entries_.push_back(transactions[i]);
+    if (i >= 2)
+      connection->entries_.push_back(transactions[i - 2]);
+  }
+  while (state->ProcessSingleUpdate()) {
+  }
+
+  auto snapshot = state->GetSnapshot();
+  EXPECT_EQ(snapshot.version(), transactions.size());
+  EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(0), 0).payload(),
+            VersionedStorage::PayloadHandle{transactions.size() - 1});
+}
+
+TEST_F(ReplicatedState_Test, malformed_transactions_are_skipped) {
+  for (size_t decoding_threads_count : {0, 2}) {
+    RefPtr<ScriptedRSMConnection> connection = new ScriptedRSMConnection;
+    auto state = ReplicatedState::Create(Guid{{7, 8}}, connection, behavior_,
+                                         decoding_threads_count);
+    CommandId command_id = CommandId::GenerateRandom();
+    auto push_entry = [&](std::string entry) {
+      connection->entries_.emplace_back(command_id, std::move(entry));
+      ++command_id;
+    };
+    push_entry(MakeChainedTransaction(0));
+    std::string transaction = MakeChainedTransaction(1);
+    push_entry(transaction.substr(0, transaction.size() - 1));
+    push_entry(transaction + 'x');
+    push_entry(transaction);
+    while (state->ProcessSingleUpdate()) {
+    }
+
+    // The malformed entries don't increment the version.
+    EXPECT_FALSE(state->has_failed());
+    auto snapshot = state->GetSnapshot();
+    EXPECT_EQ(snapshot.version(), 2);
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(0), 0).payload(),
+              VersionedStorage::PayloadHandle{1});
+  }
+}
+
+TEST_F(ReplicatedState_Test, speculative_state_is_rebased_on_commit) {
+  const Guid guid{{3, 4}};
+  auto server = ReplicatedState::Create(
+      guid,
+      RSMConnection::CreateSingleServerRSM("state",
+                                           CreateNetworkManager("server")),
+      behavior_, 0);
+  auto client = ReplicatedState::Create(
+      guid,
+      RSMConnection::ConnectToSingleServerRSM(
+          "state", CreateNetworkManager("client"), "server"),
+      behavior_, 0);
+
+  // Both participants try to claim the same subkey, and the server's
+  // transaction is committed first.
+  auto make_claim = [&](uint64_t owner) {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->RequireMissingSubkey(MakeKeyDescriptor(0), 0);
+    transaction->Put(MakeKeyDescriptor(0), 0, behavior_->MakePayload(owner));
+    transaction->Put(MakeKeyDescriptor(owner), 0,
+                     behavior_->MakePayload(owner));
+    return SerializeTransaction(*transaction);
+  };
+  server->SendTransaction(make_claim(1));
+  client->SendTransaction(make_claim(2));
+
+  // The own transactions are observed before they are committed.
+  {
+    auto speculative_state = client->GetSpeculativeState();
+    EXPECT_EQ(client->GetSnapshot().version(), 0);
+    EXPECT_EQ(speculative_state->version(), 1);
+    EXPECT_EQ(speculative_state->Get(MakeKeyDescriptor(0), 0).payload(),
+              VersionedStorage::PayloadHandle{2});
+    EXPECT_EQ(speculative_state->GetSubkeysCount(MakeKeyDescriptor(2)), 1);
+  }
+
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds{30};
+  while (server->GetSnapshot().version() != 2 ||
+         client->GetSnapshot().version() != 2) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    server->ProcessSingleUpdate();
+    client->ProcessSingleUpdate();
+  }
+
+  // The client's transaction was rejected, so its speculative effects are
+  // rolled back.
+  for (auto* state : {server.get(), client.get()}) {
+    auto speculative_state = state->GetSpeculativeState();
+    EXPECT_EQ(speculative_state->version(), 2);
+    EXPECT_EQ(speculative_state->changed_keys_count(), 0);
+    EXPECT_EQ(speculative_state->Get(MakeKeyDescriptor(0), 0).payload(),
+              VersionedStorage::PayloadHandle{1});
+    EXPECT_EQ(speculative_state->GetSubkeysCount(MakeKeyDescriptor(2)), 0);
+  }
+}
+
+TEST_F(ReplicatedState_Test, late_participant_restores_serialized_state) {
+  // Enough transactions for the server to discard the first ones from the log.
+  constexpr uint64_t kTransactionsCount =
+      SingleServerRSM::kSnapshotInterval + 10;
+  const Guid guid{{7, 8}};
+  auto server = ReplicatedState::Create(
+      guid,
+      RSMConnection::CreateSingleServerRSM("state",
+                                           CreateNetworkManager("server")),
+      behavior_, 2);
+  auto client = ReplicatedState::Create(
+      guid,
+      RSMConnection::ConnectToSingleServerRSM(
+          "state", CreateNetworkManager("client"), "server"),
+      behavior_, 0);
+  // Each transaction adds a subkey (TestBehavior only has 1024 payloads, so
+  // they are reused).
+  auto MakeTransaction = [&](uint64_t index) {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(index % 8), index,
+                     behavior_->MakePayload(index % 1000));
+    return SerializeTransaction(*transaction);
+  };
+  for (uint64_t i = 0; i < kTransactionsCount; ++i)
+    client->SendTransaction(MakeTransaction(i));
+
+  auto ProcessUntilVersion = [](std::initializer_list<ReplicatedState*> states,
+                                uint64_t version) {
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds{30};
+    while (std::any_of(states.begin(), states.end(), [&](auto* state) {
+      return state->GetSnapshot().version() != version;
+    })) {
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+      for (auto* state : states)
+        state->ProcessSingleUpdate();
+    }
+  };
+  ProcessUntilVersion({client.get(), server.get()}, kTransactionsCount);
+
+  // The late participant receives the state of the storage instead of the
+  // discarded entries, and then applies the new transactions on top of it.
+  auto late_client = ReplicatedState::Create(
+      guid,
+      RSMConnection::ConnectToSingleServerRSM(
+          "state", CreateNetworkManager("late_client"), "server"),
+      behavior_, 0);
+  ProcessUntilVersion({late_client.get(), server.get()}, kTransactionsCount);
+  late_client->SendTransaction(MakeTransaction(kTransactionsCount));
+  ProcessUntilVersion({late_client.get(), client.get(), server.get()},
+                      kTransactionsCount + 1);
+
+  for (auto* state : {server.get(), client.get(), late_client.get()}) {
+    EXPECT_FALSE(state->has_failed());
+    auto snapshot = state->GetSnapshot();
+    EXPECT_EQ(snapshot.keys_count(), 8);
+    EXPECT_EQ(snapshot.subkeys_count(), kTransactionsCount + 1);
+    for (uint64_t i : {uint64_t{0}, kTransactionsCount}) {
+      EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(i % 8), i).payload(),
+                VersionedStorage::PayloadHandle{i % 1000});
+    }
+  }
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
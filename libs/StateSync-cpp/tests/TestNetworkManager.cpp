@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include "TestNetworkManager.h"
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+class TestNetworkManager::Connection : public NetworkConnection {
+ public:
+  Connection(std::shared_ptr<TestNetwork> network,
+             RefPtr<const InternedBlob> sender,
+             RefPtr<const InternedBlob> connection_string)
+      : NetworkConnection{std::move(connection_string)},
+        network_{std::move(network)},
+        sender_{std::move(sender)} {}
+
+  void SendMessage(std::string_view message) override {
+    auto lock = std::lock_guard{network_->mutex_};
+    auto it = network_->endpoints_.find(connection_string.get());
+    // Messages to unknown endpoints are lost.
+    if (it != network_->endpoints_.end())
+      it->second->PushMessage(sender_, message);
+  }
+
+ private:
+  const std::shared_ptr<TestNetwork> network_;
+  const RefPtr<const InternedBlob> sender_;
+};
+
+TestNetworkManager::TestNetworkManager(std::shared_ptr<TestNetwork> network,
+                                       std::string connection_string)
+    : connection_string_{InternedBlob::Create(connection_string)},
+      network_{std::move(network)} {
+  auto lock = std::lock_guard{network_->mutex_};
+  network_->endpoints_.emplace(connection_string_.get(), this);
+}
+
+TestNetworkManager::~TestNetworkManager() noexcept {
+  auto lock = std::lock_guard{network_->mutex_};
+  network_->endpoints_.erase(connection_string_.get());
+}
+
+std::shared_ptr<NetworkConnection> TestNetworkManager::GetConnection(
+    const InternedBlob& connection_string) {
+  return std::make_shared<Connection>(network_, connection_string_,
+                                      &connection_string);
+}
+
+bool TestNetworkManager::PollMessage(NetworkListener& listener) {
+  Message message;
+  {
+    auto lock = std::lock_guard{inbox_mutex_};
+    if (inbox_.empty())
+      return false;
+    message = std::move(inbox_.front());
+    inbox_.pop_front();
+  }
+  listener.OnMessage(*message.sender_, message.data_);
+  return true;
+}
+
+void TestNetworkManager::DiscardReceivedMessages() {
+  auto lock = std::lock_guard{inbox_mutex_};
+  inbox_.clear();
+}
+
+void TestNetworkManager::PushMessage(const RefPtr<const InternedBlob>& sender,
+                                     std::string_view data) {
+  auto lock = std::lock_guard{inbox_mutex_};
+  inbox_.push_back({sender, std::string{data}});
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -0,0 +1,65 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <Microsoft/MixedReality/Sharing/StateSync/NetworkConnection.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/NetworkListener.h>
+#include <Microsoft/MixedReality/Sharing/StateSync/NetworkManager.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+class TestNetworkManager;
+
+// In-process network that delivers messages between TestNetworkManager
+// objects reliably and in order.
+class TestNetwork {
+ private:
+  std::mutex mutex_;
+  std::map<const InternedBlob*, TestNetworkManager*> endpoints_;
+
+  friend class TestNetworkManager;
+};
+
+// Network manager that is reachable by other endpoints of the same TestNetwork
+// through its connection string.
+class TestNetworkManager : public NetworkManager {
+ public:
+  TestNetworkManager(std::shared_ptr<TestNetwork> network,
+                     std::string connection_string);
+  ~TestNetworkManager() noexcept override;
+
+  std::shared_ptr<NetworkConnection> GetConnection(
+      const InternedBlob& connection_string) override;
+
+  bool PollMessage(NetworkListener& listener) override;
+
+  // Discards the received messages that were not polled yet, as if they were
+  // lost by the network.
+  void DiscardReceivedMessages();
+
+  const RefPtr<const InternedBlob> connection_string_;
+
+ private:
+  class Connection;
+
+  struct Message {
+    RefPtr<const InternedBlob> sender_;
+    std::string data_;
+  };
+
+  void PushMessage(const RefPtr<const InternedBlob>& sender,
+                   std::string_view data);
+
+  const std::shared_ptr<TestNetwork> network_;
+
+  std::mutex inbox_mutex_;
+  std::deque<Message> inbox_;
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
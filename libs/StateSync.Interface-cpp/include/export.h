@@ -13,4 +13,9 @@
 #elif defined(__ANDROID__)
 #define MRS_API __attribute__((visibility("default")))
 #define MRS_CALL __attribute__((stdcall))
+#else
+// stdcall only exists on 32-bit x86, and other platforms have a single calling
+// convention.
+#define MRS_API __attribute__((visibility("default")))
+#define MRS_CALL
 #endif
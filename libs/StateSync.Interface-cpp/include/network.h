@@ -11,17 +11,29 @@ struct mrsChannel {};
 // 0 = success, otherwise failure
 using Result = int;
 
+// Returned by mrsChannelSendMessage when the ordered channel has too many
+// messages waiting for the credit granted by the receiver (the message is not
+// sent, and can be retried later).
+constexpr Result kMrsResultWouldBlock = 2;
+
 enum class mrsChannelType : unsigned char { kUnordered, kOrdered };
 
 extern "C" {
 
+// Binds the sockets to a free port.
 MRS_API Result MRS_CALL mrsInit();
+// Binds the sockets to the port (0 picks a free port, like mrsInit()).
+MRS_API Result MRS_CALL mrsInitWithPort(uint16_t port);
 MRS_API Result MRS_CALL mrsQuit();
 
+// The port the sockets are bound to. The ID of this endpoint is
+// "<IPv4 address>:<port>".
+MRS_API Result MRS_CALL mrsGetLocalPort(uint16_t* port_out);
+
 // IEndpoint
 
 // Get a reference to an IEndpoint. Release with mrsReleaseEndpoint when
-// finished.
+// finished. The ID is "<IPv4 address>:<port>".
 MRS_API Result MRS_CALL mrsAcquireEndpoint(const char* id,
                                            uint32_t id_size,
                                            mrsEndpoint** endpoint_out);
@@ -59,6 +71,18 @@ MRS_API Result MRS_CALL mrsCategoryStopListening(mrsChannelCategory* category);
 
 MRS_API Result MRS_CALL mrsDisposeCategory(mrsChannelCategory* category);
 
+// The share of the bandwidth to an endpoint that the ordered messages of the
+// category get while the messages of several categories are waiting
+// (relative to the weights of the other categories, 1 by default).
+MRS_API Result MRS_CALL mrsSetCategoryWeight(mrsChannelCategory* category,
+                                             uint32_t weight);
+
+// The size of the received ordered messages that each sender can have in
+// flight (sent, but not taken from the queue of the category). 1 MiB by
+// default.
+MRS_API Result MRS_CALL
+mrsSetCategoryCreditWindow(mrsChannelCategory* category, uint32_t size);
+
 struct mrsMessage {
   mrsEndpoint* sender;
   mrsChannelCategory* category;
@@ -84,7 +108,7 @@ MRS_API Result MRS_CALL mrsDisposeMessages(mrsMessage* messages,
 // IChannel
 
 // Destroy with mrsDisposeChannel.
-MRS_API Result MRS_CALL mrsCreateChannel(mrsChannelCategory category,
+MRS_API Result MRS_CALL mrsCreateChannel(mrsChannelCategory* category,
                                          mrsEndpoint* endpoint,
                                          mrsChannel** channel_out);
 
@@ -99,8 +123,15 @@ MRS_API Result MRS_CALL mrsIsChannelOk(mrsChannel* channel, uint8_t* ok_out);
 MRS_API Result MRS_CALL mrsGetChannelSendQueueCount(mrsChannel* channel,
                                                     uint32_t* count_out);
 
+// The size of the messages the channel can send before it has to wait for the
+// receiver to grant more credit.
+MRS_API Result MRS_CALL mrsGetChannelSendCredit(mrsChannel* channel,
+                                                uint32_t* size_out);
+
 MRS_API Result MRS_CALL mrsChannelReconnect(mrsChannel* channel);
 
+// Returns kMrsResultWouldBlock if the channel has too many messages waiting
+// for credit.
 MRS_API Result MRS_CALL mrsChannelSendMessage(mrsChannel* channel,
                                               const char* payload,
                                               uint32_t payload_size);
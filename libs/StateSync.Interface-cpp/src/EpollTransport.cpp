@@ -0,0 +1,1110 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include "src/EpollTransport.h"
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <optional>
+#include <system_error>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+namespace {
+
+constexpr size_t kFrameHeaderSize = 4;
+constexpr size_t kReadChunkSize = 64 * 1024;
+
+// The first frame of each connection:
+// <port of the sending transport, 2 bytes><connection id, 8 bytes>
+constexpr size_t kHelloFrameSize = 10;
+
+// The first byte of each frame after the hello frame.
+enum class FrameKind : char {
+  // <category name size><category name><payload>
+  kMessage = 0,
+  // <category name size><category name><connection id, 8 bytes>
+  // <granted size, 8 bytes>
+  kCredit = 1,
+};
+
+size_t ReadFrameSize(const char* data) noexcept {
+  const auto* header = reinterpret_cast<const uint8_t*>(data);
+  return header[0] | (header[1] << 8) | (header[2] << 16) |
+         (uint32_t{header[3]} << 24);
+}
+
+void AppendUint64(std::string& data, uint64_t value) {
+  for (int i = 0; i < 8; ++i)
+    data += static_cast<char>(value >> (i * 8));
+}
+
+uint64_t ReadUint64(const char* data) noexcept {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i)
+    value |= uint64_t{static_cast<uint8_t>(data[i])} << (i * 8);
+  return value;
+}
+
+// Returns the category name of "<category name size><category name>
+// <payload>", or std::nullopt if the message is too short.
+std::optional<std::string_view> ReadCategoryName(
+    std::string_view message) noexcept {
+  if (message.empty())
+    return std::nullopt;
+  const size_t name_size = static_cast<uint8_t>(message[0]);
+  if (message.size() < 1 + name_size)
+    return std::nullopt;
+  return message.substr(1, name_size);
+}
+
+}  // namespace
+
+struct Endpoint::Connection {
+  // The ordered messages of a category queued to the connection.
+  struct OutgoingCategory {
+    bool can_send() const noexcept {
+      return scheduled_size_ != frames_.size() && sent_size_ < granted_size_;
+    }
+
+    std::string name_;
+    uint32_t weight_;
+    // The frames of the queued messages start at scheduled_size_.
+    std::string frames_;
+    size_t scheduled_size_{0};
+    uint32_t queued_messages_count_{0};
+    // The total size of the scheduled message frames (without headers), and
+    // its limit granted by the receiver. A message can be scheduled if the
+    // limit is not reached yet (so it is exceeded by at most one message).
+    uint64_t sent_size_{0};
+    uint64_t granted_size_{EpollTransport::kInitialCredit};
+    uint64_t deficit_{0};
+  };
+
+  Connection(Endpoint* endpoint, bool is_outgoing) noexcept
+      : endpoint_{endpoint}, is_outgoing_{is_outgoing} {}
+
+  OutgoingCategory& GetCategory(std::string_view name) {
+    for (OutgoingCategory& category : categories_) {
+      if (category.name_ == name)
+        return category;
+    }
+    auto& category = categories_.emplace_back();
+    category.name_ = name;
+    category.weight_ = ChannelCategory::kDefaultWeight;
+    return category;
+  }
+
+  bool has_data_to_write() const noexcept {
+    if (!control_frames_.empty())
+      return true;
+    for (const OutgoingCategory& category : categories_) {
+      if (category.can_send())
+        return true;
+    }
+    return false;
+  }
+
+  // Moves the control frames and the messages the receiver has credit for to
+  // the output. The categories are interleaved with deficit round robin, and
+  // the scheduling stops after about kMaxWriteSize bytes, so the messages
+  // queued later still have a chance to be sent first.
+  void ScheduleFrames(std::string& output) {
+    output += control_frames_;
+    control_frames_.clear();
+    bool has_sendable_categories = !categories_.empty();
+    while (has_sendable_categories &&
+           output.size() < EpollTransport::kMaxWriteSize) {
+      has_sendable_categories = false;
+      for (size_t i = 0; i < categories_.size() &&
+                         output.size() < EpollTransport::kMaxWriteSize;
+           ++i) {
+        OutgoingCategory& category = categories_[next_category_index_];
+        next_category_index_ = (next_category_index_ + 1) % categories_.size();
+        if (!category.can_send()) {
+          category.deficit_ = 0;
+          continue;
+        }
+        has_sendable_categories = true;
+        category.deficit_ += uint64_t{EpollTransport::kQuantum} *
+                             category.weight_;
+        while (category.can_send() &&
+               output.size() < EpollTransport::kMaxWriteSize) {
+          const size_t frame_size =
+              kFrameHeaderSize +
+              ReadFrameSize(category.frames_.data() + category.scheduled_size_);
+          if (frame_size > category.deficit_)
+            break;
+          output.append(category.frames_, category.scheduled_size_,
+                        frame_size);
+          category.scheduled_size_ += frame_size;
+          category.deficit_ -= frame_size;
+          category.sent_size_ += frame_size - kFrameHeaderSize;
+          --category.queued_messages_count_;
+        }
+        if (category.scheduled_size_ == category.frames_.size()) {
+          category.frames_.clear();
+          category.scheduled_size_ = 0;
+          category.deficit_ = 0;
+        } else if (category.scheduled_size_ > category.frames_.size() / 2) {
+          category.frames_.erase(0, category.scheduled_size_);
+          category.scheduled_size_ = 0;
+        }
+      }
+    }
+  }
+
+  // Discards the queued messages and the credit (the receiver resets the
+  // credit when the connection is closed).
+  void Reset() noexcept {
+    for (OutgoingCategory& category : categories_) {
+      category.frames_.clear();
+      category.scheduled_size_ = 0;
+      category.queued_messages_count_ = 0;
+      category.sent_size_ = 0;
+      category.granted_size_ = EpollTransport::kInitialCredit;
+      category.deficit_ = 0;
+    }
+    control_frames_.clear();
+  }
+
+  // The remote endpoint. For the incoming connections it is set by the hello
+  // frame (the connection is opened from an ephemeral port).
+  Endpoint* endpoint_;
+  const bool is_outgoing_;
+
+  // Guarded by the mutex of the transport.
+  std::vector<OutgoingCategory> categories_;
+  size_t next_category_index_{0};
+  // The credit granted to the remote endpoint, sent before the messages.
+  std::string control_frames_;
+  bool is_flush_requested_{false};
+  bool has_failed_{false};
+  // The outgoing connections get a new id each time they are opened, and send
+  // it in the hello frame (which sets the id of the incoming connection on the
+  // other side). The credit frames carry the id of the connection they grant
+  // the credit for.
+  uint64_t id_{0};
+
+  // Only accessed by the I/O thread.
+  int socket_{-1};
+  sockaddr_in peer_address_{};
+  bool is_connected_{false};
+  bool is_writable_{false};
+  std::string writing_data_;
+  size_t written_size_{0};
+  std::vector<char> read_buffer_;
+  size_t read_size_{0};
+};
+
+namespace {
+
+uint64_t GetAddressKey(const sockaddr_in& address) noexcept {
+  return (uint64_t{ntohl(address.sin_addr.s_addr)} << 16) |
+         ntohs(address.sin_port);
+}
+
+[[noreturn]] void ThrowSystemError(const char* what) {
+  throw std::system_error{errno, std::generic_category(), what};
+}
+
+void CloseSocket(int& fd) noexcept {
+  if (fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+void AppendFrameHeader(std::string& data, size_t body_size) {
+  const auto size = static_cast<uint32_t>(body_size);
+  const char header[kFrameHeaderSize]{
+      static_cast<char>(size), static_cast<char>(size >> 8),
+      static_cast<char>(size >> 16), static_cast<char>(size >> 24)};
+  data.append(header, kFrameHeaderSize);
+}
+
+void AppendMessage(std::string& data,
+                   std::string_view category_name,
+                   std::string_view payload) {
+  data += static_cast<char>(category_name.size());
+  data += category_name;
+  data += payload;
+}
+
+// The size of the frame body, which is also the amount of credit used by the
+// message.
+size_t GetMessageFrameSize(std::string_view category_name,
+                           size_t payload_size) noexcept {
+  return 2 + category_name.size() + payload_size;
+}
+
+}  // namespace
+
+Endpoint::Endpoint(const sockaddr_in& address) : address_{address} {
+  char host[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+  id_ = host;
+  id_ += ':';
+  id_ += std::to_string(ntohs(address.sin_port));
+}
+
+ChannelCategory::ChannelCategory(std::string name, mrsChannelType type)
+    : name_{std::move(name)}, type_{type} {
+  if (name_.size() > EpollTransport::kMaxCategoryNameSize)
+    throw std::invalid_argument{"The category name is too long"};
+}
+
+EpollTransport::EpollTransport(uint16_t port) {
+  try {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1)
+      ThrowSystemError("epoll_create1");
+    wake_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_event_fd_ == -1)
+      ThrowSystemError("eventfd");
+
+    // If the port is picked by the system for the UDP socket, it can be taken
+    // for TCP, so a few ports are tried.
+    for (int attempt = 0;; ++attempt) {
+      sockaddr_in address{};
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_ANY);
+      address.sin_port = htons(port);
+      udp_socket_ =
+          socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (udp_socket_ == -1)
+        ThrowSystemError("socket");
+      if (bind(udp_socket_, reinterpret_cast<sockaddr*>(&address),
+               sizeof(address)) != 0) {
+        ThrowSystemError("bind");
+      }
+      socklen_t address_size = sizeof(address);
+      getsockname(udp_socket_, reinterpret_cast<sockaddr*>(&address),
+                  &address_size);
+
+      listening_socket_ =
+          socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listening_socket_ == -1)
+        ThrowSystemError("socket");
+      const int reuse_address = 1;
+      setsockopt(listening_socket_, SOL_SOCKET, SO_REUSEADDR, &reuse_address,
+                 sizeof(reuse_address));
+      if (bind(listening_socket_, reinterpret_cast<sockaddr*>(&address),
+               sizeof(address)) == 0) {
+        port_ = ntohs(address.sin_port);
+        break;
+      }
+      if (port != 0 || errno != EADDRINUSE || attempt == 16)
+        ThrowSystemError("bind");
+      CloseSocket(udp_socket_);
+      CloseSocket(listening_socket_);
+    }
+    if (listen(listening_socket_, SOMAXCONN) != 0)
+      ThrowSystemError("listen");
+
+    // Larger buffers make bursts of datagrams less likely to be dropped.
+    const int buffer_size = 4 * 1024 * 1024;
+    setsockopt(udp_socket_, SOL_SOCKET, SO_RCVBUF, &buffer_size,
+               sizeof(buffer_size));
+    setsockopt(udp_socket_, SOL_SOCKET, SO_SNDBUF, &buffer_size,
+               sizeof(buffer_size));
+
+    // The sockets are edge-triggered, so they are always read (or written)
+    // until EAGAIN.
+    auto add_to_epoll = [this](int fd, void* tag, uint32_t events) {
+      epoll_event event{};
+      event.events = events;
+      event.data.ptr = tag;
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0)
+        ThrowSystemError("epoll_ctl");
+    };
+    add_to_epoll(wake_event_fd_, &wake_event_fd_, EPOLLIN);
+    add_to_epoll(udp_socket_, &udp_socket_, EPOLLIN | EPOLLOUT | EPOLLET);
+    add_to_epoll(listening_socket_, &listening_socket_, EPOLLIN | EPOLLET);
+
+    datagram_buffers_.resize(kMaxDatagramsPerBatch * kMaxDatagramSize);
+    io_thread_ = std::thread{[this] { Run(); }};
+  } catch (...) {
+    CloseSocket(listening_socket_);
+    CloseSocket(udp_socket_);
+    CloseSocket(wake_event_fd_);
+    CloseSocket(epoll_fd_);
+    throw;
+  }
+}
+
+EpollTransport::~EpollTransport() noexcept {
+  stop_requested_ = true;
+  const uint64_t value = 1;
+  write(wake_event_fd_, &value, sizeof(value));
+  io_thread_.join();
+
+  for (auto& [name, category] : listening_categories_)
+    category->queue().SetObserver(nullptr);
+  for (auto& connection : incoming_connections_)
+    CloseSocket(connection->socket_);
+  for (auto& [key, endpoint] : endpoints_) {
+    if (endpoint->outgoing_connection_)
+      CloseSocket(endpoint->outgoing_connection_->socket_);
+  }
+  CloseSocket(listening_socket_);
+  CloseSocket(udp_socket_);
+  CloseSocket(wake_event_fd_);
+  CloseSocket(epoll_fd_);
+}
+
+Endpoint& EpollTransport::AcquireEndpoint(std::string_view id) {
+  const size_t separator_position = id.rfind(':');
+  if (separator_position == std::string_view::npos)
+    throw std::invalid_argument{"The endpoint ID has no port"};
+  const std::string host{id.substr(0, separator_position)};
+  const std::string_view port = id.substr(separator_position + 1);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  uint16_t port_number;
+  auto [end, error] =
+      std::from_chars(port.data(), port.data() + port.size(), port_number);
+  if (error != std::errc{} || end != port.data() + port.size() ||
+      inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+    throw std::invalid_argument{"The endpoint ID is not <IPv4>:<port>"};
+  }
+  address.sin_port = htons(port_number);
+
+  auto lock = std::lock_guard{mutex_};
+  Endpoint& endpoint = GetOrCreateEndpoint(address);
+  ++endpoint.references_count_;
+  return endpoint;
+}
+
+void EpollTransport::ReleaseEndpoint(Endpoint& endpoint) noexcept {
+  auto lock = std::lock_guard{mutex_};
+  assert(endpoint.references_count_ != 0);
+  --endpoint.references_count_;
+}
+
+void EpollTransport::StartListening(ChannelCategory& category) {
+  {
+    auto lock = std::lock_guard{mutex_};
+    auto [it, inserted] =
+        listening_categories_.emplace(category.name(), &category);
+    if (!inserted && it->second != &category) {
+      throw std::invalid_argument{
+          "Another category with the same name is listening"};
+    }
+  }
+  // The observer locks mutex_, so it is set and reset outside of it.
+  if (category.type() == mrsChannelType::kOrdered)
+    category.queue().SetObserver(this);
+}
+
+void EpollTransport::StopListening(ChannelCategory& category) noexcept {
+  {
+    auto lock = std::lock_guard{mutex_};
+    auto it = listening_categories_.find(category.name());
+    if (it == listening_categories_.end() || it->second != &category)
+      return;
+    listening_categories_.erase(it);
+  }
+  {
+    // Waits for the messages that are being pushed to the queue.
+    auto lock = std::lock_guard{delivery_mutex_};
+  }
+  category.queue().SetObserver(nullptr);
+}
+
+auto EpollTransport::Send(const Channel& channel, std::string_view payload)
+    -> SendResult {
+  const std::string& category_name = channel.category().name();
+  Endpoint& endpoint = channel.endpoint();
+  if (channel.category().type() == mrsChannelType::kUnordered) {
+    const size_t message_size = 1 + category_name.size() + payload.size();
+    if (message_size > kMaxDatagramSize)
+      return SendResult::kFailed;
+    auto lock = std::lock_guard{mutex_};
+    const size_t offset = datagram_queue_.data_.size();
+    AppendMessage(datagram_queue_.data_, category_name, payload);
+    datagram_queue_.datagrams_.push_back(
+        {endpoint.address(), static_cast<uint32_t>(offset),
+         static_cast<uint32_t>(message_size)});
+    Wake();
+    return SendResult::kQueued;
+  }
+  const size_t frame_size = GetMessageFrameSize(category_name, payload.size());
+  if (frame_size > kMaxFrameSize)
+    return SendResult::kFailed;
+  auto lock = std::lock_guard{mutex_};
+  Connection& connection = GetOutgoingConnection(endpoint);
+  if (connection.has_failed_)
+    return SendResult::kFailed;
+  auto& category = connection.GetCategory(category_name);
+  category.weight_ = channel.category().weight();
+  if (category.frames_.size() - category.scheduled_size_ >= kMaxQueuedSize)
+    return SendResult::kWouldBlock;
+  AppendFrameHeader(category.frames_, frame_size);
+  category.frames_ += static_cast<char>(FrameKind::kMessage);
+  AppendMessage(category.frames_, category_name, payload);
+  ++category.queued_messages_count_;
+  // Otherwise the message waits for the credit.
+  if (category.can_send())
+    RequestFlush(connection);
+  return SendResult::kQueued;
+}
+
+uint32_t EpollTransport::GetSendQueueCount(const Channel& channel) const
+    noexcept {
+  auto lock = std::lock_guard{mutex_};
+  if (channel.category().type() == mrsChannelType::kUnordered) {
+    return static_cast<uint32_t>(datagram_queue_.datagrams_.size()) +
+           sending_datagrams_count_;
+  }
+  Connection* connection = channel.endpoint().outgoing_connection_.get();
+  if (!connection)
+    return 0;
+  for (const auto& category : connection->categories_) {
+    if (category.name_ == channel.category().name())
+      return category.queued_messages_count_;
+  }
+  return 0;
+}
+
+uint32_t EpollTransport::GetSendCredit(const Channel& channel) const
+    noexcept {
+  if (channel.category().type() == mrsChannelType::kUnordered)
+    return std::numeric_limits<uint32_t>::max();
+  auto lock = std::lock_guard{mutex_};
+  Connection* connection = channel.endpoint().outgoing_connection_.get();
+  if (!connection)
+    return static_cast<uint32_t>(kInitialCredit);
+  for (const auto& category : connection->categories_) {
+    if (category.name_ == channel.category().name()) {
+      const uint64_t used_size = category.sent_size_ + category.frames_.size() -
+                                 category.scheduled_size_;
+      return static_cast<uint32_t>(std::min<uint64_t>(
+          category.granted_size_ - std::min(used_size, category.granted_size_),
+          std::numeric_limits<uint32_t>::max()));
+    }
+  }
+  return static_cast<uint32_t>(kInitialCredit);
+}
+
+bool EpollTransport::IsOk(const Channel& channel) const noexcept {
+  if (channel.category().type() == mrsChannelType::kUnordered)
+    return true;
+  auto lock = std::lock_guard{mutex_};
+  const Connection* connection =
+      channel.endpoint().outgoing_connection_.get();
+  return !connection || !connection->has_failed_;
+}
+
+void EpollTransport::Reconnect(const Channel& channel) noexcept {
+  if (channel.category().type() == mrsChannelType::kUnordered)
+    return;
+  auto lock = std::lock_guard{mutex_};
+  if (Connection* connection = channel.endpoint().outgoing_connection_.get())
+    connection->has_failed_ = false;
+}
+
+Endpoint& EpollTransport::GetOrCreateEndpoint(const sockaddr_in& address) {
+  auto& endpoint = endpoints_[GetAddressKey(address)];
+  if (!endpoint)
+    endpoint.reset(new Endpoint{address});
+  return *endpoint;
+}
+
+void EpollTransport::OnMessagesTaken(const mrsMessage* messages,
+                                     uint32_t count) noexcept {
+  auto lock = std::lock_guard{mutex_};
+  Endpoint::ReceivedCategory* received = nullptr;
+  for (uint32_t i = 0; i < count; ++i) {
+    auto& sender = *static_cast<Endpoint*>(messages[i].sender);
+    const auto& category =
+        *static_cast<const ChannelCategory*>(messages[i].category);
+    // All messages have the same category (the one that owns the queue), and
+    // consecutive messages usually have the same sender.
+    if (!received || messages[i].sender != messages[i - 1].sender) {
+      received = GetReceivedCategory(sender, category.name());
+      if (!received)
+        continue;
+    }
+    ConsumeCredit(sender, *received, category.credit_window(),
+                  GetMessageFrameSize(category.name(),
+                                      messages[i].payload_size));
+  }
+}
+
+auto EpollTransport::GetOutgoingConnection(Endpoint& endpoint)
+    -> Connection& {
+  if (!endpoint.outgoing_connection_) {
+    endpoint.outgoing_connection_ =
+        std::make_unique<Connection>(&endpoint, true);
+  }
+  return *endpoint.outgoing_connection_;
+}
+
+void EpollTransport::RequestFlush(Connection& connection) {
+  if (!connection.is_flush_requested_) {
+    connections_with_queued_data_.push_back(&connection);
+    connection.is_flush_requested_ = true;
+  }
+  Wake();
+}
+
+Endpoint::ReceivedCategory* EpollTransport::GetReceivedCategory(
+    Endpoint& sender,
+    std::string_view category_name) noexcept {
+  // Otherwise the messages were sent over a closed connection, and the
+  // sender starts with the initial credit on the next one.
+  if (!sender.incoming_connection_)
+    return nullptr;
+  for (auto& received : sender.received_categories_) {
+    if (received.name_ == category_name)
+      return &received;
+  }
+  try {
+    return &sender.received_categories_.emplace_back(Endpoint::ReceivedCategory{
+        std::string{category_name}, 0, kInitialCredit});
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void EpollTransport::ConsumeCredit(Endpoint& sender,
+                                   Endpoint::ReceivedCategory& received,
+                                   uint64_t credit_window,
+                                   uint64_t frame_size) noexcept {
+  received.consumed_size_ += frame_size;
+  const uint64_t granted_size = received.consumed_size_ + credit_window;
+  if (granted_size >= received.granted_size_ + credit_window / 4) {
+    received.granted_size_ = granted_size;
+    try {
+      QueueCreditFrame(sender, received.name_, granted_size);
+    } catch (...) {
+      // The credit will be sent with the next frame.
+    }
+  }
+}
+
+void EpollTransport::QueueCreditFrame(Endpoint& endpoint,
+                                      std::string_view category_name,
+                                      uint64_t granted_size) {
+  // The credit frames are sent even if the connection has failed (the sender
+  // can't send anything without them), but the channels of this side still
+  // see the failure until they are reconnected.
+  Connection& connection = GetOutgoingConnection(endpoint);
+  std::string& frames = connection.control_frames_;
+  AppendFrameHeader(frames, 2 + category_name.size() + 16);
+  frames += static_cast<char>(FrameKind::kCredit);
+  frames += static_cast<char>(category_name.size());
+  frames += category_name;
+  AppendUint64(frames, endpoint.incoming_connection_->id_);
+  AppendUint64(frames, granted_size);
+  RequestFlush(connection);
+}
+
+void EpollTransport::ApplyCreditFrame(Endpoint& sender,
+                                      std::string_view frame) noexcept {
+  const std::optional<std::string_view> name = ReadCategoryName(frame);
+  if (!name || frame.size() != 1 + name->size() + 16)
+    return;
+  Connection* connection = sender.outgoing_connection_.get();
+  // The credit granted for the previous connections is ignored.
+  if (!connection ||
+      ReadUint64(frame.data() + 1 + name->size()) != connection->id_) {
+    return;
+  }
+  const uint64_t granted_size = ReadUint64(frame.data() + 1 + name->size() + 8);
+  for (auto& category : connection->categories_) {
+    if (category.name_ == *name) {
+      if (granted_size > category.granted_size_) {
+        const bool could_send = category.can_send();
+        category.granted_size_ = granted_size;
+        if (!could_send && category.can_send()) {
+          try {
+            RequestFlush(*connection);
+          } catch (...) {
+            // The messages will be sent with the next message.
+          }
+        }
+      }
+      return;
+    }
+  }
+}
+
+void EpollTransport::Run() noexcept {
+  constexpr int kMaxEventsCount = 64;
+  epoll_event events[kMaxEventsCount];
+  while (!stop_requested_) {
+    const int events_count =
+        epoll_wait(epoll_fd_, events, kMaxEventsCount, -1);
+    if (events_count < 0) {
+      assert(errno == EINTR);
+      continue;
+    }
+    bool has_queued_data = false;
+    for (int i = 0; i < events_count; ++i) {
+      void* tag = events[i].data.ptr;
+      if (tag == &wake_event_fd_) {
+        uint64_t value;
+        read(wake_event_fd_, &value, sizeof(value));
+        has_queued_data = true;
+      } else if (tag == &udp_socket_) {
+        if (events[i].events & EPOLLOUT) {
+          udp_socket_is_writable_ = true;
+          SendDatagrams();
+        }
+        if (events[i].events & EPOLLIN)
+          ReceiveDatagrams();
+      } else if (tag == &listening_socket_) {
+        Accept();
+      } else {
+        HandleConnectionEvents(*static_cast<Connection*>(tag),
+                               events[i].events);
+      }
+    }
+    // New connections are opened after all events are handled, so that the
+    // events of the closed sockets are not confused with the new ones.
+    if (has_queued_data)
+      FlushQueues();
+    incoming_connections_.erase(
+        std::remove_if(incoming_connections_.begin(),
+                       incoming_connections_.end(),
+                       [](auto& connection) {
+                         return connection->socket_ == -1;
+                       }),
+        incoming_connections_.end());
+  }
+}
+
+void EpollTransport::Wake() noexcept {
+  if (!wake_requested_) {
+    wake_requested_ = true;
+    const uint64_t value = 1;
+    write(wake_event_fd_, &value, sizeof(value));
+  }
+}
+
+void EpollTransport::FlushQueues() noexcept {
+  std::vector<Connection*> connections;
+  {
+    auto lock = std::lock_guard{mutex_};
+    wake_requested_ = false;
+    connections.swap(connections_with_queued_data_);
+    for (Connection* connection : connections)
+      connection->is_flush_requested_ = false;
+    // The messages queued to the connections that have failed since then
+    // are discarded (see Connection::Reset()), but the credit frames queued
+    // after that are still sent.
+    connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                     [](Connection* connection) {
+                                       return !connection->has_data_to_write();
+                                     }),
+                      connections.end());
+  }
+  SendDatagrams();
+  for (Connection* connection : connections) {
+    if (connection->socket_ == -1)
+      Connect(*connection);
+    else if (connection->is_connected_ && connection->is_writable_)
+      WriteConnection(*connection);
+  }
+}
+
+void EpollTransport::SendDatagrams() noexcept {
+  mmsghdr headers[kMaxDatagramsPerBatch];
+  iovec buffers[kMaxDatagramsPerBatch];
+  while (true) {
+    DatagramQueue& queue = sending_datagram_queue_;
+    if (sent_datagrams_count_ == queue.datagrams_.size()) {
+      queue.data_.clear();
+      queue.datagrams_.clear();
+      sent_datagrams_count_ = 0;
+      auto lock = std::lock_guard{mutex_};
+      std::swap(queue, datagram_queue_);
+      sending_datagrams_count_ =
+          static_cast<uint32_t>(queue.datagrams_.size());
+      if (queue.datagrams_.empty())
+        return;
+    }
+    if (!udp_socket_is_writable_)
+      return;
+    const size_t batch_size = std::min(
+        kMaxDatagramsPerBatch, queue.datagrams_.size() - sent_datagrams_count_);
+    for (size_t i = 0; i < batch_size; ++i) {
+      Datagram& datagram = queue.datagrams_[sent_datagrams_count_ + i];
+      buffers[i].iov_base = queue.data_.data() + datagram.offset_;
+      buffers[i].iov_len = datagram.size_;
+      headers[i] = {};
+      headers[i].msg_hdr.msg_name = &datagram.address_;
+      headers[i].msg_hdr.msg_namelen = sizeof(datagram.address_);
+      headers[i].msg_hdr.msg_iov = &buffers[i];
+      headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    const int sent_count = sendmmsg(udp_socket_, headers,
+                                    static_cast<unsigned>(batch_size), 0);
+    if (sent_count < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        udp_socket_is_writable_ = false;
+        return;
+      }
+      if (errno == EINTR)
+        continue;
+      // The first datagram can't be sent (for example, the destination is
+      // unreachable), so it is dropped.
+      ++sent_datagrams_count_;
+    } else {
+      sent_datagrams_count_ += sent_count;
+    }
+    auto lock = std::lock_guard{mutex_};
+    sending_datagrams_count_ = static_cast<uint32_t>(
+        queue.datagrams_.size() - sent_datagrams_count_);
+  }
+}
+
+void EpollTransport::ReceiveDatagrams() noexcept {
+  mmsghdr headers[kMaxDatagramsPerBatch];
+  iovec buffers[kMaxDatagramsPerBatch];
+  sockaddr_in addresses[kMaxDatagramsPerBatch];
+  while (true) {
+    for (size_t i = 0; i < kMaxDatagramsPerBatch; ++i) {
+      buffers[i].iov_base = datagram_buffers_.data() + i * kMaxDatagramSize;
+      buffers[i].iov_len = kMaxDatagramSize;
+      headers[i] = {};
+      headers[i].msg_hdr.msg_name = &addresses[i];
+      headers[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+      headers[i].msg_hdr.msg_iov = &buffers[i];
+      headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    const int received_count = recvmmsg(
+        udp_socket_, headers, kMaxDatagramsPerBatch, MSG_DONTWAIT, nullptr);
+    if (received_count < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    auto lock = std::unique_lock{mutex_};
+    for (int i = 0; i < received_count; ++i) {
+      std::string_view message{static_cast<const char*>(buffers[i].iov_base),
+                               headers[i].msg_len};
+      // The endpoints are only created for the senders of the delivered
+      // datagrams, so the other datagrams don't grow endpoints_.
+      ChannelCategory* category =
+          FindListeningCategory(mrsChannelType::kUnordered, message);
+      if (!category)
+        continue;
+      try {
+        deliveries_.push_back(
+            {&GetOrCreateEndpoint(addresses[i]), category, message});
+      } catch (...) {
+        // The datagram is dropped.
+      }
+    }
+    DeliverMessages(lock);
+  }
+}
+
+void EpollTransport::Accept() noexcept {
+  while (true) {
+    sockaddr_in address{};
+    socklen_t address_size = sizeof(address);
+    const int fd = accept4(listening_socket_,
+                           reinterpret_cast<sockaddr*>(&address),
+                           &address_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+    try {
+      auto connection = std::make_unique<Connection>(nullptr, false);
+      connection->socket_ = fd;
+      connection->peer_address_ = address;
+      connection->is_connected_ = true;
+      epoll_event event{};
+      event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+      event.data.ptr = connection.get();
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0)
+        ThrowSystemError("epoll_ctl");
+      incoming_connections_.push_back(std::move(connection));
+    } catch (...) {
+      close(fd);
+    }
+  }
+}
+
+void EpollTransport::Connect(Connection& connection) noexcept {
+  assert(connection.is_outgoing_ && connection.socket_ == -1);
+  connection.socket_ =
+      socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (connection.socket_ == -1) {
+    CloseConnection(connection);
+    return;
+  }
+  const int no_delay = 1;
+  setsockopt(connection.socket_, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+             sizeof(no_delay));
+  // Otherwise the kernel would buffer megabytes of the scheduled messages,
+  // and the messages of other categories would wait behind them.
+  setsockopt(connection.socket_, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+             &kMaxUnsentSize, sizeof(kMaxUnsentSize));
+  connection.peer_address_ = connection.endpoint_->address();
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = &connection;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection.socket_, &event) != 0 ||
+      (connect(connection.socket_,
+               reinterpret_cast<sockaddr*>(&connection.peer_address_),
+               sizeof(connection.peer_address_)) != 0 &&
+       errno != EINPROGRESS)) {
+    CloseConnection(connection);
+    return;
+  }
+  // The hello frame tells the receiver the port of the sending transport and
+  // the id of the connection. The queued messages will be written after it.
+  try {
+    auto lock = std::lock_guard{mutex_};
+    ++connection.id_;
+    AppendFrameHeader(connection.writing_data_, kHelloFrameSize);
+    connection.writing_data_ += static_cast<char>(port_);
+    connection.writing_data_ += static_cast<char>(port_ >> 8);
+    AppendUint64(connection.writing_data_, connection.id_);
+    // The credit frames sent over the previous connection could be lost.
+    for (const auto& received : connection.endpoint_->received_categories_) {
+      QueueCreditFrame(*connection.endpoint_, received.name_,
+                       received.granted_size_);
+    }
+  } catch (...) {
+    CloseConnection(connection);
+  }
+}
+
+void EpollTransport::HandleConnectionEvents(Connection& connection,
+                                            uint32_t events) noexcept {
+  if (connection.socket_ == -1)
+    return;  // Closed while handling the previous events.
+  if (events & EPOLLERR) {
+    CloseConnection(connection);
+    return;
+  }
+  if (!connection.is_connected_ && (events & EPOLLOUT)) {
+    int error = 0;
+    socklen_t error_size = sizeof(error);
+    if (getsockopt(connection.socket_, SOL_SOCKET, SO_ERROR, &error,
+                   &error_size) != 0 ||
+        error != 0) {
+      CloseConnection(connection);
+      return;
+    }
+    connection.is_connected_ = true;
+  }
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+    ReadConnection(connection);
+    if (connection.socket_ == -1)
+      return;
+  }
+  if (events & EPOLLOUT) {
+    connection.is_writable_ = true;
+    WriteConnection(connection);
+  }
+}
+
+void EpollTransport::WriteConnection(Connection& connection) noexcept {
+  while (true) {
+    if (connection.written_size_ == connection.writing_data_.size()) {
+      connection.writing_data_.clear();
+      connection.written_size_ = 0;
+      try {
+        auto lock = std::lock_guard{mutex_};
+        connection.ScheduleFrames(connection.writing_data_);
+      } catch (...) {
+        CloseConnection(connection);
+        return;
+      }
+      if (connection.writing_data_.empty())
+        return;
+    }
+    const ssize_t written_size =
+        send(connection.socket_,
+             connection.writing_data_.data() + connection.written_size_,
+             connection.writing_data_.size() - connection.written_size_,
+             MSG_NOSIGNAL);
+    if (written_size < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        connection.is_writable_ = false;
+        return;
+      }
+      if (errno == EINTR)
+        continue;
+      CloseConnection(connection);
+      return;
+    }
+    connection.written_size_ += written_size;
+  }
+}
+
+void EpollTransport::ReadConnection(Connection& connection) noexcept {
+  std::vector<char>& buffer = connection.read_buffer_;
+  while (true) {
+    try {
+      if (buffer.size() - connection.read_size_ < kReadChunkSize)
+        buffer.resize(connection.read_size_ + kReadChunkSize);
+    } catch (...) {
+      CloseConnection(connection);
+      return;
+    }
+    const ssize_t read_size =
+        recv(connection.socket_, buffer.data() + connection.read_size_,
+             buffer.size() - connection.read_size_, 0);
+    if (read_size <= 0) {
+      if (read_size < 0 && errno == EINTR)
+        continue;
+      if (read_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      // Closed by the remote side, or failed.
+      CloseConnection(connection);
+      return;
+    }
+    if (connection.is_outgoing_)
+      continue;  // Nothing is expected from the receiver.
+    connection.read_size_ += read_size;
+
+    size_t offset = 0;
+    bool is_malformed = false;
+    {
+      auto lock = std::unique_lock{mutex_};
+      while (connection.read_size_ - offset >= kFrameHeaderSize) {
+        const size_t frame_size = ReadFrameSize(buffer.data() + offset);
+        const bool is_hello = !connection.endpoint_;
+        if (frame_size > kMaxFrameSize ||
+            (is_hello && frame_size != kHelloFrameSize)) {
+          is_malformed = true;
+          break;
+        }
+        if (connection.read_size_ - offset - kFrameHeaderSize < frame_size)
+          break;
+        const std::string_view frame{
+            buffer.data() + offset + kFrameHeaderSize, frame_size};
+        offset += kFrameHeaderSize + frame_size;
+        try {
+          if (is_hello) {
+            sockaddr_in address = connection.peer_address_;
+            address.sin_port = htons(static_cast<uint16_t>(
+                static_cast<uint8_t>(frame[0]) |
+                (static_cast<uint8_t>(frame[1]) << 8)));
+            Endpoint& sender = GetOrCreateEndpoint(address);
+            connection.endpoint_ = &sender;
+            connection.id_ = ReadUint64(frame.data() + 2);
+            // The sender starts with the initial credit.
+            sender.incoming_connection_ = &connection;
+            sender.received_categories_.clear();
+          } else if (frame.empty()) {
+            is_malformed = true;
+            break;
+          } else if (frame[0] == static_cast<char>(FrameKind::kMessage)) {
+            std::string_view message = frame.substr(1);
+            if (ChannelCategory* category =
+                    FindListeningCategory(mrsChannelType::kOrdered, message)) {
+              deliveries_.push_back({connection.endpoint_, category, message});
+            } else if (connection.endpoint_->incoming_connection_ ==
+                       &connection) {
+              // The sender used the credit for the dropped message as well.
+              if (const auto name = ReadCategoryName(message)) {
+                if (auto* received =
+                        GetReceivedCategory(*connection.endpoint_, *name)) {
+                  ConsumeCredit(*connection.endpoint_, *received,
+                                ChannelCategory::kDefaultCreditWindow,
+                                frame.size());
+                }
+              }
+            }
+          } else if (frame[0] == static_cast<char>(FrameKind::kCredit)) {
+            ApplyCreditFrame(*connection.endpoint_, frame.substr(1));
+          }
+        } catch (...) {
+          // The frame is dropped.
+        }
+      }
+      // The delivered payloads point into the buffer, so they are pushed
+      // before it's compacted.
+      DeliverMessages(lock);
+    }
+    if (is_malformed) {
+      CloseConnection(connection);
+      return;
+    }
+    std::memmove(buffer.data(), buffer.data() + offset,
+                 connection.read_size_ - offset);
+    connection.read_size_ -= offset;
+  }
+}
+
+void EpollTransport::CloseConnection(Connection& connection) noexcept {
+  if (connection.socket_ != -1) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection.socket_, nullptr);
+    CloseSocket(connection.socket_);
+  }
+  connection.is_connected_ = false;
+  connection.is_writable_ = false;
+  connection.writing_data_.clear();
+  connection.written_size_ = 0;
+  connection.read_buffer_ = {};
+  connection.read_size_ = 0;
+  auto lock = std::lock_guard{mutex_};
+  if (connection.is_outgoing_) {
+    // The queued messages are discarded until the channel is reconnected.
+    connection.has_failed_ = true;
+    connection.Reset();
+  } else if (connection.endpoint_ &&
+             connection.endpoint_->incoming_connection_ == &connection) {
+    // The sender starts with the initial credit when it reconnects.
+    connection.endpoint_->incoming_connection_ = nullptr;
+    connection.endpoint_->received_categories_.clear();
+  }
+}
+
+ChannelCategory* EpollTransport::FindListeningCategory(
+    mrsChannelType type,
+    std::string_view& message) const noexcept {
+  const std::optional<std::string_view> name = ReadCategoryName(message);
+  if (!name)
+    return nullptr;
+  auto it = listening_categories_.find(*name);
+  if (it == listening_categories_.end() || it->second->type() != type)
+    return nullptr;
+  message.remove_prefix(1 + name->size());
+  return it->second;
+}
+
+void EpollTransport::DeliverMessages(
+    std::unique_lock<std::mutex>& lock) noexcept {
+  if (deliveries_.empty())
+    return;
+  // Locked before mutex_ is unlocked, so the categories can't stop listening
+  // (and be destroyed) until the messages are pushed.
+  auto delivery_lock = std::lock_guard{delivery_mutex_};
+  lock.unlock();
+  for (const Delivery& delivery : deliveries_) {
+    try {
+      delivery.category_->queue().Push(delivery.sender_, delivery.category_,
+                                       delivery.payload_);
+    } catch (...) {
+      // The message is dropped.
+    }
+  }
+  deliveries_.clear();
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
+
+#endif  // #ifdef __linux__
@@ -0,0 +1,321 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <network.h>
+
+#ifdef __linux__
+
+#include "src/ReceiveQueue.h"
+
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+class EpollTransport;
+
+// The ID of an endpoint is "<IPv4 address>:<port>" of the remote transport.
+// The endpoints are interned by the transport and stay alive until the
+// transport is destroyed (the received messages refer to their senders
+// without owning them).
+class Endpoint : public mrsEndpoint {
+ public:
+  const std::string& id() const noexcept { return id_; }
+  const sockaddr_in& address() const noexcept { return address_; }
+
+ private:
+  struct Connection;
+
+  Endpoint(const sockaddr_in& address);
+
+  std::string id_;
+  sockaddr_in address_;
+  // The number of references acquired with EpollTransport::AcquireEndpoint().
+  uint32_t references_count_{0};
+  // The connection used by the ordered channels to this endpoint (created on
+  // the first send).
+  std::unique_ptr<Connection> outgoing_connection_;
+
+  // The last incoming connection from this endpoint. The credit in
+  // received_categories_ is granted for the messages sent over it (the sender
+  // starts with the initial credit on each new connection).
+  const Connection* incoming_connection_{nullptr};
+
+  // The credit granted to this endpoint for the ordered messages it sends to
+  // each of the local categories.
+  struct ReceivedCategory {
+    std::string name_;
+    // The total size of the taken (or dropped) messages (see
+    // EpollTransport::ConsumeCredit()).
+    uint64_t consumed_size_;
+    uint64_t granted_size_;
+  };
+  std::vector<ReceivedCategory> received_categories_;
+
+  friend class EpollTransport;
+};
+
+class ChannelCategory : public mrsChannelCategory {
+ public:
+  static constexpr uint32_t kDefaultWeight = 1;
+  static constexpr uint32_t kDefaultCreditWindow = 1024 * 1024;
+
+  ChannelCategory(std::string name, mrsChannelType type);
+
+  const std::string& name() const noexcept { return name_; }
+  mrsChannelType type() const noexcept { return type_; }
+  ReceiveQueue& queue() noexcept { return queue_; }
+
+  // The share of a busy connection that the ordered messages of the category
+  // get, relative to the other categories sent to the same endpoint (used by
+  // the sender).
+  uint32_t weight() const noexcept { return weight_; }
+  void set_weight(uint32_t weight) noexcept {
+    weight_ = std::max<uint32_t>(weight, 1);
+  }
+
+  // The size of the ordered messages each sender can have in flight (sent,
+  // but not taken from the queue) before it has to wait for the receiver
+  // (used by the receiver).
+  uint32_t credit_window() const noexcept { return credit_window_; }
+  void set_credit_window(uint32_t size) noexcept {
+    credit_window_ = std::max<uint32_t>(size, 1);
+  }
+
+ private:
+  const std::string name_;
+  const mrsChannelType type_;
+  ReceiveQueue queue_;
+  std::atomic<uint32_t> weight_{kDefaultWeight};
+  std::atomic<uint32_t> credit_window_{kDefaultCreditWindow};
+};
+
+class Channel : public mrsChannel {
+ public:
+  Channel(ChannelCategory& category, Endpoint& endpoint) noexcept
+      : category_{category}, endpoint_{endpoint} {}
+
+  ChannelCategory& category() const noexcept { return category_; }
+  Endpoint& endpoint() const noexcept { return endpoint_; }
+
+ private:
+  ChannelCategory& category_;
+  Endpoint& endpoint_;
+};
+
+// Linux implementation of the network.h transport.
+//
+// All traffic goes through two sockets bound to the same port: a UDP socket
+// shared by the unordered channels to all endpoints, and a TCP listening
+// socket. The ordered channels to an endpoint share a single TCP connection
+// (opened on the first send), and the incoming connections are only used for
+// receiving. Each message carries the name of its category, which
+// identifies the receiving queue.
+//
+// The messages are queued by the sending threads and written by a single I/O
+// thread that waits for the sockets with epoll. The datagrams are sent and
+// received in batches with sendmmsg() and recvmmsg().
+//
+// The ordered channels use credit-based flow control: the sender can only
+// write the messages of a category while their total size is within the
+// credit granted by the receiver, which grows as the receiver takes the
+// messages from the queue (see ChannelCategory::credit_window()). The credit
+// is accounted per connection: the sender starts with kInitialCredit on each
+// new connection, and ignores the credit granted for the previous ones. The
+// messages of the categories that are not listening are dropped, but their
+// size is still credited. The messages beyond the credit stay in the sender's
+// per-category queue, and Send() returns kWouldBlock once the queue is full.
+// The categories that have credit share the connection according to their
+// weights (deficit round robin), and the unsent data in the kernel is kept
+// small, so a bulk transfer doesn't delay the small messages of other
+// categories by more than a few writes.
+//
+// The unordered channels are unreliable (the datagrams can be lost), and the
+// messages queued to a failed connection are discarded.
+class EpollTransport : private ReceiveQueueObserver {
+ public:
+  // The maximum size of the category name and the payload of an unordered
+  // message (sent as a single datagram).
+  static constexpr size_t kMaxCategoryNameSize = 255;
+  static constexpr size_t kMaxDatagramSize = 65507;
+  // The maximum size of an ordered message (the connections that receive
+  // larger frames are closed).
+  static constexpr size_t kMaxFrameSize = 64 * 1024 * 1024;
+  // The maximum number of datagrams passed to sendmmsg() and recvmmsg().
+  static constexpr size_t kMaxDatagramsPerBatch = 32;
+
+  // The credit of a sender before the receiver grants more.
+  static constexpr uint64_t kInitialCredit = 64 * 1024;
+  // The size of the ordered messages of a channel that can wait for credit
+  // (Send() returns kWouldBlock after that).
+  static constexpr size_t kMaxQueuedSize = 1024 * 1024;
+  // The scheduler interleaves the categories in writes of about this size,
+  // and each category gets kQuantum bytes per unit of weight in each round.
+  static constexpr size_t kMaxWriteSize = 64 * 1024;
+  static constexpr size_t kQuantum = 4 * 1024;
+  // The limit of the unsent data in the kernel buffer of a connection.
+  static constexpr int kMaxUnsentSize = 128 * 1024;
+
+  enum class SendResult { kQueued, kWouldBlock, kFailed };
+
+  // Binds the sockets to the port on all interfaces (0 picks a free port) and
+  // starts the I/O thread. Throws std::system_error on failure.
+  explicit EpollTransport(uint16_t port);
+  ~EpollTransport() noexcept;
+
+  EpollTransport(const EpollTransport&) = delete;
+  EpollTransport& operator=(const EpollTransport&) = delete;
+
+  uint16_t port() const noexcept { return port_; }
+
+  // Throws std::invalid_argument if the ID is not "<IPv4 address>:<port>".
+  Endpoint& AcquireEndpoint(std::string_view id);
+  void ReleaseEndpoint(Endpoint& endpoint) noexcept;
+
+  // Starts pushing the received messages of the category to its queue. The
+  // category must either stop listening or outlive the transport. Throws
+  // std::invalid_argument if another category with the same name is
+  // listening.
+  void StartListening(ChannelCategory& category);
+  void StopListening(ChannelCategory& category) noexcept;
+
+  // Queues the message. Fails if the channel has failed or the payload is
+  // too large.
+  SendResult Send(const Channel& channel, std::string_view payload);
+
+  // The number of messages of the channel that are not yet scheduled for
+  // writing (for the unordered channels, the number of queued datagrams to
+  // all endpoints).
+  uint32_t GetSendQueueCount(const Channel& channel) const noexcept;
+
+  // The size of the messages the ordered channel can send without waiting
+  // for more credit (the unordered channels are not limited).
+  uint32_t GetSendCredit(const Channel& channel) const noexcept;
+
+  // Returns false if the connection used by the channel has failed.
+  bool IsOk(const Channel& channel) const noexcept;
+
+  // Resets the failed connection, so that the next message opens a new one.
+  void Reconnect(const Channel& channel) noexcept;
+
+ private:
+  using Connection = Endpoint::Connection;
+
+  // The outgoing data queued by the sending threads. The I/O thread swaps it
+  // with its own buffer, so the capacities are reused.
+  struct Datagram {
+    sockaddr_in address_;
+    uint32_t offset_;
+    uint32_t size_;
+  };
+  struct DatagramQueue {
+    std::string data_;
+    std::vector<Datagram> datagrams_;
+  };
+
+  Endpoint& GetOrCreateEndpoint(const sockaddr_in& address);
+
+  // Grants more credit to the senders as the messages are taken.
+  void OnMessagesTaken(const mrsMessage* messages,
+                       uint32_t count) noexcept override;
+
+  // The methods below should be called under the lock.
+  Connection& GetOutgoingConnection(Endpoint& endpoint);
+  void RequestFlush(Connection& connection);
+  // Returns nullptr if the endpoint has no incoming connection (or if the
+  // category can't be added).
+  Endpoint::ReceivedCategory* GetReceivedCategory(
+      Endpoint& sender,
+      std::string_view category_name) noexcept;
+  // Counts the frame of an ordered message as consumed, and grants more
+  // credit to the sender (in steps of a quarter of the window, so that a
+  // frame is not sent for each message).
+  void ConsumeCredit(Endpoint& sender,
+                     Endpoint::ReceivedCategory& received,
+                     uint64_t credit_window,
+                     uint64_t frame_size) noexcept;
+  void QueueCreditFrame(Endpoint& endpoint,
+                        std::string_view category_name,
+                        uint64_t granted_size);
+  void ApplyCreditFrame(Endpoint& sender, std::string_view frame) noexcept;
+
+  void Run() noexcept;
+  void Wake() noexcept;
+  void FlushQueues() noexcept;
+
+  void SendDatagrams() noexcept;
+  void ReceiveDatagrams() noexcept;
+  void Accept() noexcept;
+
+  void Connect(Connection& connection) noexcept;
+  void HandleConnectionEvents(Connection& connection,
+                              uint32_t events) noexcept;
+  void WriteConnection(Connection& connection) noexcept;
+  void ReadConnection(Connection& connection) noexcept;
+  void CloseConnection(Connection& connection) noexcept;
+
+  // A received message that is pushed to the queue of its category after
+  // mutex_ is unlocked (see DeliverMessages()).
+  struct Delivery {
+    Endpoint* sender_;
+    ChannelCategory* category_;
+    std::string_view payload_;
+  };
+
+  // Parses "<category name size><category name><payload>" and returns the
+  // category if it is listening and has the expected type (the message is
+  // left with the payload). Should be called under the lock.
+  ChannelCategory* FindListeningCategory(mrsChannelType type,
+                                         std::string_view& message) const
+      noexcept;
+
+  // Unlocks mutex_ and pushes deliveries_ to the queues, so that copying the
+  // payloads doesn't block the sending threads.
+  void DeliverMessages(std::unique_lock<std::mutex>& lock) noexcept;
+
+  int epoll_fd_{-1};
+  int wake_event_fd_{-1};
+  int udp_socket_{-1};
+  int listening_socket_{-1};
+  uint16_t port_{0};
+
+  std::thread io_thread_;
+  std::atomic_bool stop_requested_{false};
+
+  mutable std::mutex mutex_;
+  // The members below are guarded by mutex_.
+  std::unordered_map<uint64_t, std::unique_ptr<Endpoint>> endpoints_;
+  std::map<std::string, ChannelCategory*, std::less<>> listening_categories_;
+  DatagramQueue datagram_queue_;
+  uint32_t sending_datagrams_count_{0};
+  std::vector<Connection*> connections_with_queued_data_;
+  bool wake_requested_{false};
+
+  // Held while the messages are pushed to the queues, so that
+  // StopListening() can wait until the category is no longer used.
+  std::mutex delivery_mutex_;
+
+  // Only accessed by the I/O thread.
+  DatagramQueue sending_datagram_queue_;
+  size_t sent_datagrams_count_{0};
+  bool udp_socket_is_writable_{true};
+  std::vector<std::unique_ptr<Connection>> incoming_connections_;
+  std::vector<char> datagram_buffers_;
+  std::vector<Delivery> deliveries_;
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
+
+#endif  // #ifdef __linux__
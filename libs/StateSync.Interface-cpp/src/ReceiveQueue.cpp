@@ -0,0 +1,205 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include "src/ReceiveQueue.h"
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+// The header of the array of messages returned by Take(). The messages are
+// allocated right after it, so Dispose() can find the header.
+class alignas(mrsMessage) ReceiveQueue::Batch {
+ public:
+  struct SlabRun {
+    Slab* slab_;
+    uint32_t messages_count_;
+  };
+
+  static Batch* Create(ReceiveQueue& queue, uint32_t capacity) {
+    void* memory =
+        ::operator new(sizeof(Batch) + sizeof(mrsMessage) * capacity);
+    return new (memory) Batch{queue, capacity};
+  }
+
+  static void Destroy(Batch* batch) noexcept {
+    batch->~Batch();
+    ::operator delete(batch);
+  }
+
+  static Batch* FromMessages(mrsMessage* messages) noexcept {
+    return reinterpret_cast<Batch*>(messages) - 1;
+  }
+
+  mrsMessage* messages() noexcept {
+    return reinterpret_cast<mrsMessage*>(this + 1);
+  }
+
+  ReceiveQueue& queue_;
+  const uint32_t capacity_;
+  // The slabs referenced by the messages, in order.
+  std::vector<SlabRun> slab_runs_;
+
+ private:
+  Batch(ReceiveQueue& queue, uint32_t capacity) noexcept
+      : queue_{queue}, capacity_{capacity} {}
+};
+
+ReceiveQueue::~ReceiveQueue() noexcept {
+  for (size_t i = 0; i < messages_count_; ++i) {
+    const QueuedMessage& queued =
+        messages_[(first_message_index_ + i) & (messages_.size() - 1)];
+    ReleaseSlab(queued.slab_, 1);
+  }
+  if (receiving_slab_)
+    ReleaseSlab(receiving_slab_, 1);
+  for (Slab* slab : free_slabs_)
+    ::operator delete(slab);
+  for (Batch* batch : free_batches_)
+    Batch::Destroy(batch);
+}
+
+void ReceiveQueue::Push(mrsEndpoint* sender,
+                        mrsChannelCategory* category,
+                        std::string_view payload) {
+  if (payload.size() > std::numeric_limits<uint32_t>::max())
+    throw std::invalid_argument{"The payload is too large"};
+  const auto payload_size = static_cast<uint32_t>(payload.size());
+  if (!receiving_slab_ ||
+      receiving_slab_->capacity_ - receiving_offset_ < payload_size) {
+    auto lock = std::lock_guard{mutex_};
+    if (receiving_slab_) {
+      ReleaseSlab(receiving_slab_, 1);
+      // In case the allocation below throws.
+      receiving_slab_ = nullptr;
+    }
+    receiving_slab_ = AcquireSlab(std::max(payload_size, kSlabSize));
+    receiving_offset_ = 0;
+  }
+  char* data = receiving_slab_->data() + receiving_offset_;
+  memcpy(data, payload.data(), payload_size);
+  const mrsMessage message{sender, category,
+                           reinterpret_cast<const uint8_t*>(data),
+                           payload_size};
+  {
+    auto lock = std::lock_guard{mutex_};
+    if (messages_count_ == messages_.size()) {
+      // Growing the ring buffer, so that the first message is at index 0.
+      std::vector<QueuedMessage> new_messages(
+          std::max<size_t>(messages_.size() * 2, 256));
+      for (size_t i = 0; i < messages_count_; ++i) {
+        new_messages[i] =
+            messages_[(first_message_index_ + i) & (messages_.size() - 1)];
+      }
+      messages_.swap(new_messages);
+      first_message_index_ = 0;
+    }
+    messages_[(first_message_index_ + messages_count_++) &
+              (messages_.size() - 1)] = {message, receiving_slab_};
+    ++receiving_slab_->references_count_;
+  }
+  // The payloads are 8-byte aligned.
+  receiving_offset_ = std::min<uint32_t>(
+      receiving_slab_->capacity_, (receiving_offset_ + payload_size + 7) & ~7u);
+}
+
+mrsMessage* ReceiveQueue::Take(uint32_t max_count, uint32_t& count) {
+  mrsMessage* messages;
+  {
+    auto lock = std::lock_guard{mutex_};
+    count = static_cast<uint32_t>(
+        std::min<size_t>(messages_count_, max_count));
+    if (count == 0)
+      return nullptr;
+    Batch* batch = AcquireBatch(count);
+    messages = batch->messages();
+    for (uint32_t i = 0; i < count; ++i) {
+      const QueuedMessage& queued = messages_[first_message_index_];
+      messages[i] = queued.message_;
+      if (!batch->slab_runs_.empty() &&
+          batch->slab_runs_.back().slab_ == queued.slab_) {
+        ++batch->slab_runs_.back().messages_count_;
+      } else {
+        batch->slab_runs_.push_back({queued.slab_, 1});
+      }
+      first_message_index_ =
+          (first_message_index_ + 1) & (messages_.size() - 1);
+    }
+    messages_count_ -= count;
+  }
+  auto lock = std::lock_guard{observer_mutex_};
+  if (observer_)
+    observer_->OnMessagesTaken(messages, count);
+  return messages;
+}
+
+void ReceiveQueue::Dispose(mrsMessage* messages) noexcept {
+  Batch* batch = Batch::FromMessages(messages);
+  ReceiveQueue& queue = batch->queue_;
+  auto lock = std::lock_guard{queue.mutex_};
+  for (const Batch::SlabRun& run : batch->slab_runs_)
+    queue.ReleaseSlab(run.slab_, run.messages_count_);
+  batch->slab_runs_.clear();
+  if (queue.free_batches_.size() < kMaxPooledBatches)
+    queue.free_batches_.push_back(batch);
+  else
+    Batch::Destroy(batch);
+}
+
+void ReceiveQueue::SetObserver(ReceiveQueueObserver* observer) noexcept {
+  auto lock = std::lock_guard{observer_mutex_};
+  observer_ = observer;
+}
+
+size_t ReceiveQueue::size() const noexcept {
+  auto lock = std::lock_guard{mutex_};
+  return messages_count_;
+}
+
+size_t ReceiveQueue::allocated_slabs_count() const noexcept {
+  auto lock = std::lock_guard{mutex_};
+  return allocated_slabs_count_;
+}
+
+auto ReceiveQueue::AcquireSlab(uint32_t capacity) -> Slab* {
+  Slab* slab;
+  if (capacity == kSlabSize && !free_slabs_.empty()) {
+    slab = free_slabs_.back();
+    free_slabs_.pop_back();
+  } else {
+    slab = static_cast<Slab*>(::operator new(sizeof(Slab) + capacity));
+    slab->capacity_ = capacity;
+    ++allocated_slabs_count_;
+  }
+  slab->references_count_ = 1;
+  return slab;
+}
+
+void ReceiveQueue::ReleaseSlab(Slab* slab,
+                               uint32_t references_count) noexcept {
+  assert(slab->references_count_ >= references_count);
+  slab->references_count_ -= references_count;
+  if (slab->references_count_ != 0)
+    return;
+  if (slab->capacity_ == kSlabSize && free_slabs_.size() < kMaxPooledSlabs)
+    free_slabs_.push_back(slab);
+  else
+    ::operator delete(slab);
+}
+
+auto ReceiveQueue::AcquireBatch(uint32_t capacity) -> Batch* {
+  // The most recently disposed batch is usually large enough.
+  while (!free_batches_.empty()) {
+    Batch* batch = free_batches_.back();
+    free_batches_.pop_back();
+    if (batch->capacity_ >= capacity)
+      return batch;
+    Batch::Destroy(batch);
+  }
+  uint32_t new_capacity = 64;
+  while (new_capacity < capacity)
+    new_capacity *= 2;
+  return Batch::Create(*this, new_capacity);
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -0,0 +1,121 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <network.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+
+// Notified when the messages are taken from a ReceiveQueue (for example, to
+// let the senders know that the receiver keeps up).
+class ReceiveQueueObserver {
+ public:
+  virtual void OnMessagesTaken(const mrsMessage* messages,
+                               uint32_t count) noexcept = 0;
+
+ protected:
+  ~ReceiveQueueObserver() = default;
+};
+
+// The queue of received messages behind mrsChannelQueue.
+//
+// The payloads are copied into pooled slabs of kSlabSize bytes, and the
+// messages returned by Take() point into the slabs, so receiving a message
+// doesn't allocate once the pools are warm. Each slab is returned to the pool
+// when all messages copied to it are disposed, and Dispose() releases the
+// slabs of the whole batch at once (consecutive messages usually share a
+// slab). Payloads larger than a slab get a dedicated buffer, which is freed
+// instead of being pooled.
+//
+// The queued messages are stored in a ring buffer, and the arrays returned by
+// Take() are pooled as well.
+//
+// Push() should be called by one thread at a time (normally the thread that
+// receives the messages from the network), and copies the payload without
+// holding the lock. Take() and Dispose() can be called from any thread. All
+// taken messages must be disposed before the queue is destroyed.
+class ReceiveQueue : public mrsChannelQueue {
+ public:
+  static constexpr uint32_t kSlabSize = 64 * 1024;
+
+  // The number of unused slabs and message arrays kept for reuse (the rest
+  // are freed).
+  static constexpr size_t kMaxPooledSlabs = 64;
+  static constexpr size_t kMaxPooledBatches = 16;
+
+  ReceiveQueue() noexcept = default;
+  ~ReceiveQueue() noexcept;
+
+  ReceiveQueue(const ReceiveQueue&) = delete;
+  ReceiveQueue& operator=(const ReceiveQueue&) = delete;
+
+  // Copies the payload and queues the message.
+  void Push(mrsEndpoint* sender,
+            mrsChannelCategory* category,
+            std::string_view payload);
+
+  // Takes up to max_count oldest messages. Returns nullptr (and sets count to
+  // 0) if there are no messages. Otherwise the returned messages should be
+  // disposed with Dispose().
+  mrsMessage* Take(uint32_t max_count, uint32_t& count);
+
+  // Disposes the messages returned by Take().
+  static void Dispose(mrsMessage* messages) noexcept;
+
+  // The observer is called by Take() after the messages are taken (outside of
+  // the main lock). Resetting the observer waits until it is no longer
+  // called.
+  void SetObserver(ReceiveQueueObserver* observer) noexcept;
+
+  size_t size() const noexcept;
+
+  // The number of slabs allocated by the queue so far (including the pooled
+  // ones that were reused).
+  size_t allocated_slabs_count() const noexcept;
+
+ private:
+  struct Slab {
+    uint32_t capacity_;
+    // The number of queued (or taken and not disposed) messages in the slab,
+    // plus one while the slab is used for receiving.
+    uint32_t references_count_;
+
+    char* data() noexcept { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  struct QueuedMessage {
+    mrsMessage message_;
+    Slab* slab_;
+  };
+
+  class Batch;
+
+  // The methods below should be called under the lock.
+  Slab* AcquireSlab(uint32_t capacity);
+  void ReleaseSlab(Slab* slab, uint32_t references_count) noexcept;
+  Batch* AcquireBatch(uint32_t capacity);
+
+  mutable std::mutex mutex_;
+  // Ring buffer (the capacity is always a power of 2).
+  std::vector<QueuedMessage> messages_;
+  size_t first_message_index_{0};
+  size_t messages_count_{0};
+
+  std::vector<Slab*> free_slabs_;
+  std::vector<Batch*> free_batches_;
+  size_t allocated_slabs_count_{0};
+
+  std::mutex observer_mutex_;
+  ReceiveQueueObserver* observer_{nullptr};
+
+  // Only accessed by the thread that calls Push().
+  Slab* receiving_slab_{nullptr};
+  uint32_t receiving_offset_{0};
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -0,0 +1,339 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include "src/EpollTransport.h"
+#include "src/ReceiveQueue.h"
+
+namespace StateSync = Microsoft::MixedReality::Sharing::StateSync;
+
+namespace {
+
+Result TakeMessages(mrsChannelQueue* queue,
+                    uint32_t max_count,
+                    mrsMessage** messages_out,
+                    uint32_t* messages_count_out) noexcept {
+  if (!queue || !messages_out || !messages_count_out)
+    return 1;
+  try {
+    *messages_out = static_cast<StateSync::ReceiveQueue*>(queue)->Take(
+        max_count, *messages_count_out);
+    return 0;
+  } catch (...) {
+    *messages_out = nullptr;
+    *messages_count_out = 0;
+    return 1;
+  }
+}
+
+}  // namespace
+
+#ifdef __linux__
+
+namespace {
+
+std::mutex g_init_mutex;
+std::shared_ptr<StateSync::EpollTransport> g_transport;
+
+std::shared_ptr<StateSync::EpollTransport> GetTransport() noexcept {
+  return std::atomic_load(&g_transport);
+}
+
+Result CopyString(const std::string& string,
+                  const char** string_out,
+                  uint32_t* size_out) noexcept {
+  if (!string_out || !size_out)
+    return 1;
+  char* copy = new (std::nothrow) char[string.size()];
+  if (!copy)
+    return 1;
+  memcpy(copy, string.data(), string.size());
+  *string_out = copy;
+  *size_out = static_cast<uint32_t>(string.size());
+  return 0;
+}
+
+StateSync::Endpoint& ToEndpoint(mrsEndpoint* endpoint) noexcept {
+  return *static_cast<StateSync::Endpoint*>(endpoint);
+}
+
+StateSync::ChannelCategory& ToCategory(mrsChannelCategory* category) noexcept {
+  return *static_cast<StateSync::ChannelCategory*>(category);
+}
+
+StateSync::Channel& ToChannel(mrsChannel* channel) noexcept {
+  return *static_cast<StateSync::Channel*>(channel);
+}
+
+}  // namespace
+
+#endif  // #ifdef __linux__
+
+extern "C" {
+
+MRS_API Result MRS_CALL mrsQueueTakeAll(mrsChannelQueue* queue,
+                                        mrsMessage** messages_out,
+                                        uint32_t* messages_count_out) {
+  return TakeMessages(queue, std::numeric_limits<uint32_t>::max(),
+                      messages_out, messages_count_out);
+}
+
+MRS_API Result MRS_CALL mrsQueueTryTake(mrsChannelQueue* queue,
+                                        mrsMessage** messages_out,
+                                        uint32_t* messages_count_out) {
+  return TakeMessages(queue, 1, messages_out, messages_count_out);
+}
+
+MRS_API Result MRS_CALL mrsDisposeMessages(mrsMessage* messages, uint32_t) {
+  // The batch knows its size, and an empty batch is never returned.
+  if (messages)
+    StateSync::ReceiveQueue::Dispose(messages);
+  return 0;
+}
+
+#ifdef __linux__
+
+MRS_API Result MRS_CALL mrsInit() {
+  return mrsInitWithPort(0);
+}
+
+MRS_API Result MRS_CALL mrsInitWithPort(uint16_t port) {
+  auto lock = std::lock_guard{g_init_mutex};
+  if (GetTransport())
+    return 1;
+  try {
+    std::atomic_store(&g_transport,
+                      std::make_shared<StateSync::EpollTransport>(port));
+    return 0;
+  } catch (...) {
+    return 1;
+  }
+}
+
+MRS_API Result MRS_CALL mrsQuit() {
+  auto lock = std::lock_guard{g_init_mutex};
+  if (!GetTransport())
+    return 1;
+  std::atomic_store(&g_transport, {});
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsGetLocalPort(uint16_t* port_out) {
+  auto transport = GetTransport();
+  if (!transport || !port_out)
+    return 1;
+  *port_out = transport->port();
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsAcquireEndpoint(const char* id,
+                                           uint32_t id_size,
+                                           mrsEndpoint** endpoint_out) {
+  auto transport = GetTransport();
+  if (!transport || !id || !endpoint_out)
+    return 1;
+  try {
+    *endpoint_out = &transport->AcquireEndpoint({id, id_size});
+    return 0;
+  } catch (...) {
+    return 1;
+  }
+}
+
+MRS_API Result MRS_CALL mrsGetEndpointId(mrsEndpoint* endpoint,
+                                         const char** id_out,
+                                         uint32_t* id_size_out) {
+  if (!endpoint)
+    return 1;
+  return CopyString(ToEndpoint(endpoint).id(), id_out, id_size_out);
+}
+
+MRS_API Result MRS_CALL mrsReleaseEndpoint(mrsEndpoint* endpoint) {
+  auto transport = GetTransport();
+  if (!transport || !endpoint)
+    return 1;
+  transport->ReleaseEndpoint(ToEndpoint(endpoint));
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsCreateCategory(const char* name,
+                                          uint32_t name_size,
+                                          mrsChannelType type,
+                                          mrsChannelCategory** category_out) {
+  if (!name || !category_out)
+    return 1;
+  try {
+    *category_out =
+        new StateSync::ChannelCategory{std::string{name, name_size}, type};
+    return 0;
+  } catch (...) {
+    return 1;
+  }
+}
+
+MRS_API Result MRS_CALL mrsGetCategoryName(mrsChannelCategory* category,
+                                           const char** id_out,
+                                           uint32_t* id_size_out) {
+  if (!category)
+    return 1;
+  return CopyString(ToCategory(category).name(), id_out, id_size_out);
+}
+
+MRS_API Result MRS_CALL mrsGetCategoryType(mrsChannelCategory* category,
+                                           mrsChannelType* type_out) {
+  if (!category || !type_out)
+    return 1;
+  *type_out = ToCategory(category).type();
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsGetCategoryQueue(mrsChannelCategory* category,
+                                            mrsChannelQueue** queue_out) {
+  if (!category || !queue_out)
+    return 1;
+  *queue_out = &ToCategory(category).queue();
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsCategoryStartListening(
+    mrsChannelCategory* category) {
+  auto transport = GetTransport();
+  if (!transport || !category)
+    return 1;
+  try {
+    transport->StartListening(ToCategory(category));
+    return 0;
+  } catch (...) {
+    return 1;
+  }
+}
+
+MRS_API Result MRS_CALL mrsCategoryStopListening(
+    mrsChannelCategory* category) {
+  auto transport = GetTransport();
+  if (!transport || !category)
+    return 1;
+  transport->StopListening(ToCategory(category));
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsDisposeCategory(mrsChannelCategory* category) {
+  if (!category)
+    return 1;
+  if (auto transport = GetTransport())
+    transport->StopListening(ToCategory(category));
+  delete &ToCategory(category);
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsSetCategoryWeight(mrsChannelCategory* category,
+                                             uint32_t weight) {
+  if (!category)
+    return 1;
+  ToCategory(category).set_weight(weight);
+  return 0;
+}
+
+MRS_API Result MRS_CALL
+mrsSetCategoryCreditWindow(mrsChannelCategory* category, uint32_t size) {
+  if (!category)
+    return 1;
+  ToCategory(category).set_credit_window(size);
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsCreateChannel(mrsChannelCategory* category,
+                                         mrsEndpoint* endpoint,
+                                         mrsChannel** channel_out) {
+  if (!category || !endpoint || !channel_out)
+    return 1;
+  *channel_out = new (std::nothrow)
+      StateSync::Channel{ToCategory(category), ToEndpoint(endpoint)};
+  return *channel_out ? 0 : 1;
+}
+
+MRS_API Result MRS_CALL
+mrsGetChannelCategory(mrsChannel* channel, mrsChannelCategory** category_out) {
+  if (!channel || !category_out)
+    return 1;
+  *category_out = &ToChannel(channel).category();
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsGetChannelEndpoint(mrsChannel* channel,
+                                              mrsEndpoint** endpoint_out) {
+  if (!channel || !endpoint_out)
+    return 1;
+  *endpoint_out = &ToChannel(channel).endpoint();
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsIsChannelOk(mrsChannel* channel, uint8_t* ok_out) {
+  auto transport = GetTransport();
+  if (!transport || !channel || !ok_out)
+    return 1;
+  *ok_out = transport->IsOk(ToChannel(channel));
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsGetChannelSendQueueCount(mrsChannel* channel,
+                                                    uint32_t* count_out) {
+  auto transport = GetTransport();
+  if (!transport || !channel || !count_out)
+    return 1;
+  *count_out = transport->GetSendQueueCount(ToChannel(channel));
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsGetChannelSendCredit(mrsChannel* channel,
+                                                uint32_t* size_out) {
+  auto transport = GetTransport();
+  if (!transport || !channel || !size_out)
+    return 1;
+  *size_out = transport->GetSendCredit(ToChannel(channel));
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsChannelReconnect(mrsChannel* channel) {
+  auto transport = GetTransport();
+  if (!transport || !channel)
+    return 1;
+  transport->Reconnect(ToChannel(channel));
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsChannelSendMessage(mrsChannel* channel,
+                                              const char* payload,
+                                              uint32_t payload_size) {
+  auto transport = GetTransport();
+  if (!transport || !channel || (!payload && payload_size))
+    return 1;
+  try {
+    switch (transport->Send(ToChannel(channel), {payload, payload_size})) {
+      case StateSync::EpollTransport::SendResult::kQueued:
+        return 0;
+      case StateSync::EpollTransport::SendResult::kWouldBlock:
+        return kMrsResultWouldBlock;
+      default:
+        return 1;
+    }
+  } catch (...) {
+    return 1;
+  }
+}
+
+MRS_API Result MRS_CALL mrsDisposeChannel(mrsChannel* channel) {
+  if (!channel)
+    return 1;
+  delete &ToChannel(channel);
+  return 0;
+}
+
+MRS_API Result MRS_CALL mrsDisposeString(uint32_t, const char* ptr) {
+  delete[] ptr;
+  return 0;
+}
+
+#endif  // #ifdef __linux__
+}
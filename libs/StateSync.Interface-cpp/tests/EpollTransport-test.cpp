@@ -0,0 +1,491 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include "src/EpollTransport.h"
+
+#ifdef __linux__
+
+#include <iostream>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+namespace {
+
+using SendResult = EpollTransport::SendResult;
+
+std::string GetLocalId(const EpollTransport& transport) {
+  return "127.0.0.1:" + std::to_string(transport.port());
+}
+
+// Waits until the queue has the expected number of messages (or the timeout
+// expires) and takes them.
+std::vector<std::pair<Endpoint*, std::string>> TakeMessages(
+    ReceiveQueue& queue,
+    size_t expected_count,
+    std::chrono::milliseconds timeout = std::chrono::seconds{10}) {
+  std::vector<std::pair<Endpoint*, std::string>> result;
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (result.size() < expected_count &&
+         std::chrono::steady_clock::now() < deadline) {
+    uint32_t count;
+    mrsMessage* messages = queue.Take(std::numeric_limits<uint32_t>::max(),
+                                      count);
+    if (!messages) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      result.emplace_back(static_cast<Endpoint*>(messages[i].sender),
+                          std::string{reinterpret_cast<const char*>(
+                                          messages[i].payload),
+                                      messages[i].payload_size});
+    }
+    ReceiveQueue::Dispose(messages);
+  }
+  return result;
+}
+
+// Takes one message within the timeout.
+bool TakeMessage(ChannelCategory& category,
+                 std::chrono::milliseconds timeout) {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (std::chrono::steady_clock::now() < deadline) {
+    uint32_t count;
+    if (mrsMessage* messages = category.queue().Take(1, count)) {
+      ReceiveQueue::Dispose(messages);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Sends the messages back and forth, and returns the round trip times in
+// microseconds (without the lost messages).
+std::vector<double> MeasureRoundTrips(EpollTransport& a,
+                                      const Channel& channel,
+                                      EpollTransport& b,
+                                      const Channel& reply_channel,
+                                      size_t round_trips_count,
+                                      std::string_view payload) {
+  std::vector<double> round_trips;
+  round_trips.reserve(round_trips_count);
+  constexpr std::chrono::milliseconds kTimeout{100};
+  for (size_t i = 0; i < round_trips_count; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    a.Send(channel, payload);
+    // The channel of one side is received by the category of the other one.
+    if (!TakeMessage(reply_channel.category(), kTimeout))
+      continue;
+    b.Send(reply_channel, payload);
+    if (!TakeMessage(channel.category(), kTimeout))
+      continue;
+    const std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    round_trips.push_back(elapsed.count());
+  }
+  return round_trips;
+}
+
+void PrintRoundTrips(const char* name,
+                     std::vector<double> round_trips,
+                     size_t expected_count) {
+  if (round_trips.empty())
+    return;
+  std::sort(round_trips.begin(), round_trips.end());
+  double sum = 0;
+  for (double round_trip : round_trips)
+    sum += round_trip;
+  std::cout << name << " round trip: mean " << sum / round_trips.size()
+            << "us, median " << round_trips[round_trips.size() / 2]
+            << "us, p99 " << round_trips[round_trips.size() * 99 / 100]
+            << "us (" << round_trips.size() << " of " << expected_count
+            << ")\n";
+}
+
+}  // namespace
+
+TEST(EpollTransport, ordered_channels_share_a_connection) {
+  // The categories outlive the transports they listen to.
+  ChannelCategory first_category{"first", mrsChannelType::kOrdered};
+  ChannelCategory second_category{"second", mrsChannelType::kOrdered};
+  EpollTransport sender{0};
+  EpollTransport receiver{0};
+  receiver.StartListening(first_category);
+  receiver.StartListening(second_category);
+
+  Endpoint& endpoint = sender.AcquireEndpoint(GetLocalId(receiver));
+  EXPECT_EQ(endpoint.id(), GetLocalId(receiver));
+  Channel first_channel{first_category, endpoint};
+  Channel second_channel{second_category, endpoint};
+  constexpr size_t kMessagesCount = 1000;
+  for (size_t i = 0; i < kMessagesCount; ++i) {
+    ASSERT_EQ(sender.Send(i % 2 ? second_channel : first_channel,
+                          std::to_string(i)),
+              SendResult::kQueued);
+  }
+
+  auto first_messages =
+      TakeMessages(first_category.queue(), kMessagesCount / 2);
+  auto second_messages =
+      TakeMessages(second_category.queue(), kMessagesCount / 2);
+  ASSERT_EQ(first_messages.size(), kMessagesCount / 2);
+  ASSERT_EQ(second_messages.size(), kMessagesCount / 2);
+  for (size_t i = 0; i < kMessagesCount / 2; ++i) {
+    EXPECT_EQ(first_messages[i].first->id(), GetLocalId(sender));
+    EXPECT_EQ(first_messages[i].second, std::to_string(i * 2));
+    EXPECT_EQ(second_messages[i].second, std::to_string(i * 2 + 1));
+  }
+  EXPECT_TRUE(sender.IsOk(first_channel));
+  EXPECT_EQ(sender.GetSendQueueCount(first_channel), 0);
+  sender.ReleaseEndpoint(endpoint);
+}
+
+TEST(EpollTransport, unordered_messages_are_delivered) {
+  ChannelCategory category{"unordered", mrsChannelType::kUnordered};
+  ChannelCategory ordered_category{"ordered", mrsChannelType::kOrdered};
+  EpollTransport sender{0};
+  EpollTransport receiver{0};
+  receiver.StartListening(category);
+  receiver.StartListening(ordered_category);
+
+  Endpoint& endpoint = sender.AcquireEndpoint(GetLocalId(receiver));
+  Channel channel{category, endpoint};
+  std::string large_payload(EpollTransport::kMaxDatagramSize - 20, 'x');
+  for (int i = 0; i < 100; ++i)
+    ASSERT_EQ(sender.Send(channel, std::to_string(i)), SendResult::kQueued);
+  ASSERT_EQ(sender.Send(channel, large_payload), SendResult::kQueued);
+  large_payload.resize(EpollTransport::kMaxDatagramSize);
+  EXPECT_EQ(sender.Send(channel, large_payload), SendResult::kFailed);
+
+  // Loopback doesn't lose datagrams unless the buffers are full.
+  auto messages = TakeMessages(category.queue(), 101);
+  ASSERT_EQ(messages.size(), 101);
+  EXPECT_EQ(messages.front().first->id(), GetLocalId(sender));
+  EXPECT_EQ(messages.back().second.size(),
+            EpollTransport::kMaxDatagramSize - 20);
+  EXPECT_EQ(ordered_category.queue().size(), 0);
+  sender.ReleaseEndpoint(endpoint);
+}
+
+TEST(EpollTransport, failed_connection_can_be_reconnected) {
+  ChannelCategory category{"category", mrsChannelType::kOrdered};
+  EpollTransport sender{0};
+  auto receiver = std::make_unique<EpollTransport>(0);
+  const uint16_t port = receiver->port();
+  Endpoint& endpoint = sender.AcquireEndpoint(GetLocalId(*receiver));
+  Channel channel{category, endpoint};
+  receiver.reset();
+
+  // The connection is refused.
+  ASSERT_EQ(sender.Send(channel, "lost"), SendResult::kQueued);
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds{10};
+  while (sender.IsOk(channel))
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+  EXPECT_EQ(sender.Send(channel, "rejected"), SendResult::kFailed);
+  EXPECT_EQ(sender.GetSendQueueCount(channel), 0);
+
+  receiver = std::make_unique<EpollTransport>(port);
+  receiver->StartListening(category);
+  sender.Reconnect(channel);
+  EXPECT_TRUE(sender.IsOk(channel));
+  ASSERT_EQ(sender.Send(channel, "delivered"), SendResult::kQueued);
+  auto messages = TakeMessages(category.queue(), 1);
+  ASSERT_EQ(messages.size(), 1);
+  EXPECT_EQ(messages[0].second, "delivered");
+  sender.ReleaseEndpoint(endpoint);
+}
+
+TEST(EpollTransport, credit_limits_messages_in_flight) {
+  ChannelCategory category{"category", mrsChannelType::kOrdered};
+  EpollTransport sender{0};
+  EpollTransport receiver{0};
+  category.set_credit_window(16 * 1024);
+  receiver.StartListening(category);
+  Endpoint& endpoint = sender.AcquireEndpoint(GetLocalId(receiver));
+  Channel channel{category, endpoint};
+
+  // The receiver doesn't take the messages, so the sender runs out of credit
+  // and then fills its queue.
+  const std::string payload(1000, 'x');
+  size_t sent_count = 0;
+  while (sender.Send(channel, payload) == SendResult::kQueued)
+    ++sent_count;
+  EXPECT_EQ(sender.Send(channel, payload), SendResult::kWouldBlock);
+  // Each queued frame also has the header, the kind and the category name.
+  EXPECT_GE(sent_count * (payload.size() + 14), EpollTransport::kMaxQueuedSize);
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds{10};
+  while (sender.GetSendCredit(channel) != 0)
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+  // The initial credit is exceeded by at most one message (each message
+  // also uses 10 bytes for the kind and the category name).
+  std::this_thread::sleep_for(std::chrono::milliseconds{100});
+  EXPECT_EQ(category.queue().size(),
+            EpollTransport::kInitialCredit / (payload.size() + 10) + 1);
+
+  // Taking the messages grants more credit.
+  auto messages = TakeMessages(category.queue(), sent_count);
+  EXPECT_EQ(messages.size(), sent_count);
+  EXPECT_EQ(sender.GetSendQueueCount(channel), 0);
+  EXPECT_EQ(sender.Send(channel, payload), SendResult::kQueued);
+  sender.ReleaseEndpoint(endpoint);
+}
+
+TEST(EpollTransport, dropped_messages_are_credited) {
+  ChannelCategory category{"category", mrsChannelType::kOrdered};
+  EpollTransport sender{0};
+  EpollTransport receiver{0};
+  Endpoint& endpoint = sender.AcquireEndpoint(GetLocalId(receiver));
+  Channel channel{category, endpoint};
+
+  // The receiver doesn't listen to the category, so the messages are
+  // dropped, but the sender doesn't run out of credit.
+  const std::string payload(1000, 'x');
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds{10};
+  for (size_t i = 0; i < 4 * EpollTransport::kInitialCredit / payload.size();
+       ++i) {
+    while (sender.Send(channel, payload) == SendResult::kWouldBlock)
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+  }
+  while (sender.GetSendQueueCount(channel) != 0)
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+  EXPECT_TRUE(sender.IsOk(channel));
+  sender.ReleaseEndpoint(endpoint);
+}
+
+TEST(EpollTransport, small_messages_overtake_bulk_transfer) {
+  ChannelCategory bulk_category{"bulk", mrsChannelType::kOrdered};
+  ChannelCategory updates_category{"updates", mrsChannelType::kOrdered};
+  EpollTransport sender{0};
+  EpollTransport receiver{0};
+  receiver.StartListening(bulk_category);
+  receiver.StartListening(updates_category);
+  Endpoint& endpoint = sender.AcquireEndpoint(GetLocalId(receiver));
+  Channel bulk_channel{bulk_category, endpoint};
+  Channel updates_channel{updates_category, endpoint};
+
+  // 16 MiB are sent as fast as the receiver consumes them, and the update is
+  // sent after the last bulk message is queued.
+  constexpr size_t kBulkMessagesCount = 256;
+  const std::string bulk_payload(64 * 1024, 'x');
+  // The receiver notes how many bulk messages it got before the update.
+  size_t received_bulk_count = 0;
+  size_t bulk_count_before_update = kBulkMessagesCount;
+  std::thread receiver_thread{[&] {
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds{30};
+    while ((received_bulk_count < kBulkMessagesCount ||
+            bulk_count_before_update == kBulkMessagesCount) &&
+           std::chrono::steady_clock::now() < deadline) {
+      if (bulk_count_before_update == kBulkMessagesCount &&
+          updates_category.queue().size() != 0) {
+        bulk_count_before_update = received_bulk_count;
+      }
+      uint32_t count;
+      if (mrsMessage* messages = bulk_category.queue().Take(1, count)) {
+        ReceiveQueue::Dispose(messages);
+        ++received_bulk_count;
+      }
+    }
+  }};
+  for (size_t i = 0; i < kBulkMessagesCount; ++i) {
+    while (sender.Send(bulk_channel, bulk_payload) == SendResult::kWouldBlock)
+      std::this_thread::yield();
+  }
+  EXPECT_EQ(sender.Send(updates_channel, "update"), SendResult::kQueued);
+  receiver_thread.join();
+
+  EXPECT_EQ(received_bulk_count, kBulkMessagesCount);
+  EXPECT_EQ(updates_category.queue().size(), 1);
+  // The bulk messages waiting for credit (up to kMaxQueuedSize) are still
+  // queued when the update arrives.
+  EXPECT_LT(bulk_count_before_update, kBulkMessagesCount);
+  sender.ReleaseEndpoint(endpoint);
+}
+
+TEST(EpollTransport, c_api_loopback) {
+  ASSERT_EQ(mrsInit(), 0);
+  uint16_t port;
+  ASSERT_EQ(mrsGetLocalPort(&port), 0);
+  const std::string id = "127.0.0.1:" + std::to_string(port);
+  mrsEndpoint* endpoint;
+  ASSERT_EQ(mrsAcquireEndpoint(id.data(), static_cast<uint32_t>(id.size()),
+                               &endpoint),
+            0);
+  mrsChannelCategory* category;
+  ASSERT_EQ(mrsCreateCategory("api", 3, mrsChannelType::kOrdered, &category),
+            0);
+  ASSERT_EQ(mrsCategoryStartListening(category), 0);
+  mrsChannel* channel;
+  ASSERT_EQ(mrsCreateChannel(category, endpoint, &channel), 0);
+  ASSERT_EQ(mrsChannelSendMessage(channel, "hello", 5), 0);
+
+  mrsChannelQueue* queue;
+  ASSERT_EQ(mrsGetCategoryQueue(category, &queue), 0);
+  mrsMessage* messages = nullptr;
+  uint32_t count = 0;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds{10};
+  while (!messages) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    ASSERT_EQ(mrsQueueTakeAll(queue, &messages, &count), 0);
+  }
+  ASSERT_EQ(count, 1);
+  EXPECT_EQ(messages[0].category, category);
+  EXPECT_EQ(std::string_view(reinterpret_cast<const char*>(messages[0].payload),
+                             messages[0].payload_size),
+            "hello");
+  const char* sender_id;
+  uint32_t sender_id_size;
+  ASSERT_EQ(mrsGetEndpointId(messages[0].sender, &sender_id, &sender_id_size),
+            0);
+  EXPECT_EQ(std::string_view(sender_id, sender_id_size), id);
+  EXPECT_EQ(mrsDisposeString(sender_id_size, sender_id), 0);
+  EXPECT_EQ(mrsDisposeMessages(messages, count), 0);
+
+  EXPECT_EQ(mrsDisposeChannel(channel), 0);
+  EXPECT_EQ(mrsDisposeCategory(category), 0);
+  EXPECT_EQ(mrsReleaseEndpoint(endpoint), 0);
+  EXPECT_EQ(mrsQuit(), 0);
+}
+
+TEST(EpollTransport, DISABLED_localhost_benchmark) {
+  constexpr size_t kMessagesCount = 1'000'000;
+  constexpr size_t kPayloadSize = 100;
+  constexpr size_t kRoundTripsCount = 10'000;
+
+  EpollTransport a{0};
+  EpollTransport b{0};
+  Endpoint& a_to_b = a.AcquireEndpoint(GetLocalId(b));
+  Endpoint& b_to_a = b.AcquireEndpoint(GetLocalId(a));
+  const std::string payload(kPayloadSize, 'x');
+
+  for (auto type : {mrsChannelType::kOrdered, mrsChannelType::kUnordered}) {
+    const char* type_name =
+        type == mrsChannelType::kOrdered ? "Ordered" : "Unordered";
+    // The categories with the same name receive the messages on each side.
+    ChannelCategory a_category{type_name, type};
+    ChannelCategory b_category{type_name, type};
+    a.StartListening(a_category);
+    b.StartListening(b_category);
+    Channel channel{a_category, a_to_b};
+    Channel reply_channel{b_category, b_to_a};
+
+    // Throughput. The datagrams that don't fit into the socket buffers are
+    // dropped, so the sender is throttled by the size of its queue.
+    {
+      const auto start = std::chrono::steady_clock::now();
+      size_t received_count = 0;
+      std::thread receiver{[&] {
+        auto last_receive_time = std::chrono::steady_clock::now();
+        while (received_count < kMessagesCount &&
+               std::chrono::steady_clock::now() - last_receive_time <
+                   std::chrono::seconds{1}) {
+          uint32_t count;
+          if (mrsMessage* messages = b_category.queue().Take(
+                  std::numeric_limits<uint32_t>::max(), count)) {
+            received_count += count;
+            last_receive_time = std::chrono::steady_clock::now();
+            ReceiveQueue::Dispose(messages);
+          }
+        }
+      }};
+      for (size_t i = 0; i < kMessagesCount; ++i) {
+        while (a.GetSendQueueCount(channel) > 10'000)
+          std::this_thread::yield();
+        while (a.Send(channel, payload) == SendResult::kWouldBlock)
+          std::this_thread::yield();
+      }
+      receiver.join();
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      std::cout << type_name << " throughput: "
+                << received_count / elapsed.count() / 1e6
+                << "M messages/s, received " << received_count << " of "
+                << kMessagesCount << '\n';
+    }
+
+    PrintRoundTrips(type_name,
+                    MeasureRoundTrips(a, channel, b, reply_channel,
+                                      kRoundTripsCount, payload),
+                    kRoundTripsCount);
+    a.StopListening(a_category);
+    b.StopListening(b_category);
+  }
+  a.ReleaseEndpoint(a_to_b);
+  b.ReleaseEndpoint(b_to_a);
+}
+
+// Measures the latency of small ordered messages while a bulk transfer to the
+// same endpoint saturates the connection.
+TEST(EpollTransport, DISABLED_bulk_transfer_benchmark) {
+  constexpr size_t kRoundTripsCount = 2'000;
+  const std::string bulk_payload(64 * 1024, 'x');
+
+  ChannelCategory a_bulk{"bulk", mrsChannelType::kOrdered};
+  ChannelCategory b_bulk{"bulk", mrsChannelType::kOrdered};
+  ChannelCategory a_updates{"updates", mrsChannelType::kOrdered};
+  ChannelCategory b_updates{"updates", mrsChannelType::kOrdered};
+  EpollTransport a{0};
+  EpollTransport b{0};
+  b.StartListening(b_bulk);
+  a.StartListening(a_updates);
+  b.StartListening(b_updates);
+  Endpoint& a_to_b = a.AcquireEndpoint(GetLocalId(b));
+  Endpoint& b_to_a = b.AcquireEndpoint(GetLocalId(a));
+  Channel bulk_channel{a_bulk, a_to_b};
+  Channel updates_channel{a_updates, a_to_b};
+  Channel reply_channel{b_updates, b_to_a};
+
+  PrintRoundTrips("Idle",
+                  MeasureRoundTrips(a, updates_channel, b, reply_channel,
+                                    kRoundTripsCount, "update"),
+                  kRoundTripsCount);
+
+  for (uint32_t weight : {1, 16}) {
+    a_updates.set_weight(weight);
+    std::atomic_bool stop{false};
+    size_t bulk_size = 0;
+    std::thread bulk_sender{[&] {
+      while (!stop) {
+        if (a.Send(bulk_channel, bulk_payload) == SendResult::kWouldBlock)
+          std::this_thread::yield();
+      }
+    }};
+    std::thread bulk_receiver{[&] {
+      while (!stop) {
+        uint32_t count;
+        if (mrsMessage* messages = b_bulk.queue().Take(
+                std::numeric_limits<uint32_t>::max(), count)) {
+          bulk_size += count * bulk_payload.size();
+          ReceiveQueue::Dispose(messages);
+        }
+      }
+    }};
+    const auto start = std::chrono::steady_clock::now();
+    auto round_trips = MeasureRoundTrips(a, updates_channel, b, reply_channel,
+                                         kRoundTripsCount, "update");
+    stop = true;
+    bulk_sender.join();
+    bulk_receiver.join();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    const std::string name =
+        "With bulk transfer (weight " + std::to_string(weight) + ")";
+    PrintRoundTrips(name.c_str(), std::move(round_trips), kRoundTripsCount);
+    std::cout << "Bulk throughput: "
+              << bulk_size / elapsed.count() / (1024 * 1024) << " MiB/s\n";
+  }
+  a.StopListening(a_updates);
+  b.StopListening(b_bulk);
+  b.StopListening(b_updates);
+  a.ReleaseEndpoint(a_to_b);
+  b.ReleaseEndpoint(b_to_a);
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
+
+#endif  // #ifdef __linux__
@@ -0,0 +1,184 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include "src/ReceiveQueue.h"
+
+#include <deque>
+#include <iostream>
+
+namespace Microsoft::MixedReality::Sharing::StateSync {
+namespace {
+
+std::string MakePayload(size_t index, size_t size) {
+  std::string result(size, '\0');
+  for (size_t i = 0; i < size; ++i)
+    result[i] = static_cast<char>('a' + (index + i) % 26);
+  return result;
+}
+
+std::string_view GetPayload(const mrsMessage& message) {
+  return {reinterpret_cast<const char*>(message.payload),
+          message.payload_size};
+}
+
+}  // namespace
+
+TEST(ReceiveQueue, messages_are_taken_in_order) {
+  ReceiveQueue queue;
+  mrsEndpoint endpoint;
+  mrsChannelCategory category;
+  for (size_t i = 0; i < 1000; ++i)
+    queue.Push(&endpoint, &category, MakePayload(i, i % 100));
+  EXPECT_EQ(queue.size(), 1000);
+
+  mrsMessage* messages;
+  uint32_t count;
+  ASSERT_EQ(mrsQueueTryTake(&queue, &messages, &count), 0);
+  ASSERT_EQ(count, 1);
+  EXPECT_EQ(GetPayload(messages[0]), MakePayload(0, 0));
+  EXPECT_EQ(mrsDisposeMessages(messages, count), 0);
+
+  ASSERT_EQ(mrsQueueTakeAll(&queue, &messages, &count), 0);
+  ASSERT_EQ(count, 999);
+  for (size_t i = 0; i < count; ++i) {
+    EXPECT_EQ(messages[i].sender, &endpoint);
+    EXPECT_EQ(messages[i].category, &category);
+    EXPECT_EQ(GetPayload(messages[i]), MakePayload(i + 1, (i + 1) % 100));
+  }
+  EXPECT_EQ(mrsDisposeMessages(messages, count), 0);
+
+  EXPECT_EQ(queue.size(), 0);
+  ASSERT_EQ(mrsQueueTakeAll(&queue, &messages, &count), 0);
+  EXPECT_EQ(messages, nullptr);
+  EXPECT_EQ(count, 0);
+}
+
+TEST(ReceiveQueue, slabs_are_reused) {
+  ReceiveQueue queue;
+  mrsEndpoint endpoint;
+  mrsChannelCategory category;
+  const std::string payload = MakePayload(0, 1000);
+  for (int iteration = 0; iteration < 100; ++iteration) {
+    for (int i = 0; i < 500; ++i)
+      queue.Push(&endpoint, &category, payload);
+    uint32_t count;
+    mrsMessage* messages = queue.Take(1000, count);
+    ASSERT_EQ(count, 500);
+    EXPECT_EQ(GetPayload(messages[count - 1]), payload);
+    ReceiveQueue::Dispose(messages);
+  }
+  // Each iteration receives about 8 slabs worth of payloads.
+  EXPECT_LT(queue.allocated_slabs_count(), 20);
+}
+
+TEST(ReceiveQueue, large_payloads_get_dedicated_buffers) {
+  ReceiveQueue queue;
+  mrsEndpoint endpoint;
+  mrsChannelCategory category;
+  const std::string large_payload =
+      MakePayload(1, ReceiveQueue::kSlabSize * 3 + 5);
+  queue.Push(&endpoint, &category, "small");
+  queue.Push(&endpoint, &category, large_payload);
+  queue.Push(&endpoint, &category, "small again");
+
+  // The messages can be disposed in any order.
+  uint32_t count;
+  mrsMessage* first = queue.Take(2, count);
+  ASSERT_EQ(count, 2);
+  mrsMessage* second = queue.Take(2, count);
+  ASSERT_EQ(count, 1);
+  EXPECT_EQ(GetPayload(first[0]), "small");
+  EXPECT_EQ(GetPayload(first[1]), large_payload);
+  EXPECT_EQ(GetPayload(second[0]), "small again");
+  ReceiveQueue::Dispose(second);
+  ReceiveQueue::Dispose(first);
+  EXPECT_EQ(queue.allocated_slabs_count(), 3);
+}
+
+// Compares the queue to the straightforward one that allocates each payload
+// and each array of taken messages.
+TEST(ReceiveQueue, DISABLED_loopback_benchmark) {
+  constexpr size_t kMessagesCount = 10'000'000;
+  constexpr size_t kPayloadSize = 100;
+
+  struct NaiveQueue {
+    void Push(mrsEndpoint* sender,
+              mrsChannelCategory* category,
+              std::string_view payload) {
+      auto* copy = new uint8_t[payload.size()];
+      memcpy(copy, payload.data(), payload.size());
+      auto lock = std::lock_guard{mutex_};
+      messages_.push_back({sender, category, copy,
+                           static_cast<uint32_t>(payload.size())});
+    }
+    mrsMessage* Take(uint32_t& count) {
+      auto lock = std::lock_guard{mutex_};
+      count = static_cast<uint32_t>(messages_.size());
+      if (count == 0)
+        return nullptr;
+      auto* result = new mrsMessage[count];
+      std::copy(messages_.begin(), messages_.end(), result);
+      messages_.clear();
+      return result;
+    }
+    static void Dispose(mrsMessage* messages, uint32_t count) {
+      for (uint32_t i = 0; i < count; ++i)
+        delete[] messages[i].payload;
+      delete[] messages;
+    }
+    std::mutex mutex_;
+    std::deque<mrsMessage> messages_;
+  };
+
+  auto run = [&](const char* name, auto& queue, auto dispose) {
+    mrsEndpoint endpoint;
+    mrsChannelCategory category;
+    const std::string payload = MakePayload(0, kPayloadSize);
+    const auto start = std::chrono::steady_clock::now();
+    std::thread producer{[&] {
+      for (size_t i = 0; i < kMessagesCount; ++i)
+        queue.Push(&endpoint, &category, payload);
+    }};
+    size_t received_count = 0;
+    size_t received_size = 0;
+    while (received_count != kMessagesCount) {
+      uint32_t count;
+      mrsMessage* messages = queue.Take(count);
+      for (uint32_t i = 0; i < count; ++i)
+        received_size += messages[i].payload_size;
+      received_count += count;
+      if (messages)
+        dispose(messages, count);
+    }
+    producer.join();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(received_size, kMessagesCount * kPayloadSize);
+    std::cout << name << ": " << kMessagesCount / elapsed.count() / 1e6
+              << "M messages/s\n";
+  };
+
+  struct PooledQueue {
+    void Push(mrsEndpoint* sender,
+              mrsChannelCategory* category,
+              std::string_view payload) {
+      queue_.Push(sender, category, payload);
+    }
+    mrsMessage* Take(uint32_t& count) {
+      return queue_.Take(std::numeric_limits<uint32_t>::max(), count);
+    }
+    ReceiveQueue queue_;
+  };
+
+  NaiveQueue naive_queue;
+  run("Allocating queue", naive_queue, &NaiveQueue::Dispose);
+  PooledQueue pooled_queue;
+  run("ReceiveQueue", pooled_queue,
+      [](mrsMessage* messages, uint32_t) { ReceiveQueue::Dispose(messages); });
+  std::cout << "Slabs allocated: "
+            << pooled_queue.queue_.allocated_slabs_count() << '\n';
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::StateSync
@@ -4,6 +4,7 @@
 #pragma once
 #include <Microsoft/MixedReality/Sharing/VersionedStorage/enums.h>
 
+#include <optional>
 #include <string_view>
 #include <vector>
 
@@ -80,7 +81,37 @@ class Behavior {
   [[nodiscard]] virtual void* AllocateZeroedPages(
       size_t pages_count) noexcept = 0;
 
-  // Frees pages previously allocated with AllocateZeroedPages.
+  // Reserves the address space for pages_count pages (each is 4096 bytes
+  // large) without allocating them. The returned address should be
+  // page-aligned.
+  // Large blobs reserve more pages than they need initially, and commit them
+  // with CommitPages() as they grow, instead of being reallocated.
+  // Returns nullptr if the reservation is not possible or not supported (in
+  // which case AllocateZeroedPages() is used, and the blob can't grow).
+  [[nodiscard]] virtual void* ReservePages(size_t) noexcept { return nullptr; }
+
+  // Allocates zeroed memory for pages_count pages starting from the
+  // page-aligned address within the range previously reserved with
+  // ReservePages().
+  // Returns false if the allocation is not possible.
+  [[nodiscard]] virtual bool CommitPages(void*, size_t) noexcept {
+    return false;
+  }
+
+  // Returns the maximum number of threads (including the writer thread) that
+  // can be used to copy the state into a new blob when the current one runs out
+  // of space.
+  // If it's greater than 1, GetKeyHash(KeyHandle), Less(KeyHandle, KeyHandle)
+  // and both DuplicateHandle() methods can be called concurrently from several
+  // threads during the merge, so they must be thread-safe.
+  // The default implementation returns 1 (the merge is performed on the writer
+  // thread).
+  [[nodiscard]] virtual uint32_t GetMergeThreadsCount() const noexcept {
+    return 1;
+  }
+
+  // Frees pages previously allocated with AllocateZeroedPages, or reserved with
+  // ReservePages (including all committed pages).
   virtual void FreePages(void* address) noexcept = 0;
 
   // Serializes the key associated with the provided handle and returns the
@@ -101,6 +132,24 @@ class Behavior {
   virtual PayloadHandle DeserializePayload(
       std::string_view serialized_payload) = 0;
 
+  // Calculates the result of a read-modify-write operation for a subkey that
+  // currently has current_payload (or is missing if it's nullopt).
+  // The operand is provided in the serialized form (as written by
+  // Serialize(PayloadHandle)).
+  // Returns the new payload (the ownership is transferred to the caller), or
+  // nullopt if the operation can't be applied to the current payload (for
+  // example, on overflow), in which case the transaction will fail as if its
+  // prerequisites were not satisfied.
+  // If the behavior is used with a replicated storage, the result must be
+  // deterministic.
+  // The default implementation doesn't support any operations.
+  [[nodiscard]] virtual std::optional<PayloadHandle> ApplyOperation(
+      SubkeyOperationKind,
+      std::optional<PayloadHandle>,
+      std::string_view) noexcept {
+    return std::nullopt;
+  }
+
  protected:
   Behavior() = default;
   virtual ~Behavior() = default;
@@ -7,6 +7,7 @@
 #include <Microsoft/MixedReality/Sharing/VersionedStorage/VersionedPayloadHandle.h>
 
 #include <optional>
+#include <string_view>
 
 namespace Microsoft::MixedReality::Sharing::VersionedStorage {
 
@@ -75,6 +76,22 @@ class Snapshot {
     return SubkeyIteratorRange{SubkeyIterator{key_view, *this}};
   }
 
+  // Returns true if all prerequisites of the serialized transaction (see
+  // TransactionBuilder::Serialize()) are satisfied by the state of this
+  // snapshot.
+  // This is a read-only operation that doesn't lock the storage, and can be
+  // used to discard transactions that would fail on the latest known state
+  // before they are submitted. The result is only exact for this snapshot: if
+  // the state changes before the transaction is applied, a transaction that
+  // passed the check can fail, and one that didn't pass it can succeed.
+  // Always returns false for a default-constructed snapshot or a malformed
+  // transaction.
+  // Only the prerequisites are checked. Results of subkey operations (see
+  // TransactionBuilder::ApplyOperation()) are not calculated, so the
+  // transaction can still fail if the operation fails.
+  bool CheckPrerequisites(std::string_view serialized_transaction) const
+      noexcept;
+
  private:
   Detail::HeaderBlock* header_block_{nullptr};
   std::shared_ptr<Behavior> behavior_;
@@ -0,0 +1,94 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/Behavior.h>
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/KeyDescriptor.h>
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/Snapshot.h>
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/VersionedPayloadHandle.h>
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace Microsoft::MixedReality::Sharing::VersionedStorage {
+
+// A snapshot with speculative transactions applied on top of it, without
+// modifying the storage.
+// This allows the application to observe the effects of its own transactions
+// before they are applied to the storage (for example, while they are waiting
+// to be committed by a replicated state machine). Once the storage catches up,
+// a new overlay should be created on top of the new snapshot, with the
+// transactions that are still pending applied again (so the transactions that
+// were rejected, or applied in a different order, are rolled back).
+//
+// The overlay only stores the subkeys changed by the speculative
+// transactions, and forwards the rest of the lookups to the snapshot.
+// The payloads assigned by the i-th speculative transaction get the version
+// base().version() + i.
+//
+// The const methods can be called concurrently.
+class SpeculativeOverlay {
+ public:
+  SpeculativeOverlay(Snapshot base,
+                     std::shared_ptr<Behavior> behavior) noexcept;
+
+  // Duplicates all handles held by the other overlay.
+  SpeculativeOverlay(const SpeculativeOverlay& other) noexcept;
+  SpeculativeOverlay& operator=(const SpeculativeOverlay&) = delete;
+
+  ~SpeculativeOverlay() noexcept;
+
+  const Snapshot& base() const noexcept { return base_; }
+
+  // The version of the base snapshot plus the number of speculative
+  // transactions applied to the overlay.
+  uint64_t version() const noexcept { return version_; }
+
+  // Applies the serialized transaction (see TransactionBuilder::Serialize())
+  // to the overlay, following the same rules as Storage::ApplyTransaction().
+  // Returns false if the prerequisites of the transaction are not satisfied
+  // (the version is incremented anyway), or if the transaction is malformed
+  // (the version is not incremented).
+  bool ApplyTransaction(std::string_view serialized_transaction) noexcept;
+
+  // Same as Snapshot::Get(), but observes the speculative changes.
+  VersionedPayloadHandle Get(const KeyDescriptor& key, uint64_t subkey) const
+      noexcept;
+
+  // Same as Snapshot::GetSubkeysCount(), but observes the speculative changes.
+  size_t GetSubkeysCount(const KeyDescriptor& key) const noexcept;
+
+  // The number of keys with speculatively changed subkeys.
+  size_t changed_keys_count() const noexcept { return keys_.size(); }
+
+ private:
+  struct KeyOverlay {
+    KeyHandle key_;
+    uint64_t key_hash_;
+    // If true, the subkeys of the base snapshot are hidden.
+    bool is_cleared_{false};
+    size_t subkeys_count_{0};
+    // Missing payloads mark removed subkeys.
+    std::map<uint64_t, VersionedPayloadHandle> subkeys_;
+  };
+
+  // The number of keys is expected to be small (they are only changed by
+  // the pending transactions), so the keys are searched linearly.
+  const KeyOverlay* FindKey(const KeyDescriptor& key) const noexcept;
+
+  VersionedPayloadHandle Get(const KeyOverlay* key_overlay,
+                             const KeyDescriptor& key,
+                             uint64_t subkey) const noexcept;
+
+  void Release(KeyOverlay& key_overlay) noexcept;
+
+  Snapshot base_;
+  std::shared_ptr<Behavior> behavior_;
+  uint64_t version_;
+  std::vector<KeyOverlay> keys_;
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::VersionedStorage
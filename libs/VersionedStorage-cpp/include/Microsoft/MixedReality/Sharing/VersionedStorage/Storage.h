@@ -8,8 +8,18 @@
 
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
 
 namespace Microsoft::MixedReality::Sharing::VersionedStorage {
+namespace Detail {
+class KeyHandleCache;
+class KeyStateBlock;
+class SubkeyStateBlock;
+}  // namespace Detail
+
+class SerializedTransactionView;
 
 // A versioned snapshottable map-like data structure.
 // It supports two-level addressing, with keys and subkeys within a key, where
@@ -55,6 +65,11 @@ class Storage {
     // and no further modifications can be made to the same state.
     // Old snapshots can still be safely observed.
     FailedDueToInsufficientResources,
+
+    // The transaction is malformed and wasn't applied. The version is not
+    // incremented (all participants reject the same transaction the same
+    // way), and the storage can keep applying other transactions.
+    RejectedAsMalformed,
   };
 
   // Applies the provided transaction and increments the version of the storage
@@ -63,6 +78,97 @@ class Storage {
   [[nodiscard]] TransactionResult ApplyTransaction(
       std::string_view serialized_transaction) noexcept;
 
+  // A serialized transaction that was parsed by DecodeTransaction().
+  // References the serialized transaction, which must stay alive until the
+  // decoded transaction is applied or destroyed.
+  class DecodedTransaction {
+   public:
+    DecodedTransaction(DecodedTransaction&&) noexcept;
+    DecodedTransaction& operator=(DecodedTransaction&&) noexcept;
+    ~DecodedTransaction() noexcept;
+
+   private:
+    explicit DecodedTransaction(
+        std::unique_ptr<SerializedTransactionView> view) noexcept;
+
+    std::unique_ptr<SerializedTransactionView> view_;
+    friend class Storage;
+  };
+
+  // Parses and validates the layout of the serialized transaction.
+  // Returns an empty optional if the transaction is malformed (see
+  // TransactionResult::RejectedAsMalformed).
+  // Doesn't access the state of the storage, so it can be called from any
+  // thread, concurrently with ApplyTransaction() (for example, the next
+  // transaction can be decoded while the current one is being applied).
+  // Throws std::bad_alloc if the decoded transaction can't be allocated.
+  std::optional<DecodedTransaction> DecodeTransaction(
+      std::string_view serialized_transaction) const;
+
+  // Same as ApplyTransaction() above, for a transaction that was decoded by
+  // DecodeTransaction() (the transaction can only be applied once).
+  [[nodiscard]] TransactionResult ApplyTransaction(
+      DecodedTransaction&& transaction) noexcept;
+
+  // Appends the latest state of the storage (its version and the latest
+  // payloads of all subkeys) to the provided string, in the format expected by
+  // StateRestorer.
+  // Throws std::bad_alloc, or the exceptions thrown by Behavior::Serialize().
+  void SerializeState(std::string& state_blob) const;
+
+  // Builds the state serialized by SerializeState() (possibly by another
+  // storage with an equivalent Behavior) from consecutive chunks of the
+  // serialized state. The serialized state is never stored in one buffer:
+  // only the record that is split between the chunks is buffered (each record
+  // is a single key or a single payload).
+  class StateRestorer {
+   public:
+    explicit StateRestorer(std::shared_ptr<Behavior> behavior) noexcept;
+    ~StateRestorer() noexcept;
+
+    StateRestorer(const StateRestorer&) = delete;
+    StateRestorer& operator=(const StateRestorer&) = delete;
+
+    // Returns false if the state is malformed, or if there is not enough
+    // memory to restore it. The restorer can't be used after that.
+    [[nodiscard]] bool Append(std::string_view chunk) noexcept;
+
+    // True once the whole state was appended.
+    bool is_complete() const noexcept {
+      return header_block_ && !has_failed_ && remaining_keys_count_ == 0 &&
+             remaining_key_subkeys_count_ == 0;
+    }
+
+   private:
+    // Throws std::out_of_range if the record is malformed, or the exceptions
+    // thrown by Behavior::DeserializeKey() and Behavior::DeserializePayload().
+    bool ProcessRecord(std::string_view record);
+
+    std::shared_ptr<Behavior> behavior_;
+    // The blob of the restored state, created once the header is received.
+    Detail::HeaderBlock* header_block_{nullptr};
+    SnapshotInfo info_;
+    std::string incomplete_record_;
+    size_t remaining_keys_count_{0};
+    size_t remaining_subkeys_count_{0};
+    Detail::KeyStateBlock* last_key_block_{nullptr};
+    uint64_t last_key_hash_{0};
+    uint32_t key_subkeys_count_{0};
+    uint32_t remaining_key_subkeys_count_{0};
+    Detail::SubkeyStateBlock* last_subkey_block_{nullptr};
+    bool has_failed_{false};
+
+    friend class Storage;
+  };
+
+  // Replaces the state of the storage with the state built by the restorer,
+  // including the version. The storage can keep applying transactions after
+  // that (even if it previously failed due to insufficient resources).
+  // The restorer must be created with the same Behavior.
+  // Returns false (without changing the state) if the restorer didn't receive
+  // the complete state.
+  [[nodiscard]] bool RestoreState(StateRestorer& restorer) noexcept;
+
   const auto& behavior() const noexcept { return behavior_; }
 
  private:
@@ -73,6 +179,10 @@ class Storage {
   Snapshot latest_snapshot_;
   std::mutex writer_mutex_;
   mutable std::mutex latest_snapshot_reader_mutex_;
+
+  // Remembers the hashes and handles of recently mentioned keys to speed up
+  // the deserialization of transactions. Guarded by writer_mutex_.
+  std::unique_ptr<Detail::KeyHandleCache> key_handle_cache_;
 };
 
 }  // namespace Microsoft::MixedReality::Sharing::VersionedStorage
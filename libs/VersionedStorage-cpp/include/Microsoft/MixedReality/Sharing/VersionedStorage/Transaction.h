@@ -44,6 +44,15 @@ struct SubkeyTransactionView {
   SubkeyTransactionView(PayloadHandle handle) noexcept
       : operation_{Operation::PutSubkey}, handle_{handle} {}
 
+  // Converts the result of Behavior::ApplyOperation() to a view (takes the
+  // ownership of the result).
+  // If the result is the same as the current payload, the result is released,
+  // and no change is required.
+  static SubkeyTransactionView FromOperationResult(
+      Behavior& behavior,
+      std::optional<PayloadHandle> current_payload,
+      std::optional<PayloadHandle> result) noexcept;
+
   // If this view owns a handle, transfers the ownership to the caller.
   std::optional<PayloadHandle> ReleaseHandle() noexcept {
     if (operation_ == Operation::PutSubkey) {
@@ -87,6 +96,16 @@ class TransactionView {
   virtual SubkeyTransactionView GetSubkeyTransactionView(
       VersionedPayloadHandle current_state) noexcept = 0;
 
+  // Writes up to max_count subkeys that will be returned by the following
+  // MoveNextSubkey() calls for the current key (without advancing), and returns
+  // the number of written subkeys.
+  // This is only a hint that allows the storage to prefetch the state of
+  // upcoming subkeys, so the implementation is allowed to return fewer subkeys
+  // than there are left (or 0).
+  virtual size_t PeekNextSubkeys(uint64_t*, size_t) noexcept {
+    return 0;
+  }
+
  protected:
   uint64_t current_subkey_{0};
 };
@@ -98,19 +117,34 @@ class TransactionBuilder : public TransactionView {
   virtual ~TransactionBuilder() noexcept = default;
 
   // Instructs the transaction to write the value to the subkey of the key.
-  // The effect of any previous Put() or Delete() calls on the same subkey
-  // within this transaction will be overwritten by this call. When the
-  // transaction is applied, the new value will overwrite any previous value
-  // that this subkey had (or insert it if it was missing).
+  // The effect of any previous Put(), Delete() or ApplyOperation() calls on the
+  // same subkey within this transaction will be overwritten by this call. When
+  // the transaction is applied, the new value will overwrite any previous
+  // value that this subkey had (or insert it if it was missing).
   virtual void Put(KeyDescriptor& key,
                    uint64_t subkey,
                    PayloadHandle new_payload) noexcept = 0;
 
   // Instructs the transaction to delete the subkey of the key.
-  // The effect of any previous Put() or Delete() calls on the same subkey
-  // within this transaction will be overwritten by this call.
+  // The effect of any previous Put(), Delete() or ApplyOperation() calls on the
+  // same subkey within this transaction will be overwritten by this call.
   virtual void Delete(KeyDescriptor& key, uint64_t subkey) noexcept = 0;
 
+  // Instructs the transaction to replace the value of the subkey with the
+  // result of a read-modify-write operation, calculated by
+  // Behavior::ApplyOperation() when the transaction is applied (from the value
+  // the subkey has at that moment, or from the missing value if the key is
+  // cleared by this transaction).
+  // Unlike Put() combined with RequireExactPayload(), this doesn't fail if the
+  // subkey was concurrently modified by another transaction, which allows
+  // contended values, such as shared counters, to be updated in one attempt.
+  // The effect of any previous Put(), Delete() or ApplyOperation() calls on the
+  // same subkey within this transaction will be overwritten by this call.
+  virtual void ApplyOperation(KeyDescriptor& key,
+                              uint64_t subkey,
+                              SubkeyOperationKind operation_kind,
+                              PayloadHandle operand) noexcept = 0;
+
   // Instructs the transaction to delete all existing subkeys of the key before
   // applying any other changes.
   // Subkeys will be removed after the prerequisites of the transaction are
@@ -165,8 +199,10 @@ class TransactionBuilder : public TransactionView {
   virtual void Serialize(Serialization::BitstreamWriter& bitstream_writer,
                          std::vector<std::byte>& byte_stream) noexcept = 0;
 
+  // subkeys_encoding only affects the output of Serialize().
   static std::unique_ptr<TransactionBuilder> Create(
-      std::shared_ptr<Behavior> behavior) noexcept;
+      std::shared_ptr<Behavior> behavior,
+      SubkeysEncoding subkeys_encoding = SubkeysEncoding::Deltas) noexcept;
 
  protected:
   TransactionBuilder() noexcept = default;
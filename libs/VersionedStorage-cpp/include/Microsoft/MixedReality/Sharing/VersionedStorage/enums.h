@@ -20,6 +20,34 @@ enum class KeySubscriptionHandle : uint64_t { kInvalid = 0 };
 
 enum class SubkeySubscriptionHandle : uint64_t { kInvalid = 0 };
 
+// Deterministic read-modify-write operations that transactions can apply to
+// subkeys (see TransactionBuilder::ApplyOperation()).
+// The new payload is calculated by Behavior::ApplyOperation() from the current
+// payload of the subkey and the operand provided with the transaction.
+enum class SubkeyOperationKind : uint32_t {
+  // Adds the operand to the current payload.
+  Add,
+  // Replaces the current payload with the operand if the operand is less.
+  Min,
+  // Replaces the current payload with the operand if the operand is greater.
+  Max,
+};
+
+// Encodings of the sorted subkeys of each key in serialized transactions
+// (see TransactionBuilder::Create()). Transactions serialized with any encoding
+// can be applied by any storage.
+enum class SubkeysEncoding : uint32_t {
+  // Each subkey is stored as an exponential-Golomb code of its difference with
+  // the previous one.
+  Deltas,
+  // The differences are bit-packed in blocks of 128 subkeys (see
+  // Serialization::BlockMonotonicSequenceEncoder), which is more compact and
+  // faster to decode. Only used for keys that have at least one full block of
+  // subkeys in the transaction (shorter sequences would be stored exactly as
+  // with Deltas anyway).
+  PackedBlocks,
+};
+
 // Versions greater or equal to this value are considered to be invalid.
 static constexpr uint64_t kInvalidVersion = 0x7FFF'FFFF'FFFF'FFFF;
 
@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <optional>
 
 namespace Microsoft::MixedReality::Sharing::VersionedStorage::Detail {
 namespace {
@@ -59,14 +60,15 @@ BlobAccessor::IndexOffsetAndSlotHashes::IndexOffsetAndSlotHashes(
     uint64_t key_hash,
     uint64_t subkey)
 #ifdef MS_MR_SHARING_PLATFORM_ANY_64_BIT
-    : IndexOffsetAndSlotHashes{CalculateHash64(key_hash, subkey)} {
+    : IndexOffsetAndSlotHashes{
+          CalculateHash64<kNativeHashVersion>(key_hash, subkey)} {
 }
 #else
 {
   // This hash is not persisted anywhere, so it doesn't have to be the same for
-  // each platform. Current CalculateHash64() implementation is quite slow on
-  // x32, so we replace it with a lower quality mixer that should be good
-  // enough.
+  // each platform. Even the 32-bit-friendly version of CalculateHash64() is
+  // quite slow on x32, so we replace it with a lower quality mixer that should
+  // be good enough.
   // Magic numbers here are just random primes. Multiplication makes the top
   // bits of the result dependent on most of the bits of the input (like in
   // Knuth multiplicative hash), and xoring with rotations makes low bits
@@ -106,11 +108,16 @@ MS_MR_SHARING_FORCEINLINE bool HeaderBlock::IsVersionFromThisBlob(
 
 MS_MR_SHARING_FORCEINLINE uint32_t
 MutatingBlobAccessor::available_data_blocks_count() const noexcept {
-  return header_block_.data_blocks_capacity_ -
-         header_block_.stored_data_blocks_count_ -
-         ((header_block_.stored_versions_count() +
-           VersionRefCount::kCountsPerBlock - 1) /
-          VersionRefCount::kCountsPerBlock);
+  // The data blocks can't go past the committed range, or into the blocks
+  // occupied by reference counts (if the committed ranges already met).
+  const uint32_t ref_count_blocks_count =
+      (header_block_.stored_versions_count() +
+       VersionRefCount::kCountsPerBlock - 1) /
+      VersionRefCount::kCountsPerBlock;
+  return std::min(header_block_.data_blocks_capacity_,
+                  header_block_.reserved_data_blocks_count_ -
+                      ref_count_blocks_count) -
+         header_block_.stored_data_blocks_count_;
 }
 
 MS_MR_SHARING_FORCEINLINE DataBlockLocation
@@ -127,19 +134,47 @@ class HeaderBlock::BlockInserter {
     return accessor_.GetBlockAt<StateBlockBase>(location);
   }
 
-  BlockInserter(MutatingBlobAccessor& accessor, uint32_t index_offset_hash)
+  BlockInserter(MutatingBlobAccessor& accessor,
+                IndexLevel level,
+                const BlobAccessor::IndexOffsetAndSlotHashes& hashes,
+                AppendRange* range)
       : accessor_{accessor},
-        new_block_data_location_{accessor.AllocateDataBlock()},
-        new_block_{GetAt(new_block_data_location_)} {
-    assert(accessor.header_block().remaining_index_slots_capacity_ > 0);
-    --accessor.header_block().remaining_index_slots_capacity_;
+        new_block_data_location_{range ? range->AllocateDataBlock()
+                                       : accessor.AllocateDataBlock()},
+        new_block_{GetAt(new_block_data_location_)},
+        is_concurrent_{range != nullptr} {
     // If we won't find a free slot, we'll write a bit indicating that there was
     // a failed insertion attempt. We'll use kThisBlockOverflowMask for the
     // first block and kPrecedingBlocksOverflowMask for the next blocks (see
     // below).
     uint64_t overflow_mask = IndexBlock::kThisBlockOverflowMask;
     const auto index_blocks_mask = accessor.header_block().index_blocks_mask_;
-    for (auto offset = index_offset_hash;; ++offset) {
+    if (is_concurrent_) {
+      // The capacity was reserved by ReserveAppendRange(), but other threads
+      // can be claiming slots in the same index blocks, so the slot is claimed
+      // by updating the counts and the hash with a single CAS.
+      for (auto offset = hashes.index_offset_hash;; ++offset) {
+        uint32_t index_block_id = offset & index_blocks_mask;
+        IndexBlock& index = accessor.GetIndexBlock(index_block_id);
+        uint64_t counts_and_hashes = index.counts_and_hashes_relaxed();
+        while (IndexBlock::HasFreeSlots(counts_and_hashes)) {
+          if (index.counts_and_hashes_.compare_exchange_weak(
+                  counts_and_hashes,
+                  WithNewSlot(counts_and_hashes, level, hashes.slot_hash),
+                  std::memory_order_relaxed)) {
+            counts_and_hashes_ = counts_and_hashes;
+            index_block_id_ = index_block_id;
+            return;
+          }
+        }
+        index.counts_and_hashes_.fetch_or(overflow_mask,
+                                          std::memory_order_relaxed);
+        overflow_mask = IndexBlock::kPrecedingBlocksOverflowMask;
+      }
+    }
+    assert(accessor.header_block().remaining_index_slots_capacity_ > 0);
+    --accessor.header_block().remaining_index_slots_capacity_;
+    for (auto offset = hashes.index_offset_hash;; ++offset) {
       uint32_t index_block_id = offset & index_blocks_mask;
       IndexBlock& index = accessor.GetIndexBlock(index_block_id);
       const auto counts_and_hashes = index.counts_and_hashes_relaxed();
@@ -163,6 +198,33 @@ class HeaderBlock::BlockInserter {
   virtual bool IsNewBlockLessThan(const StateBlockBase& other) const
       noexcept = 0;
 
+  // Increments the number of keys or subkeys and writes the hash byte of the
+  // slot they will occupy.
+  static uint64_t WithNewSlot(uint64_t counts_and_hashes,
+                              IndexLevel level,
+                              uint8_t slot_hash) noexcept {
+    if (level == IndexLevel::Key) {
+      const auto keys_count = IndexBlock::GetKeysCount(counts_and_hashes);
+      return counts_and_hashes +
+             (static_cast<uint64_t>(slot_hash) << ((keys_count + 1) * 8)) + 1;
+    }
+    const auto subkeys_count = IndexBlock::GetSubkeysCount(counts_and_hashes);
+    return counts_and_hashes +
+           (static_cast<uint64_t>(slot_hash) << ((7 - subkeys_count) * 8)) + 8;
+  }
+
+  // Makes the slot visible to the readers. Slots claimed concurrently are
+  // already counted (the blob is not visible to the readers yet).
+  void PublishIndexSlot(IndexBlock& index,
+                        IndexLevel level,
+                        uint8_t slot_hash) noexcept {
+    if (!is_concurrent_) {
+      index.counts_and_hashes_.store(
+          WithNewSlot(counts_and_hashes_, level, slot_hash),
+          std::memory_order_release);
+    }
+  }
+
   void PublishToSortedList(DataBlockLocation& tree_root,
                            std::atomic<IndexSlotLocation>& list_head) {
     const bool is_tree_root_valid = tree_root != DataBlockLocation::kInvalid;
@@ -185,6 +247,30 @@ class HeaderBlock::BlockInserter {
     prev_next->store(index_slot_location_, std::memory_order_release);
   }
 
+  // Links the new block after last_block (or makes it the head of the empty
+  // list), leaving the tree untouched.
+  // See MutatingBlobAccessor::AppendKeyBlock() for details.
+  void AppendToSortedList(StateBlockBase* last_block,
+                          std::atomic<IndexSlotLocation>& list_head) {
+    std::atomic<IndexSlotLocation>* prev_next =
+        last_block ? &last_block->next_ : &list_head;
+    assert(prev_next->load(std::memory_order_relaxed) ==
+           IndexSlotLocation::kInvalid);
+    prev_next->store(index_slot_location_, std::memory_order_release);
+  }
+
+  // If append_after is set, the new block is appended after the provided last
+  // block of the list (nullptr if the list is empty). Otherwise it's inserted
+  // into the tree.
+  void Publish(DataBlockLocation& tree_root,
+               std::atomic<IndexSlotLocation>& list_head,
+               std::optional<StateBlockBase*> append_after) {
+    if (append_after)
+      AppendToSortedList(*append_after, list_head);
+    else
+      PublishToSortedList(tree_root, list_head);
+  }
+
   void Insert(DataBlockLocation& parent_location) noexcept {
     assert(parent_location != DataBlockLocation::kInvalid);
     auto& parent_block = GetAt(parent_location);
@@ -313,6 +399,7 @@ class HeaderBlock::BlockInserter {
   uint32_t index_block_id_;
   IndexSlotLocation index_slot_location_{IndexSlotLocation::kInvalid};
   StateBlockBase* previous_block_{nullptr};
+  const bool is_concurrent_;
 };
 
 class HeaderBlock::KeyBlockInserter : public HeaderBlock::BlockInserter {
@@ -320,8 +407,10 @@ class HeaderBlock::KeyBlockInserter : public HeaderBlock::BlockInserter {
   KeyBlockInserter(MutatingBlobAccessor& accessor,
                    KeyHandle key_handle,
                    const Behavior& behavior,
-                   const BlobAccessor::IndexOffsetAndSlotHashes& hashes)
-      : HeaderBlock::BlockInserter{accessor, hashes.index_offset_hash},
+                   const BlobAccessor::IndexOffsetAndSlotHashes& hashes,
+                   std::optional<StateBlockBase*> append_after = {},
+                   AppendRange* range = nullptr)
+      : HeaderBlock::BlockInserter{accessor, IndexLevel::Key, hashes, range},
         key_handle_{key_handle},
         behavior_{behavior} {
     const auto keys_count_in_slot =
@@ -333,16 +422,15 @@ class HeaderBlock::KeyBlockInserter : public HeaderBlock::BlockInserter {
 
     new (&new_block_)
         KeyStateBlock{key_handle, KeySubscriptionHandle::kInvalid};
-    PublishToSortedList(accessor.header_block().keys_tree_root_,
-                        accessor.header_block().keys_list_head_);
-    // Incrementing the keys count and writing the hash byte
-    const uint64_t new_counts_and_hashes =
-        counts_and_hashes_ +
-        (static_cast<uint64_t>(hashes.slot_hash)
-         << ((keys_count_in_slot + 1) * 8)) +
-        1;
-    index.counts_and_hashes_.store(new_counts_and_hashes,
-                                   std::memory_order_release);
+    if (range && !*append_after) {
+      // The first key of the range's own list.
+      assert(range->keys_list_head_ == IndexSlotLocation::kInvalid);
+      range->keys_list_head_ = index_slot_location_;
+    } else {
+      Publish(accessor.header_block().keys_tree_root_,
+              accessor.header_block().keys_list_head_, append_after);
+    }
+    PublishIndexSlot(index, IndexLevel::Key, hashes.slot_hash);
   }
 
   KeyStateBlock& new_block() noexcept {
@@ -364,8 +452,11 @@ class HeaderBlock::SubkeyBlockInserter : public HeaderBlock::BlockInserter {
   SubkeyBlockInserter(MutatingBlobAccessor& accessor,
                       KeyStateBlock& key_block,
                       uint64_t subkey,
-                      const BlobAccessor::IndexOffsetAndSlotHashes& hashes)
-      : HeaderBlock::BlockInserter{accessor, hashes.index_offset_hash},
+                      const BlobAccessor::IndexOffsetAndSlotHashes& hashes,
+                      std::optional<StateBlockBase*> append_after = {},
+                      AppendRange* range = nullptr)
+      : HeaderBlock::BlockInserter{accessor, IndexLevel::Subkey, hashes,
+                                   range},
         subkey_{subkey} {
     const auto subkeys_count_in_slot =
         IndexBlock::GetSubkeysCount(counts_and_hashes_);
@@ -376,19 +467,9 @@ class HeaderBlock::SubkeyBlockInserter : public HeaderBlock::BlockInserter {
 
     new (&new_block_) SubkeyStateBlock{
         key_block.key_, SubkeySubscriptionHandle::kInvalid, subkey};
-    PublishToSortedList(key_block.subkeys_tree_root_,
-                        key_block.subkeys_list_head_);
-    // Incrementing the subkeys count and writing the hash byte
-    const uint64_t new_counts_and_hashes =
-        counts_and_hashes_ +
-        (static_cast<uint64_t>(hashes.slot_hash)
-         << ((7 - subkeys_count_in_slot) * 8)) +
-        8;
-
-    assert(IndexBlock::GetSubkeysCount(new_counts_and_hashes) ==
-           IndexBlock::GetSubkeysCount(counts_and_hashes_) + 1);
-    index.counts_and_hashes_.store(new_counts_and_hashes,
-                                   std::memory_order_release);
+    Publish(key_block.subkeys_tree_root_, key_block.subkeys_list_head_,
+            append_after);
+    PublishIndexSlot(index, IndexLevel::Subkey, hashes.slot_hash);
   }
 
   SubkeyStateBlock& new_block() noexcept {
@@ -518,6 +599,14 @@ SubkeyStateAndIndexView BlobAccessor::FindSubkeyStateAndIndex(
       });
 }
 
+void BlobAccessor::PrefetchSubkeyIndex(uint64_t key_hash,
+                                       uint64_t subkey) const noexcept {
+  const IndexOffsetAndSlotHashes hashes{key_hash, subkey};
+  Platform::Prefetch(
+      &blob_layout_.index_begin_[hashes.index_offset_hash &
+                                 header_block_.index_blocks_mask_]);
+}
+
 bool MutatingBlobAccessor::ReserveSpaceForTransaction(
     KeyStateAndIndexView& key_state_and_index_view) noexcept {
   assert(key_state_and_index_view);
@@ -547,6 +636,10 @@ bool MutatingBlobAccessor::ReserveSpaceForTransaction(
   KeyVersionBlock& new_version_block =
       GetBlockAt<KeyVersionBlock>(new_version_block_location);
 
+  // On failure, the blocks consumed by the builder are returned, so that the
+  // caller can retry after TryGrow() (nothing was published yet).
+  const uint32_t stored_data_blocks_count =
+      header_block_.stored_data_blocks_count_;
   KeyVersionBlock::Builder builder{new_version_block, available_blocks_count,
                                    header_block_.stored_data_blocks_count_};
 
@@ -562,6 +655,7 @@ bool MutatingBlobAccessor::ReserveSpaceForTransaction(
               return !builder.Push(offset,
                                    version_block->GetSubkeysCount(offset));
             })) {
+      header_block_.stored_data_blocks_count_ = stored_data_blocks_count;
       return false;
     }
   } else if (version_ref_count_accessor.ForEachAliveVersion(
@@ -569,10 +663,13 @@ bool MutatingBlobAccessor::ReserveSpaceForTransaction(
                    return !builder.Push(offset,
                                         state_block.GetSubkeysCount(offset));
                  })) {
+    header_block_.stored_data_blocks_count_ = stored_data_blocks_count;
     return false;
   }
-  if (!builder.FinalizeAndReserveOne())
+  if (!builder.FinalizeAndReserveOne()) {
+    header_block_.stored_data_blocks_count_ = stored_data_blocks_count;
     return false;
+  }
 
   // Publishing the new version block that now contains all alive version and an
   // extra slot for the new version that will be inserted.
@@ -618,6 +715,9 @@ bool MutatingBlobAccessor::ReserveSpaceForTransaction(
   SubkeyVersionBlock& new_version_block =
       GetBlockAt<SubkeyVersionBlock>(new_version_block_location);
 
+  // On failure, the blocks consumed by the builder are returned (see above).
+  const uint32_t stored_data_blocks_count =
+      header_block_.stored_data_blocks_count_;
   SubkeyVersionBlock::Builder builder{previous_version_block_location,
                                       new_version_block, available_blocks_count,
                                       header_block_.stored_data_blocks_count_};
@@ -636,6 +736,7 @@ bool MutatingBlobAccessor::ReserveSpaceForTransaction(
               return !builder.Push(version,
                                    version_block->GetVersionedPayload(version));
             })) {
+      header_block_.stored_data_blocks_count_ = stored_data_blocks_count;
       return false;
     }
   } else if (version_ref_count_accessor.ForEachAliveVersion(
@@ -645,10 +746,13 @@ bool MutatingBlobAccessor::ReserveSpaceForTransaction(
                    return !builder.Push(
                        version, state_block.GetVersionedPayload(version));
                  })) {
+    header_block_.stored_data_blocks_count_ = stored_data_blocks_count;
     return false;
   }
-  if (!builder.FinalizeAndReserveOne(new_version, has_value))
+  if (!builder.FinalizeAndReserveOne(new_version, has_value)) {
+    header_block_.stored_data_blocks_count_ = stored_data_blocks_count;
     return false;
+  }
 
   // Publishing the new version block that now contains all alive version and an
   // extra slot for the new version that will be inserted.
@@ -662,10 +766,25 @@ HeaderBlock::HeaderBlock(uint64_t base_version,
                          uint32_t index_blocks_mask,
                          uint32_t index_slots_capacity,
                          uint32_t data_blocks_capacity)
+    : HeaderBlock{base_version,         index_blocks_mask,
+                  index_slots_capacity, data_blocks_capacity,
+                  data_blocks_capacity, data_blocks_capacity} {}
+
+HeaderBlock::HeaderBlock(uint64_t base_version,
+                         uint32_t index_blocks_mask,
+                         uint32_t index_slots_capacity,
+                         uint32_t data_blocks_capacity,
+                         uint32_t reserved_data_blocks_count,
+                         uint32_t ref_count_blocks_capacity)
     : base_version_{base_version},
       index_blocks_mask_{index_blocks_mask},
       remaining_index_slots_capacity_{index_slots_capacity},
-      data_blocks_capacity_{data_blocks_capacity} {
+      data_blocks_capacity_{data_blocks_capacity},
+      reserved_data_blocks_count_{reserved_data_blocks_count},
+      ref_count_blocks_capacity_{ref_count_blocks_capacity} {
+  assert(data_blocks_capacity_ <= reserved_data_blocks_count_ &&
+         ref_count_blocks_capacity_ <= reserved_data_blocks_count_ &&
+         ref_count_blocks_capacity_ > 0);
   version_ref_count_accessor().InitVersion(VersionOffset{0});
 }
 
@@ -763,6 +882,23 @@ void HeaderBlock::RemoveSnapshotReference(uint64_t version,
   }
 }
 
+namespace {
+
+constexpr uint32_t kBlocksPerPage = Platform::kPageSize / kBlockSize;
+
+// Blobs of at least this size reserve kReservedPagesMultiplier times more
+// address space than they need initially, so that they can grow in place
+// (see MutatingBlobAccessor::TryGrow()). Smaller blobs are cheap to merge.
+constexpr size_t kMinPagesCountForReservation = 16;
+#ifdef MS_MR_SHARING_PLATFORM_ANY_64_BIT
+constexpr size_t kReservedPagesMultiplier = 8;
+#else
+// The address space is too scarce to reserve it in advance.
+constexpr size_t kReservedPagesMultiplier = 1;
+#endif
+
+}  // namespace
+
 HeaderBlock* HeaderBlock::CreateBlob(Behavior& behavior,
                                      uint64_t base_version,
                                      size_t min_index_capacity) noexcept {
@@ -786,12 +922,45 @@ HeaderBlock* HeaderBlock::CreateBlob(Behavior& behavior,
     }
   }
   const uint32_t index_blocks_count = 1u << index_blocks_count_log2;
-  constexpr uint32_t kBlocksPerPage = Platform::kPageSize / kBlockSize;
   // Each index entry should have a data block.
   // On top of that we want about the same amount of space for the version
   // blocks, and an extra block for the header.
   const uint32_t pages_count =
       (index_capacity * 2 + index_blocks_count) / kBlocksPerPage + 1;
+
+  const size_t reserved_pages_count =
+      static_cast<size_t>(pages_count) * kReservedPagesMultiplier;
+  if (pages_count >= kMinPagesCountForReservation &&
+      reserved_pages_count > pages_count &&
+      reserved_pages_count * kBlocksPerPage <= ~0u) {
+    // Committing the same number of pages as a non-reserved blob would have:
+    // all but the last one at the front (for the header, the index and the
+    // data blocks), and the last one at the back (for the reference counts).
+    if (auto reserved = static_cast<std::byte*>(
+            behavior.ReservePages(reserved_pages_count))) {
+      const size_t front_size = (pages_count - 1) * size_t{Platform::kPageSize};
+      if (behavior.CommitPages(reserved, pages_count - 1) &&
+          behavior.CommitPages(reserved + reserved_pages_count *
+                                              Platform::kPageSize -
+                                              Platform::kPageSize,
+                               1)) {
+        assert(front_size > (index_blocks_count + 1) * kBlockSize);
+        auto header = reinterpret_cast<HeaderBlock*>(reserved);
+        new (header) HeaderBlock{
+            base_version,
+            index_blocks_count - 1,
+            index_capacity,
+            static_cast<uint32_t>(front_size / kBlockSize) -
+                index_blocks_count - 1,
+            static_cast<uint32_t>(reserved_pages_count * kBlocksPerPage) -
+                index_blocks_count - 1,
+            kBlocksPerPage};
+        return header;
+      }
+      behavior.FreePages(reserved);
+    }
+  }
+
   auto header =
       static_cast<HeaderBlock*>(behavior.AllocateZeroedPages(pages_count));
   if (header) {
@@ -806,6 +975,69 @@ HeaderBlock* HeaderBlock::CreateBlob(Behavior& behavior,
   return header;
 }
 
+bool MutatingBlobAccessor::TryGrow(Behavior& behavior,
+                                   uint32_t min_extra_blocks_count) noexcept {
+  HeaderBlock& header = header_block_;
+  if (header.data_blocks_capacity_ == header.reserved_data_blocks_count_)
+    return false;  // Not reserved, or already fully committed.
+
+  // The reserved range consists of whole pages, and so do both committed
+  // ranges (the header and the index are at the front).
+  const uint32_t front_blocks_count =
+      header.index_blocks_mask_ + 2 + header.data_blocks_capacity_;
+  assert(front_blocks_count % kBlocksPerPage == 0);
+  assert(header.ref_count_blocks_capacity_ % kBlocksPerPage == 0);
+  const uint32_t front_pages_count = front_blocks_count / kBlocksPerPage;
+  const uint32_t back_pages_count =
+      header.ref_count_blocks_capacity_ / kBlocksPerPage;
+  const uint32_t uncommitted_pages_count =
+      (header.index_blocks_mask_ + 2 + header.reserved_data_blocks_count_) /
+          kBlocksPerPage -
+      front_pages_count - back_pages_count;
+
+  // Doubling both committed ranges (the back one only if it's more than half
+  // full), but never committing more than what is reserved.
+  uint32_t extra_front_pages_count = std::max(
+      front_pages_count,
+      (min_extra_blocks_count + kBlocksPerPage - 1) / kBlocksPerPage);
+  uint32_t extra_back_pages_count = 0;
+  const uint32_t ref_count_blocks_count =
+      (header.stored_versions_count() + VersionRefCount::kCountsPerBlock - 1) /
+      VersionRefCount::kCountsPerBlock;
+  if (2 * ref_count_blocks_count >= header.ref_count_blocks_capacity_)
+    extra_back_pages_count = back_pages_count;
+  if (extra_front_pages_count + extra_back_pages_count >=
+      uncommitted_pages_count) {
+    extra_front_pages_count = uncommitted_pages_count;
+    extra_back_pages_count = 0;
+  }
+
+  auto front_end = reinterpret_cast<std::byte*>(&header) +
+                   size_t{front_pages_count} * Platform::kPageSize;
+  if (!behavior.CommitPages(front_end, extra_front_pages_count))
+    return false;
+  if (extra_back_pages_count) {
+    auto back_begin =
+        front_end +
+        size_t{uncommitted_pages_count - extra_back_pages_count} *
+            Platform::kPageSize;
+    if (!behavior.CommitPages(back_begin, extra_back_pages_count))
+      return false;
+  }
+
+  if (extra_front_pages_count == uncommitted_pages_count) {
+    // The committed ranges met, so the data blocks and the reference counts
+    // share the whole reserved range (the same as for non-reserved blobs).
+    header.data_blocks_capacity_ = header.reserved_data_blocks_count_;
+    header.ref_count_blocks_capacity_ = header.reserved_data_blocks_count_;
+  } else {
+    header.data_blocks_capacity_ += extra_front_pages_count * kBlocksPerPage;
+    header.ref_count_blocks_capacity_ +=
+        extra_back_pages_count * kBlocksPerPage;
+  }
+  return true;
+}
+
 bool MutatingBlobAccessor::AddVersion() noexcept {
   uint32_t new_version_id = header_block_.stored_versions_count();
   if (new_version_id == ~0u) {
@@ -814,11 +1046,14 @@ bool MutatingBlobAccessor::AddVersion() noexcept {
     return false;
   }
 
-  assert(header_block_.data_blocks_capacity_ >
+  // The reference counts can't go past the committed range, or into the data
+  // blocks (if the committed ranges already met).
+  assert(header_block_.reserved_data_blocks_count_ >
          header_block_.stored_data_blocks_count_);
   const uint32_t blocks_available_for_versions =
-      header_block_.data_blocks_capacity_ -
-      header_block_.stored_data_blocks_count_;
+      std::min(header_block_.ref_count_blocks_capacity_,
+               header_block_.reserved_data_blocks_count_ -
+                   header_block_.stored_data_blocks_count_);
   static constexpr uint32_t kMaxPossibleBlocksConsumedByVersions =
       (~0u / VersionRefCount::kCountsPerBlock) + 1;
   if (blocks_available_for_versions < kMaxPossibleBlocksConsumedByVersions &&
@@ -866,4 +1101,108 @@ SubkeyStateAndIndexView MutatingBlobAccessor::InsertSubkeyBlock(
   return {&inserter.new_block(), nullptr, &inserter.index_block_slot()};
 }
 
+KeyStateAndIndexView MutatingBlobAccessor::AppendKeyBlock(
+    Behavior& behavior,
+    KeyHandle key_handle,
+    uint64_t key_hash,
+    KeyStateBlock* last_key_block,
+    AppendRange* range) noexcept {
+  assert(range || CanInsertStateBlocks(1));
+  assert(key_hash == behavior.GetKeyHash(key_handle));
+  assert(!last_key_block || behavior.Less(last_key_block->key_, key_handle));
+  HeaderBlock::KeyBlockInserter inserter{
+      *this, key_handle, behavior, {key_hash}, last_key_block, range};
+  return {&inserter.new_block(), nullptr, &inserter.index_block_slot()};
+}
+
+SubkeyStateAndIndexView MutatingBlobAccessor::AppendSubkeyBlock(
+    Behavior& behavior,
+    KeyStateBlock& key_block,
+    uint64_t key_hash,
+    uint64_t subkey,
+    SubkeyStateBlock* last_subkey_block,
+    AppendRange* range) noexcept {
+  assert(range || CanInsertStateBlocks(1));
+  assert(key_hash == behavior.GetKeyHash(key_block.key_));
+  assert(!last_subkey_block || last_subkey_block->subkey_ < subkey);
+  HeaderBlock::SubkeyBlockInserter inserter(
+      *this, key_block, subkey, {key_hash, subkey}, last_subkey_block, range);
+  return {&inserter.new_block(), nullptr, &inserter.index_block_slot()};
+}
+
+AppendRange MutatingBlobAccessor::ReserveAppendRange(
+    uint32_t blocks_count) noexcept {
+  assert(CanInsertStateBlocks(blocks_count));
+  header_block_.remaining_index_slots_capacity_ -= blocks_count;
+  AppendRange range;
+  range.next_data_block_ = header_block_.stored_data_blocks_count_;
+  header_block_.stored_data_blocks_count_ += blocks_count;
+  range.end_data_block_ = header_block_.stored_data_blocks_count_;
+  return range;
+}
+
+void MutatingBlobAccessor::AppendKeysList(
+    const AppendRange& range,
+    KeyStateBlock* last_key_block) noexcept {
+  assert(range.keys_list_head_ != IndexSlotLocation::kInvalid);
+  std::atomic<IndexSlotLocation>& prev_next =
+      last_key_block ? last_key_block->next_ : header_block_.keys_list_head_;
+  assert(prev_next.load(std::memory_order_relaxed) ==
+         IndexSlotLocation::kInvalid);
+  prev_next.store(range.keys_list_head_, std::memory_order_release);
+}
+
+namespace {
+
+// Consumes count blocks from the iterator (in the sorted order) and arranges
+// them into a balanced AA-tree, returning the location of its root.
+// The left subtree of each node gets (count - 1) / 2 nodes, and the right one
+// gets the rest (which is at most one more). With such a split, the level of
+// each node is one more than the level of its left child (or 0 if there is
+// none), and all invariants of the AA-tree are satisfied: the right child
+// is either on the same level as its parent (only if it's a full subtree with
+// 2^k - 1 nodes, so its own right child is one level lower), or one level
+// lower.
+template <IndexLevel kLevel>
+DataBlockLocation BuildTree(BlockIterator<kLevel>& it,
+                            uint32_t count,
+                            uint8_t& level) noexcept {
+  if (count == 0)
+    return DataBlockLocation::kInvalid;
+  const uint32_t left_count = (count - 1) / 2;
+  uint8_t left_level = 0;
+  const DataBlockLocation left_location = BuildTree(it, left_count, left_level);
+  assert(!it.is_end());
+  StateAndIndexView<kLevel> view = *it;
+  ++it;
+  uint8_t right_level = 0;
+  StateBlockBase& block = *view.state_block_;
+  block.left_tree_child_ = left_location;
+  block.right_tree_child_ = BuildTree(it, count - 1 - left_count, right_level);
+  level = left_count ? left_level + 1 : 0;
+  block.SetTreeLevel(level);
+  return view.index_block_slot_->state_block_location_;
+}
+
+}  // namespace
+
+void MutatingBlobAccessor::BuildKeysTree(uint32_t keys_count) noexcept {
+  assert(header_block_.keys_tree_root_ == DataBlockLocation::kInvalid);
+  KeyBlockIterator it = begin();
+  uint8_t level = 0;
+  header_block_.keys_tree_root_ = BuildTree(it, keys_count, level);
+  assert(it.is_end());
+}
+
+void MutatingBlobAccessor::BuildSubkeysTree(KeyStateBlock& key_block,
+                                            uint32_t subkeys_count) noexcept {
+  assert(key_block.subkeys_tree_root_ == DataBlockLocation::kInvalid);
+  SubkeyBlockIterator it{
+      key_block.subkeys_list_head_.load(std::memory_order_relaxed),
+      blob_layout_};
+  uint8_t level = 0;
+  key_block.subkeys_tree_root_ = BuildTree(it, subkeys_count, level);
+  assert(it.is_end());
+}
+
 }  // namespace Microsoft::MixedReality::Sharing::VersionedStorage::Detail
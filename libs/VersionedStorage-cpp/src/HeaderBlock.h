@@ -13,6 +13,7 @@
 #include "src/SubkeyStateView.h"
 #include "src/VersionRefCount.h"
 
+#include <cassert>
 #include <cstddef>
 
 namespace Microsoft::MixedReality::Sharing::VersionedStorage {
@@ -25,6 +26,24 @@ class IndexBlock;
 class BlobAccessor;
 class MutatingBlobAccessor;
 
+// A range of data blocks (and as many index slots) reserved with
+// MutatingBlobAccessor::ReserveAppendRange(). Several threads can append blocks
+// to a fresh blob at the same time, as long as each of them uses its own range
+// (see MutatingBlobAccessor::AppendKeyBlock()).
+struct AppendRange {
+  DataBlockLocation AllocateDataBlock() noexcept {
+    assert(next_data_block_ < end_data_block_);
+    return DataBlockLocation{next_data_block_++};
+  }
+
+  uint32_t next_data_block_{0};
+  uint32_t end_data_block_{0};
+
+  // The head of the separate list of keys appended with this range.
+  // See MutatingBlobAccessor::AppendKeysList().
+  IndexSlotLocation keys_list_head_{IndexSlotLocation::kInvalid};
+};
+
 // The first block of any storage blob, contains blob-wide layout
 // characteristics.
 class alignas(kBlockSize) HeaderBlock {
@@ -34,6 +53,17 @@ class alignas(kBlockSize) HeaderBlock {
               uint32_t index_slots_capacity,
               uint32_t data_blocks_capacity);
 
+  // Constructor for blobs that are only partially committed (see
+  // MutatingBlobAccessor::TryGrow()). The first data_blocks_capacity data
+  // blocks and the last ref_count_blocks_capacity data blocks (out of
+  // reserved_data_blocks_count) must be committed.
+  HeaderBlock(uint64_t base_version,
+              uint32_t index_blocks_mask,
+              uint32_t index_slots_capacity,
+              uint32_t data_blocks_capacity,
+              uint32_t reserved_data_blocks_count,
+              uint32_t ref_count_blocks_capacity);
+
   // Creates a new blob and returns the pointer to its HeaderBlock.
   // Both the block's reference count and the base_version's reference
   // count are 1.
@@ -66,8 +96,9 @@ class alignas(kBlockSize) HeaderBlock {
     // Accessor is constructed from the position of the refcount of the base
     // version, which is located at the end of the blob, see VersionRefCount.h
     // for details.
-    return {15 + reinterpret_cast<VersionRefCount*>(this + index_blocks_mask_ +
-                                                    data_blocks_capacity_ + 1)};
+    return {15 +
+            reinterpret_cast<VersionRefCount*>(
+                this + index_blocks_mask_ + reserved_data_blocks_count_ + 1)};
   }
 
   bool IsVersionFromThisBlob(uint64_t version) const noexcept;
@@ -85,9 +116,18 @@ class alignas(kBlockSize) HeaderBlock {
   uint32_t remaining_index_slots_capacity_;
 
   // Data blocks are consumed from two sides.
-  // From the front, they are used to store reference counts for versions.
-  // From the back, they are used to store state and version blocks.
-  const uint32_t data_blocks_capacity_;
+  // From the front, they are used to store state and version blocks.
+  // From the back, they are used to store reference counts for versions.
+  // If the blob was allocated by reserving a larger address range, only the
+  // first data_blocks_capacity_ blocks and the last ref_count_blocks_capacity_
+  // blocks of the reserved range are committed, and both numbers can grow
+  // until the committed ranges meet. Otherwise all three numbers are the same.
+  // Reference counts are always located relatively to the end of the
+  // reserved range, so they are never moved (other threads can access them at
+  // any time).
+  uint32_t data_blocks_capacity_;
+  const uint32_t reserved_data_blocks_count_;
+  uint32_t ref_count_blocks_capacity_;
   uint32_t stored_data_blocks_count_{0};
   std::atomic_uint32_t stored_versions_count_{1};
 
@@ -141,6 +181,11 @@ class BlobAccessor {
   SubkeyStateAndIndexView FindSubkeyStateAndIndex(const KeyDescriptor& key,
                                                   uint64_t subkey) noexcept;
 
+  // Prefetches the first index block that will be inspected by
+  // FindSubkeyState() and FindSubkeyStateAndIndex() for the subkey of the key
+  // with the provided hash.
+  void PrefetchSubkeyIndex(uint64_t key_hash, uint64_t subkey) const noexcept;
+
   KeyBlockIterator begin() const noexcept {
     return {header_block_.keys_list_head_.load(std::memory_order_acquire),
             blob_layout_};
@@ -214,6 +259,17 @@ class MutatingBlobAccessor : public BlobAccessor {
   // Returns the number of data blocks available for allocation.
   uint32_t available_data_blocks_count() const noexcept;
 
+  // Commits more pages of the reserved address range of the blob (if it has
+  // one), so that at least min_extra_blocks_count more data blocks (and about
+  // as many as the blob already has) become available without the merge. The
+  // storage for reference counts of versions is extended as well.
+  // Returns false if the blob can't grow (it wasn't reserved, the reserved
+  // range is fully committed, or the allocation failed).
+  // The content of the blob is not moved, so this is safe to call while other
+  // threads are reading the blob.
+  [[nodiscard]] bool TryGrow(Behavior& behavior,
+                             uint32_t min_extra_blocks_count) noexcept;
+
   DataBlockLocation AllocateDataBlock() noexcept;
 
   // Attempts to add a new version to the blob.
@@ -234,6 +290,51 @@ class MutatingBlobAccessor : public BlobAccessor {
                                             KeyStateBlock& key_block,
                                             uint64_t subkey) noexcept;
 
+  // Faster alternatives to InsertKeyBlock() and InsertSubkeyBlock() for
+  // populating a fresh blob in the sorted order (used by the merge).
+  // The new block must be greater than all blocks in the list it is appended
+  // to, and last_key_block/last_subkey_block must point to the current last
+  // block of that list (or be nullptr if the list is empty).
+  // The hash of the key is provided by the caller, and the AA-trees are not
+  // updated: once the list is complete, BuildKeysTree()/BuildSubkeysTree()
+  // must be called before inserting more blocks into it with
+  // InsertKeyBlock()/InsertSubkeyBlock().
+  // If the range is provided, the data block is allocated from it, and the
+  // index slot is claimed atomically, so other threads can append blocks with
+  // their own ranges at the same time (nothing else can access the blob until
+  // they are done). Keys appended with a range form a separate list, which
+  // is linked into the blob with AppendKeysList().
+  KeyStateAndIndexView AppendKeyBlock(Behavior& behavior,
+                                      KeyHandle key_handle,
+                                      uint64_t key_hash,
+                                      KeyStateBlock* last_key_block,
+                                      AppendRange* range = nullptr) noexcept;
+
+  SubkeyStateAndIndexView AppendSubkeyBlock(
+      Behavior& behavior,
+      KeyStateBlock& key_block,
+      uint64_t key_hash,
+      uint64_t subkey,
+      SubkeyStateBlock* last_subkey_block,
+      AppendRange* range = nullptr) noexcept;
+
+  // Reserves blocks_count data blocks and as many index slots for
+  // AppendKeyBlock() and AppendSubkeyBlock().
+  [[nodiscard]] AppendRange ReserveAppendRange(uint32_t blocks_count) noexcept;
+
+  // Links the list of keys appended with the range after last_key_block (or
+  // makes it the list of keys of the blob if last_key_block is nullptr).
+  void AppendKeysList(const AppendRange& range,
+                      KeyStateBlock* last_key_block) noexcept;
+
+  // Builds a balanced AA-tree out of the list of keys, which must contain
+  // exactly keys_count blocks, none of which is in the tree yet.
+  void BuildKeysTree(uint32_t keys_count) noexcept;
+
+  // Same as above, for the list of subkeys of the key.
+  void BuildSubkeysTree(KeyStateBlock& key_block,
+                        uint32_t subkeys_count) noexcept;
+
   // The provided search_result will be updated if the operation had to
   // reallocate the version block. If search_result has no version block after
   // the operation, that means that the new version can be stored in the state
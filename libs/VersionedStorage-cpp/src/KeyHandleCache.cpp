@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include "src/KeyHandleCache.h"
+
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/Behavior.h>
+
+#include <Microsoft/MixedReality/Sharing/Common/hash.h>
+
+namespace Microsoft::MixedReality::Sharing::VersionedStorage::Detail {
+
+static_assert((KeyHandleCache::kSlotsCount & (KeyHandleCache::kSlotsCount - 1)) ==
+                  0,
+              "The number of slots must be a power of two");
+
+KeyHandleCache::KeyHandleCache(Behavior& behavior) noexcept
+    : behavior_{behavior} {}
+
+KeyHandleCache::~KeyHandleCache() noexcept {
+  Clear();
+}
+
+KeyHandleCache::Slot* KeyHandleCache::GetSlot(
+    std::string_view serialized_key) noexcept {
+  if (serialized_key.size() > kMaxCachedKeySize)
+    return nullptr;
+
+  // The slot is selected with our own hash function instead of the one
+  // provided by the behavior, since the whole point of the cache is to avoid
+  // calling the behavior (which can be arbitrarily expensive). The hash never
+  // leaves the process, so the fastest version for the platform is used.
+  const uint64_t slot_id =
+      CalculateHash64<kNativeHashVersion>(serialized_key.data(),
+                                          serialized_key.size()) &
+      (kSlotsCount - 1);
+  Slot& slot = slots_[slot_id];
+  if (slot.is_used_ && slot.serialized_key() == serialized_key) {
+    ++hits_count_;
+    return &slot;
+  }
+  ++misses_count_;
+  if (slot.key_handle_) {
+    behavior_.Release(*slot.key_handle_);
+    slot.key_handle_.reset();
+  }
+  memcpy(slot.serialized_key_, serialized_key.data(), serialized_key.size());
+  slot.serialized_key_size_ = static_cast<uint32_t>(serialized_key.size());
+  slot.key_hash_ = behavior_.GetKeyHash(serialized_key);
+  slot.is_used_ = true;
+  return &slot;
+}
+
+KeyHandle KeyHandleCache::MakeHandle(Slot& slot) noexcept {
+  assert(slot.is_used_);
+  if (!slot.key_handle_)
+    slot.key_handle_ = behavior_.DeserializeKey(slot.serialized_key());
+  return behavior_.DuplicateHandle(*slot.key_handle_);
+}
+
+void KeyHandleCache::Clear() noexcept {
+  for (Slot& slot : slots_) {
+    if (slot.key_handle_) {
+      behavior_.Release(*slot.key_handle_);
+      slot.key_handle_.reset();
+    }
+    slot.is_used_ = false;
+  }
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::VersionedStorage::Detail
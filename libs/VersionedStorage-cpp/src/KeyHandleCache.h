@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/enums.h>
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace Microsoft::MixedReality::Sharing::VersionedStorage {
+class Behavior;
+}  // namespace Microsoft::MixedReality::Sharing::VersionedStorage
+
+namespace Microsoft::MixedReality::Sharing::VersionedStorage::Detail {
+
+// A small direct-mapped cache of keys that were recently mentioned in
+// serialized transactions.
+// Maps serialized keys to their hashes and (after the first time the key is
+// deserialized) to key handles owned by the cache, so that hot keys don't have
+// to go through Behavior::GetKeyHash() and Behavior::DeserializeKey() every
+// time they are mentioned.
+// The cache is bounded: colliding keys evict each other, and keys larger than
+// kMaxCachedKeySize are never cached. The cached keys are stored inline, so
+// the lookups never allocate.
+// Not thread-safe. Storage only accesses it from the writer thread (under the
+// writer mutex).
+class KeyHandleCache {
+ public:
+  static constexpr size_t kSlotsCount = 256;
+  static constexpr size_t kMaxCachedKeySize = 256;
+
+  struct Slot {
+    std::string_view serialized_key() const noexcept {
+      return {serialized_key_, serialized_key_size_};
+    }
+
+    char serialized_key_[kMaxCachedKeySize];
+    uint32_t serialized_key_size_{0};
+    uint64_t key_hash_{0};
+    bool is_used_{false};
+    // Lazily populated by MakeHandle().
+    std::optional<KeyHandle> key_handle_;
+  };
+
+  KeyHandleCache(Behavior& behavior) noexcept;
+  ~KeyHandleCache() noexcept;
+
+  KeyHandleCache(const KeyHandleCache&) = delete;
+  KeyHandleCache& operator=(const KeyHandleCache&) = delete;
+
+  // Returns the slot associated with the serialized key, evicting the previous
+  // occupant of the slot and calculating the hash of the key on a miss.
+  // Returns nullptr if the key is too large to be cached.
+  // The returned pointer stays valid until the next call to GetSlot().
+  [[nodiscard]] Slot* GetSlot(std::string_view serialized_key) noexcept;
+
+  // Returns a new handle for the key in the slot (the ownership is transferred
+  // to the caller).
+  [[nodiscard]] KeyHandle MakeHandle(Slot& slot) noexcept;
+
+  // Releases all cached handles.
+  void Clear() noexcept;
+
+  uint64_t hits_count() const noexcept { return hits_count_; }
+  uint64_t misses_count() const noexcept { return misses_count_; }
+
+ private:
+  Behavior& behavior_;
+  uint64_t hits_count_{0};
+  uint64_t misses_count_{0};
+  Slot slots_[kSlotsCount];
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::VersionedStorage::Detail
@@ -0,0 +1,373 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/Behavior.h>
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/KeyDescriptor.h>
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/Transaction.h>
+
+#include "src/KeyHandleCache.h"
+#include "src/TransactionLayout.h"
+
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlockMonotonicSequenceEncoder.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/MonotonicSequenceEncoder.h>
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+
+namespace Microsoft::MixedReality::Sharing::VersionedStorage {
+
+// Presents a serialized transaction (see TransactionBuilder::Serialize()) as a
+// TransactionView, without unpacking it.
+// key_handle_cache is optional; when provided, it is used to look up hashes
+// and handles of keys (and must not be accessed concurrently).
+// The constructor only parses the layout of the transaction (without calling
+// the behavior or accessing the cache), so it can run on any thread.
+// A malformed transaction is presented as a transaction without keys (see
+// is_valid()).
+class SerializedTransactionView : public TransactionView, public KeyDescriptor {
+ public:
+  SerializedTransactionView(Behavior& behavior,
+                            Detail::KeyHandleCache* key_handle_cache,
+                            std::string_view serialized_transaction)
+      : KeyDescriptor{0},
+        behavior_{behavior},
+        key_handle_cache_{key_handle_cache},
+        reader_{serialized_transaction} {
+    try {
+      const TransactionHeader header{reader_};
+      format_ = header.format_;
+      mentioned_keys_count_ = header.mentioned_keys_count_;
+      Serialization::BitstreamReader preparse_reader{reader_};
+      // The transaction consists of bit stream and byte stream (right after the
+      // bit stream). We expect the sizes of all payloads to add up to the exact
+      // size of the byte stream.
+      uint64_t bytestream_content_size = 0;
+      auto AddBytestreamContentSize = [&](auto value) {
+        if (value <= ~0ull - bytestream_content_size) {
+          bytestream_content_size += value;
+          if (bytestream_content_size <=
+              preparse_reader.untouched_bytes_count())
+            return;
+        }
+        throw std::invalid_argument{"Can't decode a transaction"};
+      };
+      for (uint64_t key_id = 0; key_id < mentioned_keys_count_; ++key_id) {
+        KeyTransactionLayout key_layout{preparse_reader, format_};
+        AddBytestreamContentSize(key_layout.key_size_);
+
+        if (key_layout.subkeys_encoding_ == SubkeysEncoding::PackedBlocks) {
+          // subkey_block_ is not used until the first MoveNextKey(), so the
+          // blocks are decoded into it.
+          Serialization::BlockMonotonicSequenceEncoder preparse_subkey_encoder;
+          for (uint64_t subkey_id = 0; subkey_id < key_layout.subkeys_count_;) {
+            const size_t block_size = static_cast<size_t>(std::min<uint64_t>(
+                kSubkeysBlockSize, key_layout.subkeys_count_ - subkey_id));
+            preparse_subkey_encoder.DecodeBlock({subkey_block_, block_size},
+                                                preparse_reader);
+            for (size_t i = 0; i < block_size; ++i, ++subkey_id) {
+              SubkeyTransactionLayout layout{preparse_reader, format_};
+              AddBytestreamContentSize(layout.bytestream_content_size());
+            }
+          }
+        } else {
+          Serialization::MonotonicSequenceEncoder preparse_subkey_encoder;
+          for (uint64_t subkey_id = 0; subkey_id < key_layout.subkeys_count_;
+               ++subkey_id) {
+            [[maybe_unused]] uint64_t subkey =
+                preparse_subkey_encoder.DecodeNext(preparse_reader);
+            SubkeyTransactionLayout layout{preparse_reader, format_};
+            AddBytestreamContentSize(layout.bytestream_content_size());
+          }
+        }
+        mentioned_subkeys_count_ += key_layout.subkeys_count_;
+      }
+      size_t untouched_bytes_count = preparse_reader.untouched_bytes_count();
+      if (untouched_bytes_count != bytestream_content_size) {
+        throw std::invalid_argument{
+            "Can't decode a transaction: message size doesn't match the "
+            "layout"};
+      }
+      next_data_ = serialized_transaction.data() +
+                   (serialized_transaction.size() - untouched_bytes_count);
+      is_valid_ = true;
+    } catch (const std::exception&) {
+      mentioned_keys_count_ = 0;
+      mentioned_subkeys_count_ = 0;
+    }
+  }
+
+  // False if the layout of the transaction is malformed.
+  bool is_valid() const noexcept { return is_valid_; }
+
+  // The cache is only used while iterating over the keys, so it can be
+  // attached after the transaction is decoded.
+  void set_key_handle_cache(Detail::KeyHandleCache* key_handle_cache) noexcept {
+    key_handle_cache_ = key_handle_cache;
+  }
+
+  uint64_t mentioned_keys_count() const noexcept override {
+    return mentioned_keys_count_;
+  }
+
+  uint64_t mentioned_subkeys_count_hint() const noexcept override {
+    return mentioned_subkeys_count_;
+  }
+
+  bool MoveNextKey() noexcept override {
+    if (next_key_id_ == mentioned_keys_count_)
+      return false;
+    ++next_key_id_;
+    current_key_layout_ = KeyTransactionLayout{reader_, format_};
+    current_serialized_key_ =
+        ConsumeData(static_cast<size_t>(current_key_layout_.key_size_));
+    // Hot keys are likely to be mentioned by many transactions, so we don't
+    // have to go through the behavior every time.
+    if (key_handle_cache_)
+      current_cache_slot_ = key_handle_cache_->GetSlot(current_serialized_key_);
+    key_hash_ = current_cache_slot_
+                    ? current_cache_slot_->key_hash_
+                    : behavior_.GetKeyHash(current_serialized_key_);
+    next_subkey_id_ = 0;
+    decoded_subkeys_count_ = 0;
+    lookahead_begin_ = 0;
+    lookahead_end_ = 0;
+    subkey_encoder_.~MonotonicSequenceEncoder();
+    new (&subkey_encoder_) Serialization::MonotonicSequenceEncoder{};
+    subkey_block_encoder_.~BlockMonotonicSequenceEncoder();
+    new (&subkey_block_encoder_)
+        Serialization::BlockMonotonicSequenceEncoder{};
+    subkey_block_begin_ = 0;
+    subkey_block_end_ = 0;
+    return true;
+  }
+
+  bool MoveNextSubkey() noexcept override {
+    if (next_subkey_id_ == current_key_layout_.subkeys_count_)
+      return false;
+    ++next_subkey_id_;
+    if (lookahead_begin_ == lookahead_end_)
+      DecodeLookahead();
+    assert(lookahead_begin_ != lookahead_end_);
+    const DecodedSubkey& decoded = lookahead_[lookahead_begin_++];
+    current_subkey_ = decoded.subkey_;
+    current_subkey_layout_ = decoded.layout_;
+    current_required_payload_ = decoded.required_payload_;
+    current_new_payload_ = decoded.new_payload_;
+    return true;
+  }
+
+  size_t PeekNextSubkeys(uint64_t* subkeys,
+                         size_t max_count) noexcept override {
+    if (lookahead_end_ - lookahead_begin_ < max_count)
+      DecodeLookahead();
+    const size_t count =
+        std::min(max_count, lookahead_end_ - lookahead_begin_);
+    for (size_t i = 0; i < count; ++i)
+      subkeys[i] = lookahead_[lookahead_begin_ + i].subkey_;
+    return count;
+  }
+
+  KeyTransactionView GetKeyTransactionView() noexcept override {
+    assert(next_key_id_ != 0);
+    return {*this, current_key_layout_.clear_before_transaction_,
+            current_key_layout_.required_subkeys_count_};
+  }
+
+  SubkeyTransactionView GetSubkeyTransactionView(
+      VersionedPayloadHandle current_state) noexcept override {
+    assert(next_subkey_id_ != 0);
+    if (!SatisfiesRequirements(current_state))
+      return SubkeyTransactionView::Operation::ValidationFailed;
+
+    if (!RequiresChange(current_state))
+      return SubkeyTransactionView::Operation::NoChangeRequired;
+
+    if (current_subkey_layout_.action_kind_ ==
+        SubkeyTransactionActionKind::RemoveSubkey) {
+      return SubkeyTransactionView::Operation::RemoveSubkey;
+    }
+    if (current_subkey_layout_.action_kind_ ==
+        SubkeyTransactionActionKind::ApplyOperation) {
+      return ApplyOperation(current_state);
+    }
+    assert(current_subkey_layout_.action_kind_ ==
+           SubkeyTransactionActionKind::PutSubkey);
+    return behavior_.DeserializePayload(current_new_payload_);
+  }
+
+  bool IsEqualTo(KeyHandle key) const noexcept override {
+    return behavior_.Equal(key, current_serialized_key_);
+  }
+
+  bool IsLessThan(KeyHandle key) const noexcept override {
+    return behavior_.Less(current_serialized_key_, key);
+  }
+
+  bool IsGreaterThan(KeyHandle key) const noexcept override {
+    return behavior_.Less(key, current_serialized_key_);
+  }
+
+  KeyHandle MakeHandle() noexcept override {
+    if (current_cache_slot_)
+      return key_handle_cache_->MakeHandle(*current_cache_slot_);
+    return behavior_.DeserializeKey(current_serialized_key_);
+  }
+
+  KeyHandle MakeHandle(KeyHandle existing_handle) noexcept override {
+    return behavior_.DuplicateHandle(existing_handle);
+  }
+
+  // Checks the requirement of the current subkey without producing any
+  // handles (unlike GetSubkeyTransactionView()).
+  // Should only be called after a successful MoveNextSubkey().
+  bool SatisfiesRequirements(VersionedPayloadHandle current_state) const
+      noexcept {
+    assert(next_subkey_id_ != 0);
+    switch (current_subkey_layout_.requirement_kind_) {
+      case SubkeyTransactionRequirementKind::SubkeyExists:
+        return current_state.has_payload();
+      case SubkeyTransactionRequirementKind::SubkeyMissing:
+        return !current_state.has_payload();
+      case SubkeyTransactionRequirementKind::ExactVersion:
+        return current_state.version() ==
+               current_subkey_layout_.required_version_;
+      case SubkeyTransactionRequirementKind::ExactPayload:
+        return current_state && behavior_.Equal(current_state.payload(),
+                                                current_required_payload_);
+      default:
+        return true;
+    }
+  }
+
+ private:
+  // Decodes as many subkeys of the current key as fits into the lookahead
+  // buffer (keeping the ones that were decoded, but not consumed yet).
+  void DecodeLookahead() noexcept {
+    std::copy(lookahead_ + lookahead_begin_, lookahead_ + lookahead_end_,
+              lookahead_);
+    lookahead_end_ -= lookahead_begin_;
+    lookahead_begin_ = 0;
+    while (lookahead_end_ != kLookaheadCapacity &&
+           decoded_subkeys_count_ != current_key_layout_.subkeys_count_) {
+      DecodedSubkey& decoded = lookahead_[lookahead_end_++];
+      decoded.subkey_ = DecodeNextSubkey();
+      ++decoded_subkeys_count_;
+      decoded.layout_ = SubkeyTransactionLayout{reader_, format_};
+      if (decoded.layout_.requirement_kind_ ==
+          SubkeyTransactionRequirementKind::ExactPayload) {
+        decoded.required_payload_ = ConsumeData(
+            static_cast<size_t>(decoded.layout_.required_payload_size_));
+      } else {
+        decoded.required_payload_ = {};
+      }
+      if (decoded.layout_.has_payload_in_bytestream()) {
+        decoded.new_payload_ = ConsumeData(
+            static_cast<size_t>(decoded.layout_.new_payload_size_));
+      } else {
+        decoded.new_payload_ = {};
+      }
+    }
+  }
+
+  // The subkey transaction of the decoded subkey is either right after it, or
+  // after the rest of the block of subkeys (see KeyTransactionLayout).
+  uint64_t DecodeNextSubkey() {
+    if (current_key_layout_.subkeys_encoding_ != SubkeysEncoding::PackedBlocks)
+      return subkey_encoder_.DecodeNext(reader_);
+    if (subkey_block_begin_ == subkey_block_end_) {
+      subkey_block_begin_ = 0;
+      subkey_block_end_ = static_cast<size_t>(std::min<uint64_t>(
+          kSubkeysBlockSize,
+          current_key_layout_.subkeys_count_ - decoded_subkeys_count_));
+      subkey_block_encoder_.DecodeBlock({subkey_block_, subkey_block_end_},
+                                        reader_);
+    }
+    return subkey_block_[subkey_block_begin_++];
+  }
+
+  std::string_view ConsumeData(size_t size) noexcept {
+    const char* data = next_data_;
+    next_data_ += size;
+    return {data, size};
+  }
+
+  bool RequiresChange(VersionedPayloadHandle current_state) const noexcept {
+    switch (current_subkey_layout_.action_kind_) {
+      case SubkeyTransactionActionKind::PutSubkey:
+        return !current_state.has_payload() ||
+               !behavior_.Equal(current_state.payload(), current_new_payload_);
+      case SubkeyTransactionActionKind::RemoveSubkey:
+        return current_state.has_payload();
+      case SubkeyTransactionActionKind::ApplyOperation:
+        // Can't be known before the result of the operation is calculated.
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  SubkeyTransactionView ApplyOperation(
+      VersionedPayloadHandle current_state) noexcept {
+    std::optional<PayloadHandle> current_payload;
+    if (current_state)
+      current_payload = current_state.payload();
+    // If the key is cleared by this transaction, the operation observes the
+    // subkey as missing (but the result is still compared with the actual
+    // payload, so that unchanged subkeys keep their versions, as with
+    // PutSubkey).
+    return SubkeyTransactionView::FromOperationResult(
+        behavior_, current_payload,
+        behavior_.ApplyOperation(
+            current_subkey_layout_.operation_kind_,
+            current_key_layout_.clear_before_transaction_ ? std::nullopt
+                                                          : current_payload,
+            current_new_payload_));
+  }
+
+  Behavior& behavior_;
+  Detail::KeyHandleCache* key_handle_cache_;
+  Detail::KeyHandleCache::Slot* current_cache_slot_{nullptr};
+  TransactionFormat format_{TransactionFormat::Initial};
+  uint64_t mentioned_keys_count_{0};
+  uint64_t mentioned_subkeys_count_{0};
+  bool is_valid_{false};
+  uint64_t next_key_id_{0};
+  uint64_t next_subkey_id_{0};
+  uint64_t decoded_subkeys_count_{0};
+  const char* next_data_{nullptr};
+  Serialization::BitstreamReader reader_;
+  Serialization::MonotonicSequenceEncoder subkey_encoder_;
+  Serialization::BlockMonotonicSequenceEncoder subkey_block_encoder_;
+  KeyTransactionLayout current_key_layout_;
+  SubkeyTransactionLayout current_subkey_layout_;
+  std::string_view current_serialized_key_;    // FIXME: set
+  std::string_view current_required_payload_;  // FIXME: set
+  std::string_view current_new_payload_;       // FIXME: set
+
+  // Subkeys are decoded in batches, so that the storage could peek at the
+  // upcoming subkeys (see PeekNextSubkeys()).
+  struct DecodedSubkey {
+    uint64_t subkey_;
+    SubkeyTransactionLayout layout_;
+    std::string_view required_payload_;
+    std::string_view new_payload_;
+  };
+  static constexpr size_t kLookaheadCapacity = 64;
+  size_t lookahead_begin_{0};
+  size_t lookahead_end_{0};
+  DecodedSubkey lookahead_[kLookaheadCapacity];
+
+  // The last decoded block of subkeys (only used with
+  // SubkeysEncoding::PackedBlocks).
+  static constexpr size_t kSubkeysBlockSize =
+      Serialization::BlockMonotonicSequenceEncoder::kBlockSize;
+  size_t subkey_block_begin_{0};
+  size_t subkey_block_end_{0};
+  uint64_t subkey_block_[kSubkeysBlockSize];
+};
+
+}  // namespace Microsoft::MixedReality::Sharing::VersionedStorage
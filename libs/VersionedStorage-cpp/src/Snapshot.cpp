@@ -6,6 +6,7 @@
 #include <Microsoft/MixedReality/Sharing/VersionedStorage/Snapshot.h>
 
 #include "src/HeaderBlock.h"
+#include "src/SerializedTransactionView.h"
 #include "src/StateBlock.h"
 
 namespace Microsoft::MixedReality::Sharing::VersionedStorage {
@@ -105,6 +106,49 @@ std::optional<KeyView> Snapshot::Get(const KeyDescriptor& key) const noexcept {
   return {};
 }
 
+bool Snapshot::CheckPrerequisites(
+    std::string_view serialized_transaction) const noexcept {
+  // Default-constructed snapshots don't have a behavior to decode the
+  // transaction with.
+  if (!header_block_)
+    return false;
+  // Not passing the key cache since it's owned by the writer thread.
+  SerializedTransactionView transaction{*behavior_, nullptr,
+                                        serialized_transaction};
+  if (!transaction.is_valid())
+    return false;
+  Detail::BlobAccessor accessor{*header_block_};
+  const Detail::VersionOffset version_offset =
+      Detail::MakeVersionOffset(info_.version_, header_block_->base_version());
+
+  while (transaction.MoveNextKey()) {
+    const KeyTransactionView key_transaction_view =
+        transaction.GetKeyTransactionView();
+    KeyDescriptor& key = key_transaction_view.key_descriptior_;
+    const Detail::KeyStateView key_state_view = accessor.FindKeyState(key);
+
+    if (key_transaction_view.required_subkeys_count_) {
+      const uint32_t subkeys_count =
+          key_state_view ? key_state_view.GetSubkeysCount(version_offset) : 0;
+      if (*key_transaction_view.required_subkeys_count_ != subkeys_count)
+        return false;
+    }
+    while (transaction.MoveNextSubkey()) {
+      VersionedPayloadHandle current_state;
+      // If the key is missing, all its subkeys are missing as well.
+      if (key_state_view) {
+        if (Detail::SubkeyStateView subkey_state_view =
+                accessor.FindSubkeyState(key, transaction.current_subkey())) {
+          current_state = subkey_state_view.GetPayload(info_.version_);
+        }
+      }
+      if (!transaction.SatisfiesRequirements(current_state))
+        return false;
+    }
+  }
+  return true;
+}
+
 size_t Snapshot::GetSubkeysCount(const KeyDescriptor& key) const noexcept {
   if (header_block_) {
     if (Detail::KeyStateView view =
@@ -0,0 +1,232 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "src/pch.h"
+
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/SpeculativeOverlay.h>
+
+#include "src/SerializedTransactionView.h"
+
+namespace Microsoft::MixedReality::Sharing::VersionedStorage {
+
+SpeculativeOverlay::SpeculativeOverlay(
+    Snapshot base,
+    std::shared_ptr<Behavior> behavior) noexcept
+    : base_{std::move(base)},
+      behavior_{std::move(behavior)},
+      version_{base_.version()} {}
+
+SpeculativeOverlay::SpeculativeOverlay(const SpeculativeOverlay& other) noexcept
+    : base_{other.base_},
+      behavior_{other.behavior_},
+      version_{other.version_},
+      keys_{other.keys_} {
+  for (KeyOverlay& key_overlay : keys_) {
+    key_overlay.key_ = behavior_->DuplicateHandle(key_overlay.key_);
+    for (auto& [subkey, payload] : key_overlay.subkeys_) {
+      if (payload) {
+        payload = {payload.version(),
+                   behavior_->DuplicateHandle(payload.payload())};
+      }
+    }
+  }
+}
+
+SpeculativeOverlay::~SpeculativeOverlay() noexcept {
+  for (KeyOverlay& key_overlay : keys_)
+    Release(key_overlay);
+}
+
+bool SpeculativeOverlay::ApplyTransaction(
+    std::string_view serialized_transaction) noexcept {
+  // Not passing the key cache since it's owned by the writer thread of the
+  // storage.
+  SerializedTransactionView transaction{*behavior_, nullptr,
+                                        serialized_transaction};
+  if (!transaction.is_valid())
+    return false;
+  const uint64_t new_version = ++version_;
+
+  // As with Storage::ApplyTransaction(), the transaction either has all its
+  // effects or none, so the changes are collected first, and applied only if
+  // all prerequisites are satisfied.
+  struct SubkeyChange {
+    uint64_t subkey_;
+    VersionedPayloadHandle current_state_;
+    SubkeyTransactionView view_;
+  };
+  struct KeyChange {
+    size_t key_index_;
+    bool clear_before_transaction_;
+    size_t subkeys_count_after_;
+    size_t subkey_changes_end_;
+  };
+  std::vector<KeyChange> key_changes;
+  std::vector<SubkeyChange> subkey_changes;
+  const size_t original_keys_count = keys_.size();
+
+  bool is_valid = true;
+  while (is_valid && transaction.MoveNextKey()) {
+    const KeyTransactionView key_transaction_view =
+        transaction.GetKeyTransactionView();
+    KeyDescriptor& key = key_transaction_view.key_descriptior_;
+    const bool clear_before_transaction =
+        key_transaction_view.clear_before_transaction_;
+    const KeyOverlay* key_overlay = FindKey(key);
+    const size_t subkeys_count_before =
+        key_overlay ? key_overlay->subkeys_count_ : base_.GetSubkeysCount(key);
+    if (key_transaction_view.required_subkeys_count_ &&
+        *key_transaction_view.required_subkeys_count_ !=
+            subkeys_count_before) {
+      is_valid = false;
+      break;
+    }
+    const size_t subkey_changes_begin = subkey_changes.size();
+    size_t subkeys_count_after =
+        clear_before_transaction ? 0 : subkeys_count_before;
+    while (transaction.MoveNextSubkey()) {
+      const uint64_t subkey = transaction.current_subkey();
+      const VersionedPayloadHandle current_state =
+          Get(key_overlay, key, subkey);
+      SubkeyTransactionView view =
+          transaction.GetSubkeyTransactionView(current_state);
+      switch (view.operation_) {
+        case SubkeyTransactionView::Operation::ValidationFailed:
+          is_valid = false;
+          break;
+        case SubkeyTransactionView::Operation::NoChangeRequired:
+          // The key is cleared, but this subkey keeps its payload.
+          if (clear_before_transaction && current_state)
+            ++subkeys_count_after;
+          else
+            continue;
+          break;
+        case SubkeyTransactionView::Operation::PutSubkey:
+          if (clear_before_transaction || !current_state)
+            ++subkeys_count_after;
+          break;
+        case SubkeyTransactionView::Operation::RemoveSubkey:
+          if (!clear_before_transaction)
+            --subkeys_count_after;
+          break;
+      }
+      if (!is_valid)
+        break;
+      subkey_changes.push_back({subkey, current_state, view});
+    }
+    if (!is_valid)
+      break;
+    if (!clear_before_transaction &&
+        subkey_changes.size() == subkey_changes_begin) {
+      continue;
+    }
+    size_t key_index;
+    if (key_overlay) {
+      key_index = key_overlay - keys_.data();
+    } else {
+      key_index = keys_.size();
+      const uint64_t key_hash = key.hash();
+      keys_.push_back(
+          {key.MakeHandle(), key_hash, false, subkeys_count_before, {}});
+    }
+    key_changes.push_back({key_index, clear_before_transaction,
+                           subkeys_count_after, subkey_changes.size()});
+  }
+
+  if (!is_valid) {
+    for (SubkeyChange& change : subkey_changes) {
+      if (auto handle = change.view_.ReleaseHandle())
+        behavior_->Release(*handle);
+    }
+    while (keys_.size() != original_keys_count) {
+      Release(keys_.back());
+      keys_.pop_back();
+    }
+    return false;
+  }
+
+  size_t subkey_change_index = 0;
+  for (const KeyChange& key_change : key_changes) {
+    KeyOverlay& key_overlay = keys_[key_change.key_index_];
+    std::map<uint64_t, VersionedPayloadHandle> cleared_subkeys;
+    auto& subkeys = key_change.clear_before_transaction_
+                        ? cleared_subkeys
+                        : key_overlay.subkeys_;
+    for (; subkey_change_index != key_change.subkey_changes_end_;
+         ++subkey_change_index) {
+      SubkeyChange& change = subkey_changes[subkey_change_index];
+      VersionedPayloadHandle new_state;
+      if (auto handle = change.view_.ReleaseHandle()) {
+        new_state = {new_version, *handle};
+      } else if (change.view_.operation_ ==
+                 SubkeyTransactionView::Operation::NoChangeRequired) {
+        // Only recorded for the subkeys that survive the clearing of the key.
+        new_state = {change.current_state_.version(),
+                     behavior_->DuplicateHandle(
+                         change.current_state_.payload())};
+      }
+      auto [it, inserted] = subkeys.emplace(change.subkey_, new_state);
+      if (!inserted) {
+        if (it->second)
+          behavior_->Release(it->second.payload());
+        it->second = new_state;
+      }
+    }
+    if (key_change.clear_before_transaction_) {
+      for (auto& [subkey, payload] : key_overlay.subkeys_) {
+        if (payload)
+          behavior_->Release(payload.payload());
+      }
+      key_overlay.subkeys_.swap(cleared_subkeys);
+      key_overlay.is_cleared_ = true;
+    }
+    key_overlay.subkeys_count_ = key_change.subkeys_count_after_;
+  }
+  return true;
+}
+
+VersionedPayloadHandle SpeculativeOverlay::Get(const KeyDescriptor& key,
+                                               uint64_t subkey) const noexcept {
+  return Get(FindKey(key), key, subkey);
+}
+
+size_t SpeculativeOverlay::GetSubkeysCount(const KeyDescriptor& key) const
+    noexcept {
+  if (const KeyOverlay* key_overlay = FindKey(key))
+    return key_overlay->subkeys_count_;
+  return base_.GetSubkeysCount(key);
+}
+
+auto SpeculativeOverlay::FindKey(const KeyDescriptor& key) const noexcept
+    -> const KeyOverlay* {
+  for (const KeyOverlay& key_overlay : keys_) {
+    if (key_overlay.key_hash_ == key.hash() &&
+        key.IsEqualTo(key_overlay.key_)) {
+      return &key_overlay;
+    }
+  }
+  return nullptr;
+}
+
+VersionedPayloadHandle SpeculativeOverlay::Get(const KeyOverlay* key_overlay,
+                                               const KeyDescriptor& key,
+                                               uint64_t subkey) const noexcept {
+  if (key_overlay) {
+    auto it = key_overlay->subkeys_.find(subkey);
+    if (it != key_overlay->subkeys_.end())
+      return it->second;
+    if (key_overlay->is_cleared_)
+      return {};
+  }
+  return base_.Get(key, subkey);
+}
+
+void SpeculativeOverlay::Release(KeyOverlay& key_overlay) noexcept {
+  for (auto& [subkey, payload] : key_overlay.subkeys_) {
+    if (payload)
+      behavior_->Release(payload.payload());
+  }
+  behavior_->Release(key_overlay.key_);
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::VersionedStorage
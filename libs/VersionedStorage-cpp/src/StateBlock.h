@@ -43,6 +43,12 @@ class StateBlockBase : public KeyHandleWrapper {
     subscription_and_tree_height_ += kTreeHeightIncrement;
   }
 
+  void SetTreeLevel(uint8_t level) noexcept {
+    subscription_and_tree_height_ =
+        (subscription_and_tree_height_ & kSubscriptionMask) |
+        (static_cast<uint64_t>(level) << kTreeHeightShiftBits);
+  }
+
   constexpr bool is_scratch_buffer_mode() const noexcept {
     return (subscription_and_tree_height_ & kScratchBufferModeMask) ==
            kScratchBufferModeMask;
@@ -6,13 +6,16 @@
 #include <Microsoft/MixedReality/Sharing/VersionedStorage/Storage.h>
 
 #include "src/HeaderBlock.h"
+#include "src/KeyHandleCache.h"
+#include "src/SerializedTransactionView.h"
 #include "src/TransactionLayout.h"
 
-#include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamReader.h>
-#include <Microsoft/MixedReality/Sharing/Common/Serialization/MonotonicSequenceEncoder.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobReader.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlobWriter.h>
 
 #include <limits>
-#include <type_traits>
+#include <system_error>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -72,7 +75,9 @@ class TransactionApplicator {
       : behavior_{std::move(behavior)},
         accessor_{accessor},
         new_version_{accessor.next_version()},
-        is_version_added_{accessor.AddVersion()},
+        is_version_added_{accessor.AddVersion() ||
+                          (accessor.TryGrow(*behavior_, 0) &&
+                           accessor.AddVersion())},
         is_allocation_failed_{!is_version_added_} {}
 
   ~TransactionApplicator() noexcept { Clear(); }
@@ -80,8 +85,7 @@ class TransactionApplicator {
   std::pair<Snapshot, Storage::TransactionResult> Apply(
       TransactionView& transaction) noexcept {
     if (Prepare(transaction)) {
-      if (is_allocation_failed_ ||
-          !accessor_.CanInsertStateBlocks(extra_blocks_count_)) {
+      if (is_allocation_failed_ || !CanInsertStateBlocks()) {
         return CreateMergedBlob(Storage::TransactionResult::Applied);
       }
       return {ApplyToExistingBlob(), Storage::TransactionResult::Applied};
@@ -165,7 +169,7 @@ class TransactionApplicator {
                    SubkeyTransactionView::Operation::PutSubkey);
             ++extra_blocks_count_;
           } else if (!is_allocation_failed_) {
-            is_allocation_failed_ = !accessor_.ReserveSpaceForTransaction(
+            is_allocation_failed_ = !ReserveSpaceForTransaction(
                 subkey_transaction.state_and_index_view_, new_version_,
                 has_new_payload);
           }
@@ -177,11 +181,24 @@ class TransactionApplicator {
         pending_key_transaction.subkeys_count_after_ =
             pending_key_transaction.subkeys_count_before_;
 
+        // Each lookup below is a random access into the index, which is
+        // likely to miss the cache for large blobs. Prefetching the index
+        // blocks of the upcoming subkeys allows the misses to overlap.
+        size_t prefetched_subkeys_count = 0;
         while (transaction.MoveNextSubkey()) {
           const uint64_t transaction_subkey = transaction.current_subkey();
 
           SubkeyStateAndIndexView current_subkey_view;
           if (pending_key_transaction.state_and_index_view_) {
+            // The next batch is prefetched when the current subkey is the
+            // last one of the previous batch, so that every subkey (except
+            // for the first one) is prefetched.
+            if (prefetched_subkeys_count != 0)
+              --prefetched_subkeys_count;
+            if (prefetched_subkeys_count == 0) {
+              prefetched_subkeys_count = PrefetchNextSubkeys(
+                  transaction, key_transaction_view.key_descriptior_.hash());
+            }
             current_subkey_view = accessor_.FindSubkeyStateAndIndex(
                 key_transaction_view.key_descriptior_, transaction_subkey);
           }
@@ -217,7 +234,7 @@ class TransactionApplicator {
                    SubkeyTransactionView::Operation::PutSubkey);
             ++extra_blocks_count_;
           } else if (!is_allocation_failed_) {
-            is_allocation_failed_ = !accessor_.ReserveSpaceForTransaction(
+            is_allocation_failed_ = !ReserveSpaceForTransaction(
                 subkey_transaction.state_and_index_view_, new_version_,
                 has_new_payload);
           }
@@ -242,7 +259,7 @@ class TransactionApplicator {
         ++extra_blocks_count_;
       } else if (!is_allocation_failed_ &&
                  pending_key_transaction.subkeys_count_changed()) {
-        is_allocation_failed_ = !accessor_.ReserveSpaceForTransaction(
+        is_allocation_failed_ = !ReserveSpaceForTransaction(
             pending_key_transaction.state_and_index_view_);
       }
     }
@@ -279,12 +296,52 @@ class TransactionApplicator {
   }
 
  private:
+  static constexpr size_t kPrefetchBatchSize = 16;
+
+  // If the blob runs out of data blocks, it is grown in place (if it can be)
+  // before falling back to the merge.
+  template <typename TView, typename... TArgs>
+  bool ReserveSpaceForTransaction(TView& view, TArgs... args) noexcept {
+    while (!accessor_.ReserveSpaceForTransaction(view, args...)) {
+      if (!accessor_.TryGrow(*behavior_, 1))
+        return false;
+    }
+    return true;
+  }
+
+  // Same as above, but only while the index still has room for the new
+  // blocks (otherwise the merge is required anyway).
+  bool CanInsertStateBlocks() noexcept {
+    while (!accessor_.CanInsertStateBlocks(extra_blocks_count_)) {
+      if (extra_blocks_count_ > accessor_.remaining_index_slots_capacity() ||
+          !accessor_.TryGrow(
+              *behavior_,
+              static_cast<uint32_t>(extra_blocks_count_ -
+                                    accessor_.available_data_blocks_count()))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Prefetches the index blocks of up to kPrefetchBatchSize subkeys that
+  // follow the current one, and returns the number of prefetched subkeys.
+  size_t PrefetchNextSubkeys(TransactionView& transaction,
+                             uint64_t key_hash) noexcept {
+    uint64_t subkeys[kPrefetchBatchSize];
+    const size_t count =
+        transaction.PeekNextSubkeys(subkeys, kPrefetchBatchSize);
+    for (size_t i = 0; i < count; ++i)
+      accessor_.PrefetchSubkeyIndex(key_hash, subkeys[i]);
+    return count;
+  }
+
   void PrepareCleanupAndAdvance(SubkeyBlockIterator& it) noexcept {
     if (!is_allocation_failed_) {
       SubkeyStateAndIndexView view = *it;
       if (view.has_payload_thread_unsafe()) {
         is_allocation_failed_ =
-            !accessor_.ReserveSpaceForTransaction(view, new_version_, false);
+            !ReserveSpaceForTransaction(view, new_version_, false);
       }
     }
     ++it;
@@ -371,21 +428,52 @@ class TransactionApplicator {
     }
   }
 
-  size_t CountRequiredBlocksForMerge() const noexcept {
+  // A contiguous range of keys of the old blob, which is merged into the new
+  // blob as a single unit of work (possibly on another thread, see
+  // MergeChunksInParallel()).
+  struct MergeChunk {
+    KeyBlockIterator begin_;
+    uint32_t old_keys_count_{0};
+    uint32_t new_blocks_count_{0};
+    AppendRange range_;
+
+    // Populated by MergeKeys().
+    KeyStateBlock* last_new_key_state_block_{nullptr};
+    uint32_t new_key_blocks_count_{0};
+    uint32_t keys_count_{0};
+    uint32_t subkeys_count_{0};
+  };
+
+  // Keys are never split between chunks, so a chunk can be larger if some key
+  // has more subkeys than that.
+  static constexpr uint32_t kMergeChunkBlocksCount = 16384;
+
+  // Splits the surviving keys into chunks and returns the total number of
+  // blocks required for the merge.
+  size_t CountRequiredBlocksForMerge(std::vector<MergeChunk>& chunks) const
+      noexcept {
     size_t required_blocks_count = extra_blocks_count_;
-    for (auto&& key_state_view : accessor_) {
-      KeyBlockFlags key_flags = GetKeyBlockFlags(key_state_view);
-      for (SubkeyStateAndIndexView subkey_state_view :
-           accessor_.GetSubkeys(key_state_view)) {
+    for (auto it = accessor_.begin(); !it.is_end(); ++it) {
+      if (chunks.empty() ||
+          chunks.back().new_blocks_count_ >= kMergeChunkBlocksCount) {
+        chunks.emplace_back().begin_ = it;
+      }
+      MergeChunk& chunk = chunks.back();
+      ++chunk.old_keys_count_;
+      KeyBlockFlags key_flags = GetKeyBlockFlags(*it);
+      uint32_t key_blocks_count = 0;
+      for (SubkeyStateAndIndexView subkey_state_view : accessor_.GetSubkeys(*it)) {
         if (SubkeyBlockShouldSurvive(
                 subkey_state_view,
                 key_flags.is_clear_before_transaction_mode)) {
-          ++required_blocks_count;
+          ++key_blocks_count;
           key_flags.should_survive = true;
         }
       }
       if (key_flags.should_survive)
-        ++required_blocks_count;
+        ++key_blocks_count;
+      chunk.new_blocks_count_ += key_blocks_count;
+      required_blocks_count += key_blocks_count;
     }
     return required_blocks_count;
   }
@@ -419,33 +507,30 @@ class TransactionApplicator {
     return {};
   }
 
-  std::pair<Snapshot, Storage::TransactionResult> CreateMergedBlob(
-      Storage::TransactionResult successful_result) noexcept {
-    if (is_version_added_) {
-      accessor_.header_block().RemoveSnapshotReference(new_version_,
-                                                       *behavior_);
-    }
-    accessor_.SetImmutableMode();
-    InitScratchBuffers();
-    const size_t required_blocks_count = CountRequiredBlocksForMerge();
-    HeaderBlock* new_header_block = HeaderBlock::CreateBlob(
-        *behavior_, new_version_, required_blocks_count * 2);
-    if (!new_header_block)
-      return {Snapshot{},
-              Storage::TransactionResult::FailedDueToInsufficientResources};
-
-    MutatingBlobAccessor new_accessor{*new_header_block};
-
-    // First, moving all surviving blocks from the existing blob.
-    for (auto&& old_key_state_view : accessor_) {
+  // Moves the surviving blocks of the chunk's keys to the new blob.
+  // If the range is provided, the blocks are allocated from it, and the keys
+  // form the separate list (other chunks can be merged at the same time).
+  void MergeKeys(MutatingBlobAccessor& new_accessor,
+                 MergeChunk& chunk,
+                 AppendRange* range) noexcept {
+    KeyBlockIterator it = chunk.begin_;
+    for (uint32_t i = 0; i < chunk.old_keys_count_; ++i, ++it) {
+      const KeyStateAndIndexView old_key_state_view = *it;
       auto key_flags = GetKeyBlockFlags(old_key_state_view);
       KeyStateBlock* new_key_state_block = nullptr;
+      uint64_t key_hash = 0;
+      SubkeyStateBlock* last_new_subkey_state_block = nullptr;
+      uint32_t new_subkey_blocks_count = 0;
       auto EnsureNewKeyBlockExists = [&] {
         if (!new_key_state_block) {
           auto& old_key_block = *old_key_state_view.state_block_;
-          KeyStateAndIndexView key_state_view = new_accessor.InsertKeyBlock(
-              *behavior_, behavior_->DuplicateHandle(old_key_block.key_));
+          key_hash = behavior_->GetKeyHash(old_key_block.key_);
+          KeyStateAndIndexView key_state_view = new_accessor.AppendKeyBlock(
+              *behavior_, behavior_->DuplicateHandle(old_key_block.key_),
+              key_hash, chunk.last_new_key_state_block_, range);
           new_key_state_block = key_state_view.state_block_;
+          chunk.last_new_key_state_block_ = new_key_state_block;
+          ++chunk.new_key_blocks_count_;
           assert(new_key_state_block);
           if (old_key_block.has_subscription()) {
             assert(!"Not implemented yet");
@@ -468,7 +553,7 @@ class TransactionApplicator {
           if (new_subkeys_count) {
             new_key_state_block->PushSubkeysCountFromWriterThread(
                 VersionOffset{0}, new_subkeys_count);
-            ++new_accessor.keys_count();
+            ++chunk.keys_count_;
           }
         }
       };
@@ -485,9 +570,13 @@ class TransactionApplicator {
           const uint64_t subkey = old_subkey_state_block.subkey_;
           SubkeyStateBlock* new_subkey_state_block =
               new_accessor
-                  .InsertSubkeyBlock(*behavior_, *new_key_state_block, subkey)
+                  .AppendSubkeyBlock(*behavior_, *new_key_state_block,
+                                     key_hash, subkey,
+                                     last_new_subkey_state_block, range)
                   .state_block_;
           assert(new_subkey_state_block);
+          last_new_subkey_state_block = new_subkey_state_block;
+          ++new_subkey_blocks_count;
           if (old_subkey_state_block.has_subscription()) {
             // Should move the subscription to the new block.
             assert(!"Not implemented yet");
@@ -497,11 +586,94 @@ class TransactionApplicator {
                   key_flags.is_clear_before_transaction_mode)) {
             new_subkey_state_block->PushFromWriterThread(handle.version(),
                                                          handle.payload());
-            ++new_accessor.subkeys_count();
+            ++chunk.subkeys_count_;
           }
         }
       }
+      if (new_key_state_block) {
+        new_accessor.BuildSubkeysTree(*new_key_state_block,
+                                      new_subkey_blocks_count);
+      }
+    }
+  }
+
+  // Merges the chunks on threads_count threads (including this one).
+  // The Behavior must support this (see Behavior::GetMergeThreadsCount()).
+  void MergeChunksInParallel(MutatingBlobAccessor& new_accessor,
+                             std::vector<MergeChunk>& chunks,
+                             uint32_t threads_count) noexcept {
+    for (MergeChunk& chunk : chunks)
+      chunk.range_ = new_accessor.ReserveAppendRange(chunk.new_blocks_count_);
+
+    std::atomic_size_t next_chunk_id{0};
+    auto merge_chunks = [&]() noexcept {
+      for (size_t id = next_chunk_id.fetch_add(1, std::memory_order_relaxed);
+           id < chunks.size();
+           id = next_chunk_id.fetch_add(1, std::memory_order_relaxed)) {
+        MergeKeys(new_accessor, chunks[id], &chunks[id].range_);
+      }
+    };
+    std::vector<std::thread> threads;
+    try {
+      threads.reserve(threads_count - 1);
+      for (uint32_t i = 1; i < threads_count; ++i)
+        threads.emplace_back(merge_chunks);
+    } catch (const std::system_error&) {
+      // Fewer threads will do the same work.
+    }
+    merge_chunks();
+    for (std::thread& thread : threads)
+      thread.join();
+  }
+
+  std::pair<Snapshot, Storage::TransactionResult> CreateMergedBlob(
+      Storage::TransactionResult successful_result) noexcept {
+    if (is_version_added_) {
+      accessor_.header_block().RemoveSnapshotReference(new_version_,
+                                                       *behavior_);
+    }
+    accessor_.SetImmutableMode();
+    InitScratchBuffers();
+    std::vector<MergeChunk> chunks;
+    const size_t required_blocks_count = CountRequiredBlocksForMerge(chunks);
+    HeaderBlock* new_header_block = HeaderBlock::CreateBlob(
+        *behavior_, new_version_, required_blocks_count * 2);
+    if (!new_header_block)
+      return {Snapshot{},
+              Storage::TransactionResult::FailedDueToInsufficientResources};
+
+    MutatingBlobAccessor new_accessor{*new_header_block};
+
+    // First, moving all surviving blocks from the existing blob.
+    // Both keys and subkeys are visited in the sorted order, so the blocks are
+    // appended to the end of the lists of the new blob, and the AA-trees are
+    // built once each list is complete (this is much cheaper than inserting
+    // the blocks into the trees one by one).
+    const uint32_t threads_count = static_cast<uint32_t>(
+        std::min<size_t>(behavior_->GetMergeThreadsCount(), chunks.size()));
+    if (threads_count > 1)
+      MergeChunksInParallel(new_accessor, chunks, threads_count);
+
+    KeyStateBlock* last_new_key_state_block = nullptr;
+    uint32_t new_key_blocks_count = 0;
+    for (MergeChunk& chunk : chunks) {
+      if (threads_count > 1) {
+        // Each chunk has its own list of keys.
+        if (chunk.last_new_key_state_block_) {
+          new_accessor.AppendKeysList(chunk.range_, last_new_key_state_block);
+          last_new_key_state_block = chunk.last_new_key_state_block_;
+        }
+      } else {
+        chunk.last_new_key_state_block_ = last_new_key_state_block;
+        MergeKeys(new_accessor, chunk, nullptr);
+        last_new_key_state_block = chunk.last_new_key_state_block_;
+      }
+      new_key_blocks_count += chunk.new_key_blocks_count_;
+      new_accessor.keys_count() += chunk.keys_count_;
+      new_accessor.subkeys_count() += chunk.subkeys_count_;
     }
+    new_accessor.BuildKeysTree(new_key_blocks_count);
+
     // Now handling keys and subkeys from the new transaction that were not
     // touched by the code above.
     auto it = subkey_transactions_.begin();
@@ -651,7 +823,8 @@ Storage::Storage(std::shared_ptr<Behavior> behavior)
     : behavior_{std::move(behavior)},
       latest_snapshot_{*Detail::HeaderBlock::CreateBlob(*behavior_, 0, 0),
                        behavior_,
-                       {}} {
+                       {}},
+      key_handle_cache_{std::make_unique<Detail::KeyHandleCache>(*behavior_)} {
   assert(behavior_);
 }
 
@@ -690,199 +863,239 @@ Storage::TransactionResult Storage::ApplyTransaction(
 
 struct SafeBytestreamSizeCounter {};
 
-class SerializedTransactionView : public TransactionView, public KeyDescriptor {
- public:
-  SerializedTransactionView(Behavior& behavior,
-                            std::string_view serialized_transaction)
-      : KeyDescriptor{0}, behavior_{behavior}, reader_{serialized_transaction} {
-    try {
-      mentioned_keys_count_ = reader_.ReadExponentialGolombCode();
-      Serialization::BitstreamReader preparse_reader{reader_};
-      // The transaction consists of bit stream and byte stream (right after the
-      // bit stream). We expect the sizes of all payloads to add up to the exact
-      // size of the byte stream.
-      uint64_t bytestream_content_size = 0;
-      auto AddBytestreamContentSize = [&](auto value) {
-        if (value <= ~0ull - bytestream_content_size) {
-          bytestream_content_size += value;
-          if (bytestream_content_size <=
-              preparse_reader.untouched_bytes_count())
-            return;
-        }
-        throw std::invalid_argument{"Can't decode a transaction"};
-      };
-      for (uint64_t key_id = 0; key_id < mentioned_keys_count_; ++key_id) {
-        KeyTransactionLayout key_layout{preparse_reader};
-        AddBytestreamContentSize(key_layout.key_size_);
-
-        Serialization::MonotonicSequenceEncoder preparse_subkey_encoder;
-        for (uint64_t subkey_id = 0; subkey_id < key_layout.subkeys_count_;
-             ++subkey_id) {
-          [[maybe_unused]] uint64_t subkey =
-              preparse_subkey_encoder.DecodeNext(preparse_reader);
-          SubkeyTransactionLayout layout{preparse_reader};
-          AddBytestreamContentSize(layout.bytestream_content_size());
-        }
-        mentioned_subkeys_count_ += key_layout.subkeys_count_;
-      }
-      size_t untouched_bytes_count = preparse_reader.untouched_bytes_count();
-      if (untouched_bytes_count != bytestream_content_size) {
-        throw std::invalid_argument{
-            "Can't decode a transaction: message size doesn't match the "
-            "layout"};
-      }
-      next_data_ = serialized_transaction.data() +
-                   (serialized_transaction.size() - untouched_bytes_count);
-    } catch (const std::exception&) {
-      assert(false);  // Not implemented yet
-    }
-  }
+Storage::TransactionResult Storage::ApplyTransaction(
+    std::string_view serialized_transaction) noexcept {
+  SerializedTransactionView transaction{*behavior_, key_handle_cache_.get(),
+                                        serialized_transaction};
+  if (!transaction.is_valid())
+    return TransactionResult::RejectedAsMalformed;
+  return ApplyTransaction(transaction);
+}
 
-  uint64_t mentioned_keys_count() const noexcept override {
-    return mentioned_keys_count_;
-  }
+Storage::DecodedTransaction::DecodedTransaction(
+    std::unique_ptr<SerializedTransactionView> view) noexcept
+    : view_{std::move(view)} {}
 
-  uint64_t mentioned_subkeys_count_hint() const noexcept override {
-    return mentioned_subkeys_count_;
-  }
+Storage::DecodedTransaction::DecodedTransaction(DecodedTransaction&&) noexcept =
+    default;
 
-  bool MoveNextKey() noexcept override {
-    if (next_key_id_ == mentioned_keys_count_)
-      return false;
-    ++next_key_id_;
-    current_key_layout_ = KeyTransactionLayout{reader_};
-    current_serialized_key_ =
-        ConsumeData(static_cast<size_t>(current_key_layout_.key_size_));
-    key_hash_ = behavior_.GetKeyHash(current_serialized_key_);
-    next_subkey_id_ = 0;
-    subkey_encoder_.~MonotonicSequenceEncoder();
-    new (&subkey_encoder_) Serialization::MonotonicSequenceEncoder{};
-    return true;
-  }
+Storage::DecodedTransaction& Storage::DecodedTransaction::operator=(
+    DecodedTransaction&&) noexcept = default;
 
-  bool MoveNextSubkey() noexcept override {
-    if (next_subkey_id_ == current_key_layout_.subkeys_count_)
-      return false;
-    ++next_subkey_id_;
-    current_subkey_ = subkey_encoder_.DecodeNext(reader_);
-    static_assert(
-        std::is_trivially_destructible_v<decltype(current_subkey_layout_)>);
-    new (&current_subkey_layout_) SubkeyTransactionLayout{reader_};
-    if (current_subkey_layout_.requirement_kind_ ==
-        SubkeyTransactionRequirementKind::ExactPayload) {
-      current_required_payload_ = ConsumeData(
-          static_cast<size_t>(current_subkey_layout_.required_payload_size_));
-    } else {
-      current_required_payload_ = {};
-    }
-    if (current_subkey_layout_.action_kind_ ==
-        SubkeyTransactionActionKind::PutSubkey) {
-      current_new_payload_ = ConsumeData(
-          static_cast<size_t>(current_subkey_layout_.new_payload_size_));
-    }
-    return true;
-  }
+Storage::DecodedTransaction::~DecodedTransaction() noexcept = default;
 
-  KeyTransactionView GetKeyTransactionView() noexcept override {
-    assert(next_key_id_ != 0);
-    return {*this, current_key_layout_.clear_before_transaction_,
-            current_key_layout_.required_subkeys_count_};
-  }
+std::optional<Storage::DecodedTransaction> Storage::DecodeTransaction(
+    std::string_view serialized_transaction) const {
+  auto view = std::make_unique<SerializedTransactionView>(
+      *behavior_, nullptr, serialized_transaction);
+  if (!view->is_valid())
+    return {};
+  return DecodedTransaction{std::move(view)};
+}
 
-  SubkeyTransactionView GetSubkeyTransactionView(
-      VersionedPayloadHandle current_state) noexcept override {
-    assert(next_subkey_id_ != 0);
-    if (!SatisfiesRequirements(current_state))
-      return SubkeyTransactionView::Operation::ValidationFailed;
+Storage::TransactionResult Storage::ApplyTransaction(
+    DecodedTransaction&& transaction) noexcept {
+  assert(transaction.view_);
+  auto view = std::move(transaction.view_);
+  // The cache is guarded by writer_mutex_, which is locked below, and the
+  // view doesn't use it until the transaction is applied.
+  view->set_key_handle_cache(key_handle_cache_.get());
+  return ApplyTransaction(*view);
+}
 
-    if (!RequiresChange(current_state))
-      return SubkeyTransactionView::Operation::NoChangeRequired;
+namespace {
 
-    if (current_subkey_layout_.action_kind_ ==
-        SubkeyTransactionActionKind::RemoveSubkey) {
-      return SubkeyTransactionView::Operation::RemoveSubkey;
-    }
-    assert(current_subkey_layout_.action_kind_ ==
-           SubkeyTransactionActionKind::PutSubkey);
-    return behavior_.DeserializePayload(current_new_payload_);
-  }
+// The serialized state is a sequence of records, each prefixed with its size
+// (kRecordSizeBytes bytes, little-endian): the header with the version and the
+// numbers of keys and subkeys, then each key followed by its subkeys (both in
+// the sorted order). The records are written with BlobWriter.
+constexpr size_t kRecordSizeBytes = 4;
+
+void AppendRecord(std::string& state_blob,
+                  Serialization::BlobWriter& writer) {
+  const std::string_view record = writer.Finalize();
+  if (record.size() > std::numeric_limits<uint32_t>::max())
+    throw std::out_of_range{"The record is too large to be serialized"};
+  for (size_t i = 0; i < kRecordSizeBytes; ++i)
+    state_blob.push_back(static_cast<char>(record.size() >> (i * 8)));
+  state_blob.append(record);
+}
 
-  bool IsEqualTo(KeyHandle key) const noexcept override {
-    return behavior_.Equal(key, current_serialized_key_);
-  }
+size_t ReadRecordSize(std::string_view data) noexcept {
+  assert(data.size() >= kRecordSizeBytes);
+  size_t size = 0;
+  for (size_t i = 0; i < kRecordSizeBytes; ++i)
+    size |= size_t{static_cast<uint8_t>(data[i])} << (i * 8);
+  return size;
+}
 
-  bool IsLessThan(KeyHandle key) const noexcept override {
-    return behavior_.Less(current_serialized_key_, key);
-  }
+}  // namespace
 
-  bool IsGreaterThan(KeyHandle key) const noexcept override {
-    return behavior_.Less(key, current_serialized_key_);
+void Storage::SerializeState(std::string& state_blob) const {
+  const Snapshot snapshot = GetSnapshot();
+  {
+    Serialization::BlobWriter writer;
+    writer.WriteGolomb(snapshot.version());
+    writer.WriteGolomb(snapshot.keys_count());
+    writer.WriteGolomb(snapshot.subkeys_count());
+    AppendRecord(state_blob, writer);
   }
-
-  KeyHandle MakeHandle() noexcept override {
-    return behavior_.DeserializeKey(current_serialized_key_);
+  std::vector<std::byte> byte_stream;
+  for (const KeyView key_view : snapshot) {
+    byte_stream.clear();
+    behavior_->Serialize(key_view.key_handle(), byte_stream);
+    Serialization::BlobWriter key_writer;
+    key_writer.WriteBytesWithSize(byte_stream.data(), byte_stream.size());
+    key_writer.WriteGolomb(key_view.subkeys_count());
+    AppendRecord(state_blob, key_writer);
+    for (const SubkeyView subkey_view : snapshot.GetSubkeys(key_view)) {
+      byte_stream.clear();
+      behavior_->Serialize(subkey_view.payload(), byte_stream);
+      Serialization::BlobWriter subkey_writer;
+      subkey_writer.WriteGolomb(subkey_view.subkey());
+      subkey_writer.WriteGolomb(subkey_view.version());
+      subkey_writer.WriteBytesWithSize(byte_stream.data(), byte_stream.size());
+      AppendRecord(state_blob, subkey_writer);
+    }
   }
+}
 
-  KeyHandle MakeHandle(KeyHandle existing_handle) noexcept override {
-    return behavior_.DuplicateHandle(existing_handle);
-  }
+Storage::StateRestorer::StateRestorer(
+    std::shared_ptr<Behavior> behavior) noexcept
+    : behavior_{std::move(behavior)} {}
 
- private:
-  std::string_view ConsumeData(size_t size) noexcept {
-    const char* data = next_data_;
-    next_data_ += size;
-    return {data, size};
-  }
+Storage::StateRestorer::~StateRestorer() noexcept {
+  // Releases the handles that were added to the blob.
+  if (header_block_)
+    header_block_->RemoveSnapshotReference(info_.version_, *behavior_);
+}
 
-  bool SatisfiesRequirements(VersionedPayloadHandle current_state) const
-      noexcept {
-    switch (current_subkey_layout_.requirement_kind_) {
-      case SubkeyTransactionRequirementKind::SubkeyExists:
-        return current_state.has_payload();
-      case SubkeyTransactionRequirementKind::SubkeyMissing:
-        return !current_state.has_payload();
-      case SubkeyTransactionRequirementKind::ExactVersion:
-        return current_state.version() ==
-               current_subkey_layout_.required_version_;
-      case SubkeyTransactionRequirementKind::ExactPayload:
-        return current_state && behavior_.Equal(current_state.payload(),
-                                                current_required_payload_);
-      default:
+bool Storage::StateRestorer::Append(std::string_view chunk) noexcept {
+  if (has_failed_)
+    return false;
+  try {
+    if (!incomplete_record_.empty()) {
+      // Completing the record that started in the previous chunk.
+      auto TakeBytes = [&](size_t size) {
+        const size_t count =
+            std::min(size - incomplete_record_.size(), chunk.size());
+        incomplete_record_.append(chunk.data(), count);
+        chunk.remove_prefix(count);
+        return incomplete_record_.size() == size;
+      };
+      if (incomplete_record_.size() < kRecordSizeBytes &&
+          !TakeBytes(kRecordSizeBytes)) {
         return true;
+      }
+      if (!TakeBytes(kRecordSizeBytes + ReadRecordSize(incomplete_record_)))
+        return true;
+      has_failed_ = !ProcessRecord(
+          std::string_view{incomplete_record_}.substr(kRecordSizeBytes));
+      incomplete_record_.clear();
     }
+    while (!has_failed_ && chunk.size() >= kRecordSizeBytes) {
+      const size_t size = ReadRecordSize(chunk);
+      if (chunk.size() - kRecordSizeBytes < size)
+        break;
+      has_failed_ = !ProcessRecord(chunk.substr(kRecordSizeBytes, size));
+      chunk.remove_prefix(kRecordSizeBytes + size);
+    }
+    if (!has_failed_)
+      incomplete_record_.assign(chunk);
+  } catch (const std::exception&) {
+    has_failed_ = true;
   }
+  return !has_failed_;
+}
 
-  bool RequiresChange(VersionedPayloadHandle current_state) const noexcept {
-    switch (current_subkey_layout_.action_kind_) {
-      case SubkeyTransactionActionKind::PutSubkey:
-        return !current_state.has_payload() ||
-               !behavior_.Equal(current_state.payload(), current_new_payload_);
-      case SubkeyTransactionActionKind::RemoveSubkey:
-        return current_state.has_payload();
-      default:
+bool Storage::StateRestorer::ProcessRecord(std::string_view record) {
+  Serialization::BlobReader reader{record};
+  if (!header_block_) {
+    const uint64_t version = reader.ReadGolomb();
+    const uint64_t keys_count = reader.ReadGolomb();
+    const uint64_t subkeys_count = reader.ReadGolomb();
+    // Each key has at least one subkey, and each subkey has a block.
+    if (keys_count > subkeys_count ||
+        subkeys_count > std::numeric_limits<uint32_t>::max()) {
+      return false;
+    }
+    // Leaving as much free space as the merge would.
+    header_block_ = Detail::HeaderBlock::CreateBlob(
+        *behavior_, version,
+        static_cast<size_t>(keys_count + subkeys_count) * 2);
+    if (!header_block_)
+      return false;
+    info_ = {version, static_cast<size_t>(keys_count),
+             static_cast<size_t>(subkeys_count)};
+    remaining_keys_count_ = info_.keys_count_;
+    remaining_subkeys_count_ = info_.subkeys_count_;
+    return true;
+  }
+  Detail::MutatingBlobAccessor accessor{*header_block_};
+  if (remaining_key_subkeys_count_ == 0) {
+    const std::string_view serialized_key = reader.ReadBytesWithSize();
+    const uint64_t subkeys_count = reader.ReadGolomb();
+    if (remaining_keys_count_ == 0 || subkeys_count == 0 ||
+        subkeys_count > remaining_subkeys_count_) {
+      return false;
+    }
+    const KeyHandle key = behavior_->DeserializeKey(serialized_key);
+    if (last_key_block_ && !behavior_->Less(last_key_block_->key_, key)) {
+      behavior_->Release(key);
+      return false;
+    }
+    last_key_hash_ = behavior_->GetKeyHash(key);
+    last_key_block_ =
+        accessor
+            .AppendKeyBlock(*behavior_, key, last_key_hash_, last_key_block_)
+            .state_block_;
+    key_subkeys_count_ = static_cast<uint32_t>(subkeys_count);
+    last_key_block_->PushSubkeysCountFromWriterThread(Detail::VersionOffset{0},
+                                                      key_subkeys_count_);
+    ++accessor.keys_count();
+    --remaining_keys_count_;
+    remaining_key_subkeys_count_ = key_subkeys_count_;
+    last_subkey_block_ = nullptr;
+    return true;
+  }
+  const uint64_t subkey = reader.ReadGolomb();
+  const uint64_t version = reader.ReadGolomb();
+  const std::string_view serialized_payload = reader.ReadBytesWithSize();
+  if ((last_subkey_block_ && subkey <= last_subkey_block_->subkey_) ||
+      version > info_.version_) {
+    return false;
+  }
+  const PayloadHandle payload =
+      behavior_->DeserializePayload(serialized_payload);
+  last_subkey_block_ =
+      accessor
+          .AppendSubkeyBlock(*behavior_, *last_key_block_, last_key_hash_,
+                             subkey, last_subkey_block_)
+          .state_block_;
+  last_subkey_block_->PushFromWriterThread(version, payload);
+  ++accessor.subkeys_count();
+  --remaining_subkeys_count_;
+  if (--remaining_key_subkeys_count_ == 0) {
+    accessor.BuildSubkeysTree(*last_key_block_, key_subkeys_count_);
+    if (remaining_keys_count_ == 0) {
+      if (remaining_subkeys_count_ != 0)
         return false;
+      accessor.BuildKeysTree(static_cast<uint32_t>(info_.keys_count_));
     }
   }
+  return true;
+}
 
-  Behavior& behavior_;
-  uint64_t mentioned_keys_count_{0};
-  uint64_t mentioned_subkeys_count_{0};
-  uint64_t next_key_id_{0};
-  uint64_t next_subkey_id_{0};
-  const char* next_data_{nullptr};
-  Serialization::BitstreamReader reader_;
-  Serialization::MonotonicSequenceEncoder subkey_encoder_;
-  KeyTransactionLayout current_key_layout_;
-  SubkeyTransactionLayout current_subkey_layout_;
-  std::string_view current_serialized_key_;    // FIXME: set
-  std::string_view current_required_payload_;  // FIXME: set
-  std::string_view current_new_payload_;       // FIXME: set
-};
-
-Storage::TransactionResult Storage::ApplyTransaction(
-    std::string_view serialized_transaction) noexcept {
-  SerializedTransactionView transaction{*behavior_, serialized_transaction};
-  return ApplyTransaction(transaction);
+bool Storage::RestoreState(StateRestorer& restorer) noexcept {
+  assert(restorer.behavior_ == behavior_);
+  if (!restorer.is_complete())
+    return false;
+  Snapshot snapshot{*std::exchange(restorer.header_block_, nullptr), behavior_,
+                    restorer.info_};
+  auto writer_mutex_lock = std::lock_guard{writer_mutex_};
+  auto lock = std::lock_guard{latest_snapshot_reader_mutex_};
+  latest_snapshot_ = std::move(snapshot);
+  return true;
 }
 
 }  // namespace Microsoft::MixedReality::Sharing::VersionedStorage
@@ -6,6 +6,7 @@
 #include <Microsoft/MixedReality/Sharing/VersionedStorage/Transaction.h>
 
 #include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamWriter.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BlockMonotonicSequenceEncoder.h>
 #include <Microsoft/MixedReality/Sharing/Common/Serialization/MonotonicSequenceEncoder.h>
 #include <Microsoft/MixedReality/Sharing/VersionedStorage/KeyDescriptorWithHandle.h>
 
@@ -41,6 +42,9 @@ class SubkeyTransaction {
         return handle.has_payload();
       case SubkeyTransactionActionKind::PutSubkey:
         return !handle || !behavior.Equal(new_payload_, handle.payload());
+      case SubkeyTransactionActionKind::ApplyOperation:
+        // Can't be known before the result of the operation is calculated.
+        return true;
     }
     return false;
   }
@@ -70,15 +74,34 @@ class SubkeyTransaction {
     return {};
   }
 
+  // Calculates the result of ApplyOperation action for the provided state.
+  SubkeyTransactionView ApplyOperation(VersionedPayloadHandle current_state,
+                                       bool clear_before_transaction,
+                                       Behavior& behavior) const noexcept {
+    assert(layout_.action_kind_ ==
+           SubkeyTransactionActionKind::ApplyOperation);
+    std::optional<PayloadHandle> current_payload;
+    if (current_state)
+      current_payload = current_state.payload();
+
+    std::vector<std::byte> serialized_operand;
+    behavior.Serialize(new_payload_, serialized_operand);
+    return SubkeyTransactionView::FromOperationResult(
+        behavior, current_payload,
+        behavior.ApplyOperation(
+            layout_.operation_kind_,
+            clear_before_transaction ? std::nullopt : current_payload,
+            {reinterpret_cast<const char*>(serialized_operand.data()),
+             serialized_operand.size()}));
+  }
+
   void ResetAction(Behavior& behavior) noexcept {
-    if (layout_.action_kind_ == SubkeyTransactionActionKind::PutSubkey)
-      behavior.Release(new_payload_);
+    ReleaseActionPayload(behavior);
     layout_.action_kind_ = SubkeyTransactionActionKind::NoAction;
   }
 
   void SetActionPut(PayloadHandle new_payload, Behavior& behavior) noexcept {
-    if (layout_.action_kind_ == SubkeyTransactionActionKind::PutSubkey)
-      behavior.Release(new_payload_);
+    ReleaseActionPayload(behavior);
     layout_.action_kind_ = SubkeyTransactionActionKind::PutSubkey;
     // Note: the size in the layout is not initialized here, it will be set
     // after the serialization of the payload.
@@ -86,11 +109,22 @@ class SubkeyTransaction {
   }
 
   void SetActionRemove(Behavior& behavior) noexcept {
-    if (layout_.action_kind_ == SubkeyTransactionActionKind::PutSubkey)
-      behavior.Release(new_payload_);
+    ReleaseActionPayload(behavior);
     layout_.action_kind_ = SubkeyTransactionActionKind::RemoveSubkey;
   }
 
+  void SetActionApplyOperation(SubkeyOperationKind operation_kind,
+                               PayloadHandle operand,
+                               Behavior& behavior) noexcept {
+    ReleaseActionPayload(behavior);
+    layout_.action_kind_ = SubkeyTransactionActionKind::ApplyOperation;
+    layout_.operation_kind_ = operation_kind;
+    // Stored in the same field as the new payload of PutSubkey.
+    // Note: the size in the layout is not initialized here, it will be set
+    // after the serialization of the operand.
+    new_payload_ = operand;
+  }
+
   void ResetRequirement(
       Behavior& behavior,
       SubkeyTransactionRequirementKind new_requirement =
@@ -117,19 +151,25 @@ class SubkeyTransaction {
 
   void Serialize(Serialization::BitstreamWriter& bitstream_writer,
                  std::vector<std::byte>& byte_stream,
-                 Behavior& behavior) noexcept {
+                 Behavior& behavior,
+                 TransactionFormat format) noexcept {
     if (layout_.requirement_kind_ ==
         SubkeyTransactionRequirementKind::ExactPayload) {
       layout_.required_payload_size_ =
           behavior.Serialize(required_payload_, byte_stream);
     }
-    if (layout_.action_kind_ == SubkeyTransactionActionKind::PutSubkey) {
+    if (layout_.has_payload_in_bytestream()) {
       layout_.new_payload_size_ = behavior.Serialize(new_payload_, byte_stream);
     }
-    layout_.Serialize(bitstream_writer);
+    layout_.Serialize(bitstream_writer, format);
   }
 
  private:
+  void ReleaseActionPayload(Behavior& behavior) noexcept {
+    if (layout_.has_payload_in_bytestream())
+      behavior.Release(new_payload_);
+  }
+
   SubkeyTransactionLayout layout_;
   PayloadHandle required_payload_{0};
   PayloadHandle new_payload_{0};
@@ -251,14 +291,22 @@ class TransactionImpl : public TransactionBuilder {
     if (!tx.RequiresChange(current_state, *behavior_))
       return {SubkeyTransactionView::Operation::NoChangeRequired};
 
+    if (tx.action_kind() == SubkeyTransactionActionKind::ApplyOperation) {
+      return tx.ApplyOperation(
+          current_state, key_it_->second.layout_.clear_before_transaction_,
+          *behavior_);
+    }
+
     if (auto handle = tx.ReleaseHandle())
       return {*handle};
 
     return {SubkeyTransactionView::Operation::RemoveSubkey};
   }
 
-  TransactionImpl(std::shared_ptr<Behavior> behavior) noexcept
+  TransactionImpl(std::shared_ptr<Behavior> behavior,
+                  SubkeysEncoding subkeys_encoding) noexcept
       : behavior_{std::move(behavior)},
+        subkeys_encoding_{subkeys_encoding},
         key_transactions_map_{*behavior_},
         key_descriptor_{*behavior_, KeyHandle{0}, false} {}
 
@@ -279,6 +327,15 @@ class TransactionImpl : public TransactionBuilder {
     subkey_transaction.SetActionPut(new_payload, *behavior_);
   }
 
+  void ApplyOperation(KeyDescriptor& key,
+                      uint64_t subkey,
+                      SubkeyOperationKind operation_kind,
+                      PayloadHandle operand) noexcept override {
+    SubkeyTransaction& subkey_transaction = GetSubkeyTransaction(key, subkey);
+    subkey_transaction.SetActionApplyOperation(operation_kind, operand,
+                                               *behavior_);
+  }
+
   void Delete(KeyDescriptor& key, uint64_t subkey) noexcept override {
     KeyTransaction& key_transaction = GetKeyTransaction(key);
     if (key_transaction.layout_.clear_before_transaction_) {
@@ -357,21 +414,75 @@ class TransactionImpl : public TransactionBuilder {
 
   void Serialize(Serialization::BitstreamWriter& bitstream_writer,
                  std::vector<std::byte>& byte_stream) noexcept override {
-    bitstream_writer.WriteExponentialGolombCode(key_transactions_map_.size());
+    TransactionHeader header;
+    header.format_ = GetFormat();
+    header.mentioned_keys_count_ = key_transactions_map_.size();
+    header.Serialize(bitstream_writer);
     for (auto&& [key, key_transaction] : key_transactions_map_) {
       key_transaction.layout_.key_size_ =
           behavior_->Serialize(key, byte_stream);
       key_transaction.layout_.subkeys_count_ = key_transaction.subkeys_.size();
-      key_transaction.layout_.Serialize(bitstream_writer);
+      key_transaction.layout_.subkeys_encoding_ =
+          key_transaction.layout_.subkeys_count_ >= kSubkeysBlockSize
+              ? subkeys_encoding_
+              : SubkeysEncoding::Deltas;
+      key_transaction.layout_.Serialize(bitstream_writer, header.format_);
+      if (key_transaction.layout_.subkeys_encoding_ ==
+          SubkeysEncoding::PackedBlocks) {
+        SerializeSubkeysInBlocks(key_transaction, bitstream_writer,
+                                 byte_stream, header.format_);
+        continue;
+      }
       Serialization::MonotonicSequenceEncoder subkey_encoder;
       for (auto&& [subkey, subkey_transaction] : key_transaction.subkeys_) {
         subkey_encoder.EncodeNext(subkey, bitstream_writer);
-        subkey_transaction.Serialize(bitstream_writer, byte_stream, *behavior_);
+        subkey_transaction.Serialize(bitstream_writer, byte_stream, *behavior_,
+                                     header.format_);
       }
     }
   }
 
  protected:
+  static constexpr size_t kSubkeysBlockSize =
+      Serialization::BlockMonotonicSequenceEncoder::kBlockSize;
+
+  // The oldest format that can represent the transaction.
+  TransactionFormat GetFormat() const noexcept {
+    for (auto&& [key, key_transaction] : key_transactions_map_) {
+      if (subkeys_encoding_ == SubkeysEncoding::PackedBlocks &&
+          key_transaction.subkeys_.size() >= kSubkeysBlockSize)
+        return TransactionFormat::Extended;
+      for (auto&& [subkey, subkey_transaction] : key_transaction.subkeys_) {
+        if (subkey_transaction.action_kind() ==
+            SubkeyTransactionActionKind::ApplyOperation)
+          return TransactionFormat::Extended;
+      }
+    }
+    return TransactionFormat::Initial;
+  }
+
+  // Each block of subkeys is followed by the subkey transactions of the block.
+  void SerializeSubkeysInBlocks(
+      KeyTransaction& key_transaction,
+      Serialization::BitstreamWriter& bitstream_writer,
+      std::vector<std::byte>& byte_stream,
+      TransactionFormat format) noexcept {
+    Serialization::BlockMonotonicSequenceEncoder subkey_encoder;
+    uint64_t block[kSubkeysBlockSize];
+    auto it = begin(key_transaction.subkeys_);
+    const auto it_end = end(key_transaction.subkeys_);
+    while (it != it_end) {
+      auto block_it = it;
+      size_t block_size = 0;
+      for (; block_size < kSubkeysBlockSize && it != it_end; ++it)
+        block[block_size++] = it->first;
+      subkey_encoder.EncodeBlock({block, block_size}, bitstream_writer);
+      for (; block_it != it; ++block_it)
+        block_it->second.Serialize(bitstream_writer, byte_stream, *behavior_,
+                                   format);
+    }
+  }
+
   KeyTransaction& GetKeyTransaction(KeyDescriptor& key) noexcept {
     auto it = key_transactions_map_.lower_bound(key);
     if (it != key_transactions_map_.end() && key.IsEqualTo(it->first))
@@ -390,6 +501,7 @@ class TransactionImpl : public TransactionBuilder {
   }
 
   std::shared_ptr<Behavior> behavior_;
+  SubkeysEncoding subkeys_encoding_;
   KeyTransactionsMap key_transactions_map_;
   KeyDescriptorWithHandle key_descriptor_;
   bool is_iterating_over_keys_ = false;
@@ -402,9 +514,24 @@ class TransactionImpl : public TransactionBuilder {
 
 }  // namespace
 
+SubkeyTransactionView SubkeyTransactionView::FromOperationResult(
+    Behavior& behavior,
+    std::optional<PayloadHandle> current_payload,
+    std::optional<PayloadHandle> result) noexcept {
+  if (!result)
+    return Operation::ValidationFailed;
+  if (current_payload && behavior.Equal(*current_payload, *result)) {
+    behavior.Release(*result);
+    return Operation::NoChangeRequired;
+  }
+  return *result;
+}
+
 std::unique_ptr<TransactionBuilder> TransactionBuilder::Create(
-    std::shared_ptr<Behavior> behavior) noexcept {
-  return std::make_unique<TransactionImpl>(std::move(behavior));
+    std::shared_ptr<Behavior> behavior,
+    SubkeysEncoding subkeys_encoding) noexcept {
+  return std::make_unique<TransactionImpl>(std::move(behavior),
+                                           subkeys_encoding);
 }
 
 }  // namespace Microsoft::MixedReality::Sharing::VersionedStorage
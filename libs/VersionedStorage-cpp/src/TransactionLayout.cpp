@@ -10,8 +10,32 @@
 
 namespace Microsoft::MixedReality::Sharing::VersionedStorage {
 
+TransactionHeader::TransactionHeader(Serialization::BitstreamReader& reader)
+    : mentioned_keys_count_{reader.ReadExponentialGolombCode()} {
+  if (mentioned_keys_count_ != 0 || reader.untouched_bytes_count() == 0)
+    return;
+  const uint64_t format = reader.ReadExponentialGolombCode();
+  if (format != static_cast<uint64_t>(TransactionFormat::Extended))
+    throw std::invalid_argument{"Unknown transaction format"};
+  format_ = TransactionFormat::Extended;
+  mentioned_keys_count_ = reader.ReadExponentialGolombCode();
+}
+
+void TransactionHeader::Serialize(
+    Serialization::BitstreamWriter& bitstream_writer) noexcept {
+  if (format_ != TransactionFormat::Initial) {
+    // Empty transactions don't need any of the extensions.
+    assert(mentioned_keys_count_ != 0);
+    bitstream_writer.WriteExponentialGolombCode(0);
+    bitstream_writer.WriteExponentialGolombCode(
+        static_cast<uint64_t>(format_));
+  }
+  bitstream_writer.WriteExponentialGolombCode(mentioned_keys_count_);
+}
+
 SubkeyTransactionLayout::SubkeyTransactionLayout(
-    Serialization::BitstreamReader& reader) {
+    Serialization::BitstreamReader& reader,
+    TransactionFormat format) {
   const bool has_requirement = reader.ReadBits32(1) == 1;
   // Transaction must have either an action, a requirement, or both.
   // The first bit indicates that there is a requirement. If there is no
@@ -33,12 +57,29 @@ SubkeyTransactionLayout::SubkeyTransactionLayout(
     requirement_kind_ = SubkeyTransactionRequirementKind::NoRequirement;
   }
   if (has_action) {
+    // Initial format:
+    //   0 - RemoveSubkey,
+    //   1+ - PutSubkey (the size of the payload is encoded as code - 1).
+    // Extended format:
+    //   0 - RemoveSubkey,
+    //   1 - ApplyOperation (followed by the kind and the size of the operand),
+    //   2+ - PutSubkey (the size of the payload is encoded as code - 2).
     const uint64_t action_code = reader.ReadExponentialGolombCode();
     if (action_code == 0) {
       action_kind_ = SubkeyTransactionActionKind::RemoveSubkey;
-    } else {
+    } else if (format == TransactionFormat::Initial) {
       action_kind_ = SubkeyTransactionActionKind::PutSubkey;
       new_payload_size_ = action_code - 1;
+    } else if (action_code == 1) {
+      action_kind_ = SubkeyTransactionActionKind::ApplyOperation;
+      const uint64_t operation_kind = reader.ReadExponentialGolombCode();
+      if (operation_kind > static_cast<uint64_t>(SubkeyOperationKind::Max))
+        throw std::invalid_argument{"Unknown subkey operation kind"};
+      operation_kind_ = static_cast<SubkeyOperationKind>(operation_kind);
+      new_payload_size_ = reader.ReadExponentialGolombCode();
+    } else {
+      action_kind_ = SubkeyTransactionActionKind::PutSubkey;
+      new_payload_size_ = action_code - 2;
     }
   } else {
     action_kind_ = SubkeyTransactionActionKind::NoAction;
@@ -46,7 +87,8 @@ SubkeyTransactionLayout::SubkeyTransactionLayout(
 }
 
 void SubkeyTransactionLayout::Serialize(
-    Serialization::BitstreamWriter& bitstream_writer) noexcept {
+    Serialization::BitstreamWriter& bitstream_writer,
+    TransactionFormat format) noexcept {
   const bool has_action = action_kind_ != SubkeyTransactionActionKind::NoAction;
   const bool has_requirement =
       requirement_kind_ != SubkeyTransactionRequirementKind::NoRequirement;
@@ -70,37 +112,56 @@ void SubkeyTransactionLayout::Serialize(
         "Can't serialize a subkey transaction that has neither actions nor "
         "requirements."};
   }
-  if (has_action) {
-    assert(action_kind_ != SubkeyTransactionActionKind::PutSubkey ||
-           new_payload_size_ < ~0ull);
-    const uint64_t code =
-        action_kind_ == SubkeyTransactionActionKind::RemoveSubkey
-            ? 0
-            : new_payload_size_ + 1;
-    bitstream_writer.WriteExponentialGolombCode(code);
+  if (action_kind_ == SubkeyTransactionActionKind::RemoveSubkey) {
+    bitstream_writer.WriteExponentialGolombCode(0);
+  } else if (action_kind_ == SubkeyTransactionActionKind::ApplyOperation) {
+    assert(format == TransactionFormat::Extended);
+    bitstream_writer.WriteExponentialGolombCode(1);
+    bitstream_writer.WriteExponentialGolombCode(
+        static_cast<uint64_t>(operation_kind_));
+    bitstream_writer.WriteExponentialGolombCode(new_payload_size_);
+  } else if (action_kind_ == SubkeyTransactionActionKind::PutSubkey) {
+    const uint64_t first_put_code =
+        format == TransactionFormat::Initial ? 1 : 2;
+    assert(new_payload_size_ <= ~0ull - first_put_code);
+    bitstream_writer.WriteExponentialGolombCode(new_payload_size_ +
+                                                first_put_code);
   }
 }
 
 KeyTransactionLayout::KeyTransactionLayout(
-    Serialization::BitstreamReader& reader)
+    Serialization::BitstreamReader& reader,
+    TransactionFormat format)
     : key_size_{reader.ReadExponentialGolombCode()},
       subkeys_count_{reader.ReadExponentialGolombCode()} {
-  auto flags = reader.ReadBits32(2);
+  // Bit 0: clear_before_transaction_.
+  // Bit 1: has required_subkeys_count_.
+  // Bit 2 (only in the extended format): subkeys_encoding_.
+  const bool is_extended = format != TransactionFormat::Initial;
+  auto flags = reader.ReadBits32(is_extended ? 3 : 2);
   clear_before_transaction_ = flags & 1;
-  const bool has_requirement = flags >> 1;
+  const bool has_requirement = (flags >> 1) & 1;
+  subkeys_encoding_ = SubkeysEncoding{flags >> 2};
   if (has_requirement)
     required_subkeys_count_ = reader.ReadExponentialGolombCode();
 }
 
 void KeyTransactionLayout::Serialize(
-    Serialization::BitstreamWriter& bitstream_writer) noexcept {
+    Serialization::BitstreamWriter& bitstream_writer,
+    TransactionFormat format) noexcept {
   bitstream_writer.WriteExponentialGolombCode(key_size_);
   bitstream_writer.WriteExponentialGolombCode(subkeys_count_);
   const bool has_requirement = required_subkeys_count_.has_value();
 
   uint64_t flags = static_cast<uint64_t>(clear_before_transaction_) |
                    static_cast<uint64_t>(has_requirement) << 1;
-  bitstream_writer.WriteBits(flags, 2);
+  if (format == TransactionFormat::Initial) {
+    assert(subkeys_encoding_ == SubkeysEncoding::Deltas);
+    bitstream_writer.WriteBits(flags, 2);
+  } else {
+    flags |= static_cast<uint64_t>(subkeys_encoding_) << 2;
+    bitstream_writer.WriteBits(flags, 3);
+  }
   if (has_requirement)
     bitstream_writer.WriteExponentialGolombCode(*required_subkeys_count_);
 }
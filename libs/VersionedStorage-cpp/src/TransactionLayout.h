@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 #pragma once
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/enums.h>
 
 namespace Microsoft::MixedReality::Sharing::Serialization {
 class BitstreamReader;
@@ -10,6 +11,32 @@ class BitstreamWriter;
 
 namespace Microsoft::MixedReality::Sharing::VersionedStorage {
 
+// The version of the serialized transaction format.
+// The writer only uses the newer versions for the transactions that need them,
+// so that the rest of the transactions can still be decoded by older readers.
+enum class TransactionFormat : uint64_t {
+  Initial = 0,
+  // Adds SubkeyTransactionActionKind::ApplyOperation and
+  // SubkeysEncoding::PackedBlocks (see KeyTransactionLayout).
+  Extended = 1,
+};
+
+// The beginning of the serialized transaction.
+// In the initial format, it is just the number of mentioned keys.
+// The newer formats start with 0 (the number of keys of an empty transaction),
+// followed by the version of the format and the actual number of keys.
+// The encoded empty transaction is never followed by anything else, so the
+// escape is unambiguous.
+struct TransactionHeader {
+  TransactionHeader() noexcept = default;
+  // Throws std::invalid_argument if the format is unknown.
+  TransactionHeader(Serialization::BitstreamReader& reader);
+  void Serialize(Serialization::BitstreamWriter& bitstream_writer) noexcept;
+
+  TransactionFormat format_{TransactionFormat::Initial};
+  uint64_t mentioned_keys_count_{0};
+};
+
 enum class SubkeyTransactionRequirementKind {
   NoRequirement,
   SubkeyExists,
@@ -22,6 +49,8 @@ enum class SubkeyTransactionActionKind {
   NoAction,
   RemoveSubkey,
   PutSubkey,
+  // Read-modify-write operation (see SubkeyOperationKind).
+  ApplyOperation,
 };
 
 // The layout stores all the information about the subkey transaction except for
@@ -30,19 +59,27 @@ struct SubkeyTransactionLayout {
   // Note: default-constructed layout is not valid and can't be serialized
   // (a valid subkey transaction must have an action, a requirement, or both).
   SubkeyTransactionLayout() noexcept = default;
-  SubkeyTransactionLayout(Serialization::BitstreamReader& reader);
+  SubkeyTransactionLayout(Serialization::BitstreamReader& reader,
+                          TransactionFormat format);
 
-  void Serialize(Serialization::BitstreamWriter& bitstream_writer) noexcept;
+  // ApplyOperation requires TransactionFormat::Extended.
+  void Serialize(Serialization::BitstreamWriter& bitstream_writer,
+                 TransactionFormat format) noexcept;
 
   constexpr uint64_t bytestream_content_size() const noexcept {
-    uint64_t result = action_kind_ == SubkeyTransactionActionKind::PutSubkey
-                          ? new_payload_size_
-                          : 0;
+    uint64_t result = has_payload_in_bytestream() ? new_payload_size_ : 0;
     if (requirement_kind_ == SubkeyTransactionRequirementKind::ExactPayload)
       result += required_payload_size_;
     return result;
   }
 
+  // Both the new payload of PutSubkey and the operand of ApplyOperation are
+  // stored in the byte stream.
+  constexpr bool has_payload_in_bytestream() const noexcept {
+    return action_kind_ == SubkeyTransactionActionKind::PutSubkey ||
+           action_kind_ == SubkeyTransactionActionKind::ApplyOperation;
+  }
+
   SubkeyTransactionRequirementKind requirement_kind_{
       SubkeyTransactionRequirementKind::NoRequirement};
 
@@ -52,6 +89,9 @@ struct SubkeyTransactionLayout {
   };
   SubkeyTransactionActionKind action_kind_{
       SubkeyTransactionActionKind::NoAction};
+  // Only meaningful if action_kind_ is ApplyOperation.
+  SubkeyOperationKind operation_kind_{SubkeyOperationKind::Add};
+  // The size of the new payload, or of the operand of the operation.
   uint64_t new_payload_size_{0};
 };
 
@@ -64,12 +104,20 @@ struct KeyTransactionLayout {
   // (a valid key transaction must mention subkeys, have requirements or clear
   // the key).
   KeyTransactionLayout() noexcept = default;
-  KeyTransactionLayout(Serialization::BitstreamReader& reader);
-  void Serialize(Serialization::BitstreamWriter& bitstream_writer) noexcept;
+  KeyTransactionLayout(Serialization::BitstreamReader& reader,
+                       TransactionFormat format);
+
+  // SubkeysEncoding::PackedBlocks requires TransactionFormat::Extended.
+  void Serialize(Serialization::BitstreamWriter& bitstream_writer,
+                 TransactionFormat format) noexcept;
 
   uint64_t key_size_{0};
   uint64_t subkeys_count_{0};
   bool clear_before_transaction_{false};
+  // With SubkeysEncoding::PackedBlocks, each block of subkeys is followed by
+  // the subkey transactions of this block. Otherwise each subkey is followed
+  // by its subkey transaction.
+  SubkeysEncoding subkeys_encoding_{SubkeysEncoding::Deltas};
   std::optional<uint64_t> required_subkeys_count_;
 };
 
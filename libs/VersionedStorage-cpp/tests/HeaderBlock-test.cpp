@@ -809,6 +809,66 @@ TEST_F(HeaderBlock_Test, empty_versions) {
   }
 }
 
+TEST_F(HeaderBlock_Test, reserved_blob_grows_in_place) {
+  // 512 index slots (128 index blocks) require 19 pages, which is enough to
+  // reserve the address space for growing the blob in place.
+  HeaderBlock* header_block =
+      HeaderBlock::CreateBlob(*behavior_, kBaseVersion, 400);
+  ASSERT_NE(header_block, nullptr);
+  EXPECT_EQ(behavior_->total_allocated_pages_count(), 19);
+  EXPECT_EQ(behavior_->total_reserved_pages_count(), 19 * 8);
+
+  MutatingBlobAccessor accessor(*header_block);
+  EXPECT_EQ(accessor.remaining_index_slots_capacity(), 512);
+
+  // 18 pages are committed at the front, and the last page of the reserved
+  // range is committed for the reference counts.
+  EXPECT_EQ(header_block->data_blocks_capacity(), 18 * 64 - 128 - 1);
+  EXPECT_EQ(accessor.available_data_blocks_count(), 18 * 64 - 128 - 1);
+
+  // One key with 399 subkeys.
+  KeyStateBlock& key_block = *accessor
+                                  .InsertKeyBlock(*behavior_,
+                                                  behavior_->MakeKey(5))
+                                  .state_block_;
+  for (uint64_t subkey = 0; subkey < 399; ++subkey)
+    accessor.InsertSubkeyBlock(*behavior_, key_block, subkey);
+  EXPECT_EQ(accessor.available_data_blocks_count(), 18 * 64 - 128 - 401);
+
+  // The last page fits the reference counts of 64 * 16 versions.
+  for (int i = 1; i < 64 * 16; ++i) {
+    ASSERT_TRUE(accessor.AddVersion());
+  }
+  EXPECT_FALSE(accessor.AddVersion());
+
+  // Both committed ranges are doubled.
+  ASSERT_TRUE(accessor.TryGrow(*behavior_, 0));
+  EXPECT_EQ(behavior_->total_allocated_pages_count(), 19 + 18 + 1);
+  EXPECT_EQ(header_block->data_blocks_capacity(), 36 * 64 - 128 - 1);
+  EXPECT_EQ(accessor.available_data_blocks_count(), 36 * 64 - 128 - 401);
+  ASSERT_TRUE(accessor.AddVersion());
+
+  // Growing until the whole reserved range is committed.
+  while (accessor.TryGrow(*behavior_, 1)) {
+  }
+  EXPECT_EQ(behavior_->total_allocated_pages_count(), 19 * 8);
+  EXPECT_EQ(behavior_->total_reserved_pages_count(), 19 * 8);
+  EXPECT_EQ(header_block->data_blocks_capacity(), 19 * 8 * 64 - 128 - 1);
+  // 1025 versions occupy 65 blocks at the end.
+  EXPECT_EQ(accessor.available_data_blocks_count(),
+            19 * 8 * 64 - 128 - 1 - 400 - 65);
+
+  // The content of the blob wasn't moved.
+  ASSERT_TRUE(accessor.FindKeyState(MakeKeyDescriptor(5)));
+  for (uint64_t subkey = 0; subkey < 399; ++subkey) {
+    EXPECT_TRUE(accessor.FindSubkeyState(MakeKeyDescriptor(5), subkey));
+  }
+
+  for (uint64_t i = 0; i < 64 * 16 + 1; ++i) {
+    header_block->RemoveSnapshotReference(kBaseVersion + i, *behavior_);
+  }
+}
+
 class PrepareTransaction_Test : public HeaderBlock_Test {
  public:
   PrepareTransaction_Test()
@@ -0,0 +1,207 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamWriter.h>
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/KeyDescriptorWithHandle.h>
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/SpeculativeOverlay.h>
+#include <Microsoft/MixedReality/Sharing/VersionedStorage/Storage.h>
+
+#include "TestBehavior.h"
+
+namespace Microsoft::MixedReality::Sharing::VersionedStorage {
+
+class SpeculativeOverlay_Test : public ::testing::Test {
+ protected:
+  ~SpeculativeOverlay_Test() override {
+    behavior_->CheckLeakingHandles();
+    EXPECT_EQ(behavior_.use_count(), 1);
+  }
+
+  KeyDescriptorWithHandle MakeKeyDescriptor(uint64_t id) const noexcept {
+    return {*behavior_, behavior_->MakeKey(id), true};
+  }
+
+  PayloadHandle MakePayload(uint64_t id) { return behavior_->MakePayload(id); }
+
+  std::vector<char> SerializeTransaction(TransactionBuilder& transaction) {
+    Serialization::BitstreamWriter bitstream_writer;
+    std::vector<std::byte> byte_stream;
+    transaction.Serialize(bitstream_writer, byte_stream);
+    auto bitstream_bytes = bitstream_writer.Finalize();
+    std::vector<char> buf(bitstream_bytes.size() + byte_stream.size());
+    char* dst = buf.data();
+    memcpy(dst, bitstream_bytes.data(), bitstream_bytes.size());
+    memcpy(dst + bitstream_bytes.size(), byte_stream.data(),
+           byte_stream.size());
+    return buf;
+  }
+
+  bool ApplyTransaction(SpeculativeOverlay& overlay,
+                        TransactionBuilder& transaction) {
+    const auto buf = SerializeTransaction(transaction);
+    return overlay.ApplyTransaction({buf.data(), buf.size()});
+  }
+
+  Storage::TransactionResult ApplyTransaction(Storage& storage,
+                                              TransactionBuilder& transaction) {
+    const auto buf = SerializeTransaction(transaction);
+    return storage.ApplyTransaction({buf.data(), buf.size()});
+  }
+
+  std::shared_ptr<TestBehavior> behavior_{std::make_shared<TestBehavior>()};
+};
+
+TEST_F(SpeculativeOverlay_Test, observes_speculative_changes) {
+  Storage storage{behavior_};
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(1), 10, MakePayload(10));
+    transaction->Put(MakeKeyDescriptor(1), 20, MakePayload(20));
+    ASSERT_EQ(ApplyTransaction(storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  SpeculativeOverlay overlay{storage.GetSnapshot(), behavior_};
+  EXPECT_EQ(overlay.version(), 1);
+  EXPECT_EQ(overlay.changed_keys_count(), 0);
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(1), 10, MakePayload(11));
+    transaction->Delete(MakeKeyDescriptor(1), 20);
+    transaction->Put(MakeKeyDescriptor(2), 30, MakePayload(30));
+    transaction->RequireExactPayload(MakeKeyDescriptor(1), 20,
+                                     MakePayload(20));
+    EXPECT_TRUE(ApplyTransaction(overlay, *transaction));
+  }
+  EXPECT_EQ(overlay.version(), 2);
+  EXPECT_EQ(overlay.changed_keys_count(), 2);
+
+  EXPECT_EQ(overlay.GetSubkeysCount(MakeKeyDescriptor(1)), 1);
+  EXPECT_EQ(overlay.Get(MakeKeyDescriptor(1), 10).payload(), PayloadHandle{11});
+  EXPECT_EQ(overlay.Get(MakeKeyDescriptor(1), 10).version(), 2);
+  EXPECT_FALSE(overlay.Get(MakeKeyDescriptor(1), 20));
+  EXPECT_EQ(overlay.GetSubkeysCount(MakeKeyDescriptor(2)), 1);
+  EXPECT_EQ(overlay.Get(MakeKeyDescriptor(2), 30).payload(), PayloadHandle{30});
+
+  // The storage is not affected.
+  auto snapshot = storage.GetSnapshot();
+  EXPECT_EQ(snapshot.version(), 1);
+  EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(1), 10).payload(),
+            PayloadHandle{10});
+  EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(1), 20).payload(),
+            PayloadHandle{20});
+  EXPECT_EQ(snapshot.GetSubkeysCount(MakeKeyDescriptor(2)), 0);
+
+  // The copy is independent from the original.
+  SpeculativeOverlay copy{overlay};
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(2), 31, MakePayload(31));
+    EXPECT_TRUE(ApplyTransaction(copy, *transaction));
+  }
+  EXPECT_EQ(copy.version(), 3);
+  EXPECT_EQ(copy.GetSubkeysCount(MakeKeyDescriptor(2)), 2);
+  EXPECT_EQ(overlay.GetSubkeysCount(MakeKeyDescriptor(2)), 1);
+  EXPECT_FALSE(overlay.Get(MakeKeyDescriptor(2), 31));
+}
+
+TEST_F(SpeculativeOverlay_Test, failed_prerequisites_have_no_effect) {
+  Storage storage{behavior_};
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(1), 10, MakePayload(10));
+    ASSERT_EQ(ApplyTransaction(storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  SpeculativeOverlay overlay{storage.GetSnapshot(), behavior_};
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(1), 10, MakePayload(11));
+    transaction->Put(MakeKeyDescriptor(2), 20, MakePayload(20));
+    transaction->RequireSubkeysCount(MakeKeyDescriptor(3), 1);
+    EXPECT_FALSE(ApplyTransaction(overlay, *transaction));
+  }
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(2), 20, MakePayload(20));
+    transaction->RequireMissingSubkey(MakeKeyDescriptor(1), 10);
+    EXPECT_FALSE(ApplyTransaction(overlay, *transaction));
+  }
+  // The version is incremented anyway, matching the storage.
+  EXPECT_EQ(overlay.version(), 3);
+  EXPECT_EQ(overlay.changed_keys_count(), 0);
+  EXPECT_EQ(overlay.Get(MakeKeyDescriptor(1), 10).payload(), PayloadHandle{10});
+  EXPECT_EQ(overlay.GetSubkeysCount(MakeKeyDescriptor(2)), 0);
+}
+
+TEST_F(SpeculativeOverlay_Test, matches_storage) {
+  Storage storage{behavior_};
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(5), 111, MakePayload(1));
+    transaction->Put(MakeKeyDescriptor(5), 222, MakePayload(2));
+    transaction->Put(MakeKeyDescriptor(5), 333, MakePayload(3));
+    ASSERT_EQ(ApplyTransaction(storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  SpeculativeOverlay overlay{storage.GetSnapshot(), behavior_};
+
+  // The same transactions are applied to both the storage and the overlay,
+  // and the overlay should observe the same state as the storage.
+  std::vector<std::vector<char>> transactions;
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(5), 222, MakePayload(22));
+    transaction->Put(MakeKeyDescriptor(5), 333, MakePayload(3));
+    transaction->Put(MakeKeyDescriptor(5), 444, MakePayload(4));
+    transaction->ClearBeforeTransaction(MakeKeyDescriptor(5));
+    transaction->RequireSubkeysCount(MakeKeyDescriptor(5), 3);
+    transactions.push_back(SerializeTransaction(*transaction));
+  }
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Delete(MakeKeyDescriptor(5), 222);
+    transaction->Put(MakeKeyDescriptor(6), 1, MakePayload(6));
+    transaction->RequireExactPayload(MakeKeyDescriptor(5), 444,
+                                     MakePayload(4));
+    transactions.push_back(SerializeTransaction(*transaction));
+  }
+  {
+    // Fails, since the subkey 111 was removed by the first transaction.
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(6), 2, MakePayload(7));
+    transaction->RequirePresentSubkey(MakeKeyDescriptor(5), 111);
+    transactions.push_back(SerializeTransaction(*transaction));
+  }
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->ClearBeforeTransaction(MakeKeyDescriptor(6));
+    transaction->Put(MakeKeyDescriptor(5), 111, MakePayload(11));
+    transactions.push_back(SerializeTransaction(*transaction));
+  }
+  for (const auto& transaction : transactions) {
+    const std::string_view serialized{transaction.data(), transaction.size()};
+    EXPECT_EQ(overlay.ApplyTransaction(serialized),
+              storage.ApplyTransaction(serialized) ==
+                  Storage::TransactionResult::Applied);
+  }
+
+  auto snapshot = storage.GetSnapshot();
+  EXPECT_EQ(overlay.version(), snapshot.version());
+  EXPECT_EQ(overlay.version(), 5);
+  EXPECT_EQ(overlay.base().version(), 1);
+  for (uint64_t key : {5, 6}) {
+    const auto key_descriptor = MakeKeyDescriptor(key);
+    EXPECT_EQ(overlay.GetSubkeysCount(key_descriptor),
+              snapshot.GetSubkeysCount(key_descriptor));
+    for (uint64_t subkey : {1, 2, 111, 222, 333, 444}) {
+      EXPECT_EQ(overlay.Get(key_descriptor, subkey),
+                snapshot.Get(key_descriptor, subkey));
+    }
+  }
+  EXPECT_EQ(overlay.GetSubkeysCount(MakeKeyDescriptor(5)), 3);
+  EXPECT_EQ(overlay.GetSubkeysCount(MakeKeyDescriptor(6)), 0);
+}
+
+}  // namespace Microsoft::MixedReality::Sharing::VersionedStorage
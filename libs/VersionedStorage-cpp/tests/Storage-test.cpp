@@ -4,12 +4,16 @@
 #include "pch.h"
 
 #include <Microsoft/MixedReality/Sharing/Common/Serialization/BitstreamWriter.h>
+#include <Microsoft/MixedReality/Sharing/Common/Serialization/MonotonicSequenceEncoder.h>
 #include <Microsoft/MixedReality/Sharing/VersionedStorage/KeyDescriptorWithHandle.h>
 #include <Microsoft/MixedReality/Sharing/VersionedStorage/Storage.h>
 
 #include "TestBehavior.h"
 
 #include <array>
+#include <chrono>
+#include <iostream>
+#include <thread>
 
 namespace Microsoft::MixedReality::Sharing::VersionedStorage {
 
@@ -91,6 +95,13 @@ TEST_F(Storage_Test, unused_transaction_builder_cleans_after_itself) {
   transaction->Put(MakeKeyDescriptor(3), 981, MakePayload(3));
   transaction->Delete(MakeKeyDescriptor(3), 981);  // Deletes the one above
 
+  transaction->ApplyOperation(MakeKeyDescriptor(4), 1, SubkeyOperationKind::Add,
+                              MakePayload(5));
+  transaction->Put(MakeKeyDescriptor(4), 1,
+                   MakePayload(6));  // Overwrites the one above
+  transaction->ApplyOperation(MakeKeyDescriptor(4), 2, SubkeyOperationKind::Max,
+                              MakePayload(7));
+
   transaction->RequireExactPayload(MakeKeyDescriptor(7), 111, MakePayload(3));
   transaction->RequireMissingSubkey(MakeKeyDescriptor(7), 112);
   transaction->RequireSubkeysCount(MakeKeyDescriptor(7), 6);
@@ -797,6 +808,49 @@ TEST_F(Storage_Test, single_subkey_versions_reallocation) {
   }
 }
 
+TEST_F(Storage_Test, large_blob_grows_in_place) {
+  ResetBehavior();
+  auto storage{std::make_shared<Storage>(behavior_)};
+  static constexpr uint64_t kSubkeysCount = 400;
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    for (uint64_t subkey = 0; subkey < kSubkeysCount; ++subkey)
+      transaction->Put(MakeKeyDescriptor(5), subkey, MakePayload(subkey));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  // The blob was large enough to reserve extra address space.
+  const uint64_t reserved_pages_count = behavior_->total_reserved_pages_count();
+  EXPECT_NE(reserved_pages_count, 0);
+  const uint64_t allocated_pages_count =
+      behavior_->total_allocated_pages_count();
+
+  // Keeping all the versions alive, so that they have to be stored in the
+  // blob. The blob commits more pages instead of being reallocated.
+  std::vector<Snapshot> snapshots;
+  for (uint64_t i = 0; i < 3'000; ++i) {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(5), i % kSubkeysCount,
+                     MakePayload((i + 1) % 1000));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+    snapshots.emplace_back(storage->GetSnapshot());
+  }
+  EXPECT_EQ(behavior_->total_reserved_pages_count(), reserved_pages_count);
+  EXPECT_GT(behavior_->total_allocated_pages_count(), allocated_pages_count);
+
+  const auto key_5 = MakeKeyDescriptor(5);
+  for (uint64_t i = 0; i < snapshots.size(); ++i) {
+    auto& snapshot = snapshots[i];
+    EXPECT_EQ(snapshot.version(), i + 2);
+    EXPECT_EQ(snapshot.GetSubkeysCount(key_5), kSubkeysCount);
+    ASSERT_TRUE(snapshot.Get(key_5, i % kSubkeysCount));
+    EXPECT_EQ(snapshot.Get(key_5, i % kSubkeysCount).payload(),
+              PayloadHandle{(i + 1) % 1000});
+    EXPECT_EQ(snapshot.Get(key_5, i % kSubkeysCount).version(), i + 2);
+  }
+}
+
 TEST_F(Storage_Test, reallocated_with_cleanups) {
   ResetBehavior();
   auto storage{std::make_shared<Storage>(behavior_)};
@@ -922,4 +976,575 @@ TEST_F(Storage_Test, reallocated_with_cleanups) {
   }
 }
 
+TEST_F(Storage_Test, hot_keys_are_deserialized_once) {
+  auto storage{std::make_shared<Storage>(behavior_)};
+
+  // The key is removed and re-inserted by every other transaction, so the
+  // storage has to create a new handle each time.
+  for (uint64_t i = 0; i < 10; ++i) {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    if (i % 2 == 0) {
+      transaction->Put(MakeKeyDescriptor(5), 42, MakePayload(i));
+    } else {
+      transaction->Delete(MakeKeyDescriptor(5), 42);
+    }
+    transaction->Put(MakeKeyDescriptor(6), 100 + i, MakePayload(i));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  // Each key was deserialized only the first time it was inserted.
+  EXPECT_EQ(behavior_->deserialized_keys_count(), 2);
+
+  auto snapshot = storage->GetSnapshot();
+  EXPECT_EQ(snapshot.version(), 10);
+  EXPECT_EQ(snapshot.keys_count(), 1);
+  EXPECT_EQ(snapshot.subkeys_count(), 10);
+  EXPECT_FALSE(snapshot.Get(MakeKeyDescriptor(5), 42));
+  EXPECT_EQ(snapshot.GetSubkeysCount(MakeKeyDescriptor(6)), 10);
+}
+
+TEST_F(Storage_Test, subkey_operations) {
+  auto storage{std::make_shared<Storage>(behavior_)};
+
+  // Missing subkeys are initialized with the operand.
+  for (uint64_t i = 0; i < 5; ++i) {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->ApplyOperation(MakeKeyDescriptor(5), 42,
+                                SubkeyOperationKind::Add, MakePayload(3));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  {
+    auto snapshot = storage->GetSnapshot();
+    EXPECT_EQ(snapshot.version(), 5);
+    EXPECT_EQ(snapshot.subkeys_count(), 1);
+    ASSERT_TRUE(snapshot.Get(MakeKeyDescriptor(5), 42));
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 42).payload(),
+              PayloadHandle{15});
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 42).version(), 5);
+  }
+  {
+    // The result is the same as the current payload.
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->ApplyOperation(MakeKeyDescriptor(5), 42,
+                                SubkeyOperationKind::Max, MakePayload(10));
+    transaction->ApplyOperation(MakeKeyDescriptor(5), 43,
+                                SubkeyOperationKind::Min, MakePayload(7));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+
+    auto snapshot = storage->GetSnapshot();
+    EXPECT_EQ(snapshot.version(), 6);
+    EXPECT_EQ(snapshot.subkeys_count(), 2);
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 42).payload(),
+              PayloadHandle{15});
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 42).version(), 5);
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 43).payload(),
+              PayloadHandle{7});
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 43).version(), 6);
+  }
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->ApplyOperation(MakeKeyDescriptor(5), 42,
+                                SubkeyOperationKind::Min, MakePayload(10));
+    transaction->ApplyOperation(MakeKeyDescriptor(5), 43,
+                                SubkeyOperationKind::Max, MakePayload(20));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+
+    auto snapshot = storage->GetSnapshot();
+    EXPECT_EQ(snapshot.version(), 7);
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 42).payload(),
+              PayloadHandle{10});
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 42).version(), 7);
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 43).payload(),
+              PayloadHandle{20});
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 43).version(), 7);
+  }
+  {
+    // TestBehavior fails operations that produce payloads out of range,
+    // which fails the whole transaction.
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(6), 1, MakePayload(1));
+    transaction->ApplyOperation(MakeKeyDescriptor(5), 42,
+                                SubkeyOperationKind::Add, MakePayload(1020));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::
+                  AppliedWithNoEffectDueToUnsatisfiedPrerequisites);
+
+    auto snapshot = storage->GetSnapshot();
+    EXPECT_EQ(snapshot.version(), 8);
+    EXPECT_EQ(snapshot.keys_count(), 1);
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 42).payload(),
+              PayloadHandle{10});
+  }
+  {
+    // Operations observe cleared subkeys as missing.
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->ClearBeforeTransaction(MakeKeyDescriptor(5));
+    transaction->ApplyOperation(MakeKeyDescriptor(5), 42,
+                                SubkeyOperationKind::Add, MakePayload(2));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+
+    auto snapshot = storage->GetSnapshot();
+    EXPECT_EQ(snapshot.version(), 9);
+    EXPECT_EQ(snapshot.subkeys_count(), 1);
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), 42).payload(),
+              PayloadHandle{2});
+    EXPECT_FALSE(snapshot.Get(MakeKeyDescriptor(5), 43));
+  }
+}
+
+TEST_F(Storage_Test, transactions_without_operations_keep_initial_format) {
+  // Encoding the transaction manually, in the initial format.
+  Serialization::BitstreamWriter bitstream_writer;
+  std::vector<std::byte> byte_stream;
+  {
+    const KeyHandle key = behavior_->MakeKey(3);
+    const PayloadHandle payload = MakePayload(7);
+    bitstream_writer.WriteExponentialGolombCode(1);  // Keys count
+    bitstream_writer.WriteExponentialGolombCode(
+        behavior_->Serialize(key, byte_stream));
+    bitstream_writer.WriteExponentialGolombCode(2);  // Subkeys count
+    bitstream_writer.WriteBits(0, 2);                // Key flags
+    Serialization::MonotonicSequenceEncoder subkey_encoder;
+    subkey_encoder.EncodeNext(5, bitstream_writer);
+    bitstream_writer.WriteBits(0, 1);  // No requirement
+    bitstream_writer.WriteExponentialGolombCode(
+        behavior_->Serialize(payload, byte_stream) + 1);  // Put
+    subkey_encoder.EncodeNext(9, bitstream_writer);
+    bitstream_writer.WriteBits(0, 1);                 // No requirement
+    bitstream_writer.WriteExponentialGolombCode(0);  // Remove
+    behavior_->Release(key);
+    behavior_->Release(payload);
+  }
+  auto bitstream_bytes = bitstream_writer.Finalize();
+  std::vector<char> expected(bitstream_bytes.begin(), bitstream_bytes.end());
+  for (std::byte b : byte_stream)
+    expected.push_back(static_cast<char>(b));
+
+  auto transaction = TransactionBuilder::Create(behavior_);
+  transaction->Put(MakeKeyDescriptor(3), 5, MakePayload(7));
+  transaction->Delete(MakeKeyDescriptor(3), 9);
+  EXPECT_EQ(SerializeTransaction(*transaction), expected);
+
+  auto storage{std::make_shared<Storage>(behavior_)};
+  ASSERT_EQ(storage->ApplyTransaction({expected.data(), expected.size()}),
+            Storage::TransactionResult::Applied);
+  auto snapshot = storage->GetSnapshot();
+  EXPECT_EQ(snapshot.subkeys_count(), 1);
+  EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(3), 5).payload(), PayloadHandle{7});
+}
+
+TEST_F(Storage_Test, check_prerequisites_on_snapshot) {
+  auto storage{std::make_shared<Storage>(behavior_)};
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(5), 42, MakePayload(1));
+    transaction->Put(MakeKeyDescriptor(5), 43, MakePayload(2));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  auto snapshot = storage->GetSnapshot();
+  auto CheckPrerequisites = [&](TransactionBuilder& transaction) {
+    auto serialized_transaction = SerializeTransaction(transaction);
+    return snapshot.CheckPrerequisites(
+        {serialized_transaction.data(), serialized_transaction.size()});
+  };
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->RequireExactPayload(MakeKeyDescriptor(5), 42, MakePayload(1));
+    transaction->RequireExactVersion(MakeKeyDescriptor(5), 43, 1);
+    transaction->RequireMissingSubkey(MakeKeyDescriptor(5), 44);
+    transaction->RequireMissingSubkey(MakeKeyDescriptor(6), 42);
+    transaction->RequireSubkeysCount(MakeKeyDescriptor(5), 2);
+    transaction->RequireSubkeysCount(MakeKeyDescriptor(7), 0);
+    transaction->Put(MakeKeyDescriptor(6), 1, MakePayload(3));
+    EXPECT_TRUE(CheckPrerequisites(*transaction));
+  }
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->RequireExactPayload(MakeKeyDescriptor(5), 42, MakePayload(2));
+    EXPECT_FALSE(CheckPrerequisites(*transaction));
+  }
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->RequirePresentSubkey(MakeKeyDescriptor(6), 42);
+    EXPECT_FALSE(CheckPrerequisites(*transaction));
+  }
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->RequireSubkeysCount(MakeKeyDescriptor(5), 1);
+    EXPECT_FALSE(CheckPrerequisites(*transaction));
+  }
+
+  // The snapshot is not affected by newer transactions.
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Delete(MakeKeyDescriptor(5), 42);
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->RequirePresentSubkey(MakeKeyDescriptor(5), 42);
+    auto serialized_transaction = SerializeTransaction(*transaction);
+    std::string_view view{serialized_transaction.data(),
+                          serialized_transaction.size()};
+    EXPECT_TRUE(snapshot.CheckPrerequisites(view));
+    EXPECT_FALSE(storage->GetSnapshot().CheckPrerequisites(view));
+    EXPECT_FALSE(Snapshot{}.CheckPrerequisites(view));
+  }
+}
+
+TEST_F(Storage_Test, large_transaction_on_existing_key) {
+  auto storage{std::make_shared<Storage>(behavior_)};
+  constexpr uint64_t kSubkeysCount = 300;
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    for (uint64_t i = 0; i < kSubkeysCount; ++i)
+      transaction->Put(MakeKeyDescriptor(5), i * 3, MakePayload(i));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  // Mentions more subkeys of the existing key than the serialized transaction
+  // view can decode ahead of time, including the ones that don't exist yet.
+  // The last requirement is not satisfied, so the transaction has no effect.
+  for (bool should_fail : {true, false}) {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    for (uint64_t i = 0; i < kSubkeysCount; ++i) {
+      if (i % 2 == 0) {
+        transaction->RequireExactPayload(MakeKeyDescriptor(5), i * 3,
+                                         MakePayload(i));
+        transaction->Delete(MakeKeyDescriptor(5), i * 3);
+      } else {
+        transaction->Put(MakeKeyDescriptor(5), i * 3 + 1,
+                         MakePayload(i + kSubkeysCount));
+      }
+    }
+    transaction->RequireMissingSubkey(MakeKeyDescriptor(5),
+                                      should_fail ? 3 : 2);
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              should_fail ? Storage::TransactionResult::
+                                AppliedWithNoEffectDueToUnsatisfiedPrerequisites
+                          : Storage::TransactionResult::Applied);
+  }
+
+  auto snapshot = storage->GetSnapshot();
+  EXPECT_EQ(snapshot.version(), 3);
+  EXPECT_EQ(snapshot.GetSubkeysCount(MakeKeyDescriptor(5)), kSubkeysCount);
+  for (uint64_t i = 0; i < kSubkeysCount; ++i) {
+    if (i % 2 == 0) {
+      EXPECT_FALSE(snapshot.Get(MakeKeyDescriptor(5), i * 3));
+    } else {
+      EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), i * 3).payload(),
+                PayloadHandle{i});
+      EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(5), i * 3 + 1).payload(),
+                PayloadHandle{i + kSubkeysCount});
+    }
+  }
+}
+
+TEST_F(Storage_Test, packed_subkeys_encoding) {
+  // The same transactions are applied to two storages, with different
+  // encodings of subkeys. Key 1 has too few subkeys to be packed.
+  auto storage{std::make_shared<Storage>(behavior_)};
+  auto packed_storage{std::make_shared<Storage>(behavior_)};
+  constexpr uint64_t kSubkeysCount = 1000;
+  for (uint64_t round = 0; round < 3; ++round) {
+    size_t serialized_sizes[2];
+    for (SubkeysEncoding subkeys_encoding :
+         {SubkeysEncoding::Deltas, SubkeysEncoding::PackedBlocks}) {
+      const bool is_packed = subkeys_encoding == SubkeysEncoding::PackedBlocks;
+      auto transaction =
+          TransactionBuilder::Create(behavior_, subkeys_encoding);
+      for (uint64_t i = 0; i < kSubkeysCount; ++i) {
+        // Round 2 mentions the same subkeys as round 0.
+        const uint64_t subkey = i * (round % 2 + 1) + (i / 100) * 1000;
+        if (round == 2 && i % 3 == 0) {
+          transaction->RequirePresentSubkey(MakeKeyDescriptor(0), subkey);
+          transaction->Delete(MakeKeyDescriptor(0), subkey);
+        } else {
+          transaction->Put(MakeKeyDescriptor(0), subkey,
+                           MakePayload((round + i) % 100));
+        }
+      }
+      for (uint64_t i = 0; i < 10; ++i)
+        transaction->Put(MakeKeyDescriptor(1), i + round, MakePayload(round));
+      serialized_sizes[is_packed] = SerializeTransaction(*transaction).size();
+      ASSERT_EQ(ApplyTransaction(is_packed ? *packed_storage : *storage,
+                                 *transaction),
+                Storage::TransactionResult::Applied);
+    }
+    EXPECT_LT(serialized_sizes[1], serialized_sizes[0]);
+  }
+
+  auto snapshot = storage->GetSnapshot();
+  auto packed_snapshot = packed_storage->GetSnapshot();
+  ASSERT_EQ(packed_snapshot.version(), snapshot.version());
+  ASSERT_EQ(packed_snapshot.subkeys_count(), snapshot.subkeys_count());
+  for (uint64_t key : {0, 1}) {
+    ASSERT_EQ(packed_snapshot.GetSubkeysCount(MakeKeyDescriptor(key)),
+              snapshot.GetSubkeysCount(MakeKeyDescriptor(key)));
+    for (uint64_t subkey = 0; subkey < 2 * kSubkeysCount + 10000; ++subkey) {
+      ASSERT_EQ(packed_snapshot.Get(MakeKeyDescriptor(key), subkey),
+                snapshot.Get(MakeKeyDescriptor(key), subkey))
+          << "key=" << key << ", subkey=" << subkey;
+    }
+  }
+}
+
+TEST_F(Storage_Test, interleaved_insertions_after_reallocations) {
+  auto storage{std::make_shared<Storage>(behavior_)};
+  // Each round inserts keys and subkeys in between the ones inserted by the
+  // previous rounds, both into the blobs created by merges and into the ones
+  // that still have enough capacity.
+  // Key 0 is mentioned by all rounds, and each other key only by one round.
+  constexpr uint64_t kRoundsCount = 8;
+  constexpr uint64_t kSubkeysPerRound = 50;
+  for (uint64_t round = 0; round < kRoundsCount; ++round) {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    for (uint64_t key = 0; key < 32; ++key) {
+      const bool is_mentioned = key == 0 || (key % kRoundsCount) ==
+                                                kRoundsCount - 1 - round;
+      if (!is_mentioned)
+        continue;
+      for (uint64_t i = 0; i < kSubkeysPerRound; ++i) {
+        transaction->Put(MakeKeyDescriptor(key),
+                         i * kRoundsCount + kRoundsCount - 1 - round,
+                         MakePayload(round));
+      }
+    }
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+
+  auto snapshot = storage->GetSnapshot();
+  uint64_t expected_key = 0;
+  for (KeyIterator key_it = snapshot.begin(); key_it != snapshot.end();
+       ++key_it, ++expected_key) {
+    ASSERT_EQ(key_it->key_handle(), KeyHandle{expected_key});
+    const bool is_key_0 = expected_key == 0;
+    ASSERT_EQ(key_it->subkeys_count(),
+              is_key_0 ? kRoundsCount * kSubkeysPerRound : kSubkeysPerRound);
+    uint64_t expected_subkey = is_key_0 ? 0 : expected_key % kRoundsCount;
+    auto subkeys = snapshot.GetSubkeys(*key_it);
+    for (SubkeyIterator it = subkeys.begin(); it != subkeys.end(); ++it) {
+      ASSERT_EQ(it->subkey(), expected_subkey);
+      expected_subkey += is_key_0 ? 1 : kRoundsCount;
+    }
+  }
+  EXPECT_EQ(expected_key, 32);
+}
+
+TEST_F(Storage_Test, parallel_merge) {
+  behavior_->set_merge_threads_count(4);
+  auto storage{std::make_shared<Storage>(behavior_)};
+  // Key 0 alone is larger than a chunk of the merge, and the other keys are
+  // grouped into several chunks.
+  auto GetSubkeysCount = [](uint64_t key) -> uint64_t {
+    return key == 0 ? 40000 : 1000 + key;
+  };
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    for (uint64_t key = 0; key < 32; ++key) {
+      for (uint64_t subkey = 0; subkey < GetSubkeysCount(key); ++subkey) {
+        transaction->Put(MakeKeyDescriptor(key), subkey * 2,
+                         MakePayload((key + subkey) % 1000));
+      }
+    }
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  // Forcing the merge, and then inserting in between the merged subkeys.
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->RequireMissingSubkey(MakeKeyDescriptor(0), 0);
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::
+                  AppliedWithNoEffectDueToUnsatisfiedPrerequisites);
+  }
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    for (uint64_t key = 0; key < 32; ++key)
+      transaction->Put(MakeKeyDescriptor(key), 1, MakePayload(key));
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+
+  auto snapshot = storage->GetSnapshot();
+  uint64_t expected_key = 0;
+  uint64_t expected_subkeys_count = 0;
+  for (KeyIterator key_it = snapshot.begin(); key_it != snapshot.end();
+       ++key_it, ++expected_key) {
+    ASSERT_EQ(key_it->key_handle(), KeyHandle{expected_key});
+    ASSERT_EQ(key_it->subkeys_count(), GetSubkeysCount(expected_key) + 1);
+    expected_subkeys_count += GetSubkeysCount(expected_key) + 1;
+    uint64_t expected_subkey = 0;
+    auto subkeys = snapshot.GetSubkeys(*key_it);
+    for (SubkeyIterator it = subkeys.begin(); it != subkeys.end(); ++it) {
+      ASSERT_EQ(it->subkey(), expected_subkey);
+      expected_subkey += expected_subkey < 2 ? 1 : 2;
+    }
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(expected_key), 1).payload(),
+              PayloadHandle{expected_key});
+    EXPECT_EQ(snapshot.Get(MakeKeyDescriptor(expected_key), 10).payload(),
+              PayloadHandle{expected_key + 5});
+  }
+  EXPECT_EQ(expected_key, 32);
+  EXPECT_EQ(snapshot.subkeys_count(), expected_subkeys_count);
+}
+
+TEST_F(Storage_Test, restore_serialized_state_from_chunks) {
+  Storage storage{behavior_};
+  for (uint64_t round = 0; round < 3; ++round) {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    for (uint64_t key = round; key < 10; ++key) {
+      for (uint64_t subkey = 0; subkey < key + round; ++subkey) {
+        transaction->Put(MakeKeyDescriptor(key), subkey * 3,
+                         MakePayload(key * 100 + subkey + round));
+      }
+    }
+    ASSERT_EQ(ApplyTransaction(storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  std::string state;
+  storage.SerializeState(state);
+
+  // The chunks are split at every possible position, including in the middle
+  // of the size of a record.
+  for (size_t chunk_size : {size_t{1}, size_t{3}, size_t{17}, state.size()}) {
+    Storage restored_storage{behavior_};
+    {
+      Storage::StateRestorer restorer{behavior_};
+      for (size_t offset = 0; offset < state.size(); offset += chunk_size) {
+        ASSERT_FALSE(restorer.is_complete());
+        ASSERT_TRUE(restorer.Append(std::string_view{state}.substr(
+            offset, chunk_size)));
+      }
+      ASSERT_TRUE(restorer.is_complete());
+      ASSERT_TRUE(restored_storage.RestoreState(restorer));
+    }
+    const Snapshot expected = storage.GetSnapshot();
+    const Snapshot snapshot = restored_storage.GetSnapshot();
+    EXPECT_EQ(snapshot.version(), expected.version());
+    EXPECT_EQ(snapshot.keys_count(), expected.keys_count());
+    EXPECT_EQ(snapshot.subkeys_count(), expected.subkeys_count());
+    KeyIterator key_it = snapshot.begin();
+    for (const KeyView expected_key : expected) {
+      ASSERT_NE(key_it, snapshot.end());
+      ASSERT_EQ(key_it->key_handle(), expected_key.key_handle());
+      ASSERT_EQ(key_it->subkeys_count(), expected_key.subkeys_count());
+      auto subkeys = snapshot.GetSubkeys(*key_it);
+      SubkeyIterator it = subkeys.begin();
+      for (const SubkeyView expected_subkey :
+           expected.GetSubkeys(expected_key)) {
+        ASSERT_NE(it, subkeys.end());
+        EXPECT_EQ(it->subkey(), expected_subkey.subkey());
+        EXPECT_EQ(it->version(), expected_subkey.version());
+        EXPECT_EQ(it->payload(), expected_subkey.payload());
+        ++it;
+      }
+      EXPECT_EQ(it, subkeys.end());
+      ++key_it;
+    }
+    EXPECT_EQ(key_it, snapshot.end());
+
+    // The restored storage keeps applying transactions.
+    auto transaction = TransactionBuilder::Create(behavior_);
+    transaction->Put(MakeKeyDescriptor(5), 1, MakePayload(1));
+    ASSERT_EQ(ApplyTransaction(restored_storage, *transaction),
+              Storage::TransactionResult::Applied);
+    EXPECT_EQ(restored_storage.GetSnapshot().version(), expected.version() + 1);
+    EXPECT_EQ(restored_storage.GetSnapshot().GetSubkeysCount(
+                  MakeKeyDescriptor(5)),
+              expected.GetSubkeysCount(MakeKeyDescriptor(5)) + 1);
+  }
+}
+
+TEST_F(Storage_Test, restore_malformed_or_incomplete_state) {
+  Storage storage{behavior_};
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    for (uint64_t key = 0; key < 4; ++key)
+      transaction->Put(MakeKeyDescriptor(key), key, MakePayload(key));
+    ASSERT_EQ(ApplyTransaction(storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  std::string state;
+  storage.SerializeState(state);
+  Storage restored_storage{behavior_};
+  {
+    // The restorer releases the handles of the incomplete state.
+    Storage::StateRestorer restorer{behavior_};
+    ASSERT_TRUE(restorer.Append(state.substr(0, state.size() - 1)));
+    EXPECT_FALSE(restorer.is_complete());
+    EXPECT_FALSE(restored_storage.RestoreState(restorer));
+  }
+  {
+    Storage::StateRestorer restorer{behavior_};
+    EXPECT_FALSE(restorer.Append(state + state));
+    EXPECT_FALSE(restorer.is_complete());
+    EXPECT_FALSE(restorer.Append(""));
+  }
+  EXPECT_EQ(restored_storage.GetSnapshot().version(), 0);
+  EXPECT_EQ(restored_storage.GetSnapshot().keys_count(), 0);
+}
+
+// Benchmark (disabled by default, run with --gtest_also_run_disabled_tests).
+// A transaction with unsatisfied prerequisites still produces a new version,
+// and always does it by merging the existing state into a new blob, so its
+// application time is dominated by CreateMergedBlob().
+TEST_F(Storage_Test, DISABLED_merge_benchmark) {
+  constexpr uint64_t kKeysCount = 32;
+  constexpr uint64_t kSubkeysPerKey = 32768;  // 1M subkeys in total.
+  constexpr int kIterationsCount = 10;
+
+  auto storage{std::make_shared<Storage>(behavior_)};
+  {
+    auto transaction = TransactionBuilder::Create(behavior_);
+    for (uint64_t key = 0; key < kKeysCount; ++key) {
+      for (uint64_t subkey = 0; subkey < kSubkeysPerKey; ++subkey) {
+        transaction->Put(MakeKeyDescriptor(key), subkey,
+                         MakePayload(subkey % 1000));
+      }
+    }
+    ASSERT_EQ(ApplyTransaction(*storage, *transaction),
+              Storage::TransactionResult::Applied);
+  }
+  auto transaction = TransactionBuilder::Create(behavior_);
+  transaction->RequireMissingSubkey(MakeKeyDescriptor(0), 0);
+  const auto serialized_transaction = SerializeTransaction(*transaction);
+
+  std::vector<uint32_t> threads_counts{1, 2, 4};
+  if (const uint32_t cores_count = std::thread::hardware_concurrency();
+      cores_count > 4) {
+    threads_counts.push_back(cores_count);
+  }
+  for (uint32_t threads_count : threads_counts) {
+    behavior_->set_merge_threads_count(threads_count);
+    std::chrono::steady_clock::duration best_duration =
+        std::chrono::steady_clock::duration::max();
+    for (int i = 0; i < kIterationsCount; ++i) {
+      const auto start = std::chrono::steady_clock::now();
+      const auto result =
+          storage->ApplyTransaction({serialized_transaction.data(),
+                                     serialized_transaction.size()});
+      best_duration =
+          std::min(best_duration, std::chrono::steady_clock::now() - start);
+      ASSERT_EQ(result, Storage::TransactionResult::
+                            AppliedWithNoEffectDueToUnsatisfiedPrerequisites);
+    }
+    EXPECT_EQ(storage->GetSnapshot().subkeys_count(),
+              kKeysCount * kSubkeysPerKey);
+    std::cout << "Merging " << kKeysCount * kSubkeysPerKey << " subkeys on "
+              << threads_count << " threads took "
+              << std::chrono::duration_cast<std::chrono::microseconds>(
+                     best_duration)
+                     .count()
+              << "us\n";
+  }
+}
+
 }  // namespace Microsoft::MixedReality::Sharing::VersionedStorage
@@ -143,6 +143,17 @@ void* TestBehavior::AllocateZeroedPages(size_t pages_count) noexcept {
   return Platform::AllocateZeroedPages(pages_count);
 }
 
+void* TestBehavior::ReservePages(size_t pages_count) noexcept {
+  total_reserved_pages_count_.fetch_add(pages_count, std::memory_order_relaxed);
+  return Platform::ReservePages(pages_count);
+}
+
+bool TestBehavior::CommitPages(void* address, size_t pages_count) noexcept {
+  total_allocated_pages_count_.fetch_add(pages_count,
+                                         std::memory_order_relaxed);
+  return Platform::CommitPages(address, pages_count);
+}
+
 void TestBehavior::FreePages(void* address) noexcept {
   Platform::FreePages(address);
 }
@@ -171,6 +182,7 @@ KeyHandle TestBehavior::DeserializeKey(std::string_view serialized_payload) {
   KeyHandle result;
   memcpy(&result, serialized_payload.data(), sizeof(KeyHandle));
   GetKeyState(result).reference_count_.fetch_add(1, std::memory_order_relaxed);
+  deserialized_keys_count_.fetch_add(1, std::memory_order_relaxed);
   return result;
 }
 
@@ -187,6 +199,34 @@ PayloadHandle TestBehavior::DeserializePayload(
   return result;
 }
 
+std::optional<PayloadHandle> TestBehavior::ApplyOperation(
+    SubkeyOperationKind operation_kind,
+    std::optional<PayloadHandle> current_payload,
+    std::string_view serialized_operand) noexcept {
+  uint64_t operand;
+  EXPECT_EQ(serialized_operand.size(), sizeof(operand));
+  memcpy(&operand, serialized_operand.data(), sizeof(operand));
+
+  uint64_t result = operand;
+  if (current_payload) {
+    const auto current = static_cast<uint64_t>(*current_payload);
+    switch (operation_kind) {
+      case SubkeyOperationKind::Add:
+        result = current + operand;
+        break;
+      case SubkeyOperationKind::Min:
+        result = std::min(current, operand);
+        break;
+      case SubkeyOperationKind::Max:
+        result = std::max(current, operand);
+        break;
+    }
+  }
+  if (result >= kPayloadsCount)
+    return {};
+  return MakePayload(result);
+}
+
 TestBehavior::KeyState& TestBehavior::GetKeyState(KeyHandle handle) noexcept {
   EXPECT_TRUE(IsValid(handle));
   return key_states_[static_cast<size_t>(handle)];
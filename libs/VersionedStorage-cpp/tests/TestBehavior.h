@@ -47,8 +47,18 @@ class TestBehavior : public Behavior {
   PayloadHandle DuplicateHandle(PayloadHandle handle) noexcept override;
 
   void* AllocateZeroedPages(size_t pages_count) noexcept override;
+  void* ReservePages(size_t pages_count) noexcept override;
+  bool CommitPages(void* address, size_t pages_count) noexcept override;
   void FreePages(void* address) noexcept override;
 
+  uint32_t GetMergeThreadsCount() const noexcept override {
+    return merge_threads_count_;
+  }
+
+  void set_merge_threads_count(uint32_t count) noexcept {
+    merge_threads_count_ = count;
+  }
+
   size_t Serialize(KeyHandle handle,
                    std::vector<std::byte>& byte_stream) override;
 
@@ -60,10 +70,25 @@ class TestBehavior : public Behavior {
   PayloadHandle DeserializePayload(
       std::string_view serialized_payload) override;
 
+  // Treats payloads as integers (operations that would produce a payload
+  // outside of the supported range fail).
+  std::optional<PayloadHandle> ApplyOperation(
+      SubkeyOperationKind operation_kind,
+      std::optional<PayloadHandle> current_payload,
+      std::string_view serialized_operand) noexcept override;
+
   uint64_t total_allocated_pages_count() const noexcept {
     return total_allocated_pages_count_.load(std::memory_order_relaxed);
   }
 
+  uint64_t total_reserved_pages_count() const noexcept {
+    return total_reserved_pages_count_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t deserialized_keys_count() const noexcept {
+    return deserialized_keys_count_.load(std::memory_order_relaxed);
+  }
+
  private:
   std::mutex writer_mutex_;
 
@@ -94,8 +119,14 @@ class TestBehavior : public Behavior {
   PayloadState& GetPayloadState(PayloadHandle handle) noexcept;
   const PayloadState& GetPayloadState(PayloadHandle handle) const noexcept;
 
-  // Doesn't decrement when pages are freed.
+  // Don't decrement when pages are freed.
+  // Committed pages are counted as allocated.
   std::atomic_uint64_t total_allocated_pages_count_{0};
+  std::atomic_uint64_t total_reserved_pages_count_{0};
+
+  std::atomic_uint64_t deserialized_keys_count_{0};
+
+  uint32_t merge_threads_count_{1};
 };
 
 }  // namespace Microsoft::MixedReality::Sharing::VersionedStorage